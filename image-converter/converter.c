@@ -5,6 +5,7 @@
  * Convert image from rgb to 7 color
 */
 
+#include <string.h>
 #include "converter.h"
 
 typedef struct
@@ -15,6 +16,7 @@ typedef struct
 } RGB8_t;
 
 #define _NUM_COLORS 7
+#define _STRIPE_HEIGHT 16   //Rows dithered at a time by the firmware (_DISPLAY_STRIPE_HEIGHT)
 const RGB8_t color_palette[_NUM_COLORS] = 
 {
     {  0,   0,   0},    //Black
@@ -28,7 +30,9 @@ const RGB8_t color_palette[_NUM_COLORS] =
 
 
 static void convert_pixels(uint8_t* out, uint8_t* in, int width, int height);
+static void dither_stripe(uint8_t* out, const uint8_t* src, int16_t* rows, int width, int height, bool first);
 static int find_closest_color(RGB8_t color);
+static int find_closest_color_int(const int16_t* color);
 static int distance2(RGB8_t c1, RGB8_t c2);
 
 
@@ -53,6 +57,51 @@ uint8_t* convert(uint8_t* pix, int width, int height)
 }
 
 
+/*
+    Place the image in the top left corner of a out_width x out_height
+    canvas (the rest is black) and dither it with the same Floyd-Steinberg
+    algorithm used by the firmware: stripes of _STRIPE_HEIGHT rows, the error
+    of the last row of a stripe is carried into the next one
+*/
+uint8_t* convert_dither(uint8_t* pix, int width, int height, int out_width, int out_height)
+{
+    uint8_t* p_out;
+    uint8_t* canvas;
+    int16_t* rows;
+
+    //Allocate memory for the output array, the canvas and the dither rows
+    p_out = malloc(out_width * out_height * sizeof(uint8_t));
+    canvas = calloc(out_width * out_height * 3, sizeof(uint8_t));
+    rows = calloc(3 * out_width * 3, sizeof(int16_t));
+    if(p_out == NULL || canvas == NULL || rows == NULL)
+    {
+        #ifdef DEBUG
+            printf("[converter.c convert_dither()] Memory allocation failed\n");
+        #endif
+        free(p_out);
+        free(canvas);
+        free(rows);
+        return NULL;
+    }
+
+    //Copy image into the canvas (crop if larger)
+    for(int y = 0; y < height && y < out_height; y++)
+        memcpy(&canvas[y * out_width * 3], &pix[y * width * 3], (width < out_width ? width : out_width) * 3);
+
+    for(int y = 0; y < out_height; y += _STRIPE_HEIGHT)
+    {
+        int h = out_height - y < _STRIPE_HEIGHT ? out_height - y : _STRIPE_HEIGHT;
+
+        dither_stripe(&p_out[y * out_width], &canvas[y * out_width * 3], rows, out_width, h, y == 0);
+    }
+
+    free(canvas);
+    free(rows);
+
+    return p_out;
+}
+
+
 static void convert_pixels(uint8_t* out, uint8_t* in, int width, int height)
 {
     for(int y = 0; y < height; y++)
@@ -75,6 +124,118 @@ static void convert_pixels(uint8_t* out, uint8_t* in, int width, int height)
 }
 
 
+/*
+    Floyd-Steinberg dithering of one stripe, a port of SendStripe() in
+    stm32/Core/Src/hardware/display.c with the same 16 bit integer arithmetic
+    and quantization error clamp. rows holds three rows of width RGB pixels:
+    the current row, the next row and the error carried into the next stripe
+*/
+static void dither_stripe(uint8_t* out, const uint8_t* src, int16_t* rows, int width, int height, bool first)
+{
+    int16_t* carry = &rows[2 * width * 3];
+    int16_t* cur = &rows[0];
+    int16_t* next = &rows[width * 3];
+
+    //Clear the error carried into the first stripe
+    if(first)
+        memset(carry, 0, width * 3 * sizeof(int16_t));
+
+    for(int i = 0; i < width * 3; i++)
+        cur[i] = src[i];
+
+    for(int y = 0; y < height; y++)
+    {
+        //The error of the last row goes into the carry row (cleared while reading the first row)
+        if(y < height - 1)
+        {
+            const uint8_t* row = &src[(y + 1) * width * 3];
+            for(int i = 0; i < width * 3; i++)
+                next[i] = row[i];
+        }
+        else
+        {
+            next = carry;
+        }
+
+        for(int x = 0; x < width; x++)
+        {
+            int16_t old_color[3];
+            int16_t quant_err[3];
+
+            for(int c = 0; c < 3; c++)
+            {
+                old_color[c] = cur[x * 3 + c];
+                if(y == 0)
+                {
+                    old_color[c] += carry[x * 3 + c];
+                    carry[x * 3 + c] = 0;
+                }
+            }
+
+            //Find closest color and quantization error
+            int code = find_closest_color_int(old_color);
+            out[y * width + x] = code;
+
+            quant_err[0] = old_color[0] - color_palette[code].r;
+            quant_err[1] = old_color[1] - color_palette[code].g;
+            quant_err[2] = old_color[2] - color_palette[code].b;
+
+            //Clamp quantization error
+            int len = quant_err[0]*quant_err[0] + quant_err[1]*quant_err[1] + quant_err[2]*quant_err[2];
+            if(len > 195075)
+            {
+                for(int c = 0; c < 3; c++)
+                    quant_err[c] /= len >> 8;
+            }
+
+            //Propagate quantization error
+            for(int c = 0; c < 3; c++)
+            {
+                if(x < width - 1)
+                {
+                    cur[(x + 1) * 3 + c] = (cur[(x + 1) * 3 + c]*16 + 7*quant_err[c]) / 16;
+                    next[(x + 1) * 3 + c] = (next[(x + 1) * 3 + c]*16 + 1*quant_err[c]) / 16;
+                }
+                if(x > 0)
+                    next[(x - 1) * 3 + c] = (next[(x - 1) * 3 + c]*16 + 3*quant_err[c]) / 16;
+                next[x * 3 + c] = (next[x * 3 + c]*16 + 5*quant_err[c]) / 16;
+            }
+        }
+
+        //Swap the rows
+        int16_t* tmp = cur;
+        cur = next;
+        next = tmp;
+    }
+}
+
+
+/*
+    Same as find_closest_color() for colors out of the 0-255 range
+*/
+static int find_closest_color_int(const int16_t* color)
+{
+    int closest_dst = INT32_MAX;
+    int indx = 0;
+
+    for(int i = 0; i < _NUM_COLORS; i++)
+    {
+        int dr = color[0] - (int)color_palette[i].r;
+        int dg = color[1] - (int)color_palette[i].g;
+        int db = color[2] - (int)color_palette[i].b;
+        int dst = dr*dr + dg*dg + db*db;
+
+        if(dst < closest_dst)
+        {
+            closest_dst = dst;
+            indx = i;
+        }
+    }
+
+    return indx;
+}
+
+
 /*
     Searches the palette for the closest color and returns its index
 */
@@ -8,5 +8,6 @@
 #include <stdbool.h>
 
 uint8_t* convert(uint8_t* pix, int width, int height);
+uint8_t* convert_dither(uint8_t* pix, int width, int height, int out_width, int out_height);
 
 #endif
\ No newline at end of file
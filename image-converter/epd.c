@@ -0,0 +1,185 @@
+/**
+ * File: epd.c
+ * Author: ts-manuel
+ * 
+ * Writes pre-rendered frames (.epd) that the firmware streams
+ * to the display without decoding
+*/
+
+#include "epd.h"
+
+static void pack_pixels(uint8_t* out, uint8_t* in);
+static uint32_t lz_compress(uint8_t* out, uint8_t* in, uint32_t size);
+static uint8_t* lz_write_length(uint8_t* out, uint32_t len);
+
+
+/*
+    Write a 600x448 image of palette indices as a .epd file,
+    the pixel data is LZ compressed if compress is true
+*/
+bool write_epd(FILE* fp, uint8_t* data, bool compress)
+{
+    EPD_Header_t header;
+    uint8_t padding[EPD_DATA_OFFSET - sizeof(EPD_Header_t)];
+    uint32_t data_size = EPD_WIDTH / 2 * EPD_HEIGHT;
+    uint8_t* packed;
+    uint8_t* compressed = NULL;
+
+    //Worst case compressed size is one token every 15 literals
+    packed = malloc(data_size * 2);
+    if(packed == NULL)
+    {
+        #ifdef DEBUG
+            printf("[epd.c write_epd()] Memory allocation failed\n");
+        #endif
+        return false;
+    }
+
+    pack_pixels(packed, data);
+
+    if(compress)
+    {
+        compressed = packed + data_size;
+        data_size = lz_compress(compressed, packed, data_size);
+
+        #ifdef DEBUG
+            printf("[epd.c write_epd()] Compressed to %u bytes\n", data_size);
+        #endif
+    }
+
+    //Fill header
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, EPD_MAGIC, 4);
+    header.version = EPD_VERSION;
+    header.palette = EPD_PALETTE_7COLOR;
+    header.format = compress ? EPD_FORMAT_LZ : EPD_FORMAT_RAW;
+    header.width = EPD_WIDTH;
+    header.height = EPD_HEIGHT;
+    header.data_offset = EPD_DATA_OFFSET;
+    header.data_size = data_size;
+    header.crc = crc32_update(0, compress ? compressed : packed, data_size);
+
+    //Write header, padding and pixel data
+    memset(padding, 0, sizeof(padding));
+    bool res = fwrite(&header, sizeof(header), 1, fp) == 1 &&
+               fwrite(padding, sizeof(padding), 1, fp) == 1 &&
+               fwrite(compress ? compressed : packed, data_size, 1, fp) == 1;
+
+    free(packed);
+
+    return res;
+}
+
+
+/*
+    CRC-32 (IEEE 802.3, same as zlib), start with crc = 0
+*/
+uint32_t crc32_update(uint32_t crc, const void* data, uint32_t len)
+{
+    const uint8_t* pt = (const uint8_t*)data;
+
+    crc = ~crc;
+    while(len--)
+    {
+        crc ^= *pt++;
+        for(int k = 0; k < 8; k++)
+            crc = (crc & 1) ? (crc >> 1) ^ 0xEDB88320 : crc >> 1;
+    }
+
+    return ~crc;
+}
+
+
+/*
+    Two pixels per byte, first pixel in the high nibble
+*/
+static void pack_pixels(uint8_t* out, uint8_t* in)
+{
+    for(int i = 0; i < EPD_WIDTH * EPD_HEIGHT; i += 2)
+    {
+        *out++ = (in[i] << 4) | in[i+1];
+    }
+}
+
+
+/*
+    Greedy LZ77, searches the whole window for the longest match
+    and returns the compressed size
+*/
+static uint32_t lz_compress(uint8_t* out, uint8_t* in, uint32_t size)
+{
+    uint8_t* start = out;
+    uint32_t literals = 0;
+    uint32_t pos = 0;
+
+    while(pos < size)
+    {
+        uint32_t best_len = 0;
+        uint32_t best_offset = 0;
+
+        //Find longest match
+        for(uint32_t offset = 1; offset <= EPD_LZ_WINDOW && offset <= pos; offset++)
+        {
+            uint32_t len = 0;
+
+            while(pos + len < size && in[pos + len] == in[pos + len - offset])
+                len++;
+
+            if(len > best_len)
+            {
+                best_len = len;
+                best_offset = offset;
+            }
+        }
+
+        if(best_len < EPD_LZ_MIN_MATCH)
+        {
+            literals++;
+            pos++;
+            continue;
+        }
+
+        //Emit token, literals, offset and match length
+        uint32_t match = best_len - EPD_LZ_MIN_MATCH;
+        *out++ = ((literals < 15 ? literals : 15) << 4) | (match < 15 ? match : 15);
+        if(literals >= 15)
+            out = lz_write_length(out, literals - 15);
+        memcpy(out, &in[pos - literals], literals);
+        out += literals;
+        *out++ = best_offset & 0xff;
+        *out++ = best_offset >> 8;
+        if(match >= 15)
+            out = lz_write_length(out, match - 15);
+
+        pos += best_len;
+        literals = 0;
+    }
+
+    //Last literals complete the frame without a match
+    if(literals > 0)
+    {
+        *out++ = (literals < 15 ? literals : 15) << 4;
+        if(literals >= 15)
+            out = lz_write_length(out, literals - 15);
+        memcpy(out, &in[pos - literals], literals);
+        out += literals;
+    }
+
+    return out - start;
+}
+
+
+/*
+    Write the continuation bytes of a length that doesn't fit in the token
+*/
+static uint8_t* lz_write_length(uint8_t* out, uint32_t len)
+{
+    while(len >= 255)
+    {
+        *out++ = 255;
+        len -= 255;
+    }
+    *out++ = len;
+
+    return out;
+}
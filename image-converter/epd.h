@@ -0,0 +1,45 @@
+#ifndef _EPD_H_
+#define _EPD_H_
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#define EPD_WIDTH   600
+#define EPD_HEIGHT  448
+
+/*
+    Pre-rendered frame header,
+    must match stm32/Core/Inc/frame/frame.h
+*/
+#define EPD_MAGIC           "EPDF"
+#define EPD_VERSION         1
+#define EPD_PALETTE_7COLOR  0
+#define EPD_PALETTE_BW      1
+#define EPD_PALETTE_BWR     2
+#define EPD_FORMAT_RAW      0
+#define EPD_FORMAT_LZ       1       //See stm32/Core/Inc/frame/frame.h for the code
+#define EPD_DATA_OFFSET     512     //Pixel data starts at a sector boundary
+#define EPD_LZ_WINDOW       1024    //Maximum match offset
+#define EPD_LZ_MIN_MATCH    4       //Shortest match
+
+typedef struct __attribute__((packed))
+{
+    char magic[4];
+    uint8_t version;
+    uint8_t palette;
+    uint8_t format;
+    uint8_t reserved;
+    uint16_t width;
+    uint16_t height;
+    uint32_t data_offset;
+    uint32_t data_size;
+    uint32_t crc;
+} EPD_Header_t;
+
+bool write_epd(FILE* fp, uint8_t* data, bool compress);
+uint32_t crc32_update(uint32_t crc, const void* data, uint32_t len);
+
+#endif
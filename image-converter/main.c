@@ -5,6 +5,13 @@
  * Simple commnd line programm to convert image files (.png .bmp .jpg)
  * to a c array with 4 bits per pixel to be used with Waveshare 7 color e-Paper display
  * 
+ * With the -epd option the image is dithered and saved as a pre-rendered
+ * .epd frame that the firmware streams from the SD card to the display,
+ * -epz does the same with LZ compressed pixel data
+ * 
+ * With the -movie option the files of a directory are packed in a single
+ * .epm movie that the firmware plays one frame per wake
+ * 
 */
 
 #include <stdio.h>
@@ -16,6 +23,8 @@
 #include "stb_image.h"
 #include "array.h"
 #include "converter.h"
+#include "epd.h"
+#include "movie.h"
 
 #define _DESIRED_CHANNELS 3
 
@@ -28,19 +37,55 @@ int main(int argc, char* argv[])
     int width, height, channels;
     stbi_uc* p_pix_in;
     uint8_t* p_pix_out;
+    bool epd = false;
+    bool compress = false;
+    char* in_file;
+    char* out_file;
 
     //Check command line arguments
-    if(argc != 3)
+    if(argc == 4 && strcmp(argv[1], "-movie") == 0)
+    {
+        fp_out = fopen(argv[3], "wb");
+        if(fp_out == NULL)
+        {
+            printf("ERROR: Unable to open output file: %s\n", argv[3]);
+            return EXIT_FAILURE;
+        }
+
+        bool res = write_movie(fp_out, argv[2]);
+        if(fclose(fp_out) != 0 || !res)
+        {
+            printf("ERROR: Unable to write output file: %s\n", argv[3]);
+            remove(argv[3]);
+            return EXIT_FAILURE;
+        }
+
+        return EXIT_SUCCESS;
+    }
+    else if(argc == 4 && (strcmp(argv[1], "-epd") == 0 || strcmp(argv[1], "-epz") == 0))
+    {
+        epd = true;
+        compress = strcmp(argv[1], "-epz") == 0;
+        in_file = argv[2];
+        out_file = argv[3];
+    }
+    else if(argc == 3)
+    {
+        in_file = argv[1];
+        out_file = argv[2];
+    }
+    else
     {
-        printf("Usage: imgconv input_file output_file\n");
+        printf("Usage: imgconv [-epd | -epz] input_file output_file\n");
+        printf("       imgconv -movie input_directory output_file.epm\n");
         return EXIT_FAILURE;
     }
 
     //Open input file
-    fp_in = fopen(argv[1], "r");
+    fp_in = fopen(in_file, "rb");
     if(fp_in == NULL)
     {
-        printf("ERROR: Unable to open file: %s\n", argv[1]);
+        printf("ERROR: Unable to open file: %s\n", in_file);
         return EXIT_FAILURE;
     }
 
@@ -53,7 +98,10 @@ int main(int argc, char* argv[])
     }
 
     //Convert image
-    p_pix_out = convert(p_pix_in, width, height);
+    if(epd)
+        p_pix_out = convert_dither(p_pix_in, width, height, EPD_WIDTH, EPD_HEIGHT);
+    else
+        p_pix_out = convert(p_pix_in, width, height);
     if(p_pix_out == NULL)
     {
         printf("ERROR: Unable to convert image data\n");
@@ -61,15 +109,26 @@ int main(int argc, char* argv[])
     }
 
     //Open output file
-    fp_out = fopen(argv[2], "w");
+    fp_out = fopen(out_file, epd ? "wb" : "w");
     if(fp_out == NULL)
     {
-        printf("ERROR: Unable to open output file: %s\n", argv[3]);
+        printf("ERROR: Unable to open output file: %s\n", out_file);
         return EXIT_FAILURE;
     }
 
     //Write to file
-    write_array(fp_out, p_pix_out, "image", width, height);
+    if(epd)
+    {
+        if(!write_epd(fp_out, p_pix_out, compress))
+        {
+            printf("ERROR: Unable to write output file: %s\n", out_file);
+            return EXIT_FAILURE;
+        }
+    }
+    else
+    {
+        write_array(fp_out, p_pix_out, "image", width, height);
+    }
 
     //Close open files and free memory
     fclose(fp_in);
@@ -0,0 +1,250 @@
+/**
+ * File: movie.c
+ * Author: ts-manuel
+ *
+ * Writes movie containers (.epm): the files of a directory in alphabetical
+ * order packed in a single file with a frame table, the firmware shows
+ * one frame per wake
+*/
+
+#include <dirent.h>
+#include <sys/stat.h>
+#include <stddef.h>
+
+#include "movie.h"
+#include "epd.h"
+#include "converter.h"
+#include "stb_image.h"
+
+static char** list_files(const char* dir_path, uint32_t* count);
+static int compare_names(const void* a, const void* b);
+static bool append_frame(FILE* fp, const char* path, MOV_Entry_t* entry);
+static bool copy_file(FILE* fp, FILE* src, long* length);
+static bool pad(FILE* fp, long align);
+
+
+/*
+    Write the files of the directory as a movie,
+    jpeg images and .epd frames are copied, other images are dithered into LZ frames
+*/
+bool write_movie(FILE* fp, const char* dir_path)
+{
+    MOV_Header_t header;
+    MOV_Entry_t* table;
+    uint32_t count;
+    char** names = list_files(dir_path, &count);
+    bool res = true;
+
+    if(names == NULL)
+        return false;
+
+    if(count == 0 || count > MOV_MAX_FRAMES)
+    {
+        printf("ERROR: %u files in %s, a movie holds 1 to %d frames\n", count, dir_path, MOV_MAX_FRAMES);
+        free(names);
+        return false;
+    }
+
+    table = calloc(count, sizeof(MOV_Entry_t));
+    if(table == NULL)
+    {
+        free(names);
+        return false;
+    }
+
+    //The frames follow the table, header and table are written last
+    res = fseek(fp, MOV_TABLE_OFFSET + count * sizeof(MOV_Entry_t), SEEK_SET) == 0 && pad(fp, MOV_ALIGN);
+
+    for(uint32_t i = 0; i < count && res; i++)
+    {
+        char path[4096];
+
+        snprintf(path, sizeof(path), "%s/%s", dir_path, names[i]);
+        res = append_frame(fp, path, &table[i]);
+
+        #ifdef DEBUG
+            printf("[movie.c write_movie()] Frame %u: %s, %u bytes at %u\n", i, names[i], table[i].length, table[i].offset);
+        #endif
+    }
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, MOV_MAGIC, 4);
+    header.version = MOV_VERSION;
+    header.frame_count = count;
+    header.table_offset = MOV_TABLE_OFFSET;
+    header.crc = crc32_update(0, &header, offsetof(MOV_Header_t, crc));
+
+    res = res && fseek(fp, 0, SEEK_SET) == 0 &&
+          fwrite(&header, sizeof(header), 1, fp) == 1 &&
+          fseek(fp, MOV_TABLE_OFFSET, SEEK_SET) == 0 &&
+          fwrite(table, sizeof(MOV_Entry_t), count, fp) == count;
+
+    if(res)
+        printf("%u frames\n", count);
+
+    for(uint32_t i = 0; i < count; i++)
+        free(names[i]);
+    free(names);
+    free(table);
+
+    return res;
+}
+
+
+/*
+    Names of the regular files of the directory in alphabetical order
+*/
+static char** list_files(const char* dir_path, uint32_t* count)
+{
+    DIR* dir = opendir(dir_path);
+    struct dirent* ent;
+    char** names = NULL;
+    uint32_t size = 0;
+
+    *count = 0;
+
+    if(dir == NULL)
+    {
+        printf("ERROR: Unable to open directory: %s\n", dir_path);
+        return NULL;
+    }
+
+    while((ent = readdir(dir)) != NULL)
+    {
+        char path[4096];
+        struct stat st;
+
+        snprintf(path, sizeof(path), "%s/%s", dir_path, ent->d_name);
+        if(ent->d_name[0] == '.' || stat(path, &st) != 0 || !S_ISREG(st.st_mode))
+            continue;
+
+        if(*count == size)
+        {
+            size = size == 0 ? 64 : size * 2;
+            names = realloc(names, size * sizeof(char*));
+            if(names == NULL)
+                break;
+        }
+
+        names[(*count)++] = strdup(ent->d_name);
+    }
+
+    closedir(dir);
+
+    if(names == NULL)
+        return calloc(1, sizeof(char*));
+
+    qsort(names, *count, sizeof(char*), compare_names);
+
+    return names;
+}
+
+
+static int compare_names(const void* a, const void* b)
+{
+    return strcmp(*(char* const*)a, *(char* const*)b);
+}
+
+
+/*
+    Append one frame at the end of the file and fill its entry
+*/
+static bool append_frame(FILE* fp, const char* path, MOV_Entry_t* entry)
+{
+    FILE* src = fopen(path, "rb");
+    uint8_t magic[4] = {0};
+    long length;
+    bool res;
+
+    if(src == NULL)
+    {
+        printf("ERROR: Unable to open file: %s\n", path);
+        return false;
+    }
+
+    memset(entry, 0, sizeof(MOV_Entry_t));
+    entry->offset = ftell(fp);
+
+    fread(magic, 1, sizeof(magic), src);
+    rewind(src);
+
+    if(memcmp(magic, EPD_MAGIC, 4) == 0)
+    {
+        //Pre-rendered frame
+        entry->type = MOV_TYPE_FRAME;
+        res = copy_file(fp, src, &length);
+    }
+    else if(magic[0] == 0xff && magic[1] == 0xd8)
+    {
+        //Jpeg decoded by the firmware
+        entry->type = MOV_TYPE_JPEG;
+        res = copy_file(fp, src, &length);
+    }
+    else
+    {
+        //Other images are dithered here
+        int width, height, channels;
+        stbi_uc* pix_in = stbi_load_from_file(src, &width, &height, &channels, 3);
+        uint8_t* pix_out = pix_in != NULL ? convert_dither(pix_in, width, height, EPD_WIDTH, EPD_HEIGHT) : NULL;
+        FILE* tmp = tmpfile();
+
+        entry->type = MOV_TYPE_FRAME;
+        res = pix_out != NULL && tmp != NULL && write_epd(tmp, pix_out, true) &&
+              fseek(tmp, 0, SEEK_SET) == 0 && copy_file(fp, tmp, &length);
+
+        if(tmp != NULL)
+            fclose(tmp);
+        free(pix_in);
+        free(pix_out);
+    }
+
+    fclose(src);
+
+    if(!res)
+    {
+        printf("ERROR: Unable to add frame: %s\n", path);
+        return false;
+    }
+
+    entry->length = length;
+
+    return pad(fp, MOV_ALIGN);
+}
+
+
+/*
+    Copy the rest of src to fp
+*/
+static bool copy_file(FILE* fp, FILE* src, long* length)
+{
+    uint8_t buff[4096];
+    size_t len;
+
+    *length = 0;
+    while((len = fread(buff, 1, sizeof(buff), src)) > 0)
+    {
+        if(fwrite(buff, 1, len, fp) != len)
+            return false;
+        *length += len;
+    }
+
+    return ferror(src) == 0;
+}
+
+
+/*
+    Write zeros up to the next multiple of align
+*/
+static bool pad(FILE* fp, long align)
+{
+    long pos = ftell(fp);
+
+    while(pos % align != 0)
+    {
+        if(fputc(0, fp) == EOF)
+            return false;
+        pos++;
+    }
+
+    return true;
+}
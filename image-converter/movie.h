@@ -0,0 +1,42 @@
+#ifndef _MOVIE_H_
+#define _MOVIE_H_
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+/*
+    Movie container header and frame table,
+    must match stm32/Core/Inc/frame/movie.h
+*/
+#define MOV_MAGIC           "EPDM"
+#define MOV_VERSION         1
+#define MOV_TABLE_OFFSET    512     //Frame table starts at a sector boundary
+#define MOV_ALIGN           512     //Every frame starts at a sector boundary
+#define MOV_MAX_FRAMES      65535
+#define MOV_TYPE_JPEG       0
+#define MOV_TYPE_FRAME      1
+
+typedef struct __attribute__((packed))
+{
+    char magic[4];
+    uint8_t version;
+    uint8_t reserved[3];
+    uint32_t frame_count;
+    uint32_t table_offset;
+    uint32_t crc;           //CRC-32 of the fields above
+} MOV_Header_t;
+
+typedef struct __attribute__((packed))
+{
+    uint32_t offset;
+    uint32_t length;
+    uint8_t type;
+    uint8_t reserved[3];
+} MOV_Entry_t;
+
+bool write_movie(FILE* fp, const char* dir_path);
+
+#endif
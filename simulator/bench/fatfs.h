@@ -0,0 +1,15 @@
+/**
+ * File: fatfs.h
+ * Author: ts-manuel
+ * 
+ * Replaces stm32/FATFS/App/fatfs.h for the FatFs benchmark,
+ * the real FatFs is compiled with the ffconf.h of the firmware
+*/
+
+#ifndef _FATFS_H_
+#define _FATFS_H_
+
+#include "ff.h"
+#include "diskio.h"
+
+#endif
@@ -0,0 +1,275 @@
+/**
+ * File: seekbench.c
+ * Author: ts-manuel
+ *
+ * Counts the FAT sector reads of a fragmented file read following the FAT
+ * chain and with the cluster link map tables of fast_seek.c. FatFs is
+ * compiled with the ffconf.h of the firmware and runs on a RAM disk
+ * (512MB FAT32, 4KB clusters), the 32MB file is fragmented by writing it
+ * interleaved with a second file that is then deleted.
+ *
+ * Usage: seekbench [FRAGMENTS]    (default 32)
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "fatfs.h"
+#include "fast_seek.h"
+#include "arena.h"
+#include "cmsis_os.h"
+
+#define _DISK_SECTORS   (512 * 1024 * 2)    //512MB
+#define _CLUSTER_BYTES  4096
+#define _FILE_BYTES     (32 * 1024 * 1024)
+#define _SEEKS          100                 //Random frame seeks
+
+typedef struct
+{
+    uint32_t open;          //FAT reads to open the file (and build the table)
+    uint32_t seeks;         //FAT reads of the random seeks
+    uint32_t sequential;    //FAT reads of a sequential read of the whole file
+} SeekCounts_t;
+
+static uint8_t* disk;
+static DWORD fat_start;
+static DWORD fat_end;
+static uint32_t fat_reads;
+static uint8_t buffer[32768];
+
+Arena_t arena_ccm;
+
+static bool make_file(int fragments);
+static bool measure(bool fast_seek, SeekCounts_t* counts);
+
+
+int main(int argc, char* argv[])
+{
+    static FATFS fs;
+    static BYTE work[_MAX_SS * 8];
+    SeekCounts_t chain, table;
+    int fragments = argc > 1 ? atoi(argv[1]) : 32;
+
+    if(fragments < 1 || fragments > _FILE_BYTES / _CLUSTER_BYTES)
+    {
+        printf("Usage: seekbench [FRAGMENTS]  (1 to %d)\n", _FILE_BYTES / _CLUSTER_BYTES);
+        return EXIT_FAILURE;
+    }
+
+    disk = calloc(_DISK_SECTORS, _MAX_SS);
+    if(disk == NULL || f_mkfs("", FM_FAT32, _CLUSTER_BYTES, work, sizeof(work)) != FR_OK ||
+       f_mount(&fs, "", 1) != FR_OK)
+    {
+        printf("ERROR: Unable to format the RAM disk\n");
+        return EXIT_FAILURE;
+    }
+
+    fat_start = fs.fatbase;
+    fat_end = fs.fatbase + fs.fsize * fs.n_fats;
+
+    FSEEK_Init();
+
+    //Mount again so that no FAT sector is left in the window of the volume
+    if(!make_file(fragments) || f_mount(NULL, "", 0) != FR_OK || f_mount(&fs, "", 1) != FR_OK ||
+       !measure(false, &chain) || !measure(true, &table))
+    {
+        printf("ERROR: Benchmark failed\n");
+        return EXIT_FAILURE;
+    }
+
+    printf("RAM disk 512MB FAT32, 4KB clusters, 32MB file in %d fragments\n", fragments);
+    if(FSEEK_GetStats()->fragmented > 0)
+        printf("Too many fragments for a %d entry table, the chain is followed\n", _FSEEK_CLMT_ENTRIES);
+    printf("\nFAT sector reads     chain  link map\n");
+    printf("open              %8u  %8u\n", chain.open, table.open);
+    printf("random seeks      %8u  %8u\n", chain.seeks, table.seeks);
+    printf("sequential read   %8u  %8u\n", chain.sequential, table.sequential);
+
+    return EXIT_SUCCESS;
+}
+
+
+/*
+    Write the file a fragment at a time, with one cluster of another file
+    between the fragments, then delete the other file
+*/
+static bool make_file(int fragments)
+{
+    static FIL file, gap;
+    const int clusters = _FILE_BYTES / _CLUSTER_BYTES;
+    UINT written;
+    bool ok;
+
+    ok = f_open(&file, "MOVIE.EPM", FA_WRITE | FA_CREATE_ALWAYS) == FR_OK &&
+         f_open(&gap, "GAP.TMP", FA_WRITE | FA_CREATE_ALWAYS) == FR_OK;
+
+    for(int i = 0; ok && i < clusters; i++)
+    {
+        ok = f_write(&file, buffer, _CLUSTER_BYTES, &written) == FR_OK && written == _CLUSTER_BYTES;
+
+        if(ok && (i + 1) * fragments / clusters != i * fragments / clusters)
+            ok = f_write(&gap, buffer, _CLUSTER_BYTES, &written) == FR_OK && written == _CLUSTER_BYTES;
+    }
+
+    return ok && f_close(&file) == FR_OK && f_close(&gap) == FR_OK && f_unlink("GAP.TMP") == FR_OK;
+}
+
+
+/*
+    Open the file with f_open() or with FSEEK_Open(), seek to random frames
+    and read the whole file. Every seek starts from the beginning of the file,
+    like a frame read after the movie is opened
+*/
+static bool measure(bool fast_seek, SeekCounts_t* counts)
+{
+    static FIL file;
+    FRESULT res;
+    UINT read;
+
+    fat_reads = 0;
+    res = fast_seek ? FSEEK_Open(&file, "MOVIE.EPM") : f_open(&file, "MOVIE.EPM", FA_READ | FA_OPEN_EXISTING);
+    if(res != FR_OK)
+        return false;
+    counts->open = fat_reads;
+
+    srand(1);
+    fat_reads = 0;
+    for(int i = 0; i < _SEEKS; i++)
+    {
+        FSIZE_t offset = (FSIZE_t)(rand() % (_FILE_BYTES / _MAX_SS)) * _MAX_SS;
+
+        if(f_lseek(&file, offset) != FR_OK || f_read(&file, buffer, _MAX_SS, &read) != FR_OK ||
+           f_lseek(&file, 0) != FR_OK)
+            return false;
+    }
+    counts->seeks = fat_reads;
+
+    fat_reads = 0;
+    do
+    {
+        if(f_read(&file, buffer, sizeof(buffer), &read) != FR_OK)
+            return false;
+    } while(read > 0);
+    counts->sequential = fat_reads;
+
+    return (fast_seek ? FSEEK_Close(&file) : f_close(&file)) == FR_OK;
+}
+
+
+/*
+    RAM disk, the reads of the first FAT are counted
+*/
+DSTATUS disk_initialize(BYTE pdrv)
+{
+    return 0;
+}
+
+
+DSTATUS disk_status(BYTE pdrv)
+{
+    return 0;
+}
+
+
+DRESULT disk_read(BYTE pdrv, BYTE* buff, DWORD sector, UINT count)
+{
+    if(sector >= fat_start && sector < fat_end)
+        fat_reads += count;
+
+    memcpy(buff, &disk[sector * _MAX_SS], count * _MAX_SS);
+
+    return RES_OK;
+}
+
+
+DRESULT disk_write(BYTE pdrv, const BYTE* buff, DWORD sector, UINT count)
+{
+    memcpy(&disk[sector * _MAX_SS], buff, count * _MAX_SS);
+
+    return RES_OK;
+}
+
+
+DRESULT disk_ioctl(BYTE pdrv, BYTE cmd, void* buff)
+{
+    if(cmd == GET_SECTOR_COUNT)
+        *(DWORD*)buff = _DISK_SECTORS;
+    else if(cmd == GET_SECTOR_SIZE)
+        *(WORD*)buff = _MAX_SS;
+    else if(cmd == GET_BLOCK_SIZE)
+        *(DWORD*)buff = 1;
+
+    return RES_OK;
+}
+
+
+DWORD get_fattime(void)
+{
+    return 0;
+}
+
+
+/*
+    Single thread, the locks are always free
+*/
+osMutexId_t osMutexNew(const osMutexAttr_t* attr)
+{
+    return (osMutexId_t)1;
+}
+
+
+osStatus_t osMutexAcquire(osMutexId_t mutex_id, uint32_t timeout)
+{
+    return osOK;
+}
+
+
+osStatus_t osMutexRelease(osMutexId_t mutex_id)
+{
+    return osOK;
+}
+
+
+osSemaphoreId_t osSemaphoreNew(uint32_t max_count, uint32_t initial_count, const osSemaphoreAttr_t* attr)
+{
+    return (osSemaphoreId_t)1;
+}
+
+
+osStatus_t osSemaphoreAcquire(osSemaphoreId_t semaphore_id, uint32_t timeout)
+{
+    return osOK;
+}
+
+
+osStatus_t osSemaphoreRelease(osSemaphoreId_t semaphore_id)
+{
+    return osOK;
+}
+
+
+osStatus_t osSemaphoreDelete(osSemaphoreId_t semaphore_id)
+{
+    return osOK;
+}
+
+
+void* pvPortMalloc(size_t size)
+{
+    return malloc(size);
+}
+
+
+void vPortFree(void* ptr)
+{
+    free(ptr);
+}
+
+
+void* ARENA_Alloc(Arena_t* arena, uint32_t size)
+{
+    return calloc(1, size);
+}
@@ -0,0 +1,72 @@
+/**
+ * File: fatfs.c
+ * Author: ts-manuel
+ * 
+ * FatFs functions on top of the host file system
+*/
+
+#include "fatfs.h"
+
+
+FRESULT f_open(FIL* fp, const char* path, BYTE mode)
+{
+    fp->fp = fopen(path, (mode & FA_WRITE) ? "r+b" : "rb");
+    if(fp->fp == NULL)
+        return FR_NO_FILE;
+
+    fseek(fp->fp, 0, SEEK_END);
+    fp->size = ftell(fp->fp);
+    fseek(fp->fp, 0, SEEK_SET);
+    fp->fptr = 0;
+
+    return FR_OK;
+}
+
+
+FRESULT f_close(FIL* fp)
+{
+    if(fp->fp == NULL)
+        return FR_INVALID_OBJECT;
+
+    fclose(fp->fp);
+    fp->fp = NULL;
+
+    return FR_OK;
+}
+
+
+FRESULT f_read(FIL* fp, void* buff, UINT btr, UINT* br)
+{
+    *br = fread(buff, 1, btr, fp->fp);
+    fp->fptr += *br;
+
+    return ferror(fp->fp) ? FR_DISK_ERR : FR_OK;
+}
+
+
+FRESULT f_write(FIL* fp, const void* buff, UINT btw, UINT* bw)
+{
+    *bw = fwrite(buff, 1, btw, fp->fp);
+    fp->fptr += *bw;
+    if(fp->fptr > fp->size)
+        fp->size = fp->fptr;
+
+    return ferror(fp->fp) ? FR_DISK_ERR : FR_OK;
+}
+
+
+/*
+    Seeking past the end is clipped to the file size (read mode)
+*/
+FRESULT f_lseek(FIL* fp, FSIZE_t ofs)
+{
+    if(ofs > fp->size)
+        ofs = fp->size;
+
+    if(fseek(fp->fp, ofs, SEEK_SET) != 0)
+        return FR_DISK_ERR;
+
+    fp->fptr = ofs;
+
+    return FR_OK;
+}
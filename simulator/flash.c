@@ -0,0 +1,483 @@
+/**
+ * File: flash.c
+ * Author: ts-manuel
+ * 
+ * Model of flash sectors 10 and 11 for the state store of stm32/Core/Src/hardware/flash.c.
+ * Programming can only clear bits and the time of every operation is added to
+ * the simulated time. The power can be cut after a number of operations: the
+ * operation in progress is left half done (random bits of the word cleared,
+ * random words of the sector erased) and the firmware stops there like the
+ * CPU would. flash_fuzz() runs the writes of a wake with random power cuts,
+ * also while a sector is copied or erased, and checks that every key read at
+ * the next wake holds the new or the previous value. Then it checks the file
+ * resumed from the backup SRAM, or from flash when the backup SRAM is lost.
+*/
+
+#include <setjmp.h>
+#include <time.h>
+#include "flash.h"
+#include "panel.h"
+#include "main.h"
+#include "profiler.h"
+#include "hardware/flash.h"
+
+uint32_t sim_flash[2 * _FLASH_SECTOR_SIZE / sizeof(uint32_t)];
+static FlashStats_t stats;
+static bool locked = true;
+static uint32_t cut_countdown;  //Operations left before the power is cut, 0 never
+static bool cut_done;
+static jmp_buf power_cut;
+
+static uint32_t store_fuzz(uint32_t wakes);
+static uint32_t resume_fuzz(uint32_t wakes);
+static void resume_cost(uint32_t wakes);
+static void wake_file(char* path, FmanPosition_t* pos, uint32_t i);
+static void source_of(char* source, const char* path);
+static void power_on(bool backup_lost);
+static bool operation(uint64_t ns);
+static uint64_t host_time(void);
+
+
+HAL_StatusTypeDef HAL_FLASH_Unlock(void)
+{
+    locked = false;
+
+    return HAL_OK;
+}
+
+
+HAL_StatusTypeDef HAL_FLASH_Lock(void)
+{
+    locked = true;
+
+    return HAL_OK;
+}
+
+
+/*
+    Only word programming of the sector is modelled
+*/
+HAL_StatusTypeDef HAL_FLASH_Program(uint32_t type, uintptr_t address, uint64_t data)
+{
+    uintptr_t offset = address - (uintptr_t)sim_flash;
+
+    if(locked || type != FLASH_TYPEPROGRAM_WORD || offset >= sizeof(sim_flash) || offset % sizeof(uint32_t) != 0)
+        return HAL_ERROR;
+
+    uint32_t* word = &sim_flash[offset / sizeof(uint32_t)];
+    stats.programs++;
+
+    if(!operation(FLASH_PROGRAM_US * 1000ULL))
+    {
+        *word &= (uint32_t)data | (uint32_t)rand();
+        longjmp(power_cut, 1);
+    }
+
+    *word &= (uint32_t)data;
+
+    return HAL_OK;
+}
+
+
+/*
+    Only the erase of one of the two sectors is modelled
+*/
+HAL_StatusTypeDef HAL_FLASHEx_Erase(FLASH_EraseInitTypeDef* init, uint32_t* error)
+{
+    *error = 0xffffffff;
+
+    if(locked || init->NbSectors != 1 || (init->Sector != FLASH_SECTOR_10 && init->Sector != FLASH_SECTOR_11))
+        return HAL_ERROR;
+
+    uint32_t* sector = &sim_flash[(init->Sector - FLASH_SECTOR_10) * _FLASH_SECTOR_SIZE / sizeof(uint32_t)];
+    stats.erases++;
+
+    if(!operation(FLASH_ERASE_MS * 1000000ULL))
+    {
+        for(int i = 0; i < _FLASH_SECTOR_SIZE / sizeof(uint32_t); i++)
+        {
+            if(rand() & 1)
+                sector[i] = 0xffffffff;
+        }
+        longjmp(power_cut, 1);
+    }
+
+    memset(sector, 0xff, _FLASH_SECTOR_SIZE);
+
+    return HAL_OK;
+}
+
+
+/*
+    Cut the power during the nth operation from now, 0 to keep it on
+*/
+void flash_cut_after(uint32_t operations)
+{
+    cut_countdown = operations;
+    cut_done = false;
+}
+
+
+const FlashStats_t* flash_get_stats(void)
+{
+    return &stats;
+}
+
+
+/*
+    Runs the store and the resume state with random power cuts, then compares
+    the cost of writing the file to flash every wake with the backup SRAM.
+    Returns EXIT_FAILURE if a key or the file on the display is lost or wrong
+*/
+int flash_fuzz(uint32_t wakes, uint32_t seed)
+{
+    uint32_t wrong;
+
+    srand(seed);
+    wrong = store_fuzz(wakes);
+    wrong += resume_fuzz(wakes);
+    resume_cost(wakes);
+
+    return wrong == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+
+/*
+    Each wake writes the file on the display, the timings and the counters
+    and the decode settings, that change every 256 wakes, and erases the inactive sector
+    like the render task, skipped one wake in eight. The power is cut in one
+    wake in four, in three in four when the active sector is almost full.
+    Returns the number of keys lost or with a wrong value
+*/
+static uint32_t store_fuzz(uint32_t wakes)
+{
+    static const uint32_t size[e_FlashKeyCount] = {
+        [e_FlashKeySource] = sizeof(FlashSource_t),
+        [e_FlashKeyDecode] = sizeof(FlashDecode_t),
+        [e_FlashKeyCounters] = sizeof(FlashCounters_t),
+        [e_FlashKeyTimings] = sizeof(ProfWake_t),
+    };
+    uint8_t old[e_FlashKeyCount][sizeof(FlashSource_t)];
+    uint8_t new[e_FlashKeyCount][sizeof(FlashSource_t)];
+    uint8_t loaded[sizeof(FlashSource_t)];
+    bool stored[e_FlashKeyCount] = {false};
+    uint32_t cuts = 0, cut_full = 0, cut_erase = 0, wrong = 0;
+    uint32_t records = 0, skipped = 0, blocking = 0, programs = 0;
+    char loaded_path[_FILE_PATH_MAX_LEN];
+    FmanPosition_t loaded_pos;
+
+    memset(sim_flash, 0xff, sizeof(sim_flash));
+    PROF_Init();
+    FLASH_Init();
+
+    for(uint32_t i = 0; i < wakes; i++)
+    {
+        bool written[e_FlashKeyCount] = {false};
+        FlashSource_t* source = (FlashSource_t*)new[e_FlashKeySource];
+        FlashCounters_t* counters = (FlashCounters_t*)new[e_FlashKeyCounters];
+        const FlashInfo_t* info = FLASH_GetInfo();
+
+        //Values written by this wake
+        memset(new, 0, sizeof(new));
+        snprintf(source->path, sizeof(source->path), "Folder %u/image %0*u.jpg", i / 100, 1 + rand() % 60, i);
+        source->position.record = i;
+        source->position.generation = (i >> 8) & 0xffff;
+        source->position.frame = i % 7;
+        written[e_FlashKeySource] = true;
+
+        FlashDecode_t* decode = (FlashDecode_t*)new[e_FlashKeyDecode];
+        decode->panel = i / 256;
+        decode->dither = 1;
+        decode->scale = 1;
+        written[e_FlashKeyDecode] = true;
+
+        for(int j = 0; j < e_ProfCount; j++)
+            ((ProfWake_t*)new[e_FlashKeyTimings])->us[j] = rand();
+        written[e_FlashKeyTimings] = true;
+
+        if(stored[e_FlashKeyCounters])
+            memcpy(counters, old[e_FlashKeyCounters], sizeof(FlashCounters_t));
+        counters->wakes++;
+        counters->updates += rand() & 1;
+        written[e_FlashKeyCounters] = true;
+
+        bool full = info->active >= 0 && info->slots - info->used < 32;
+        uint32_t programs_before = stats.programs;
+        uint32_t erases_before = stats.erases;
+        flash_cut_after(rand() % 4 < (full ? 3 : 1) ? 1 + rand() % 128 : 0);
+
+        if(setjmp(power_cut) == 0)
+        {
+            for(int key = 1; key < e_FlashKeyCount; key++)
+            {
+                if(written[key])
+                    FLASH_Write(key, new[key], size[key]);
+            }
+
+            if(rand() % 8 != 0)
+                FLASH_EraseInactive();
+        }
+
+        bool cut = cut_done;
+        flash_cut_after(0);
+        programs += stats.programs - programs_before;
+        records += info->records;
+        skipped += info->skipped;
+        blocking += info->blocking_erases;
+        cuts += cut;
+        cut_full += cut && full;
+        cut_erase += cut && stats.erases != erases_before;
+
+        //Next wake
+        FLASH_Init();
+
+        for(int key = 1; key < e_FlashKeyCount; key++)
+        {
+            bool valid = FLASH_Read(key, loaded, size[key]);
+            bool is_new = valid && written[key] && memcmp(loaded, new[key], size[key]) == 0;
+            bool is_old = stored[key] ? valid && memcmp(loaded, old[key], size[key]) == 0 : !valid;
+
+            if(!is_new && !(is_old && (cut || !written[key])))
+            {
+                wrong++;
+                printf("ERROR: Wake %u, key %d %s\n", i, key, valid ? "has a wrong value" : "lost");
+            }
+
+            if(valid)
+                memcpy(old[key], loaded, size[key]);
+            stored[key] = valid;
+        }
+    }
+
+    //Time to find the latest records at reset and to read the file, on the host
+    uint32_t loads = 10000;
+    uint64_t start = host_time();
+    for(uint32_t i = 0; i < loads; i++)
+    {
+        FLASH_Init();
+        FLASH_LoadFilePath(loaded_path, &loaded_pos);
+    }
+    uint64_t load_ns = (host_time() - start) / loads;
+
+    const FlashInfo_t* info = FLASH_GetInfo();
+    printf("Flash store: %u wakes, %u power cuts (%u with the sector almost full, %u during an erase)\n",
+        wakes, cuts, cut_full, cut_erase);
+    printf("  records: %u written, %u unchanged, %u sector switches\n", records, skipped, info->sequence);
+    printf("  program: %u words, %.1f per wake, %.3f ms per wake (simulated)\n", programs,
+        (double)programs / wakes, programs * FLASH_PROGRAM_US / 1000.0 / wakes);
+    printf("  erase:   %u sectors, %u while writing (simulated %u ms)\n", stats.erases, blocking, stats.erases * FLASH_ERASE_MS);
+    printf("  load:    %.3f us (host)\n", load_ns / 1000.0);
+    printf("  wrong or lost keys: %u\n", wrong);
+
+    return wrong;
+}
+
+
+/*
+    The file of each wake is stored with FLASH_StoreFilePath(), the power is cut
+    in one wake in four and the backup SRAM is lost in one in sixteen. The file
+    loaded at the next wake must be the new one if the backup SRAM was kept,
+    otherwise the one committed to flash: in the folder of the new file, or of
+    the committed one if the commit was cut. Returns the number of wrong files
+*/
+static uint32_t resume_fuzz(uint32_t wakes)
+{
+    char path[_FILE_PATH_MAX_LEN];
+    char loaded[_FILE_PATH_MAX_LEN];
+    char source[_FILE_PATH_MAX_LEN];
+    char committed[2][_FILE_PATH_MAX_LEN] = {"", ""};  //Source in flash, one of the two after a cut
+    FmanPosition_t pos;
+    FmanPosition_t loaded_pos;
+    uint32_t cuts = 0, losses = 0, wrong = 0, records = 0;
+
+    memset(sim_flash, 0xff, sizeof(sim_flash));
+    power_on(true);
+
+    for(uint32_t i = 0; i < wakes; i++)
+    {
+        wake_file(path, &pos, i);
+        source_of(source, path);
+        flash_cut_after(rand() % 4 == 0 ? 1 + rand() % 128 : 0);
+
+        if(setjmp(power_cut) == 0)
+        {
+            FLASH_StoreFilePath(path, &pos);
+            FLASH_EndWake(1, 0);
+            FLASH_EraseInactive();
+        }
+
+        bool cut = cut_done;
+        flash_cut_after(0);
+        cuts += cut;
+        records += FLASH_GetInfo()->records;
+
+        if(cut)
+            strcpy(committed[1], source);
+        else
+            strcpy(committed[0], source), committed[1][0] = '\0';
+
+        //Next wake
+        bool lost = rand() % 16 == 0;
+        losses += lost;
+        power_on(lost);
+
+        bool valid = FLASH_LoadFilePath(loaded, &loaded_pos);
+        bool ok;
+
+        if(!lost)
+        {
+            ok = valid && strcmp(loaded, path) == 0 && loaded_pos.record == pos.record && loaded_pos.frame == pos.frame;
+        }
+        else
+        {
+            source_of(source, valid ? loaded : "");
+            ok = strcmp(source, committed[0]) == 0 || (committed[1][0] != '\0' && strcmp(source, committed[1]) == 0);
+            strcpy(committed[0], source);
+            committed[1][0] = '\0';
+        }
+
+        if(!ok)
+        {
+            wrong++;
+            printf("ERROR: Wake %u loaded <%s>%s\n", i, valid ? loaded : "nothing", lost ? " after a backup reset" : "");
+        }
+    }
+
+    printf("Resume state: %u wakes, %u power cuts, %u backup SRAM resets, %u records committed\n", wakes, cuts, losses, records);
+    printf("  wrong files: %u\n", wrong);
+
+    return wrong;
+}
+
+
+/*
+    Flash writes of the same wakes without power cuts: file, counters and timings
+    written every wake, and the state kept in the backup SRAM
+*/
+static void resume_cost(uint32_t wakes)
+{
+    const char* name[2] = {"every wake", "backup SRAM"};
+    char path[_FILE_PATH_MAX_LEN];
+    FmanPosition_t pos;
+    double ms[2];
+
+    for(int mode = 0; mode < 2; mode++)
+    {
+        memset(sim_flash, 0xff, sizeof(sim_flash));
+        power_on(true);
+
+        uint32_t programs = stats.programs;
+        uint32_t erases = stats.erases;
+
+        for(uint32_t i = 0; i < wakes; i++)
+        {
+            wake_file(path, &pos, i);
+            PROF_AddUs(e_ProfBusy, 1 + rand() % 1000000);
+
+            if(mode == 0)
+            {
+                FlashSource_t source;
+                FlashCounters_t counters = *FLASH_GetCounters();
+
+                memset(&source, 0, sizeof(source));
+                source.position = pos;
+                strcpy(source.path, path);
+                counters.wakes = i + 1;
+
+                FLASH_Write(e_FlashKeySource, &source, sizeof(source));
+                FLASH_Write(e_FlashKeyCounters, &counters, sizeof(counters));
+                FLASH_Write(e_FlashKeyTimings, PROF_GetWake(0), sizeof(ProfWake_t));
+            }
+            else
+            {
+                FLASH_StoreFilePath(path, &pos);
+                FLASH_EndWake(1, 0);
+            }
+
+            FLASH_EraseInactive();
+            power_on(false);
+        }
+
+        programs = stats.programs - programs;
+        erases = stats.erases - erases;
+        ms[mode] = programs * FLASH_PROGRAM_US / 1000.0 / wakes;
+        printf("Flash writes, %-11s: %.1f words, %.3f ms per wake, %u erases in %u wakes (simulated)\n",
+            name[mode], (double)programs / wakes, ms[mode], erases, wakes);
+    }
+
+    printf("  saved %.3f ms of flash programming per wake\n", ms[0] - ms[1]);
+}
+
+
+/*
+    File shown at wake i: folders of 100 images, every fourth folder is a movie of 100 frames
+*/
+static void wake_file(char* path, FmanPosition_t* pos, uint32_t i)
+{
+    uint32_t folder = i / 100;
+
+    if(folder % 4 == 3)
+        snprintf(path, _FILE_PATH_MAX_LEN, "Movies/movie %u.epm", folder);
+    else
+        snprintf(path, _FILE_PATH_MAX_LEN, "Folder %u/image %0*u.jpg", folder, 1 + (i * 7919) % 60, i);
+
+    pos->record = i;
+    pos->generation = 1;
+    pos->frame = folder % 4 == 3 ? i % 100 : 0;
+}
+
+
+/*
+    Folder of an image or path of a movie, the unit committed to flash
+*/
+static void source_of(char* source, const char* path)
+{
+    const char* end = strrchr(path, '/');
+
+    strcpy(source, path);
+    if(strstr(path, ".epm") == NULL)
+        source[end != NULL ? end - path : 0] = '\0';
+}
+
+
+/*
+    Reset of the CPU after standby, the backup SRAM is cleared if the backup domain was reset
+*/
+static void power_on(bool backup_lost)
+{
+    if(backup_lost)
+    {
+        memset(PWR_BackupRegion(_BKP_PROFILER_OFFSET), 0, _BKP_PROFILER_SIZE);
+        memset(PWR_BackupRegion(_BKP_STATE_OFFSET), 0, _BKP_STATE_SIZE);
+    }
+
+    PROF_Init();
+    FLASH_Init();
+}
+
+
+/*
+    Count an operation and its time, returns false if the power is cut during it
+*/
+static bool operation(uint64_t ns)
+{
+    sim_advance_time(ns);
+    stats.sim_ns += ns;
+
+    if(cut_countdown == 0 || --cut_countdown > 0)
+        return true;
+
+    cut_done = true;
+
+    return false;
+}
+
+
+static uint64_t host_time(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
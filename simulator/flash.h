@@ -0,0 +1,28 @@
+#ifndef _FLASH_H_
+#define _FLASH_H_
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+/*
+    Simulated timing, typical values of the STM32F405 datasheet
+    at 2.7 to 3.6 V (x32 parallelism)
+*/
+#define FLASH_PROGRAM_US    16      //Word, half word or byte
+#define FLASH_ERASE_MS      1000    //128KB sector
+
+typedef struct
+{
+    uint32_t programs;      //Program operations
+    uint32_t erases;        //Sector erases
+    uint64_t sim_ns;        //Time spent programming and erasing
+} FlashStats_t;
+
+void flash_cut_after(uint32_t operations);
+const FlashStats_t* flash_get_stats(void);
+int flash_fuzz(uint32_t wakes, uint32_t seed);
+
+#endif
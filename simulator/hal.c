@@ -0,0 +1,165 @@
+/**
+ * File: hal.c
+ * Author: ts-manuel
+ * 
+ * Host implementation of the HAL functions used by the display code,
+ * the GPIOs and the SPI are connected to the panel model
+*/
+
+#include "main.h"
+#include "panel.h"
+#include "hardware/display_bus.h"
+#include "hardware/light_detector.h"
+#include "hardware/power.h"
+#include "hardware/clock.h"
+#include "DEV_Config.h"
+
+GPIO_TypeDef sim_gpiob = {1};
+GPIO_TypeDef sim_gpioc = {2};
+static SPI_TypeDef sim_spi1 = {1};
+SPI_HandleTypeDef hspi1 = {&sim_spi1};
+static uint8_t backup_sram[_BKP_SRAM_SIZE];
+
+
+void HAL_GPIO_WritePin(GPIO_TypeDef* port, uint16_t pin, GPIO_PinState state)
+{
+    panel_write_pin(pin, state == GPIO_PIN_SET);
+}
+
+
+GPIO_PinState HAL_GPIO_ReadPin(GPIO_TypeDef* port, uint16_t pin)
+{
+    if(pin != EP_BUSY_Pin)
+        return GPIO_PIN_RESET;
+
+    //Polling takes time
+    sim_advance_time(1000);
+
+    return panel_read_busy() ? GPIO_PIN_SET : GPIO_PIN_RESET;
+}
+
+
+void HAL_Delay(uint32_t delay)
+{
+    sim_advance_time((uint64_t)delay * 1000000ULL);
+}
+
+
+uint32_t HAL_GetTick(void)
+{
+    return (uint32_t)(sim_get_time() / 1000000ULL);
+}
+
+
+HAL_StatusTypeDef HAL_SPI_Transmit(SPI_HandleTypeDef* hspi, uint8_t* data, uint16_t size, uint32_t timeout)
+{
+    for(int i = 0; i < size; i++)
+        panel_write_byte(data[i]);
+
+    return HAL_OK;
+}
+
+
+/*
+    The transfer is completed before returning,
+    the complete callback is called like from the DMA interrupt
+*/
+HAL_StatusTypeDef HAL_SPI_Transmit_DMA(SPI_HandleTypeDef* hspi, uint8_t* data, uint16_t size)
+{
+    HAL_SPI_Transmit(hspi, data, size, 0);
+    HAL_SPI_TxCpltCallback(hspi);
+
+    return HAL_OK;
+}
+
+
+/*
+    Same as stm32/Core/Src/main.c
+*/
+void HAL_GPIO_EXTI_Callback(uint16_t pin)
+{
+    if(pin & EP_BUSY_Pin)
+        DBUS_BusyIRQHandler();
+}
+
+
+void DEV_SPI_WriteByte(UBYTE value)
+{
+    HAL_SPI_Transmit(&hspi1, &value, 1, 1000);
+}
+
+
+void DEV_Delay(uint32_t ms)
+{
+    HAL_Delay(ms);
+}
+
+
+/*
+    The simulated room is always bright
+*/
+bool LDR_IsDark(void)
+{
+    return false;
+}
+
+
+/*
+    The simulated core has a single clock
+*/
+void CLK_Request(ClockLevel_e level)
+{
+}
+
+
+void CLK_Release(ClockLevel_e level)
+{
+}
+
+
+void CLK_BeginWait(void)
+{
+}
+
+
+void CLK_EndWait(void)
+{
+}
+
+
+/*
+    The backup SRAM is an array, it can be loaded from and saved to a file
+    to simulate consecutive wake ups
+*/
+void* PWR_BackupRegion(uint32_t offset)
+{
+    return &backup_sram[offset];
+}
+
+
+void sim_backup_load(const char* path)
+{
+    FILE* fp = fopen(path, "rb");
+
+    if(fp != NULL)
+    {
+        if(fread(backup_sram, 1, sizeof(backup_sram), fp) != sizeof(backup_sram))
+            memset(backup_sram, 0, sizeof(backup_sram));
+        fclose(fp);
+    }
+}
+
+
+void sim_backup_save(const char* path)
+{
+    FILE* fp = fopen(path, "wb");
+
+    if(fp == NULL)
+    {
+        printf("ERROR: Unable to write file: %s\n", path);
+        return;
+    }
+
+    fwrite(backup_sram, 1, sizeof(backup_sram), fp);
+    fclose(fp);
+}
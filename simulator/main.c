@@ -0,0 +1,160 @@
+/**
+ * File: main.c
+ * Author: ts-manuel
+ * 
+ * Runs the display task of the firmware on the host. The display code
+ * (display_task.c, display.c, display_bus.c, the Waveshare driver, the jpeg decoder
+ * and the frame streamer) is compiled unmodified, the HAL, the RTOS and FatFs are
+ * replaced by host implementations and the SPI is connected to a model of the panel.
+ * The image shown by the panel is written to a .ppm file and the bytes, commands,
+ * BUSY waits and time per stage are printed at the end.
+ * The backup SRAM can be kept in a file (-b) to simulate consecutive updates.
+ * The flash action runs the state store of flash.c on a model of the flash sectors
+ * with power cuts and backup SRAM resets (flash.c of the simulator).
+ * 
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "simulator.h"
+#include "panel.h"
+#include "flash.h"
+#include "tasks/display_task.h"
+#include "profiler.h"
+
+static const char* backup = NULL;
+
+
+static void print_usage(void)
+{
+    printf("Usage: displaysim [-o output.ppm] [-b backup.bin] action\n");
+    printf("Actions:\n");
+    printf("  solid COLOR     solid color (0 to 7)\n");
+    printf("  blocks          7 color blocks test pattern\n");
+    printf("  stripes         colored stripes test pattern\n");
+    printf("  lines           black and white lines test pattern\n");
+    printf("  gradient COLOR  color gradient (0 to 7)\n");
+    printf("  file PATH [N]   jpeg image, .epd frame or frame N of a .epm movie\n");
+    printf("  flash N [SEED]  N wakes of the flash store with random power cuts\n");
+}
+
+
+int main(int argc, char* argv[])
+{
+    DisplayTaskArgs_t args;
+    DisplayJob_t msg;
+    const char* output = "display.ppm";
+    int arg = 1;
+
+    memset(&msg, 0, sizeof(msg));
+
+    //Check command line arguments
+    while(arg + 1 < argc && argv[arg][0] == '-')
+    {
+        if(strcmp(argv[arg], "-o") == 0)
+            output = argv[arg + 1];
+        else if(strcmp(argv[arg], "-b") == 0)
+            backup = argv[arg + 1];
+        else
+            break;
+        arg += 2;
+    }
+
+    if(arg >= argc)
+    {
+        print_usage();
+        return EXIT_FAILURE;
+    }
+
+    const char* action = argv[arg];
+    const char* param = arg + 1 < argc ? argv[arg + 1] : NULL;
+
+    if(strcmp(action, "solid") == 0 && param != NULL)
+    {
+        msg.action = e_DisplaySolid;
+        msg.color = atoi(param) & 0x07;
+    }
+    else if(strcmp(action, "blocks") == 0)
+    {
+        msg.action = e_DisplayBlocks;
+    }
+    else if(strcmp(action, "stripes") == 0)
+    {
+        msg.action = e_DisplayStripes;
+    }
+    else if(strcmp(action, "lines") == 0)
+    {
+        msg.action = e_DisplayLines;
+    }
+    else if(strcmp(action, "gradient") == 0 && param != NULL)
+    {
+        msg.action = e_DisplayGradient;
+        msg.color = atoi(param) & 0x07;
+    }
+    else if(strcmp(action, "file") == 0 && param != NULL)
+    {
+        if(strlen(param) >= sizeof(msg.path))
+        {
+            printf("ERROR: Path too long: %s\n", param);
+            return EXIT_FAILURE;
+        }
+        msg.action = e_DisplayFile;
+        strcpy(msg.path, param);
+        if(arg + 2 < argc)
+            msg.frame = atoi(argv[arg + 2]);
+    }
+    else if(strcmp(action, "flash") == 0 && param != NULL)
+    {
+        return flash_fuzz(atoi(param), arg + 2 < argc ? atoi(argv[arg + 2]) : 1);
+    }
+    else
+    {
+        print_usage();
+        return EXIT_FAILURE;
+    }
+
+    panel_init(output);
+    if(backup != NULL)
+        sim_backup_load(backup);
+    PROF_Init();
+
+    //Submit the job like the console task does and run the display task
+    args.message_queue = osMessageQueueNew(_DJOB_QUEUE_DEPTH, sizeof(DisplayJob_t), NULL);
+    DJOB_Init(&args);
+    DJOB_Submit(&msg);
+
+    StartDisplayTask(&args);
+
+    return EXIT_SUCCESS;
+}
+
+
+/*
+    Called when the display task waits for a message that will never come
+*/
+void sim_finish(void)
+{
+    const DisplayJob_t* job = DJOB_GetLast();
+    const ProfWake_t* wake = PROF_GetWake(0);
+
+    PROF_EndWake();
+    panel_finish();
+    if(backup != NULL)
+        sim_backup_save(backup);
+
+    printf("\n");
+    panel_print_stats(stdout);
+    printf("\nJob %u: data %u ms, refresh %u ms, total %u ms\n", job->id,
+        job->data_tick - job->start_tick, job->done_tick - job->data_tick, job->done_tick - job->submit_tick);
+
+    //Host time except busy and wake (simulated time)
+    printf("\nPhase           ms\n");
+    for(int p = 0; p < e_ProfCount; p++)
+        printf("%-10s %7.3f\n", PROF_GetPhaseName(p), wake->us[p] / 1000.0);
+
+    exit(EXIT_SUCCESS);
+}
@@ -0,0 +1,253 @@
+/**
+ * File: os.c
+ * Author: ts-manuel
+ * 
+ * Single thread CMSIS-RTOS v2, see stubs/cmsis_os.h
+*/
+
+#include "cmsis_os.h"
+#include "main.h"
+#include "panel.h"
+#include "simulator.h"
+
+#define _MAX_QUEUE_SIZE 1024
+
+typedef struct
+{
+    uint32_t msg_count;
+    uint32_t msg_size;
+    uint32_t head;
+    uint32_t count;
+    uint8_t data[_MAX_QUEUE_SIZE];
+} Queue_t;
+
+static int thread;
+static uint32_t thread_flags;
+
+
+osKernelState_t osKernelGetState(void)
+{
+    return osKernelRunning;
+}
+
+
+uint32_t osKernelGetTickCount(void)
+{
+    return HAL_GetTick();
+}
+
+
+osThreadId_t osThreadGetId(void)
+{
+    return &thread;
+}
+
+
+uint32_t osThreadFlagsSet(osThreadId_t thread_id, uint32_t flags)
+{
+    thread_flags |= flags;
+
+    return thread_flags;
+}
+
+
+uint32_t osThreadFlagsClear(uint32_t flags)
+{
+    uint32_t old = thread_flags;
+
+    thread_flags &= ~flags;
+
+    return old;
+}
+
+
+/*
+    Run the panel until one of the flags is set or the timeout expires
+*/
+uint32_t osThreadFlagsWait(uint32_t flags, uint32_t options, uint32_t timeout)
+{
+    uint64_t deadline = sim_get_time() + (uint64_t)timeout * 1000000ULL;
+
+    while((options & osFlagsWaitAll) ? (thread_flags & flags) != flags : (thread_flags & flags) == 0)
+    {
+        uint64_t next;
+
+        if(!panel_next_event(&next) || (timeout != osWaitForever && next > deadline))
+        {
+            //Nothing will ever set the flag
+            if(timeout == osWaitForever)
+                sim_finish();
+
+            sim_advance_time(deadline - sim_get_time());
+            return osFlagsErrorTimeout;
+        }
+
+        sim_advance_time(next - sim_get_time());
+    }
+
+    uint32_t res = thread_flags & flags;
+    if(!(options & osFlagsNoClear))
+        thread_flags &= ~res;
+
+    return res;
+}
+
+
+osStatus_t osDelay(uint32_t ticks)
+{
+    HAL_Delay(ticks);
+
+    return osOK;
+}
+
+
+osMessageQueueId_t osMessageQueueNew(uint32_t msg_count, uint32_t msg_size, const osMessageQueueAttr_t* attr)
+{
+    Queue_t* q;
+
+    if(msg_count * msg_size > _MAX_QUEUE_SIZE)
+        return NULL;
+
+    q = calloc(1, sizeof(Queue_t));
+    if(q != NULL)
+    {
+        q->msg_count = msg_count;
+        q->msg_size = msg_size;
+    }
+
+    return q;
+}
+
+
+osStatus_t osMessageQueuePut(osMessageQueueId_t mq_id, const void* msg_ptr, uint8_t msg_prio, uint32_t timeout)
+{
+    Queue_t* q = (Queue_t*)mq_id;
+
+    if(q->count >= q->msg_count)
+        return osErrorResource;
+
+    memcpy(&q->data[((q->head + q->count) % q->msg_count) * q->msg_size], msg_ptr, q->msg_size);
+    q->count++;
+
+    return osOK;
+}
+
+
+osStatus_t osMessageQueueGet(osMessageQueueId_t mq_id, void* msg_ptr, uint8_t* msg_prio, uint32_t timeout)
+{
+    Queue_t* q = (Queue_t*)mq_id;
+
+    if(q->count == 0)
+        return osErrorResource;
+
+    memcpy(msg_ptr, &q->data[q->head * q->msg_size], q->msg_size);
+    q->head = (q->head + 1) % q->msg_count;
+    q->count--;
+
+    return osOK;
+}
+
+
+/*
+    There is no other thread to wait for, only the flags already set are returned
+*/
+osEventFlagsId_t osEventFlagsNew(const osEventFlagsAttr_t* attr)
+{
+    return calloc(1, sizeof(uint32_t));
+}
+
+
+uint32_t osEventFlagsSet(osEventFlagsId_t ef_id, uint32_t flags)
+{
+    *(uint32_t*)ef_id |= flags;
+
+    return *(uint32_t*)ef_id;
+}
+
+
+uint32_t osEventFlagsClear(osEventFlagsId_t ef_id, uint32_t flags)
+{
+    uint32_t res = *(uint32_t*)ef_id;
+
+    *(uint32_t*)ef_id &= ~flags;
+
+    return res;
+}
+
+
+uint32_t osEventFlagsWait(osEventFlagsId_t ef_id, uint32_t flags, uint32_t options, uint32_t timeout)
+{
+    uint32_t res = *(uint32_t*)ef_id & flags;
+
+    if(res == 0)
+        return osFlagsErrorTimeout;
+
+    if(!(options & osFlagsNoClear))
+        *(uint32_t*)ef_id &= ~res;
+
+    return res;
+}
+
+
+/*
+    There is no other thread, the mutex is always free
+*/
+osMutexId_t osMutexNew(const osMutexAttr_t* attr)
+{
+    return calloc(1, sizeof(uint32_t));
+}
+
+
+osStatus_t osMutexAcquire(osMutexId_t mutex_id, uint32_t timeout)
+{
+    return osOK;
+}
+
+
+osStatus_t osMutexRelease(osMutexId_t mutex_id)
+{
+    return osOK;
+}
+
+
+/*
+    There is no other thread to release the semaphore, only the tokens available are taken
+*/
+osSemaphoreId_t osSemaphoreNew(uint32_t max_count, uint32_t initial_count, const osSemaphoreAttr_t* attr)
+{
+    uint32_t* sem = calloc(2, sizeof(uint32_t));
+
+    if(sem != NULL)
+    {
+        sem[0] = initial_count;
+        sem[1] = max_count;
+    }
+
+    return sem;
+}
+
+
+osStatus_t osSemaphoreAcquire(osSemaphoreId_t semaphore_id, uint32_t timeout)
+{
+    uint32_t* sem = (uint32_t*)semaphore_id;
+
+    if(sem[0] == 0)
+        return timeout == 0 ? osErrorResource : osErrorTimeout;
+
+    sem[0]--;
+
+    return osOK;
+}
+
+
+osStatus_t osSemaphoreRelease(osSemaphoreId_t semaphore_id)
+{
+    uint32_t* sem = (uint32_t*)semaphore_id;
+
+    if(sem[0] >= sem[1])
+        return osErrorResource;
+
+    sem[0]++;
+
+    return osOK;
+}
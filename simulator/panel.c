@@ -0,0 +1,357 @@
+/**
+ * File: panel.c
+ * Author: ts-manuel
+ * 
+ * Model of the 5.65" 7 color e-Paper panel (UC8159 controller).
+ * Rebuilds the panel RAM from the command stream, writes the
+ * refreshed image to a .ppm file and counts what the firmware sends
+*/
+
+#include "panel.h"
+#include "main.h"
+
+//Color of the 4 bit pixel codes, must match display_colors in stm32/Core/Src/hardware/display.c
+static const uint8_t palette[8][3] =
+{
+    {0x00, 0x00, 0x00},     //Black
+    {0xff, 0xff, 0xff},     //White
+    {0x00, 0xff, 0x00},     //Green
+    {0x00, 0x00, 0xff},     //Blue
+    {0xff, 0x00, 0x00},     //Red
+    {0xff, 0xff, 0x00},     //Yellow
+    {0xff, 0x80, 0x00},     //Orange
+    {0xaa, 0x6e, 0x96}      //Clean
+};
+
+static const char* stage_names[e_NumStages] =
+{
+    "idle", "init", "data", "power-on", "refresh", "power-off", "sleep"
+};
+
+static uint8_t ram[PANEL_RAM_SIZE];
+static uint32_t ram_ptr;
+static uint16_t width = PANEL_WIDTH;
+static uint16_t height = PANEL_HEIGHT;
+static uint8_t command;
+static int param;
+static bool pin_dc;
+static bool pin_cs = true;
+static bool pin_rst = true;
+static bool pin_busy = true;    //BUSY_N, low while the panel is busy
+static bool event_pending;
+static uint64_t event_time;
+static bool event_level;
+static uint64_t busy_start;
+static const char* output_path;
+
+static uint64_t sim_time;
+static PanelStage_e stage = e_StageIdle;
+static uint64_t stage_sim_start;
+static uint64_t stage_host_start;
+static PanelStats_t stats;
+
+static void receive_command(uint8_t cmd);
+static void receive_data(uint8_t data);
+static void schedule_busy(uint32_t ms, bool level_after);
+static void set_stage(PanelStage_e new_stage);
+static void write_image(void);
+static uint64_t host_time(void);
+
+
+/*
+    Set the name of the image written on refresh,
+    following refreshes are written to name_1, name_2, ...
+*/
+void panel_init(const char* path)
+{
+    output_path = path;
+    stage_host_start = host_time();
+}
+
+
+/*
+    Called when the firmware writes one of the panel control pins
+*/
+void panel_write_pin(uint16_t pin, bool level)
+{
+    if(pin == EP_DC_Pin)
+    {
+        pin_dc = level;
+    }
+    else if(pin == EP_CS_Pin)
+    {
+        if(pin_cs && !level)
+            stats.transactions++;
+        pin_cs = level;
+    }
+    else if(pin == EP_RST_Pin)
+    {
+        //Reset on the rising edge, the panel stays busy until it is ready
+        if(!pin_rst && level)
+        {
+            stats.resets++;
+            command = 0;
+            param = 0;
+            pin_busy = false;
+            set_stage(e_StageInit);
+            schedule_busy(PANEL_RESET_BUSY_MS, true);
+        }
+        pin_rst = level;
+    }
+}
+
+
+/*
+    Returns the level of the BUSY pin
+*/
+bool panel_read_busy(void)
+{
+    stats.busy_reads++;
+
+    return pin_busy;
+}
+
+
+/*
+    Called for every byte clocked out by the SPI,
+    bytes are ignored while CS is high
+*/
+void panel_write_byte(uint8_t data)
+{
+    //8 bits on the SPI
+    sim_advance_time(8ULL * 1000000000ULL / PANEL_SPI_CLOCK);
+
+    if(pin_cs)
+        return;
+
+    stats.stage[stage].bytes++;
+
+    if(pin_dc)
+        receive_data(data);
+    else
+        receive_command(data);
+}
+
+
+/*
+    Returns the time of the next change of the BUSY pin
+*/
+bool panel_next_event(uint64_t* time_ns)
+{
+    if(event_pending)
+        *time_ns = event_time;
+
+    return event_pending;
+}
+
+
+/*
+    Close the current stage at the end of the simulation
+*/
+void panel_finish(void)
+{
+    set_stage(stage);
+}
+
+
+const PanelStats_t* panel_get_stats(void)
+{
+    return &stats;
+}
+
+
+/*
+    Print counters and time per stage
+*/
+void panel_print_stats(FILE* fp)
+{
+    fprintf(fp, "Commands:          %u\n", stats.commands);
+    fprintf(fp, "Data bytes:        %u (%u pixel bytes, %u overflow)\n", stats.data_bytes, stats.pixel_bytes, stats.ram_overflow);
+    fprintf(fp, "SPI transactions:  %u\n", stats.transactions);
+    fprintf(fp, "Resets:            %u\n", stats.resets);
+    fprintf(fp, "Refreshes:         %u\n", stats.refreshes);
+    fprintf(fp, "Busy periods:      %u (%.1f ms)\n", stats.busy_periods, stats.busy_ns / 1e6);
+    fprintf(fp, "BUSY pin reads:    %u\n", stats.busy_reads);
+    fprintf(fp, "BUSY interrupts:   %u\n", stats.busy_interrupts);
+    fprintf(fp, "\n");
+    fprintf(fp, "Stage       simulated ms   host ms    bytes\n");
+    for(int i = 0; i < e_NumStages; i++)
+    {
+        fprintf(fp, "%-10s  %12.1f  %8.1f  %7u\n", stage_names[i],
+            stats.stage[i].sim_ns / 1e6, stats.stage[i].host_ns / 1e6, stats.stage[i].bytes);
+    }
+}
+
+
+/*
+    Simulated time in ns
+*/
+uint64_t sim_get_time(void)
+{
+    return sim_time;
+}
+
+
+/*
+    Advance the simulated time, changes of the BUSY pin
+    trigger the EXTI callback like on the hardware
+*/
+void sim_advance_time(uint64_t ns)
+{
+    sim_time += ns;
+
+    if(event_pending && sim_time >= event_time)
+    {
+        event_pending = false;
+        stats.busy_ns += event_time - busy_start;
+
+        if(pin_busy != event_level)
+        {
+            pin_busy = event_level;
+            stats.busy_interrupts++;
+            HAL_GPIO_EXTI_Callback(EP_BUSY_Pin);
+        }
+    }
+}
+
+
+static void receive_command(uint8_t cmd)
+{
+    stats.commands++;
+    command = cmd;
+    param = 0;
+
+    switch(cmd)
+    {
+        case 0x10:  //Data start transmission
+            ram_ptr = 0;
+            set_stage(e_StageData);
+            break;
+        case 0x04:  //Power on
+            set_stage(e_StagePowerOn);
+            pin_busy = false;
+            schedule_busy(PANEL_POWER_ON_BUSY_MS, true);
+            break;
+        case 0x12:  //Display refresh
+            set_stage(e_StageRefresh);
+            stats.refreshes++;
+            if(ram_ptr != (uint32_t)width / 2 * height)
+                printf("WARNING: Refresh after %u pixel bytes, expected %u\n", ram_ptr, width / 2 * height);
+            write_image();
+            pin_busy = false;
+            schedule_busy(PANEL_REFRESH_BUSY_MS, true);
+            break;
+        case 0x02:  //Power off, BUSY goes low when the panel is off
+            set_stage(e_StagePowerOff);
+            schedule_busy(PANEL_POWER_OFF_BUSY_MS, false);
+            break;
+        case 0x07:  //Deep sleep
+            set_stage(e_StageSleep);
+            break;
+    }
+}
+
+
+static void receive_data(uint8_t data)
+{
+    stats.data_bytes++;
+
+    switch(command)
+    {
+        case 0x61:  //Resolution setting
+            if(param == 0) width = (width & 0x00ff) | (data << 8);
+            if(param == 1) width = (width & 0xff00) | data;
+            if(param == 2) height = (height & 0x00ff) | (data << 8);
+            if(param == 3) height = (height & 0xff00) | data;
+            if(width > PANEL_WIDTH || height > PANEL_HEIGHT)
+                printf("WARNING: Resolution %ux%u larger than the panel\n", width, height);
+            break;
+        case 0x10:  //Pixel data
+            stats.pixel_bytes++;
+            if(ram_ptr < PANEL_RAM_SIZE)
+                ram[ram_ptr++] = data;
+            else
+                stats.ram_overflow++;
+            break;
+    }
+
+    param++;
+}
+
+
+/*
+    The BUSY pin changes to level_after in ms milliseconds
+*/
+static void schedule_busy(uint32_t ms, bool level_after)
+{
+    stats.busy_periods++;
+    busy_start = sim_time;
+    event_time = sim_time + (uint64_t)ms * 1000000ULL;
+    event_level = level_after;
+    event_pending = true;
+}
+
+
+/*
+    Add the time spent in the current stage to its counters
+*/
+static void set_stage(PanelStage_e new_stage)
+{
+    uint64_t now = host_time();
+
+    stats.stage[stage].sim_ns += sim_time - stage_sim_start;
+    stats.stage[stage].host_ns += now - stage_host_start;
+    stage = new_stage;
+    stage_sim_start = sim_time;
+    stage_host_start = now;
+}
+
+
+/*
+    Write the content of the panel RAM as a binary .ppm image
+*/
+static void write_image(void)
+{
+    char path[1024];
+    FILE* fp;
+    int w = width < PANEL_WIDTH ? width : PANEL_WIDTH;
+    int h = height < PANEL_HEIGHT ? height : PANEL_HEIGHT;
+
+    if(output_path == NULL)
+        return;
+
+    if(stats.refreshes > 1)
+        snprintf(path, sizeof(path), "%s_%u", output_path, stats.refreshes - 1);
+    else
+        snprintf(path, sizeof(path), "%s", output_path);
+
+    fp = fopen(path, "wb");
+    if(fp == NULL)
+    {
+        printf("ERROR: Unable to open output file: %s\n", path);
+        return;
+    }
+
+    fprintf(fp, "P6\n%d %d\n255\n", w, h);
+    for(int y = 0; y < h; y++)
+    {
+        for(int x = 0; x < w; x++)
+        {
+            uint8_t code = ram[(y * w + x) / 2];
+            code = (x % 2 == 0) ? code >> 4 : code & 0x0f;
+            fwrite(palette[code & 0x07], 3, 1, fp);
+        }
+    }
+
+    fclose(fp);
+}
+
+
+static uint64_t host_time(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
@@ -0,0 +1,72 @@
+#ifndef _PANEL_H_
+#define _PANEL_H_
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+
+#define PANEL_WIDTH     600
+#define PANEL_HEIGHT    448
+#define PANEL_RAM_SIZE  (PANEL_WIDTH / 2 * PANEL_HEIGHT)   //Two pixels per byte
+
+/*
+    Simulated timing, the BUSY times are estimates of the real panel
+    and the SPI clock is SYSCLK 72 MHz / APB2 8 / SPI prescaler 2
+*/
+#define PANEL_SPI_CLOCK         4500000 //SPI clock in Hz
+#define PANEL_RESET_BUSY_MS     20      //Hardware reset to ready
+#define PANEL_POWER_ON_BUSY_MS  200     //Command 0x04
+#define PANEL_REFRESH_BUSY_MS   15000   //Command 0x12
+#define PANEL_POWER_OFF_BUSY_MS 200     //Command 0x02
+
+typedef enum
+{
+    e_StageIdle,        //Before the first reset
+    e_StageInit,        //Reset and register setup
+    e_StageData,        //Command 0x10, pixel data
+    e_StagePowerOn,     //Command 0x04
+    e_StageRefresh,     //Command 0x12
+    e_StagePowerOff,    //Command 0x02
+    e_StageSleep,       //Command 0x07
+    e_NumStages
+} PanelStage_e;
+
+typedef struct
+{
+    uint64_t sim_ns;    //Simulated time
+    uint64_t host_ns;   //Time spent running the firmware code on the host
+    uint32_t bytes;     //Bytes received (commands and data)
+} PanelStageStats_t;
+
+typedef struct
+{
+    uint32_t commands;          //Command bytes
+    uint32_t data_bytes;        //Data bytes (all commands)
+    uint32_t pixel_bytes;       //Data bytes after command 0x10
+    uint32_t ram_overflow;      //Pixel bytes that didn't fit in the panel RAM
+    uint32_t transactions;      //Number of times CS went low
+    uint32_t resets;            //Hardware resets
+    uint32_t refreshes;         //Command 0x12
+    uint32_t busy_periods;      //Number of times the panel was busy
+    uint32_t busy_reads;        //Reads of the BUSY pin
+    uint32_t busy_interrupts;   //Edges of the BUSY pin
+    uint64_t busy_ns;           //Total time the panel was busy
+    PanelStageStats_t stage[e_NumStages];
+} PanelStats_t;
+
+void panel_init(const char* path);
+void panel_write_pin(uint16_t pin, bool level);
+bool panel_read_busy(void);
+void panel_write_byte(uint8_t data);
+bool panel_next_event(uint64_t* time_ns);
+void panel_finish(void);
+const PanelStats_t* panel_get_stats(void);
+void panel_print_stats(FILE* fp);
+
+uint64_t sim_get_time(void);
+void sim_advance_time(uint64_t ns);
+
+#endif
@@ -0,0 +1,13 @@
+#ifndef _SIMULATOR_H_
+#define _SIMULATOR_H_
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+void sim_finish(void);
+void sim_backup_load(const char* path);
+void sim_backup_save(const char* path);
+
+#endif
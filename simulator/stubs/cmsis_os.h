@@ -0,0 +1,76 @@
+/**
+ * File: cmsis_os.h
+ * Author: ts-manuel
+ * 
+ * Host replacement for CMSIS-RTOS v2, there is a single thread.
+ * Waiting on a thread flag advances the simulated time to the next
+ * panel event, waiting forever with nothing left to happen ends the simulation
+*/
+
+#ifndef _CMSIS_OS_H_
+#define _CMSIS_OS_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define osCMSIS             0x20001U
+#define osWaitForever       0xFFFFFFFFU
+#define osFlagsWaitAny      0x00000000U
+#define osFlagsWaitAll      0x00000001U
+#define osFlagsNoClear      0x00000002U
+#define osFlagsError        0x80000000U
+#define osFlagsErrorTimeout 0xFFFFFFFEU
+
+typedef void* osThreadId_t;
+typedef void* osMessageQueueId_t;
+typedef void* osEventFlagsId_t;
+typedef void* osMutexId_t;
+typedef void* osSemaphoreId_t;
+typedef struct osMessageQueueAttr_t osMessageQueueAttr_t;
+typedef struct osEventFlagsAttr_t osEventFlagsAttr_t;
+typedef struct osMutexAttr_t osMutexAttr_t;
+typedef struct osSemaphoreAttr_t osSemaphoreAttr_t;
+
+typedef enum
+{
+    osOK = 0,
+    osError = -1,
+    osErrorTimeout = -2,
+    osErrorResource = -3,
+    osErrorParameter = -4
+} osStatus_t;
+
+typedef enum
+{
+    osKernelInactive = 0,
+    osKernelReady = 1,
+    osKernelRunning = 2
+} osKernelState_t;
+
+osKernelState_t osKernelGetState(void);
+uint32_t osKernelGetTickCount(void);
+osThreadId_t osThreadGetId(void);
+uint32_t osThreadFlagsSet(osThreadId_t thread_id, uint32_t flags);
+uint32_t osThreadFlagsClear(uint32_t flags);
+uint32_t osThreadFlagsWait(uint32_t flags, uint32_t options, uint32_t timeout);
+osStatus_t osDelay(uint32_t ticks);
+osMessageQueueId_t osMessageQueueNew(uint32_t msg_count, uint32_t msg_size, const osMessageQueueAttr_t* attr);
+osStatus_t osMessageQueuePut(osMessageQueueId_t mq_id, const void* msg_ptr, uint8_t msg_prio, uint32_t timeout);
+osStatus_t osMessageQueueGet(osMessageQueueId_t mq_id, void* msg_ptr, uint8_t* msg_prio, uint32_t timeout);
+osEventFlagsId_t osEventFlagsNew(const osEventFlagsAttr_t* attr);
+uint32_t osEventFlagsSet(osEventFlagsId_t ef_id, uint32_t flags);
+uint32_t osEventFlagsClear(osEventFlagsId_t ef_id, uint32_t flags);
+uint32_t osEventFlagsWait(osEventFlagsId_t ef_id, uint32_t flags, uint32_t options, uint32_t timeout);
+osMutexId_t osMutexNew(const osMutexAttr_t* attr);
+osStatus_t osMutexAcquire(osMutexId_t mutex_id, uint32_t timeout);
+osStatus_t osMutexRelease(osMutexId_t mutex_id);
+osSemaphoreId_t osSemaphoreNew(uint32_t max_count, uint32_t initial_count, const osSemaphoreAttr_t* attr);
+osStatus_t osSemaphoreAcquire(osSemaphoreId_t semaphore_id, uint32_t timeout);
+osStatus_t osSemaphoreRelease(osSemaphoreId_t semaphore_id);
+osStatus_t osSemaphoreDelete(osSemaphoreId_t semaphore_id);
+
+//FreeRTOS heap, used by FatFs for the LFN working buffer (ff_malloc)
+void* pvPortMalloc(size_t size);
+void vPortFree(void* ptr);
+
+#endif
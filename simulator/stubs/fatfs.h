@@ -0,0 +1,57 @@
+/**
+ * File: fatfs.h
+ * Author: ts-manuel
+ * 
+ * Host replacement for FatFs, files are opened from the host file system
+*/
+
+#ifndef _FATFS_H_
+#define _FATFS_H_
+
+#include <stdio.h>
+#include <stdint.h>
+
+typedef unsigned int UINT;
+typedef uint8_t BYTE;
+typedef uint16_t WORD;
+typedef uint32_t DWORD;
+typedef uint32_t FSIZE_t;
+
+typedef enum
+{
+    FR_OK = 0,
+    FR_DISK_ERR,
+    FR_INT_ERR,
+    FR_NOT_READY,
+    FR_NO_FILE,
+    FR_NO_PATH,
+    FR_INVALID_NAME,
+    FR_DENIED,
+    FR_EXIST,
+    FR_INVALID_OBJECT
+} FRESULT;
+
+typedef struct
+{
+    FILE* fp;
+    FSIZE_t fptr;   //File read/write pointer
+    FSIZE_t size;   //File size
+} FIL;
+
+#define _MAX_SS             512     //Sector size
+
+#define FA_READ             0x01
+#define FA_WRITE            0x02
+#define FA_OPEN_EXISTING    0x00
+
+#define f_eof(fp) ((int)((fp)->fptr == (fp)->size))
+#define f_tell(fp) ((fp)->fptr)
+#define f_size(fp) ((fp)->size)
+
+FRESULT f_open(FIL* fp, const char* path, BYTE mode);
+FRESULT f_close(FIL* fp);
+FRESULT f_read(FIL* fp, void* buff, UINT btr, UINT* br);
+FRESULT f_write(FIL* fp, const void* buff, UINT btw, UINT* bw);
+FRESULT f_lseek(FIL* fp, FSIZE_t ofs);
+
+#endif
@@ -0,0 +1,99 @@
+/**
+ * File: main.h
+ * Author: ts-manuel
+ * 
+ * Host replacement for stm32/Core/Inc/main.h,
+ * declares the subset of the HAL used by the display and flash code
+*/
+
+#ifndef _MAIN_H_
+#define _MAIN_H_
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#define __weak __attribute__((weak))
+
+typedef enum
+{
+    HAL_OK,
+    HAL_ERROR,
+    HAL_BUSY,
+    HAL_TIMEOUT
+} HAL_StatusTypeDef;
+
+typedef enum
+{
+    GPIO_PIN_RESET,
+    GPIO_PIN_SET
+} GPIO_PinState;
+
+typedef struct
+{
+    int id;
+} GPIO_TypeDef;
+
+typedef struct
+{
+    int id;
+} SPI_TypeDef;
+
+typedef struct
+{
+    SPI_TypeDef* Instance;
+} SPI_HandleTypeDef;
+
+extern GPIO_TypeDef sim_gpiob;
+extern GPIO_TypeDef sim_gpioc;
+#define GPIOB (&sim_gpiob)
+#define GPIOC (&sim_gpioc)
+
+#define GPIO_PIN_0 ((uint16_t)0x0001)
+#define GPIO_PIN_1 ((uint16_t)0x0002)
+#define GPIO_PIN_4 ((uint16_t)0x0010)
+#define GPIO_PIN_5 ((uint16_t)0x0020)
+
+#define EP_DC_Pin GPIO_PIN_4
+#define EP_DC_GPIO_Port GPIOC
+#define EP_CS_Pin GPIO_PIN_5
+#define EP_CS_GPIO_Port GPIOC
+#define EP_RST_Pin GPIO_PIN_0
+#define EP_RST_GPIO_Port GPIOB
+#define EP_BUSY_Pin GPIO_PIN_1
+#define EP_BUSY_GPIO_Port GPIOB
+
+#define FLASH_TYPEPROGRAM_WORD 0x02U
+#define FLASH_TYPEERASE_SECTORS 0x00U
+#define FLASH_VOLTAGE_RANGE_3 0x02U
+#define FLASH_SECTOR_10 10U
+#define FLASH_SECTOR_11 11U
+
+typedef struct
+{
+    uint32_t TypeErase;
+    uint32_t Banks;
+    uint32_t Sector;
+    uint32_t NbSectors;
+    uint32_t VoltageRange;
+} FLASH_EraseInitTypeDef;
+
+//The flash sectors used by stm32/Core/Src/hardware/flash.c are an array
+extern uint32_t sim_flash[];
+#define _FLASH_STORE_ADDR ((uintptr_t)sim_flash)
+
+void HAL_GPIO_WritePin(GPIO_TypeDef* port, uint16_t pin, GPIO_PinState state);
+GPIO_PinState HAL_GPIO_ReadPin(GPIO_TypeDef* port, uint16_t pin);
+void HAL_Delay(uint32_t delay);
+uint32_t HAL_GetTick(void);
+HAL_StatusTypeDef HAL_SPI_Transmit(SPI_HandleTypeDef* hspi, uint8_t* data, uint16_t size, uint32_t timeout);
+HAL_StatusTypeDef HAL_SPI_Transmit_DMA(SPI_HandleTypeDef* hspi, uint8_t* data, uint16_t size);
+void HAL_SPI_TxCpltCallback(SPI_HandleTypeDef* hspi);
+void HAL_GPIO_EXTI_Callback(uint16_t pin);
+HAL_StatusTypeDef HAL_FLASH_Unlock(void);
+HAL_StatusTypeDef HAL_FLASH_Lock(void);
+HAL_StatusTypeDef HAL_FLASH_Program(uint32_t type, uintptr_t address, uint64_t data);
+HAL_StatusTypeDef HAL_FLASHEx_Erase(FLASH_EraseInitTypeDef* init, uint32_t* error);
+
+#endif
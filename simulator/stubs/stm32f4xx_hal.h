@@ -0,0 +1,13 @@
+/**
+ * File: stm32f4xx_hal.h
+ * Author: ts-manuel
+ * 
+ * Host replacement for the STM32 HAL header
+*/
+
+#ifndef _STM32F4XX_HAL_H_
+#define _STM32F4XX_HAL_H_
+
+#include "main.h"
+
+#endif
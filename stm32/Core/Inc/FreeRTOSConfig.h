@@ -59,12 +59,13 @@
 #define configSUPPORT_STATIC_ALLOCATION          1
 #define configSUPPORT_DYNAMIC_ALLOCATION         1
 #define configUSE_IDLE_HOOK                      0
+#define configUSE_TICKLESS_IDLE                  2
 #define configUSE_TICK_HOOK                      0
 #define configCPU_CLOCK_HZ                       ( SystemCoreClock )
 #define configTICK_RATE_HZ                       ((TickType_t)1000)
 #define configMAX_PRIORITIES                     ( 56 )
 #define configMINIMAL_STACK_SIZE                 ((uint16_t)128)
-#define configTOTAL_HEAP_SIZE                    ((size_t)52000)
+#define configTOTAL_HEAP_SIZE                    ((size_t)24000)
 #define configMAX_TASK_NAME_LEN                  ( 16 )
 #define configUSE_TRACE_FACILITY                 1
 #define configUSE_16_BIT_TICKS                   0
@@ -155,6 +156,9 @@ standard names. */
 
 /* USER CODE BEGIN Defines */
 /* Section where parameter definitions can be added (for instance, to override default ones in FreeRTOS.h) */
+/* Tickless idle, the RTC wakeup timer replaces SysTick while the scheduler is idle (see power.c) */
+extern void PWR_SuppressTicksAndSleep(uint32_t expected_idle_time);
+#define portSUPPRESS_TICKS_AND_SLEEP( xExpectedIdleTime ) PWR_SuppressTicksAndSleep( xExpectedIdleTime )
 /* USER CODE END Defines */
 
 #endif /* FREERTOS_CONFIG_H */
@@ -0,0 +1,60 @@
+/**
+ ******************************************************************************
+ * @file      arena.h
+ * @author    ts-manuel
+ * @brief     Statically allocated memory arenas
+ *
+ *            The large working sets are carved out of two arenas with a
+ *            size computed at compile time from the panel, decoder and
+ *            frame configuration, instead of living on the task stacks or
+ *            on the RTOS heap:
+ *
+ *            ccm  Core coupled RAM, only the CPU can access it (not the DMA):
+ *                 jpeg decoder state, dither error rows, LZ window, link
+ *                 map tables of the large files
+ *            sram Main SRAM: stripe slots (too large for the CCM together
+ *                 with the rest), row and plane buffers sent by SPI DMA,
+ *                 SD chunk buffers (jpeg read-ahead ring) and the file object of the display task
+ *                 filled by SDIO DMA
+ *
+ *            Buffers used for the whole run are allocated before the
+ *            scheduler is started. The buffers of a single update are
+ *            allocated by the display task between ARENA_Mark() and
+ *            ARENA_Release(), a file is either a jpeg or a frame so those
+ *            buffers share the same space.
+ *
+ ******************************************************************************
+ */
+
+#ifndef INC_ARENA_H_
+#define INC_ARENA_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define _ARENA_ALIGN	8	//Alignment of every allocation (SDIO DMA needs 4)
+
+#define _ARENA_SIZE(x)		(((x) + _ARENA_ALIGN - 1) & ~(_ARENA_ALIGN - 1))
+#define _ARENA_MAX(a, b)	((a) > (b) ? (a) : (b))
+
+//Variables placed in the CCM RAM, they are not initialized at startup
+#define _CCM_RAM __attribute__((section(".ccmram")))
+
+typedef struct
+{
+	const char* name;
+	uint8_t* base;
+	uint32_t size;		//Bytes
+	uint32_t used;		//Bytes allocated now
+	uint32_t peak;		//Maximum bytes allocated since boot
+} Arena_t;
+
+extern Arena_t arena_ccm;
+extern Arena_t arena_sram;
+
+
+void* ARENA_Alloc(Arena_t* arena, uint32_t size);
+uint32_t ARENA_Mark(const Arena_t* arena);
+void ARENA_Release(Arena_t* arena, uint32_t mark);
+
+#endif /* INC_ARENA_H_ */
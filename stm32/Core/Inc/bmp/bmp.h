@@ -11,7 +11,10 @@
 #define INC_BMP_BMP_H_
 
 #include <stdint.h>
+#include "hardware/panel.h"
 
+#if _PANEL_SPLASH
 extern const uint8_t splash_screen[];
+#endif
 
 #endif /* INC_BMP_BMP_H_ */
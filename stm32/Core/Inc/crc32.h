@@ -0,0 +1,17 @@
+/**
+ ******************************************************************************
+ * @file      crc32.h
+ * @author    ts-manuel
+ * @brief     CRC-32 (IEEE 802.3, same as zlib)
+ *
+ ******************************************************************************
+ */
+
+#ifndef INC_CRC32_H_
+#define INC_CRC32_H_
+
+#include <stdint.h>
+
+uint32_t CRC32_Update(uint32_t crc, const void* data, uint32_t len);
+
+#endif /* INC_CRC32_H_ */
@@ -0,0 +1,66 @@
+/**
+ ******************************************************************************
+ * @file      fast_seek.h
+ * @author    ts-manuel
+ * @brief     Cluster link map tables for the large files
+ *
+ *            Without a link map f_lseek() follows the FAT chain from the
+ *            first cluster (or from the current one when seeking forward),
+ *            one FAT read per cluster, and f_read() reads the FAT at every
+ *            cluster boundary. FSEEK_Open() opens a file for reading and,
+ *            if it spans more than _FSEEK_MIN_CLUSTERS, attaches a cluster
+ *            link map table (FatFs fast seek): the chain is walked once,
+ *            every following seek and cluster change is a lookup in RAM.
+ *
+ *            The tables live in _FSEEK_SLOTS slots allocated from the ccm
+ *            arena and are kept after FSEEK_Close() so a file opened again
+ *            during the wake (movie frames shown and rendered ahead, the
+ *            playlist index) doesn't walk the chain again. A slot is
+ *            identified by the mount ID, the first cluster and the size of
+ *            the file, FSEEK_Flush() must be called after deleting a file
+ *            since its clusters can be reused by a file of the same size.
+ *
+ *            A file with more than _FSEEK_CLMT_ENTRIES / 2 - 1 fragments
+ *            doesn't fit a table and is read following the FAT chain.
+ *
+ ******************************************************************************
+ */
+
+#ifndef INC_FAST_SEEK_H_
+#define INC_FAST_SEEK_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "fatfs.h"
+
+#define _FSEEK_SLOTS			4	//Tables cached: display file, render source, playlist index and one more
+#define _FSEEK_CLMT_ENTRIES		128	//DWORDs per table, up to 63 fragments
+#define _FSEEK_MIN_CLUSTERS		8	//Smaller files walk the chain in a few FAT reads
+
+typedef struct
+{
+	DWORD table[_FSEEK_CLMT_ENTRIES];	//Link map table, table[0] is its size
+	WORD fs_id;							//Mount ID of the volume
+	DWORD sclust;						//First cluster of the file
+	FSIZE_t size;						//Size of the file
+	uint32_t used;						//Use sequence, the least recently used slot is replaced
+	uint8_t users;						//Open files using the table
+	bool valid;
+} FastSeekSlot_t;
+
+typedef struct
+{
+	uint32_t built;			//Tables created, the chain was walked
+	uint32_t reused;		//Files opened with a table already in the cache
+	uint32_t fragmented;	//Files with too many fragments for a table
+	uint32_t full;			//Files opened while every slot was in use
+} FastSeekStats_t;
+
+
+void FSEEK_Init(void);
+FRESULT FSEEK_Open(FIL* fp, const char* path);
+FRESULT FSEEK_Close(FIL* fp);
+void FSEEK_Flush(void);
+const FastSeekStats_t* FSEEK_GetStats(void);
+
+#endif /* INC_FAST_SEEK_H_ */
@@ -4,6 +4,42 @@
  * @author    ts-manuel
  * @brief     File Manager
  *
+ *            The files are played folder by folder, both in alphabetical
+ *            order. Instead of searching the directories on every wake the
+ *            play order is kept in an index file in the root directory,
+ *            hidden so that it isn't played:
+ *
+ *            +--------------------+ 0
+ *            | FmanIndexHeader_t  |
+ *            +--------------------+ _FMAN_INDEX_OFFSET
+ *            | FmanRecord_t 0     |
+ *            | FmanRecord_t 1     |
+ *            | ...                |
+ *            +--------------------+ _FMAN_INDEX_OFFSET + count * sizeof(FmanRecord_t)
+ *
+ *            A movie (frame/movie.h) has one record per frame, the records
+ *            are sorted by path and frame. The position of the file on the
+ *            display is stored in flash as a record number together with
+ *            the generation of the index and the frame, the next file is
+ *            the following record. Without a valid position the record is
+ *            found by a binary search on the path and the frame.
+ *
+ *            The index is checked once per mount against a signature of the
+ *            root directory (folder names, dates and sizes) and every record
+ *            returned is checked against the file (size, date and time), on
+ *            a mismatch it is built again, with a new generation. If the
+ *            index can't be written the directories are searched.
+ *
+ *            The paths are long file names (_MAX_LFN). The files of a folder
+ *            are usually written in order and are appended as they are read
+ *            from the directory, otherwise the folder is sorted on the card:
+ *            one pass over the directory writes runs of _FMAN_SORT_RUN sorted
+ *            records to a temporary file, the runs are then merged two by two
+ *            between two temporary files, the last merge writes the index.
+ *            A folder of n files takes one directory pass and log2(n / 16)
+ *            sequential passes over the records, instead of n / 16 passes
+ *            over the directory.
+ *
  ******************************************************************************
  */
 
@@ -15,8 +51,51 @@
 #include <string.h>
 #include <ctype.h>
 #include "fatfs.h"
+#include "settings.h"
+#include "frame/movie.h"
+
+#define _FMAN_INDEX_PATH	"PLAYLIST.IDX"	//Hidden system file in the root directory
+#define _FMAN_INDEX_TEMP	"PLAYLIST.TMP"	//Index being built
+#define _FMAN_SORT_TEMP_A	"PLAYLIST.SR0"	//Runs of records of a folder being sorted
+#define _FMAN_SORT_TEMP_B	"PLAYLIST.SR1"
+#define _FMAN_INDEX_MAGIC	0x33494C50		//"PLI3"
+#define _FMAN_INDEX_OFFSET	512				//Records start in the second sector
+#define _FMAN_SORT_RUN		16				//Records sorted in RAM before the merge passes
+#define _FMAN_NO_POSITION	0xffff			//Generation of an invalid position
+
+typedef struct
+{
+	uint32_t record;		//Record number of the file in the index
+	uint16_t generation;	//Generation of the index the record number refers to
+	uint16_t frame;			//Frame of a movie, 0 for other files
+} FmanPosition_t;
+
+typedef struct __attribute__((packed))
+{
+	char path[_FILE_PATH_MAX_LEN];	//FOLDER/FILE
+	uint32_t size;					//Size of the file
+	uint16_t date;					//Modification date of the file (FatFs format)
+	uint16_t time;					//Modification time of the file (FatFs format)
+	uint16_t frame;					//Frame of a movie, 0 for other files
+	uint8_t reserved[4];
+} FmanRecord_t;
+
+typedef struct __attribute__((packed))
+{
+	uint32_t magic;			//_FMAN_INDEX_MAGIC
+	uint32_t count;			//Number of records
+	uint32_t generation;	//Changes at every build (16 bit)
+	uint32_t signature;		//CRC of the root directory when the index was built
+	uint32_t crc;			//CRC of the fields above
+} FmanIndexHeader_t;
+
+_Static_assert(sizeof(FmanRecord_t) == 144, "Playlist records must be 144 bytes");
 
 
-bool FMAN_FindNext(char* new_path, const char* old_path);
+void FMAN_Init(void);
+bool FMAN_FindNext(char* new_path, const char* old_path, FmanPosition_t* pos);
+bool FMAN_GetPosition(const char* path, uint16_t frame, FmanPosition_t* pos);
+bool FMAN_Rebuild(void);
+const FmanIndexHeader_t* FMAN_GetIndex(void);
 
 #endif /* INC_FILE_MANAGER_H_ */
@@ -0,0 +1,77 @@
+/**
+ ******************************************************************************
+ * @file      frame.h
+ * @author    ts-manuel
+ * @brief     Pre-rendered frames (.epd files)
+ *
+ *            A frame file contains the image already dithered and packed
+ *            in the display format (two pixels per byte), it is streamed
+ *            from the SD card to the display without decoding.
+ *
+ *            +--------------------+ 0
+ *            | FRM_Header_t       |
+ *            +--------------------+ data_offset (512, sector aligned)
+ *            | pixel data         |
+ *            +--------------------+ data_offset + data_size
+ *
+ *            The pixel data is either stored as is (_FRM_FORMAT_RAW) or
+ *            compressed (_FRM_FORMAT_LZ) with a byte oriented LZ77 code:
+ *
+ *            token     high nibble literal count, low nibble match length - 4
+ *                      (15 = the count continues in the next bytes, 255 = more)
+ *            literals  bytes copied to the output
+ *            offset    16 bit little endian distance of the match (1 to _FRM_LZ_WINDOW)
+ *            match     bytes copied from offset bytes back in the output
+ *
+ *            The offset and the match are omitted when the literals complete
+ *            the frame. Runs of the same color are matches at offset 1, repeated
+ *            dither patterns are matches at short offsets or one row back.
+ *            The crc field is computed on the pixel data as stored in the file.
+ *
+ *            The layout must match image-converter/epd.h
+ *
+ ******************************************************************************
+ */
+
+#ifndef INC_FRAME_FRAME_H_
+#define INC_FRAME_FRAME_H_
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include "fatfs.h"
+#include "hardware/display.h"
+
+#define _FRM_MAGIC			"EPDF"
+#define _FRM_VERSION		1
+#define _FRM_PALETTE_7COLOR	0		//Palette of the 5.65" 7 color display
+#define _FRM_PALETTE_BW		1		//Palette of the 4.2" black/white display
+#define _FRM_PALETTE_BWR	2		//Palette of the 4.2" black/white/red display
+#define _FRM_FORMAT_RAW		0		//Packed 4 bit per pixel
+#define _FRM_FORMAT_LZ		1		//Packed 4 bit per pixel, LZ77 compressed
+#define _FRM_CHUNK_SIZE		4096	//Bytes read from the SD card at once
+#define _FRM_LZ_WINDOW		1024	//Maximum match offset (power of 2)
+#define _FRM_LZ_MIN_MATCH	4		//Shortest match
+#define _FRM_SRAM_BYTES		(2 * _FRM_CHUNK_SIZE)	//Chunk buffers taken from the sram arena
+
+typedef struct __attribute__((packed))
+{
+	char magic[4];			//_FRM_MAGIC
+	uint8_t version;		//_FRM_VERSION
+	uint8_t palette;		//Palette ID
+	uint8_t format;			//Pixel data format
+	uint8_t reserved;
+	uint16_t width;			//Width in pixels
+	uint16_t height;		//Height in pixels
+	uint32_t data_offset;	//Offset of the pixel data from the beginning of the file
+	uint32_t data_size;		//Size of the pixel data in bytes
+	uint32_t crc;			//CRC-32 of the pixel data
+} FRM_Header_t;
+
+
+bool FRM_IsFrame(FIL* fp);
+bool FRM_Display(FIL* fp);
+bool FRM_DisplayAt(FIL* fp, FSIZE_t base);
+
+#endif /* INC_FRAME_FRAME_H_ */
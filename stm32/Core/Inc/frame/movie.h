@@ -0,0 +1,73 @@
+/**
+ ******************************************************************************
+ * @file      movie.h
+ * @author    ts-manuel
+ * @brief     Movie containers (.epm files)
+ *
+ *            A movie packs the frames of a sequence in a single file, the
+ *            playlist steps through them one per wake. Opening one file and
+ *            seeking is much cheaper than searching a folder of thousands of
+ *            small files, and the frames are stored contiguously so the
+ *            reads are sequential sectors:
+ *
+ *            +--------------------+ 0
+ *            | MOV_Header_t       |
+ *            +--------------------+ table_offset (512)
+ *            | MOV_Entry_t 0      |
+ *            | MOV_Entry_t 1      |
+ *            | ...                |
+ *            +--------------------+ sector aligned
+ *            | frame 0            | jpeg image or .epd frame
+ *            +--------------------+ sector aligned
+ *            | frame 1            |
+ *            | ...                |
+ *            +--------------------+
+ *
+ *            Opened with FSEEK_Open() the frame is located with a fast seek
+ *            (cluster link map table) instead of following the FAT chain.
+ *
+ *            The layout must match image-converter/movie.h
+ *
+ ******************************************************************************
+ */
+
+#ifndef INC_FRAME_MOVIE_H_
+#define INC_FRAME_MOVIE_H_
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include "fatfs.h"
+
+#define _MOV_MAGIC			"EPDM"
+#define _MOV_VERSION		1
+#define _MOV_EXTENSION		".EPM"	//Files indexed frame by frame by the playlist
+#define _MOV_MAX_FRAMES		65535	//Frame numbers are 16 bit in the playlist and in flash
+#define _MOV_TYPE_JPEG		0		//Baseline jpeg image
+#define _MOV_TYPE_FRAME		1		//Pre-rendered frame (frame/frame.h)
+
+typedef struct __attribute__((packed))
+{
+	char magic[4];			//_MOV_MAGIC
+	uint8_t version;		//_MOV_VERSION
+	uint8_t reserved[3];
+	uint32_t frame_count;	//Number of entries in the table
+	uint32_t table_offset;	//Offset of the frame table from the beginning of the file
+	uint32_t crc;			//CRC-32 of the fields above
+} MOV_Header_t;
+
+typedef struct __attribute__((packed))
+{
+	uint32_t offset;		//Offset of the frame from the beginning of the file (sector aligned)
+	uint32_t length;		//Size of the frame in bytes
+	uint8_t type;			//_MOV_TYPE_x
+	uint8_t reserved[3];
+} MOV_Entry_t;
+
+
+bool MOV_IsMovieName(const char* path);
+uint32_t MOV_GetFrameCount(FIL* fp);
+bool MOV_Seek(FIL* fp, uint32_t frame, MOV_Entry_t* entry);
+
+#endif /* INC_FRAME_MOVIE_H_ */
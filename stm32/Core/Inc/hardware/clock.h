@@ -0,0 +1,82 @@
+/**
+ ******************************************************************************
+ * @file      clock.h
+ * @author    ts-manuel
+ * @brief     Clock governor
+ *
+ *            The core runs at one of a few named performance levels. Tasks
+ *            request a level with CLK_Request() for the duration of a
+ *            compute bound phase (jpeg decode, dithering) and release it
+ *            with CLK_Release(), the governor runs at the highest level
+ *            requested. The I/O waits (SD card power up, display BUSY)
+ *            are enclosed in CLK_BeginWait() / CLK_EndWait(), while a task
+ *            waits its own requests are ignored but those of the other
+ *            tasks still count: the render task decodes the next image
+ *            during the panel refresh at the level it requested. The core
+ *            runs at _CLK_DEFAULT_LEVEL when no task that isn't waiting
+ *            holds a request.
+ *
+ *            Only the AHB prescaler changes between the levels, the PLL is
+ *            never touched so the 48MHz clock of USB and SDIO is stable.
+ *            The APB prescalers are chosen so that PCLK1 and PCLK2 are the
+ *            same at every level, after every change the SPI, SDIO and UART
+ *            dividers and the RTOS tick are derived again from the new
+ *            clocks anyway, so that a change of the level table can't
+ *            silently break a peripheral.
+ *
+ *            The SD card runs at the highest clock the SDIO accepts from
+ *            PCLK2, without hardware flow control a transfer fails if the
+ *            DMA can't keep up: after a CRC error or a FIFO overrun the
+ *            clock is lowered one divider step with CLK_LowerSDIOClock().
+ *
+ *            The time spent at each level is published as residency
+ *            counters (ms).
+ *
+ ******************************************************************************
+ */
+
+#ifndef INC_HARDWARE_CLOCK_H_
+#define INC_HARDWARE_CLOCK_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define _CLK_SYSCLK_HZ			72000000	//PLL output (HSE 8MHz / 4 * 72 / 2)
+#define _CLK_PLL48_HZ			48000000	//PLLQ output, clocks USB and SDIO
+#define _CLK_USB_MIN_HCLK_HZ	14200000	//Minimum AHB clock for the USB OTG FS core
+#define _CLK_SPI_MAX_HZ			4500000		//Maximum display SPI clock
+#define _CLK_SDIO_MAX_HZ		24000000	//Maximum SD card clock (CLKDIV 0, default speed cards accept 25MHz)
+#define _CLK_SDIO_MIN_HZ		4000000		//The clock is lowered after data errors down to this one
+#define _CLK_DEFAULT_LEVEL		e_ClockLow	//Level used when nothing is requested
+#define _CLK_MAX_HOLDERS		6			//Tasks with their own requests, the last entry is shared by the others
+
+typedef enum
+{
+	e_ClockLow,		//18MHz, I/O waits and console
+	e_ClockMedium,	//36MHz, directory scan and file system
+	e_ClockHigh,	//72MHz, decode and dither
+	e_ClockLevels
+} ClockLevel_e;
+
+typedef struct
+{
+	uint32_t ms[e_ClockLevels];	//Time spent at each level
+	uint32_t switches;			//Number of level changes
+} ClockResidency_t;
+
+
+void CLK_Init(void);
+void CLK_Request(ClockLevel_e level);
+void CLK_Release(ClockLevel_e level);
+void CLK_BeginWait(void);
+void CLK_EndWait(void);
+void CLK_ResumeFromStop(void);
+ClockLevel_e CLK_GetLevel(void);
+const ClockResidency_t* CLK_GetResidency(void);
+void CLK_ClearResidency(void);
+const char* CLK_GetLevelName(ClockLevel_e level);
+uint32_t CLK_GetLevelFrequency(ClockLevel_e level);
+bool CLK_LowerSDIOClock(void);
+uint32_t CLK_GetSDIOFrequency(void);
+
+#endif /* INC_HARDWARE_CLOCK_H_ */
@@ -12,28 +12,64 @@
 
 #include <stdint.h>
 #include <stdbool.h>
-#include "EPD_5in65f.h"
+#include "hardware/panel.h"
+#include "hardware/display_bus.h"
+#include "fatfs.h"
 
 #define _DITHER 1			//0 = no dither, 1 = Floyd–Steinberg
-#define _DISPLAY_WIDTH	EPD_5IN65F_WIDTH
-#define _DISPLAY_HEIGHT	EPD_5IN65F_HEIGHT
+#define _DISPLAY_WIDTH	_PANEL_WIDTH
+#define _DISPLAY_HEIGHT	_PANEL_HEIGHT
+#define _DISPLAY_ROW_BYTES	_PANEL_ROW_BYTES	//Bytes in a row of the first plane
+#define _DISPLAY_PIXELS_PER_BYTE	_PANEL_PIXELS_PER_BYTE
 
-#define _NUM_COLORS 7
-typedef struct{
-	int16_t r;
-	int16_t g;
-	int16_t b;
-} RGB16_t;
-extern const RGB16_t display_colors[_NUM_COLORS+1];
+#define _NUM_COLORS _PANEL_COLORS
 
+#define _DISPLAY_STRIPE_HEIGHT	16	//Rows in a stripe, the tallest jpeg MCU
+#define _DISPLAY_SLOT_BYTES		(_DISPLAY_WIDTH * _DISPLAY_STRIPE_HEIGHT * 3)		//RGB pixels of a stripe
+#define _DISPLAY_DITHER_BYTES	(3 * _DISPLAY_WIDTH * 3 * sizeof(int16_t))		//Dither error rows
+#define _DISPLAY_PLANE_BYTES	(_DISPLAY_ROW_BYTES * _DISPLAY_HEIGHT)				//Packed pixels of a plane
 
+#define _DISPLAY_TILE_SIZE	32	//Size in pixels of the tiles compared with the previous image
+#define _DISPLAY_FULL_REFRESH_EVERY	10	//Full refresh after this many updates on panels with partial refresh
+
+#ifndef _DISPLAY_PIPELINE_DEPTH
+#define _DISPLAY_PIPELINE_DEPTH	2	//Stripes buffered between the decoder and the output task
+#endif
+
+typedef enum
+{
+	e_RefreshNone,		//Image unchanged
+	e_RefreshPartial,	//Only the changed window was refreshed
+	e_RefreshFull
+} DisplayRefresh_e;
+
+typedef struct
+{
+	uint32_t stripes;		//Stripes written by DISP_WritePixel()
+	uint32_t decode_stall;	//Time the decoder waited for a free stripe (ms)
+	uint32_t output_stall;	//Time the output task waited for the decoder (ms)
+} DisplayPipelineStats_t;
+
+
+void DISP_Setup(void);
 void DISP_Init(void);
 void DISP_Sleep(void);
-void DISP_BeginUpdate(void);
-void DISP_EndUpdate(void);
+void DISP_BeginUpdate(bool force_full);
+DisplayRefresh_e DISP_EndUpdate(void);
+void DISP_AbortUpdate(void);
+bool DISP_WaitRefresh(uint32_t timeout);
+bool DISP_BeginRender(FIL* fp);
+bool DISP_EndRender(uint32_t* crc);
 void DISP_SendData(uint8_t data);
+void DISP_SendPixel(uint8_t color);
+void DISP_SendRow(const uint8_t* data, int len);
+uint8_t* DISP_GetRowBuffer(void);
 void DISP_SetStripeHeight(int h);
 void DISP_WritePixel(int x, int y, uint8_t r, uint8_t g, uint8_t b);
+const DisplayBusyTimes_t* DISP_GetBusyTimes(void);
+const DisplayWindow_t* DISP_GetWindow(void);
+const DisplayPipelineStats_t* DISP_GetPipelineStats(void);
+void DISP_RunOutput(void);
 
 #endif /* INC_DISPLAY_H_ */
 
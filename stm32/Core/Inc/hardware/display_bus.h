@@ -0,0 +1,80 @@
+/**
+ ******************************************************************************
+ * @file      display_bus.h
+ * @author    ts-manuel
+ * @brief     SPI transport for the E-Paper display
+ *
+ *            Commands are sent one byte at a time, pixel data is sent in
+ *            bursts by DMA with DC and CS asserted once for the whole burst.
+ *            The BUSY pin triggers an EXTI interrupt, the calling task
+ *            blocks on a thread flag while the display is busy.
+ *
+ *            Setting _DBUS_CAPTURE to 1 replaces the SPI with a capture
+ *            backend that records the byte stream and the transaction
+ *            boundaries, it is used to check the display output without
+ *            the hardware.
+ *
+ ******************************************************************************
+ */
+
+#ifndef INC_HARDWARE_DISPLAY_BUS_H_
+#define INC_HARDWARE_DISPLAY_BUS_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#ifndef _DBUS_CAPTURE
+#define _DBUS_CAPTURE 0				//0 = SPI1 + DMA, 1 = capture backend
+#endif
+
+#define _DBUS_BUSY_TIMEOUT	30000	//Maximum time in ms the display can stay busy
+#define _DBUS_STATUS_PERIOD	100		//Period in ms of the status command sent while the display is busy
+#define _DBUS_FLAG_BUSY		0x0100	//Thread flag set by the BUSY pin interrupt
+#define _DBUS_FLAG_IDLE		0x0200	//Thread flag set when a burst is completed
+
+#ifndef _DBUS_CAPTURE_SIZE
+#define _DBUS_CAPTURE_SIZE	4096	//Number of bytes stored by the capture backend
+#endif
+
+#ifndef _DBUS_CAPTURE_TRANSACTIONS
+#define _DBUS_CAPTURE_TRANSACTIONS	512	//Number of transactions stored by the capture backend
+#endif
+
+typedef enum
+{
+	e_DBusCommand,
+	e_DBusData
+} DBusTransactionType_e;
+
+typedef struct
+{
+	DBusTransactionType_e type;	//Command or data
+	uint32_t offset;			//Offset of the first byte in the byte stream
+	uint32_t length;			//Number of bytes sent while CS was low
+} DBusTransaction_t;
+
+typedef struct
+{
+	uint8_t data[_DBUS_CAPTURE_SIZE];
+	DBusTransaction_t transactions[_DBUS_CAPTURE_TRANSACTIONS];
+	uint32_t byte_count;		//Total bytes sent (can be more than the stored ones)
+	uint32_t transaction_count;	//Total transactions (can be more than the stored ones)
+} DBusCapture_t;
+
+
+void DBUS_SendCommand(uint8_t cmd);
+void DBUS_SendData(uint8_t data);
+void DBUS_SendBurst(const uint8_t* data, int len);
+void DBUS_WaitIdle(void);
+bool DBUS_WaitBusy(uint8_t level, uint32_t* elapsed);
+bool DBUS_WaitBusyStatus(uint8_t level, uint8_t status, uint32_t* elapsed);
+uint32_t DBUS_GetLastBusyTime(void);
+void DBUS_BusyIRQHandler(void);
+
+#if _DBUS_CAPTURE
+void DBUS_CaptureReset(void);
+const DBusCapture_t* DBUS_GetCapture(void);
+#endif
+
+#endif /* INC_HARDWARE_DISPLAY_BUS_H_ */
@@ -4,6 +4,37 @@
  * @author    ts-manuel
  * @brief     Flash
  *
+ *            The state kept across power losses (file on the display and its
+ *            playlist position, decode settings, wake counters, time of the
+ *            phases of the last wake) is a key/value store in flash sectors
+ *            10 and 11. One sector is active, records are appended to it and
+ *            the latest record of a key is its value. When the active sector
+ *            is full the latest record of every key is copied to the other
+ *            sector, its header is programmed last: until then the old sector
+ *            is still the active one, a valid state always exists.
+ *
+ *            Records are written in slots of 16 bytes, a word at a time in
+ *            address order. Each slot starts with a tag word (key, index of
+ *            the slot in the record, slots of the record) and the CRC-32 of
+ *            the record is in the last word, programmed last: a record cut by
+ *            a power loss is ignored. The used slots come before the erased
+ *            ones, the head of the sector is found by a binary search on the
+ *            tag words and the keys are found walking the records back from
+ *            the head.
+ *
+ *            The inactive sector is erased in the background, by the render
+ *            task while the panel refreshes (or before standby). Only if that
+ *            was missed the erase is done when the sector is needed.
+ *
+ *            The state that changes every wake (file on the display and its
+ *            position, wake counters) is kept in the backup SRAM, retained in
+ *            standby, the time of the phases is in the profiler records. The
+ *            file is committed to flash, with the counters and the timings of
+ *            the last wake, only when it's in another folder (or is another
+ *            movie) than the committed one, or when the backup SRAM content
+ *            was lost: after a reset of the backup domain the playback resumes
+ *            from the first file shown in the folder.
+ *
  ******************************************************************************
  */
 
@@ -18,11 +49,79 @@
 #include <main.h>
 
 #include "settings.h"
+#include "file_manager.h"
+#include "profiler.h"
+#include "hardware/power.h"
+
+#ifndef _FLASH_STORE_ADDR
+#define _FLASH_STORE_ADDR	0x080c0000	//Sectors 10 and 11, the last 256KB of the flash
+#endif
+#define _FLASH_SECTOR_SIZE	0x20000
+#define _FLASH_STORE_MAGIC	0x32534C46	//"FLS2", in the header of the sectors
+
+typedef enum
+{
+	e_FlashKeySource = 1,	//File on the display and its playlist position (FlashSource_t)
+	e_FlashKeyDecode,		//Settings the image on the display was decoded with (FlashDecode_t)
+	e_FlashKeyCounters,		//Wake counters (FlashCounters_t)
+	e_FlashKeyTimings,		//Time spent in each phase of the last wake (ProfWake_t)
+	e_FlashKeyCount
+} FlashKey_e;
+
+typedef struct
+{
+	FmanPosition_t position;			//Playlist position and movie frame
+	char path[_FILE_PATH_MAX_LEN];		//File path string
+} FlashSource_t;
+
+typedef struct
+{
+	uint8_t panel;			//_PANEL
+	uint8_t palette;		//_PANEL_PALETTE
+	uint8_t dither;			//_DITHER
+	uint8_t scale;			//Source pixels per panel pixel
+} FlashDecode_t;
+
+typedef struct
+{
+	uint32_t wakes;			//Wakes that reached standby
+	uint32_t updates;		//Display updates completed
+	uint32_t failures;		//Display updates failed
+	uint32_t last_failure;	//Wake of the last failed update, 0 if none
+} FlashCounters_t;
+
+typedef struct
+{
+	int active;				//Active sector (0 = sector 10, 1 = sector 11), -1 if the store is empty
+	uint32_t sequence;		//Sector switches since the store was created
+	uint32_t used;			//Slots used in the active sector
+	uint32_t slots;			//Slots per sector
+	bool erase_pending;		//The inactive sector must be erased
+	bool backup_reset;		//The wake state in the backup SRAM was lost, loaded from flash
+	uint32_t records;		//Records written since reset
+	uint32_t skipped;		//Records not written, same value as the stored one
+	uint32_t erases;		//Sectors erased since reset
+	uint32_t blocking_erases;	//Erases done while writing, the background erase was missed
+} FlashInfo_t;
+
+
+void FLASH_Init(void);
+
+bool FLASH_Read(FlashKey_e key, void* value, uint32_t size);
+
+bool FLASH_Write(FlashKey_e key, const void* value, uint32_t size);
+
+bool FLASH_EraseInactive(void);
+
+const FlashInfo_t* FLASH_GetInfo(void);
+
+bool FLASH_LoadFilePath(char* file_path, FmanPosition_t* pos);
 
+void FLASH_StoreFilePath(const char* file_path, const FmanPosition_t* pos);
 
-bool FLASH_LoadFilePath(char* file_path);
+void FLASH_EndWake(uint32_t updates, uint32_t failures);
 
-void FLASH_StoreFilePath(const char* file_path);
+const FlashCounters_t* FLASH_GetCounters(void);
 
 void FLASH_Erase(void);
 
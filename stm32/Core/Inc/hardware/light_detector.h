@@ -29,7 +29,10 @@
 #include <stdbool.h>
 
 #define _DARK_THRESHOLD	10
+#define _LDR_MAX_TIME		255		//Maximum time in ms the measurement can take
+#define _LDR_FLAG_RISE		0x0400	//Thread flag set when LDR_SIG crosses the threshold
 
 bool LDR_IsDark(void);
+void LDR_IRQHandler(void);
 
 #endif /* INC_HARDWARE_LIGHT_DETECTOR_H_ */
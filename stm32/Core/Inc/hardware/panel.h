@@ -0,0 +1,137 @@
+/**
+ ******************************************************************************
+ * @file      panel.h
+ * @author    ts-manuel
+ * @brief     E-Paper panel descriptors
+ *
+ *            The panel is selected at compile time with _PANEL. The pixel
+ *            format (bits per pixel, number of planes, palette) is known at
+ *            compile time so that the stripe and dither code in display.c
+ *            is specialised for the panel, the descriptor holds the hooks
+ *            that are called once per update (init, begin, refresh, sleep).
+ *
+ *            _PANEL_5IN65F  5.65" 7 color, 600x448, 4 bit per pixel
+ *            _PANEL_4IN2    4.2" black/white, 400x300, 1 bit per pixel
+ *            _PANEL_4IN2BC  4.2" black/white/red, 400x300, 1 bit per pixel,
+ *                           two planes (black sent with 0x10, red with 0x13)
+ *
+ *            With two planes the first plane is streamed to the display
+ *            and the second one is kept in RAM and sent by DISP_EndUpdate().
+ *
+ *            Panels with _PANEL_PARTIAL set can refresh a window of the
+ *            image, the whole plane is kept in RAM until DISP_EndUpdate()
+ *            knows which part has changed.
+ *
+ ******************************************************************************
+ */
+
+#ifndef INC_HARDWARE_PANEL_H_
+#define INC_HARDWARE_PANEL_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define _PANEL_5IN65F	0
+#define _PANEL_4IN2		1
+#define _PANEL_4IN2BC	2
+
+#ifndef _PANEL
+#define _PANEL _PANEL_5IN65F		//Panel connected to the board
+#endif
+
+#if _PANEL == _PANEL_5IN65F
+	#include "EPD_5in65f.h"
+	#define _PANEL_WIDTH		EPD_5IN65F_WIDTH
+	#define _PANEL_HEIGHT		EPD_5IN65F_HEIGHT
+	#define _PANEL_BPP			4		//Bits per pixel in each plane
+	#define _PANEL_PLANES		1		//Number of planes
+	#define _PANEL_COLORS		7		//Number of colors in the palette
+	#define _PANEL_PALETTE		_FRM_PALETTE_7COLOR	//Palette ID of the frames (frame/frame.h)
+	#define _PANEL_BLANK_BYTE	0x00	//Plane byte used to pad the image (black)
+	#define _PANEL_PARTIAL		0		//1 if the panel can refresh a window
+	#define _PANEL_SPLASH		1		//1 if the splash screen (bmp/splash_screen.c) is in the format of the panel
+#elif _PANEL == _PANEL_4IN2
+	#include "EPD_4in2.h"
+	#define _PANEL_WIDTH		EPD_4IN2_WIDTH
+	#define _PANEL_HEIGHT		EPD_4IN2_HEIGHT
+	#define _PANEL_BPP			1
+	#define _PANEL_PLANES		1
+	#define _PANEL_COLORS		2
+	#define _PANEL_PALETTE		_FRM_PALETTE_BW
+	#define _PANEL_BLANK_BYTE	0x00
+	#define _PANEL_PARTIAL		1
+	#define _PANEL_SPLASH		0
+	#define _PANEL_PLANE0_BIT(c)	(c)			//0 = black, 1 = white
+#elif _PANEL == _PANEL_4IN2BC
+	#include "EPD_4in2bc.h"
+	#define _PANEL_WIDTH		EPD_4IN2BC_WIDTH
+	#define _PANEL_HEIGHT		EPD_4IN2BC_HEIGHT
+	#define _PANEL_BPP			1
+	#define _PANEL_PLANES		2
+	#define _PANEL_COLORS		3
+	#define _PANEL_PALETTE		_FRM_PALETTE_BWR
+	#define _PANEL_BLANK_BYTE	0x00
+	#define _PANEL_PARTIAL		0
+	#define _PANEL_SPLASH		0
+	#define _PANEL_PLANE0_BIT(c)	((c) != 0)	//0 = black
+	#define _PANEL_PLANE1_BIT(c)	((c) != 2)	//0 = red
+#else
+	#error "Unknown panel"
+#endif
+
+#if _PANEL_BPP != 4 && _PANEL_BPP != 1
+	#error "Unsupported number of bits per pixel"
+#endif
+
+#if (_PANEL_WIDTH * _PANEL_BPP) % 8 != 0
+	#error "Rows must be a whole number of bytes"
+#endif
+
+#define _PANEL_ROW_BYTES		(_PANEL_WIDTH * _PANEL_BPP / 8)	//Bytes in a row of one plane
+#define _PANEL_PIXELS_PER_BYTE	(8 / _PANEL_BPP)
+
+typedef struct{
+	int16_t r;
+	int16_t g;
+	int16_t b;
+} RGB16_t;
+
+typedef struct{
+	uint32_t init;		//Reset to ready (ms)
+	uint32_t power_on;	//Power on (ms)
+	uint32_t refresh;	//Refresh (ms)
+	uint32_t power_off;	//Power off (ms)
+	bool timeout;		//At least one of the waits timed out
+} DisplayBusyTimes_t;
+
+typedef struct{
+	uint16_t x0;	//First column (multiple of 8)
+	uint16_t y0;	//First row
+	uint16_t x1;	//Last column + 1 (multiple of 8)
+	uint16_t y1;	//Last row + 1
+} DisplayWindow_t;
+
+typedef struct
+{
+	const char* name;
+	uint16_t width;						//Pixels
+	uint16_t height;					//Pixels
+	uint8_t bpp;						//Bits per pixel in each plane
+	uint8_t planes;						//Number of planes
+	uint8_t num_colors;					//Colors in the palette
+	const RGB16_t* palette;				//num_colors + 1 entries, the last one is the clean color
+	uint8_t plane_command[2];			//Data start command of each plane
+	void (*init)(DisplayBusyTimes_t* times);	//Reset and configure the panel
+	void (*begin)(void);						//Prepare to receive the first plane
+	void (*refresh)(DisplayBusyTimes_t* times);	//Show the image
+	void (*refresh_window)(const uint8_t* plane, const DisplayWindow_t* win, DisplayBusyTimes_t* times);	//Show a window of the plane (NULL if not supported)
+	void (*sleep)(void);						//Enter low power mode
+} PanelDescriptor_t;
+
+extern const PanelDescriptor_t panel;
+extern const RGB16_t display_colors[_PANEL_COLORS+1];
+
+//Called by the refresh hooks right after the refresh command (display.c)
+void DISP_RefreshStarted(void);
+
+#endif /* INC_HARDWARE_PANEL_H_ */
@@ -4,6 +4,21 @@
  * @author    ts-manuel
  * @brief     Power management and backup
  *
+ *            Tickless idle: when all the tasks are blocked the RTOS calls
+ *            PWR_SuppressTicksAndSleep(), SysTick and the HAL tick (TIM1)
+ *            are stopped and the RTC wakeup timer is programmed to expire
+ *            when the next task has to run. The time spent sleeping is
+ *            measured with the RTC sub-second counter and added to both
+ *            ticks. The core enters stop mode when no transfer is in
+ *            progress and nothing holds a PWR_StopLock() (USB connected,
+ *            console in use), otherwise it sleeps with the peripherals
+ *            running. Any EXTI (display BUSY, buttons, light sensor) or
+ *            the wakeup timer ends the idle period. The UART is not
+ *            clocked in stop mode, so its RX pin is armed as an EXTI
+ *            wake source: the first character typed only wakes the core
+ *            and is dropped, then stop mode is locked for the rest of
+ *            the wake.
+ *
  ******************************************************************************
  */
 
@@ -17,6 +32,22 @@
 #include <stdint.h>
 #include "cmsis_os.h"
 
+//Regions of the 4KB backup SRAM, the content is retained in standby
+#define _BKP_SRAM_SIZE			0x1000
+#define _BKP_DISPLAY_OFFSET		0x0000	//Tile hashes of the image shown by the display
+#define _BKP_DISPLAY_SIZE		0x0400
+#define _BKP_PROFILER_OFFSET	0x0400	//Time spent in each phase of the last wakes
+#define _BKP_PROFILER_SIZE		0x0300
+#define _BKP_SD_OFFSET			0x0700	//CID of the card and geometry of the volume mounted
+#define _BKP_SD_SIZE			0x0040
+#define _BKP_STATE_OFFSET		0x0740	//File on the display and wake counters, committed to flash on a change of folder
+#define _BKP_STATE_SIZE			0x00C0
+
+#define _PWR_WAKEUP_PERIOD		1440	//Standby wake up period in s
+#define _PWR_RTC_SYNC_PREDIV	1023	//RTC sub-second counter reload (1024Hz with LSE)
+#define _PWR_WUT_HZ				2048	//RTC wakeup timer clock used by the tickless idle (LSE / 16)
+#define _PWR_IDLE_MAX_TICKS		30000	//Longest idle period (the wakeup timer counts up to 65536)
+#define _PWR_CONSOLE_RX_PIN		GPIO_PIN_11	//Console UART RX (PB11), its EXTI line wakes the core from stop mode
 
 typedef enum
 {
@@ -24,6 +55,14 @@ typedef enum
 	PWR_SD
 } Device_e;
 
+typedef struct
+{
+	uint32_t sleep_ms;		//Time spent idle in sleep mode (peripherals running)
+	uint32_t stop_ms;		//Time spent idle in stop mode
+	uint32_t sleep_count;	//Number of times sleep mode was entered
+	uint32_t stop_count;	//Number of times stop mode was entered
+} PowerIdleStats_t;
+
 
 void PWR_Enable(Device_e dev);
 
@@ -31,4 +70,16 @@ void PWR_Disable(Device_e dev);
 
 void PWR_EnterStandBy(void);
 
+void PWR_BackupInit(void);
+
+void* PWR_BackupRegion(uint32_t offset);
+
+void PWR_SuppressTicksAndSleep(uint32_t expected_idle_time);
+
+void PWR_StopLock(void);
+
+void PWR_StopUnlock(void);
+
+const PowerIdleStats_t* PWR_GetIdleStats(void);
+
 #endif /* INC_HARDWARE_POWER_H_ */
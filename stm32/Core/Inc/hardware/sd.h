@@ -4,6 +4,24 @@
  * @author    ts-manuel
  * @brief     Driver for the SD-Card
  *
+ *            Fast wake: after the card is powered the identification is
+ *            attempted every _SD_POLL_MS until the card answers, instead of
+ *            waiting a fixed delay. The CID of the card and the geometry of
+ *            the FAT volume are kept in the backup SRAM, when the same card
+ *            is found at the next wake only its volume boot record is read
+ *            (and compared with the CRC stored) instead of the partition
+ *            table, the boot record and the FSInfo sector parsed by f_mount().
+ *
+ *            The volume is mounted for playback: the free cluster count and
+ *            the next free cluster in the FSInfo sector are only needed to
+ *            allocate clusters, SD_BeginWrite() loads them before the first
+ *            file is created, extended or deleted. Without it FatFs still
+ *            works, but searches free clusters from the beginning of the FAT
+ *            and leaves FSInfo as it was.
+ *
+ *            The time from power on to the first sector read is added to the
+ *            profiler every wake (e_ProfFirstSector).
+ *
  ******************************************************************************
  */
 
@@ -17,8 +35,22 @@
 #include "hardware/power.h"
 #include "settings.h"
 
+#define _SD_RAMP_MS			2		//Supply ramp before the first identification attempt
+#define _SD_POLL_MS			2		//Delay between identification attempts
+#define _SD_READY_TIMEOUT	500		//ms, the card is missing or broken
+
+typedef struct
+{
+	uint32_t polls;		//Identification attempts until the card answered
+	bool same_card;		//The CID matches the card of the last wake
+	bool cached;		//Mounted with the volume geometry of the last wake
+	bool writable;		//FSInfo loaded by SD_BeginWrite()
+} SDWakeInfo_t;
+
 
 HAL_StatusTypeDef SD_Init(void);
 HAL_StatusTypeDef SD_Sleep(void);
+void SD_BeginWrite(void);
+const SDWakeInfo_t* SD_GetWakeInfo(void);
 
 #endif /* INC_HARDWARE_SD_H_ */
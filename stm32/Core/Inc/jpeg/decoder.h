@@ -19,12 +19,15 @@
 #include <stddef.h>
 #include "jpeg/bit_buffer.h"
 #include "fatfs.h"
+#include "profiler.h"
+#include "tasks/read_ahead_task.h"
 
 #warning "TODO: Remove #include \"hardware/display.h\" from jpeg/decoder.h"
 #include "hardware/display.h"
 
 #define _DEBUG_PRINT	0	//0 = no debug output, 1 = print only header, 2 = print header and tables
 #define _GAMMA_CORRECT	0	//0 = no gamma correction, 1 = gamma correct decoded image
+#define _JPG_BUFF_SIZE	_RAHEAD_RING_BYTES	//Read-ahead ring, shares the sram arena with the frame chunks
 
 //JPEG Markers
 #define _SOI	0xd8	//(Start Of Image) must be the first marker of the file
@@ -149,12 +152,14 @@ typedef struct {
 	bool valid;
 	JPG_Decode_t decode;
 
-	uint8_t buff[512];
+	uint8_t* buff;		//_JPG_BUFF_SIZE bytes, filled by SDIO DMA so not in CCM RAM
+	const RAheadChunk_t* chunk;	//Chunk being decoded
 	UINT ptr;
-	UINT size;
+	UINT size;			//Bytes in the chunk
 } JPG_t;
 
 
 bool JPG_decode(FIL* fp, JPG_t* jpg);
+bool JPG_Display(FIL* fp);
 
 #endif /* INC_JPEG_DECODER_H_ */
@@ -0,0 +1,89 @@
+/**
+ ******************************************************************************
+ * @file      profiler.h
+ * @author    ts-manuel
+ * @brief     Time spent in each phase of the wake cycle
+ *
+ *            The time is measured with the DWT cycle counter (clock_gettime()
+ *            on the host with _PROF_HOST) and accumulated per phase into a
+ *            ring of records in the backup SRAM, one record per wake,
+ *            so the last _PROF_WAKES wakes survive standby.
+ *
+ *            Phases measured in different tasks overlap: the dither includes
+ *            the time waiting for the SPI and the color conversion includes
+ *            the time waiting for a free stripe. The render-ahead of the
+ *            next image is also counted in the decode phases.
+ *
+ ******************************************************************************
+ */
+
+#ifndef INC_PROFILER_H_
+#define INC_PROFILER_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "main.h"
+
+#ifndef _PROF_HOST
+#define _PROF_HOST 0			//0 = DWT cycle counter, 1 = clock_gettime() (simulator)
+#endif
+
+#define _PROF_WAKES 8			//Number of wakes kept in the backup SRAM
+
+#if _PROF_HOST
+#include <time.h>
+#endif
+
+typedef enum
+{
+	e_ProfSDPower,		//SD power up and card identification
+	e_ProfMount,		//Volume mount
+	e_ProfFirstSector,	//From SD power on to the first sector read
+	e_ProfFindNext,		//Directory scan for the next file
+	e_ProfSDRead,		//f_read of the image
+	e_ProfHeader,		//Jpeg markers and frame header
+	e_ProfEntropy,		//Huffman decode
+	e_ProfIDCT,			//Dequantize and inverse DCT
+	e_ProfColor,		//YCbCr to RGB
+	e_ProfDither,		//Dither and pixel packing
+	e_ProfSPI,			//Waiting for the SPI transfers
+	e_ProfBusy,			//Waiting for the display BUSY pin
+	e_ProfFlash,		//Flash store writes and erases
+	e_ProfRender,		//Render-ahead of the next image during the refresh
+	e_ProfSaved,		//Decode time saved by the render cache
+	e_ProfWake,			//From reset to standby
+	e_ProfCount
+} ProfPhase_e;
+
+typedef struct
+{
+	uint32_t us[e_ProfCount];	//Time spent in each phase (us)
+} ProfWake_t;
+
+
+/*
+ * Returns the current value of the counter, passed to PROF_Add() at the end of the phase
+ * */
+static inline uint32_t PROF_Start(void)
+{
+#if _PROF_HOST
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint32_t)(ts.tv_sec * 1000000000ULL + ts.tv_nsec);
+#else
+	return DWT->CYCCNT;
+#endif
+}
+
+void PROF_Init(void);
+void PROF_Add(ProfPhase_e phase, uint32_t start);
+void PROF_AddTicks(ProfPhase_e phase, uint32_t ticks);
+void PROF_AddUs(ProfPhase_e phase, uint32_t us);
+uint32_t PROF_TicksToUs(uint32_t ticks);
+void PROF_EndWake(void);
+void PROF_Clear(void);
+int PROF_GetWakeCount(void);
+const ProfWake_t* PROF_GetWake(int age);
+const char* PROF_GetPhaseName(ProfPhase_e phase);
+
+#endif /* INC_PROFILER_H_ */
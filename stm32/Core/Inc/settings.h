@@ -18,8 +18,9 @@
 /*
  * Size of the serial port receive buffer,
  * maximum number of characters in a command
+ * (power of 2, room for a long file path)
  * */
-#define _MAX_CMD_LENGTH 64
+#define _MAX_CMD_LENGTH 256
 
 /*
  * Number of seconds from the last command after witch
@@ -28,8 +29,9 @@
 #define _SLEEP_TIMEOUT 60
 
 /*
- * DO NOT max length of file path buffer
+ * Max length of file path buffer, FOLDER/FILE with
+ * long names of up to _MAX_LFN (ffconf.h) characters
  * */
-#define _FILE_PATH_MAX_LEN (8+1+8+1+3+1)
+#define _FILE_PATH_MAX_LEN (64+1+64+1)
 
 #endif /* INC_SETTINGS_H_ */
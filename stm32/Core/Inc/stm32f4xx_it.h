@@ -55,9 +55,11 @@ void UsageFault_Handler(void);
 void DebugMon_Handler(void);
 void RTC_WKUP_IRQHandler(void);
 void EXTI0_IRQHandler(void);
+void EXTI1_IRQHandler(void);
 void TIM1_UP_TIM10_IRQHandler(void);
 void USART3_IRQHandler(void);
 void DMA2_Stream3_IRQHandler(void);
+void DMA2_Stream5_IRQHandler(void);
 void OTG_FS_IRQHandler(void);
 void DMA2_Stream6_IRQHandler(void);
 /* USER CODE BEGIN EFP */
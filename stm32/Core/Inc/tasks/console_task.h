@@ -20,19 +20,25 @@
 #include "hardware/power.h"
 #include "hardware/sd.h"
 #include "hardware/flash.h"
+#include "hardware/clock.h"
 #include "tasks/display_task.h"
 #include "cmsis_os.h"
 #include "usb_device.h"
 #include "usbd_cdc_if.h"
 #include "EPD_5in65f.h"
 #include "bmp/bmp.h"
+#include "profiler.h"
+#include "arena.h"
+#include "sd_diskio.h"
 
+#define _DJOB_WAIT_TIMEOUT 60000	//Maximum time in ms the console waits for the display jobs
+#define _CONSOLE_POLL_TIME	1000	//Period in ms of the timeout check while the display jobs are running
+#define _FLAG_CONSOLE_RX	0x0001	//Thread flag set when a character is received
+#define _SD_BENCH_BYTES		4096	//Largest read of the SD benchmark, the buffer is taken from the RTOS heap
 
 typedef struct
 {
 	UART_HandleTypeDef* huart;
-	osThreadId_t displayTaskId;
-	osMessageQueueId_t display_message_queue;
 	volatile bool* sleep_cmd_disabled;
 } ConsoleTaskArgs_t;
 
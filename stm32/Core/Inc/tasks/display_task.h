@@ -4,6 +4,13 @@
  * @author    ts-manuel
  * @brief     Updates the display
  *
+ *            Updates are submitted as jobs with DJOB_Submit(), the job is
+ *            copied into the queue of the display task so the caller
+ *            doesn't have to keep anything alive. Files are opened and
+ *            closed by the display task. The next job can be queued while
+ *            the panel is still busy with the current one, completion is
+ *            reported by the done callback and by DJOB_Wait().
+ *
  ******************************************************************************
  */
 
@@ -17,11 +24,20 @@
 #include "stm32f4xx_hal.h"
 #include "cmsis_os.h"
 #include "hardware/display.h"
+#include "hardware/clock.h"
 #include "hardware/light_detector.h"
 #include "jpeg/decoder.h"
+#include "frame/frame.h"
+#include "frame/movie.h"
+#include "tasks/render_task.h"
+#include "tasks/read_ahead_task.h"
 #include "fatfs.h"
+#include "fast_seek.h"
+#include "settings.h"
 
 #define _FLAG_DISPLAY_UPDATE 1
+#define _DJOB_QUEUE_DEPTH	2		//Jobs waiting while the display is updated
+#define _DJOB_EVENT_DONE	0x0001	//Event flag set every time a job is finished
 
 typedef struct
 {
@@ -35,19 +51,54 @@ typedef enum
 	e_DisplayStripes,
 	e_DisplayLines,
 	e_DisplayGradient,
-	e_DisplayJPEG,
+	e_DisplayFile,
+#if _PANEL_SPLASH
 	e_DisplayBMP
+#endif
 } DisplayAction_e;
 
-typedef struct
+typedef enum
+{
+	e_JobQueued,
+	e_JobRunning,
+	e_JobDone,
+	e_JobFailed,		//Unable to open or decode the file
+	e_JobCancelled,
+	e_JobSkipped		//Too dark to see the display
+} DisplayJobState_e;
+
+typedef struct DisplayJob_s DisplayJob_t;
+
+struct DisplayJob_s
 {
-	DisplayAction_e action;	//Action to be performed
-	uint8_t color;			//Color to be displayed
-	FIL* fp;				//Jpeg file to be displayed
-	uint8_t* bmp;			//600x448 bitmap
-} DisplayMessage_t;
+	DisplayAction_e action;				//Action to be performed
+	uint8_t color;						//Color to be displayed
+	char path[_FILE_PATH_MAX_LEN];		//Jpeg, frame or movie file to be displayed
+	uint16_t frame;						//Frame of the movie (ignored for other files)
+	const uint8_t* bmp;					//Bitmap in the format of the panel (_PANEL_SPLASH)
+	void (*done)(const DisplayJob_t* job);	//Called by the display task when the job is finished (can be NULL)
+
+	uint32_t id;						//Assigned by DJOB_Submit()
+	DisplayJobState_e state;
+	DisplayRefresh_e refresh;			//Type of refresh performed
+	uint32_t submit_tick;				//Tick count when the job was submitted
+	uint32_t start_tick;				//Tick count when the display task started the job
+	uint32_t data_tick;					//Tick count when the image was sent to the display
+	uint32_t done_tick;					//Tick count when the refresh was completed
+	uint32_t saved_ms;					//Decode time saved by the render cache
+	RAheadStats_t read_ahead;			//Waits of the decoder and of the read-ahead task
+};
+
+void DJOB_Init(const DisplayTaskArgs_t* args);
+uint32_t DJOB_Submit(const DisplayJob_t* job);
+void DJOB_Cancel(uint32_t id);
+bool DJOB_Wait(uint32_t id, uint32_t timeout);
+bool DJOB_WaitIdle(uint32_t timeout);
+bool DJOB_IsIdle(void);
+const DisplayJob_t* DJOB_GetLast(void);
 
 void StartDisplayTask(void *_args);
+void StartDisplayOutputTask(void *_args);
 
 
 #endif /* INC_TASKS_DISPLAY_TASK_H_ */
@@ -0,0 +1,83 @@
+/**
+ ******************************************************************************
+ * @file      read_ahead_task.h
+ * @author    ts-manuel
+ * @brief     Read-ahead of the file being decoded
+ *
+ *            The jpeg decoder doesn't read the file itself: the read-ahead
+ *            task fills a ring of _RAHEAD_DEPTH chunk buffers with f_read()
+ *            while the decoder works on the chunks read before, so the SD
+ *            card transfers (multi-block DMA, the CPU is free meanwhile)
+ *            overlap the decode instead of being paid inside read_byte().
+ *
+ *            The decoder opens the stream with RAHEAD_Open(), takes the
+ *            chunks in file order with RAHEAD_NextChunk() and gives each one
+ *            back with RAHEAD_ReleaseChunk() when it has consumed it, the
+ *            buffer is then filled again with the next chunk. A seek drops
+ *            the chunks read ahead and restarts from the new position. The
+ *            first chunk after a seek ends on a sector boundary, the others
+ *            are whole sectors read straight into the buffers.
+ *
+ *            Both sides count the times they had to wait and for how long:
+ *            a decoder waiting for chunks is I/O bound, a task waiting for
+ *            free buffers means the decoder is CPU bound. The counters of
+ *            the last stream are returned by RAHEAD_GetStats().
+ *
+ *            Only one stream is open at a time, the decoder is used by one
+ *            task at a time (the render task waits for DISP_BeginRender()).
+ *            Without the task (simulator) the chunks are read when they are
+ *            requested.
+ *
+ ******************************************************************************
+ */
+
+#ifndef INC_TASKS_READ_AHEAD_TASK_H_
+#define INC_TASKS_READ_AHEAD_TASK_H_
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include "cmsis_os.h"
+#include "fatfs.h"
+
+#ifndef _RAHEAD_DEPTH
+#define _RAHEAD_DEPTH		3		//Chunk buffers, up to _RAHEAD_DEPTH - 1 chunks are read ahead of the one being decoded
+#endif
+#define _RAHEAD_CHUNK_SIZE	4096	//Bytes per chunk, 8 sectors read with one command
+#define _RAHEAD_RING_BYTES	(_RAHEAD_DEPTH * _RAHEAD_CHUNK_SIZE)	//Buffers passed to RAHEAD_Open()
+#define _FLAG_RAHEAD_START	0x0001	//Thread flag set when a stream is started
+
+_Static_assert(_RAHEAD_DEPTH >= 2, "The read-ahead needs a buffer to fill while one is decoded");
+
+typedef struct
+{
+	uint8_t* data;
+	UINT size;			//Bytes in the chunk, less than _RAHEAD_CHUNK_SIZE at the end of the file
+	FSIZE_t offset;		//Position of data[0] in the file
+	bool end;			//Last chunk of the stream, end of the file or read error
+	bool error;			//f_read() failed
+} RAheadChunk_t;
+
+typedef struct
+{
+	uint32_t chunks;		//Chunks consumed by the decoder
+	uint32_t reader_waits;	//RAHEAD_NextChunk() found no chunk ready: I/O bound
+	uint32_t reader_us;		//Time the decoder waited for the SD card
+	uint32_t worker_waits;	//The task found no free buffer: CPU bound
+	uint32_t worker_us;		//Time the task waited for the decoder
+	uint32_t seeks;			//Restarts from a new position
+} RAheadStats_t;
+
+
+void RAHEAD_Init(void);
+void RAHEAD_Open(FIL* fp, uint8_t* ring);
+const RAheadChunk_t* RAHEAD_NextChunk(void);
+void RAHEAD_ReleaseChunk(void);
+void RAHEAD_Seek(FSIZE_t ofs);
+void RAHEAD_Close(void);
+const RAheadStats_t* RAHEAD_GetStats(void);
+
+void StartReadAheadTask(void *_args);
+
+#endif /* INC_TASKS_READ_AHEAD_TASK_H_ */
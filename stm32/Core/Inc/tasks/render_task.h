@@ -0,0 +1,117 @@
+/**
+ ******************************************************************************
+ * @file      render_task.h
+ * @author    ts-manuel
+ * @brief     Render-ahead cache
+ *
+ *            The panel is busy for about 15s after the refresh command and
+ *            the CPU has nothing to do meanwhile. When the data of an image
+ *            has been sent the display task passes its path to the render
+ *            task, that finds the next file with FMAN_FindNext(), decodes
+ *            and dithers it and writes the packed pixels to the cache
+ *            folder as a raw frame. The render task has a lower priority
+ *            than the display task and uses the pipeline only once the
+ *            update has released it (DISP_BeginRender()).
+ *
+ *            The cache is content addressed: the name of an entry is the
+ *            CRC-32 of RCacheKey_t, the identity of the source file (path,
+ *            movie frame, size, date and time) and the render settings (panel, palette,
+ *            dither, crop and scale). The display task opens the entry of
+ *            the file before decoding it and streams the frame if the key
+ *            stored in the entry matches, a missing, stale or corrupted
+ *            entry falls back to the decoder. Since the playlist loops,
+ *            after the first loop every image is streamed.
+ *
+ *            +--------------------+ 0
+ *            | FRM_Header_t       |
+ *            | RCacheKey_t        |
+ *            | render_ms, used    |
+ *            +--------------------+ _RCACHE_DATA_OFFSET
+ *            | pixel data         |
+ *            +--------------------+ _RCACHE_ENTRY_BYTES
+ *
+ *            An entry is written to _RCACHE_TEMP, the headers last, and
+ *            renamed when complete, a power loss leaves at most a stale
+ *            temporary file that is deleted by the next render. The frame
+ *            CRC catches anything else when the entry is streamed.
+ *
+ *            The folder is kept under _RCACHE_MAX_KB by deleting the least
+ *            recently used entries: every entry stores a use sequence,
+ *            set to the highest one in the folder + 1 when the entry is
+ *            rendered and when it is streamed. The folder is scanned once
+ *            per render, in the background during the refresh.
+ *
+ ******************************************************************************
+ */
+
+#ifndef INC_TASKS_RENDER_TASK_H_
+#define INC_TASKS_RENDER_TASK_H_
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include "fatfs.h"
+#include "settings.h"
+#include "hardware/display.h"
+
+#ifndef _RCACHE_ENABLE
+#define _RCACHE_ENABLE		(_PANEL_PLANES == 1)	//Frames hold a single plane
+#endif
+
+#define _RCACHE_DIR			"EPDCACHE"					//Hidden system folder, skipped by FMAN_FindNext()
+#define _RCACHE_TEMP		_RCACHE_DIR "/RENDER.TMP"	//Entry being rendered
+#define _RCACHE_MAX_KB		16384						//Size cap of the folder, about 120 entries on the 5.65" panel
+#define _RCACHE_EVICT_SLOTS	4							//Least recently used entries found by one scan
+#define _RCACHE_MAGIC		0x34484352					//"RCH4"
+#define _RCACHE_DATA_OFFSET	512							//Pixel data starts in the second sector
+#define _RCACHE_ENTRY_BYTES	(_RCACHE_DATA_OFFSET + _DISPLAY_PLANE_BYTES)
+#define _RCACHE_FLAG_START	0x0001						//Thread flag of the render task
+#define _RCACHE_EVENT_IDLE	0x0001						//Event flag set when the render is finished
+
+typedef struct __attribute__((packed))
+{
+	uint32_t magic;					//_RCACHE_MAGIC
+	char path[_FILE_PATH_MAX_LEN];	//Source file
+	uint16_t frame;					//Frame of a movie, 0 for other files
+	uint32_t size;					//Size of the source file
+	uint16_t date;					//Modification date of the source file (FatFs format)
+	uint16_t time;					//Modification time of the source file (FatFs format)
+	uint8_t panel;					//_PANEL
+	uint8_t palette;				//_PANEL_PALETTE
+	uint8_t dither;					//_DITHER
+	uint8_t scale;					//Source pixels per panel pixel, the decoder doesn't scale (1)
+	uint16_t crop_x;				//Source pixel drawn at the top left corner of the panel
+	uint16_t crop_y;
+	uint16_t crop_width;			//Source area drawn on the panel, the rest is clipped
+	uint16_t crop_height;
+} RCacheKey_t;
+
+typedef struct
+{
+	uint32_t renders;		//Images rendered ahead
+	uint32_t failures;		//Renders that could not be written
+	uint32_t hits;			//Files streamed from the cache
+	uint32_t misses;		//Files decoded
+	uint32_t evictions;		//Entries deleted to stay under _RCACHE_MAX_KB
+	uint32_t saved_ms;		//Decode time saved by the hits
+	uint32_t saved_bytes;	//Source bytes not decoded thanks to the hits
+	uint32_t entries;		//Entries in the folder at the last scan
+	uint32_t bytes;			//Size of the folder at the last scan
+} RCacheStats_t;
+
+
+void RCACHE_Init(void);
+void RCACHE_Start(const char* path, uint16_t frame);
+bool RCACHE_Wait(uint32_t timeout);
+bool RCACHE_IsIdle(void);
+bool RCACHE_Open(FIL* fp, const char* path, uint16_t frame);
+uint32_t RCACHE_Hit(uint32_t stream_ms);
+void RCACHE_Invalidate(void);
+bool RCACHE_Scan(void);
+uint32_t RCACHE_Clear(void);
+const RCacheStats_t* RCACHE_GetStats(void);
+
+void StartRenderTask(void *_args);
+
+#endif /* INC_TASKS_RENDER_TASK_H_ */
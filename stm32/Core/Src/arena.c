@@ -0,0 +1,87 @@
+/**
+ ******************************************************************************
+ * @file      arena.c
+ * @author    ts-manuel
+ * @brief     Statically allocated memory arenas
+ *
+ ******************************************************************************
+ */
+
+#include "arena.h"
+#include <stdio.h>
+#include <string.h>
+#include "hardware/display.h"
+#include "jpeg/decoder.h"
+#include "frame/frame.h"
+#include "fast_seek.h"
+#include "fatfs.h"
+#include "tasks/render_task.h"
+
+//Allocated once before the scheduler is started by DISP_Setup(), DJOB_Init(), RCACHE_Init(), FMAN_Init() and FSEEK_Init()
+#define _CCM_STATIC		(_ARENA_SIZE(_DISPLAY_DITHER_BYTES) + _ARENA_SIZE(_FSEEK_SLOTS * sizeof(FastSeekSlot_t)))
+#define _SRAM_STATIC	(_ARENA_SIZE(_DISPLAY_PIPELINE_DEPTH * _DISPLAY_SLOT_BYTES) + \
+						 _ARENA_SIZE(2 * _DISPLAY_ROW_BYTES) + \
+						 (_PANEL_PLANES == 2) * _ARENA_SIZE(_DISPLAY_PLANE_BYTES) + \
+						 _PANEL_PARTIAL * _ARENA_SIZE(_DISPLAY_PLANE_BYTES) + \
+						 5 * _ARENA_SIZE(sizeof(FIL)) + \
+						 _RCACHE_ENABLE * 2 * _ARENA_SIZE(sizeof(FIL)))
+
+//Allocated for each update or render by the jpeg decoder or by the frame reader, never both
+#define _CCM_UPDATE		_ARENA_MAX(_ARENA_SIZE(sizeof(JPG_t)), _ARENA_SIZE(_FRM_LZ_WINDOW))
+#define _SRAM_UPDATE	_ARENA_MAX(_ARENA_SIZE(_JPG_BUFF_SIZE), _ARENA_SIZE(_FRM_SRAM_BYTES))
+
+#define _CCM_SIZE		(_CCM_STATIC + _CCM_UPDATE)
+#define _SRAM_SIZE		(_SRAM_STATIC + _SRAM_UPDATE)
+
+_Static_assert(_CCM_SIZE <= 64 * 1024, "The ccm arena doesn't fit the CCM RAM");
+
+static uint8_t ccm_pool[_CCM_SIZE] _CCM_RAM __attribute__((aligned(_ARENA_ALIGN)));
+static uint8_t sram_pool[_SRAM_SIZE] __attribute__((aligned(_ARENA_ALIGN)));
+
+Arena_t arena_ccm = {"ccm", ccm_pool, _CCM_SIZE, 0, 0};
+Arena_t arena_sram = {"sram", sram_pool, _SRAM_SIZE, 0, 0};
+
+
+/*
+ * Returns size bytes from the arena, cleared to 0,
+ * or NULL if the arena is full
+ * */
+void* ARENA_Alloc(Arena_t* arena, uint32_t size)
+{
+	size = _ARENA_SIZE(size);
+
+	if(size > arena->size - arena->used)
+	{
+		printf("ERROR: Arena %s full, %lu bytes requested, %lu available\n",
+				arena->name, size, arena->size - arena->used);
+		return NULL;
+	}
+
+	void* ptr = &arena->base[arena->used];
+	memset(ptr, 0, size);
+
+	arena->used += size;
+	if(arena->used > arena->peak)
+		arena->peak = arena->used;
+
+	return ptr;
+}
+
+
+/*
+ * Returns the current allocation point
+ * */
+uint32_t ARENA_Mark(const Arena_t* arena)
+{
+	return arena->used;
+}
+
+
+/*
+ * Free everything allocated after the mark
+ * */
+void ARENA_Release(Arena_t* arena, uint32_t mark)
+{
+	if(mark <= arena->used)
+		arena->used = mark;
+}
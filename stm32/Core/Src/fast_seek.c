@@ -0,0 +1,183 @@
+/**
+ ******************************************************************************
+ * @file      fast_seek.c
+ * @author    ts-manuel
+ * @brief     Cluster link map tables for the large files
+ *
+ ******************************************************************************
+ */
+
+#include "fast_seek.h"
+#include "arena.h"
+#include "cmsis_os.h"
+
+static osMutexId_t seekLock;	//Files are opened by the console, display and render tasks
+static FastSeekSlot_t* slots;	//Only the CPU reads the tables, they can be in CCM RAM
+static FastSeekStats_t stats;
+
+#if _USE_FASTSEEK
+static uint32_t sequence;		//Use sequence of the last table attached
+
+static FastSeekSlot_t* find_slot(const FIL* fp);
+static FastSeekSlot_t* free_slot(void);
+#endif
+
+
+/*
+ * Allocate the tables, must be called before the scheduler is started
+ * */
+void FSEEK_Init(void)
+{
+	slots = ARENA_Alloc(&arena_ccm, _FSEEK_SLOTS * sizeof(FastSeekSlot_t));
+	seekLock = osMutexNew(NULL);
+}
+
+
+/*
+ * Open the file for reading and attach a link map table if it's large,
+ * must be closed with FSEEK_Close()
+ * */
+FRESULT FSEEK_Open(FIL* fp, const char* path)
+{
+	FRESULT res = f_open(fp, path, FA_READ | FA_OPEN_EXISTING);
+
+#if _USE_FASTSEEK
+	if(res != FR_OK || slots == NULL || fp->obj.sclust == 0 ||
+	   f_size(fp) <= (FSIZE_t)_FSEEK_MIN_CLUSTERS * fp->obj.fs->csize * _MAX_SS)
+		return res;
+
+	osMutexAcquire(seekLock, osWaitForever);
+
+	FastSeekSlot_t* slot = find_slot(fp);
+	if(slot != NULL)
+	{
+		stats.reused++;
+	}
+	else if((slot = free_slot()) == NULL)
+	{
+		stats.full++;
+	}
+	else
+	{
+		//Walk the chain once
+		slot->valid = false;
+		slot->table[0] = _FSEEK_CLMT_ENTRIES;
+		fp->cltbl = slot->table;
+
+		if(f_lseek(fp, CREATE_LINKMAP) == FR_OK)
+		{
+			slot->fs_id = fp->obj.id;
+			slot->sclust = fp->obj.sclust;
+			slot->size = f_size(fp);
+			slot->valid = true;
+			stats.built++;
+		}
+		else
+		{
+			slot = NULL;
+			stats.fragmented++;
+		}
+	}
+
+	fp->cltbl = NULL;
+	if(slot != NULL)
+	{
+		fp->cltbl = slot->table;
+		slot->users++;
+		slot->used = ++sequence;
+	}
+
+	osMutexRelease(seekLock);
+#endif
+
+	return res;
+}
+
+
+/*
+ * Close a file opened with FSEEK_Open(), the table stays in the cache
+ * */
+FRESULT FSEEK_Close(FIL* fp)
+{
+#if _USE_FASTSEEK
+	if(fp->cltbl != NULL)
+	{
+		osMutexAcquire(seekLock, osWaitForever);
+
+		for(int i = 0; i < _FSEEK_SLOTS; i++)
+		{
+			if(fp->cltbl == slots[i].table && slots[i].users > 0)
+				slots[i].users--;
+		}
+
+		fp->cltbl = NULL;
+
+		osMutexRelease(seekLock);
+	}
+#endif
+
+	return f_close(fp);
+}
+
+
+/*
+ * Forget the tables of the closed files, called after files are deleted
+ * */
+void FSEEK_Flush(void)
+{
+	osMutexAcquire(seekLock, osWaitForever);
+
+	//A file can't be deleted while it's open, the tables in use are still valid
+	for(int i = 0; slots != NULL && i < _FSEEK_SLOTS; i++)
+	{
+		if(slots[i].users == 0)
+			slots[i].valid = false;
+	}
+
+	osMutexRelease(seekLock);
+}
+
+
+/*
+ * Returns the table counters since boot
+ * */
+const FastSeekStats_t* FSEEK_GetStats(void)
+{
+	return &stats;
+}
+
+
+#if _USE_FASTSEEK
+/*
+ * Slot holding the table of the file
+ * */
+static FastSeekSlot_t* find_slot(const FIL* fp)
+{
+	for(int i = 0; i < _FSEEK_SLOTS; i++)
+	{
+		if(slots[i].valid && slots[i].fs_id == fp->obj.id &&
+		   slots[i].sclust == fp->obj.sclust && slots[i].size == f_size(fp))
+			return &slots[i];
+	}
+
+	return NULL;
+}
+
+
+/*
+ * Least recently used slot not in use by an open file
+ * */
+static FastSeekSlot_t* free_slot(void)
+{
+	FastSeekSlot_t* slot = NULL;
+
+	for(int i = 0; i < _FSEEK_SLOTS; i++)
+	{
+		if(slots[i].users == 0 && (slot == NULL || !slots[i].valid ||
+		   (slot->valid && slots[i].used < slot->used)))
+			slot = &slots[i];
+	}
+
+	return slot;
+}
+#endif
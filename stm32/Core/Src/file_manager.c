@@ -8,7 +8,44 @@
  */
 
 #include "file_manager.h"
-
+#include "crc32.h"
+#include "arena.h"
+#include "fast_seek.h"
+#include "hardware/sd.h"
+#include "cmsis_os.h"
+#include <stddef.h>
+
+static osMutexId_t fmanLock;	//Called by the console, display and render tasks
+static FIL* indexFile;			//Filled by SDIO DMA, must not be in CCM RAM
+static FIL* movieFile;			//Movie being counted, first run of a merge
+static FIL* sortFile[2];		//Second run of a merge, merged runs
+static FmanIndexHeader_t indexHeader;	//Header of the open index
+static bool checked;			//The index matches the card, checked once per mount
+static bool stale;				//A record doesn't match its file, the index must be built again
+static bool disabled;			//The index can't be built, the directories are searched
+static FmanRecord_t last;		//Last record returned by FMAN_FindNext()
+static FmanPosition_t lastPos;
+static FmanRecord_t batch[_FMAN_SORT_RUN];
+static FmanRecord_t heads[2];	//Records being merged
+
+static bool open_index(void);
+static bool build_index(uint32_t signature, uint32_t generation);
+static bool append_folder(const char* folder, uint32_t* count);
+static bool append_sorted(const char* folder, uint32_t* count);
+static bool write_runs(const char* folder, uint32_t* records);
+static bool merge_runs(const char* src, const char* dst, uint32_t width, uint32_t records, uint32_t* count);
+static bool append_file(const FmanRecord_t* rec, uint32_t frames, uint32_t* count);
+static bool next_folder_name(char* folder);
+static bool root_signature(uint32_t* signature);
+static bool read_record(uint32_t n, FmanRecord_t* rec);
+static bool find_record(const char* path, uint16_t frame, const FmanPosition_t* pos, uint32_t* n);
+static int compare_record(const FmanRecord_t* rec, const char* path, uint16_t frame);
+static bool check_record(const FmanRecord_t* rec);
+static bool is_playable(const FILINFO* fno);
+static void fill_record(FmanRecord_t* rec, const char* folder, const FILINFO* fno);
+static uint32_t frame_count(const char* path);
+static uint32_t header_crc(const FmanIndexHeader_t* hdr);
+static bool find_next_scan(char* new_path, const char* old_path, uint16_t* frame);
 static void extract_folder_file(char* folder, char* file, const char* old_path);
 static bool check_file(const char* folder, const char* file);
 static bool check_folder(const char* folder);
@@ -18,14 +55,710 @@ static void find_first_file(const char* folder, char* file);
 
 
 /*
- * Find next file to display
+ * Allocate the file objects, must be called before the scheduler is started
+ * */
+void FMAN_Init(void)
+{
+	indexFile = ARENA_Alloc(&arena_sram, sizeof(FIL));
+	movieFile = ARENA_Alloc(&arena_sram, sizeof(FIL));
+	sortFile[0] = ARENA_Alloc(&arena_sram, sizeof(FIL));
+	sortFile[1] = ARENA_Alloc(&arena_sram, sizeof(FIL));
+	fmanLock = osMutexNew(NULL);
+	lastPos.generation = _FMAN_NO_POSITION;
+}
+
+
+/*
+ * Find next file to display, pos is the position of old_path if known
+ * (generation _FMAN_NO_POSITION otherwise, the frame is always used) and is
+ * updated with the position of new_path. pos can be NULL for frame 0
+ * */
+bool FMAN_FindNext(char* new_path, const char* old_path, FmanPosition_t* pos)
+{
+	FmanRecord_t rec;
+	uint16_t frame = pos != NULL ? pos->frame : 0;
+	uint32_t n = 0;
+	bool found = false;
+
+	osMutexAcquire(fmanLock, osWaitForever);
+
+	//A record that doesn't match the file means the card has changed, the index is built again once
+	for(int retry = 0; retry < 2 && !found && open_index(); retry++)
+	{
+		if(indexHeader.count == 0)
+		{
+			FSEEK_Close(indexFile);
+			break;
+		}
+
+		//The following record, the first if old_path is the last or is not in the index
+		if(find_record(old_path, frame, pos, &n))
+			n = (n + 1) % indexHeader.count;
+		else if(n >= indexHeader.count)
+			n = 0;
+
+		found = read_record(n, &rec) && check_record(&rec);
+		FSEEK_Close(indexFile);
+
+		stale = !found;
+	}
+
+	if(found)
+	{
+		strcpy(new_path, rec.path);
+		last = rec;
+		lastPos.record = n;
+		lastPos.generation = indexHeader.generation;
+		lastPos.frame = rec.frame;
+		if(pos != NULL)
+			*pos = lastPos;
+	}
+	else
+	{
+		found = find_next_scan(new_path, old_path, &frame);
+		if(pos != NULL)
+		{
+			pos->generation = _FMAN_NO_POSITION;
+			pos->frame = frame;
+		}
+	}
+
+	osMutexRelease(fmanLock);
+
+	return found;
+}
+
+
+/*
+ * Position of the file (frame of a movie) in the index, returns false if it's not indexed
+ * */
+bool FMAN_GetPosition(const char* path, uint16_t frame, FmanPosition_t* pos)
+{
+	uint32_t n;
+	bool found = false;
+
+	osMutexAcquire(fmanLock, osWaitForever);
+
+	//Usually the file just returned by FMAN_FindNext()
+	if(lastPos.generation != _FMAN_NO_POSITION && compare_record(&last, path, frame) == 0)
+	{
+		*pos = lastPos;
+		found = true;
+	}
+	else if(!disabled && open_index())
+	{
+		found = find_record(path, frame, NULL, &n);
+		pos->record = n;
+		pos->generation = indexHeader.generation;
+		FSEEK_Close(indexFile);
+	}
+
+	pos->frame = frame;
+	if(!found)
+		pos->generation = _FMAN_NO_POSITION;
+
+	osMutexRelease(fmanLock);
+
+	return found;
+}
+
+
+/*
+ * Build the index again, the positions stored in flash become invalid
+ * */
+bool FMAN_Rebuild(void)
+{
+	bool ok;
+
+	osMutexAcquire(fmanLock, osWaitForever);
+
+	checked = false;
+	disabled = false;
+	SD_BeginWrite();
+	f_unlink(_FMAN_INDEX_PATH);
+	ok = open_index();
+	if(ok)
+		FSEEK_Close(indexFile);
+
+	osMutexRelease(fmanLock);
+
+	return ok;
+}
+
+
+/*
+ * Returns the header of the index checked against the card,
+ * count is 0 if there is no index
  * */
-bool FMAN_FindNext(char* new_path, const char* old_path)
+const FmanIndexHeader_t* FMAN_GetIndex(void)
+{
+	osMutexAcquire(fmanLock, osWaitForever);
+
+	if(open_index())
+		FSEEK_Close(indexFile);
+
+	osMutexRelease(fmanLock);
+
+	return &indexHeader;
+}
+
+
+/*
+ * Open the index and check that it matches the card, build it if it doesn't.
+ * The file is left open if true is returned
+ * */
+static bool open_index(void)
+{
+	uint32_t signature = 0;
+	uint32_t generation;
+	UINT read;
+	bool valid = false;
+
+	if(disabled)
+		return false;
+
+	if(FSEEK_Open(indexFile, _FMAN_INDEX_PATH) == FR_OK)
+	{
+		valid = f_read(indexFile, &indexHeader, sizeof(indexHeader), &read) == FR_OK && read == sizeof(indexHeader) &&
+				indexHeader.magic == _FMAN_INDEX_MAGIC && indexHeader.crc == header_crc(&indexHeader) &&
+				f_size(indexFile) == _FMAN_INDEX_OFFSET + indexHeader.count * sizeof(FmanRecord_t);
+
+		if(valid && checked && !stale)
+			return true;
+
+		if(valid && !stale && root_signature(&signature) && signature == indexHeader.signature)
+		{
+			checked = true;
+			return true;
+		}
+
+		FSEEK_Close(indexFile);
+	}
+
+	//The root directory has changed or there is no index
+	if(signature == 0 && !root_signature(&signature))
+	{
+		memset(&indexHeader, 0, sizeof(indexHeader));
+		return false;
+	}
+
+	generation = (valid ? indexHeader.generation + 1 : signature) & 0xffff;
+	if(generation == _FMAN_NO_POSITION)
+		generation = 0;
+
+	printf("Building the playlist index...\n");
+	if(!build_index(signature, generation) ||
+	   FSEEK_Open(indexFile, _FMAN_INDEX_PATH) != FR_OK)
+	{
+		printf("ERROR: Unable to build <%s>, searching the directories\n", _FMAN_INDEX_PATH);
+		f_unlink(_FMAN_INDEX_TEMP);
+		memset(&indexHeader, 0, sizeof(indexHeader));
+		disabled = true;
+		return false;
+	}
+	printf("Playlist index: %lu records\n", indexHeader.count);
+
+	checked = true;
+	stale = false;
+	lastPos.generation = _FMAN_NO_POSITION;
+
+	return true;
+}
+
+
+/*
+ * Write the records of every folder to a temporary file and replace the index with it,
+ * the header is written last and the rename is a single directory update
+ * */
+static bool build_index(uint32_t signature, uint32_t generation)
+{
+	char folder[_FILE_PATH_MAX_LEN] = "";
+	uint32_t count = 0;
+	UINT written;
+	bool ok;
+
+	SD_BeginWrite();
+	if(f_open(indexFile, _FMAN_INDEX_TEMP, FA_WRITE | FA_CREATE_ALWAYS) != FR_OK)
+		return false;
+
+	ok = f_lseek(indexFile, _FMAN_INDEX_OFFSET) == FR_OK;
+
+	while(ok && next_folder_name(folder))
+		ok = append_folder(folder, &count);
+
+	memset(&indexHeader, 0, sizeof(indexHeader));
+	indexHeader.magic = _FMAN_INDEX_MAGIC;
+	indexHeader.count = count;
+	indexHeader.generation = generation;
+	indexHeader.signature = signature;
+	indexHeader.crc = header_crc(&indexHeader);
+
+	ok = ok && f_lseek(indexFile, 0) == FR_OK &&
+		 f_write(indexFile, &indexHeader, sizeof(indexHeader), &written) == FR_OK && written == sizeof(indexHeader);
+
+	if(f_close(indexFile) != FR_OK)
+		ok = false;
+
+	if(ok)
+	{
+		f_unlink(_FMAN_INDEX_PATH);
+		ok = f_rename(_FMAN_INDEX_TEMP, _FMAN_INDEX_PATH) == FR_OK &&
+			 f_chmod(_FMAN_INDEX_PATH, AM_HID | AM_SYS, AM_HID | AM_SYS) == FR_OK;
+		FSEEK_Flush();
+	}
+
+	return ok;
+}
+
+
+/*
+ * Append the files of the folder in alphabetical order. The directory order is
+ * tried first, files copied in one go are usually already sorted
+ * */
+static bool append_folder(const char* folder, uint32_t* count)
+{
+	FSIZE_t start = f_tell(indexFile);
+	uint32_t first = *count;
+	FmanRecord_t rec;
+	FmanRecord_t prev;
+	FILINFO fno;
+	DIR dir;
+	bool sorted = true;
+	bool ok = true;
+	bool any = false;
+
+	if(f_opendir(&dir, folder) != FR_OK)
+		return false;
+
+	while(ok && f_readdir(&dir, &fno) == FR_OK && fno.fname[0] != '\0')
+	{
+		if(!is_playable(&fno))
+			continue;
+
+		fill_record(&rec, folder, &fno);
+		if(any && strcmp(rec.path, prev.path) <= 0)
+		{
+			sorted = false;
+			break;
+		}
+
+		ok = append_file(&rec, frame_count(rec.path), count);
+		prev = rec;
+		any = true;
+	}
+
+	f_closedir(&dir);
+
+	if(ok && !sorted)
+	{
+		*count = first;
+		ok = f_lseek(indexFile, start) == FR_OK && append_sorted(folder, count);
+	}
+
+	return ok;
+}
+
+
+/*
+ * Append the files of the folder sorting them on the card,
+ * sorted runs are merged until a single run is left
+ * */
+static bool append_sorted(const char* folder, uint32_t* count)
+{
+	const char* src = _FMAN_SORT_TEMP_A;
+	const char* dst = _FMAN_SORT_TEMP_B;
+	uint32_t records = 0;
+	bool ok = write_runs(folder, &records);
+
+	//The last pass writes the index
+	for(uint32_t width = _FMAN_SORT_RUN; ok && records > 0; width *= 2)
+	{
+		bool last = records <= 2 * width;
+
+		ok = merge_runs(src, last ? NULL : dst, width, records, count);
+		if(last)
+			break;
+
+		const char* tmp = src;
+		src = dst;
+		dst = tmp;
+	}
+
+	f_unlink(_FMAN_SORT_TEMP_A);
+	f_unlink(_FMAN_SORT_TEMP_B);
+
+	return ok;
+}
+
+
+/*
+ * Write the records of the folder to _FMAN_SORT_TEMP_A in sorted runs of _FMAN_SORT_RUN,
+ * the frame field holds the number of frames (corrupted movies are skipped)
+ * */
+static bool write_runs(const char* folder, uint32_t* records)
+{
+	FmanRecord_t rec;
+	FILINFO fno;
+	DIR dir;
+	UINT written;
+	bool ok = true;
+	int n = 0;
+
+	if(f_open(sortFile[1], _FMAN_SORT_TEMP_A, FA_WRITE | FA_CREATE_ALWAYS) != FR_OK)
+		return false;
+
+	if(f_opendir(&dir, folder) != FR_OK)
+	{
+		f_close(sortFile[1]);
+		return false;
+	}
+
+	for(bool end = false; ok && !end; )
+	{
+		end = f_readdir(&dir, &fno) != FR_OK || fno.fname[0] == '\0';
+
+		if(!end && is_playable(&fno))
+		{
+			fill_record(&rec, folder, &fno);
+			uint32_t frames = frame_count(rec.path);
+			if(frames == 0)
+				continue;
+			rec.frame = frames;
+
+			//Insert in order
+			int i = n++;
+			for(; i > 0 && strcmp(rec.path, batch[i - 1].path) < 0; i--)
+				batch[i] = batch[i - 1];
+			batch[i] = rec;
+		}
+
+		//Full run or the last one
+		if(n == _FMAN_SORT_RUN || (end && n > 0))
+		{
+			ok = f_write(sortFile[1], batch, n * sizeof(FmanRecord_t), &written) == FR_OK &&
+				 written == n * sizeof(FmanRecord_t);
+			*records += n;
+			n = 0;
+		}
+	}
+
+	f_closedir(&dir);
+
+	if(f_close(sortFile[1]) != FR_OK)
+		ok = false;
+
+	return ok;
+}
+
+
+/*
+ * Merge the runs of width records of src two by two into dst,
+ * into the index if dst is NULL (src holds at most two runs)
+ * */
+static bool merge_runs(const char* src, const char* dst, uint32_t width, uint32_t records, uint32_t* count)
+{
+	FIL* in[2] = {movieFile, sortFile[0]};
+	UINT read;
+	UINT written;
+	bool ok;
+
+	ok = f_open(in[0], src, FA_READ | FA_OPEN_EXISTING) == FR_OK;
+	if(!ok)
+		return false;
+
+	ok = f_open(in[1], src, FA_READ | FA_OPEN_EXISTING) == FR_OK;
+	if(!ok)
+	{
+		f_close(in[0]);
+		return false;
+	}
+
+	if(dst != NULL)
+		ok = f_open(sortFile[1], dst, FA_WRITE | FA_CREATE_ALWAYS) == FR_OK;
+
+	for(uint32_t start = 0; ok && start < records; start += 2 * width)
+	{
+		//Records left in each run
+		uint32_t left[2];
+		left[0] = records - start < width ? records - start : width;
+		left[1] = records - start - left[0] < width ? records - start - left[0] : width;
+
+		ok = f_lseek(in[0], start * sizeof(FmanRecord_t)) == FR_OK &&
+			 f_lseek(in[1], (start + left[0]) * sizeof(FmanRecord_t)) == FR_OK;
+
+		for(int i = 0; i < 2; i++)
+		{
+			if(ok && left[i] > 0)
+				ok = f_read(in[i], &heads[i], sizeof(FmanRecord_t), &read) == FR_OK && read == sizeof(FmanRecord_t);
+		}
+
+		while(ok && (left[0] > 0 || left[1] > 0))
+		{
+			//The first run wins on equal paths, the merge is stable
+			int i = left[1] == 0 || (left[0] > 0 && strcmp(heads[0].path, heads[1].path) <= 0) ? 0 : 1;
+
+			if(dst != NULL)
+				ok = f_write(sortFile[1], &heads[i], sizeof(FmanRecord_t), &written) == FR_OK && written == sizeof(FmanRecord_t);
+			else
+				ok = append_file(&heads[i], heads[i].frame, count);
+
+			if(ok && --left[i] > 0)
+				ok = f_read(in[i], &heads[i], sizeof(FmanRecord_t), &read) == FR_OK && read == sizeof(FmanRecord_t);
+		}
+	}
+
+	f_close(in[0]);
+	f_close(in[1]);
+	if(dst != NULL && f_close(sortFile[1]) != FR_OK)
+		ok = false;
+
+	return ok;
+}
+
+
+/*
+ * Append the records of the file, one record per frame for a movie
+ * (none if the movie is corrupted)
+ * */
+static bool append_file(const FmanRecord_t* rec, uint32_t frames, uint32_t* count)
+{
+	FmanRecord_t frame = *rec;
+	UINT written;
+
+	for(uint32_t i = 0; i < frames; i++)
+	{
+		frame.frame = i;
+		if(f_write(indexFile, &frame, sizeof(frame), &written) != FR_OK || written != sizeof(frame))
+			return false;
+	}
+
+	*count += frames;
+
+	return true;
+}
+
+
+/*
+ * Replace folder with the next folder of the root directory in alphabetical order,
+ * returns false after the last one
+ * */
+static bool next_folder_name(char* folder)
+{
+	char next[_FILE_PATH_MAX_LEN] = "";
+	FILINFO fno;
+	DIR dir;
+
+	if(f_opendir(&dir, "") != FR_OK)
+		return false;
+
+	while(f_readdir(&dir, &fno) == FR_OK && fno.fname[0] != '\0')
+	{
+		//Hidden and system folders (render cache, System Volume Information) are not played
+		if(!(fno.fattrib & AM_DIR) || (fno.fattrib & (AM_HID | AM_SYS)))
+			continue;
+
+		if(strcmp(fno.fname, folder) > 0 && (next[0] == '\0' || strcmp(fno.fname, next) < 0))
+			strcpy(next, fno.fname);
+	}
+
+	f_closedir(&dir);
+
+	strcpy(folder, next);
+
+	return folder[0] != '\0';
+}
+
+
+/*
+ * CRC of the visible entries of the root directory, a folder added, removed or renamed
+ * changes it. Writing a file in a folder changes the date of the folder on most systems
+ * */
+static bool root_signature(uint32_t* signature)
+{
+	uint32_t crc = 0;
+	FILINFO fno;
+	DIR dir;
+
+	if(f_opendir(&dir, "") != FR_OK)
+		return false;
+
+	while(f_readdir(&dir, &fno) == FR_OK && fno.fname[0] != '\0')
+	{
+		if(fno.fattrib & (AM_HID | AM_SYS))
+			continue;
+
+		crc = CRC32_Update(crc, fno.fname, strlen(fno.fname));
+		crc = CRC32_Update(crc, &fno.fattrib, sizeof(fno.fattrib));
+		crc = CRC32_Update(crc, &fno.fsize, sizeof(fno.fsize));
+		crc = CRC32_Update(crc, &fno.fdate, sizeof(fno.fdate));
+		crc = CRC32_Update(crc, &fno.ftime, sizeof(fno.ftime));
+	}
+
+	f_closedir(&dir);
+
+	//0 means not computed
+	*signature = crc != 0 ? crc : 1;
+
+	return true;
+}
+
+
+/*
+ * Read record n of the open index
+ * */
+static bool read_record(uint32_t n, FmanRecord_t* rec)
+{
+	UINT read;
+
+	return n < indexHeader.count &&
+		   f_lseek(indexFile, _FMAN_INDEX_OFFSET + n * sizeof(FmanRecord_t)) == FR_OK &&
+		   f_read(indexFile, rec, sizeof(FmanRecord_t), &read) == FR_OK && read == sizeof(FmanRecord_t);
+}
+
+
+/*
+ * Find the record of the path and frame, tries the position first and then a binary search.
+ * If the record is not in the index false is returned and n is the record that would follow it
+ * */
+static bool find_record(const char* path, uint16_t frame, const FmanPosition_t* pos, uint32_t* n)
+{
+	FmanRecord_t rec;
+	uint32_t lo = 0;
+	uint32_t hi = indexHeader.count;
+
+	if(pos != NULL && pos->generation == indexHeader.generation &&
+	   read_record(pos->record, &rec) && compare_record(&rec, path, frame) == 0)
+	{
+		*n = pos->record;
+		return true;
+	}
+
+	if(lastPos.generation == indexHeader.generation && compare_record(&last, path, frame) == 0)
+	{
+		*n = lastPos.record;
+		return true;
+	}
+
+	//Records are sorted by path and frame
+	while(lo < hi)
+	{
+		uint32_t mid = lo + (hi - lo) / 2;
+
+		if(!read_record(mid, &rec))
+			break;
+
+		if(compare_record(&rec, path, frame) < 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	*n = lo;
+
+	return read_record(lo, &rec) && compare_record(&rec, path, frame) == 0;
+}
+
+
+/*
+ * Order of the records, by path and then by frame
+ * */
+static int compare_record(const FmanRecord_t* rec, const char* path, uint16_t frame)
+{
+	int res = strcmp(rec->path, path);
+
+	if(res != 0)
+		return res;
+
+	return (int)rec->frame - (int)frame;
+}
+
+
+/*
+ * Check that the file of the record hasn't changed since the index was built
+ * */
+static bool check_record(const FmanRecord_t* rec)
+{
+	FILINFO fno;
+
+	return f_stat(rec->path, &fno) == FR_OK && is_playable(&fno) &&
+		   fno.fsize == rec->size && fno.fdate == rec->date && fno.ftime == rec->time;
+}
+
+
+/*
+ * Regular files that are not hidden
+ * */
+static bool is_playable(const FILINFO* fno)
+{
+	return fno->fname[0] != '\0' && !(fno->fattrib & (AM_DIR | AM_HID | AM_SYS));
+}
+
+
+/*
+ * Record of a file
+ * */
+static void fill_record(FmanRecord_t* rec, const char* folder, const FILINFO* fno)
+{
+	memset(rec, 0, sizeof(FmanRecord_t));
+	snprintf(rec->path, sizeof(rec->path), "%s/%s", folder, fno->fname);
+	rec->size = fno->fsize;
+	rec->date = fno->fdate;
+	rec->time = fno->ftime;
+}
+
+
+/*
+ * Number of frames of a movie (0 if it's corrupted), 1 for other files
+ * */
+static uint32_t frame_count(const char* path)
+{
+	uint32_t frames = 0;
+
+	if(!MOV_IsMovieName(path))
+		return 1;
+
+	if(f_open(movieFile, path, FA_READ | FA_OPEN_EXISTING) == FR_OK)
+	{
+		frames = MOV_GetFrameCount(movieFile);
+		f_close(movieFile);
+	}
+
+	if(frames == 0)
+		printf("ERROR: Invalid movie <%s>, skipped\n", path);
+
+	return frames;
+}
+
+
+/*
+ * CRC of the header fields before the crc
+ * */
+static uint32_t header_crc(const FmanIndexHeader_t* hdr)
+{
+	return CRC32_Update(0, hdr, offsetof(FmanIndexHeader_t, crc));
+}
+
+
+/*
+ * Find next file to display searching the directories, used without the index.
+ * frame is the frame of old_path and is updated with the frame of new_path
+ * */
+static bool find_next_scan(char* new_path, const char* old_path, uint16_t* frame)
 {
 	char folder[_MAX_LFN+1];
 	char file[_MAX_LFN+1];
 	bool change_folder = true;
 
+	//Next frame of the same movie
+	if(MOV_IsMovieName(old_path) && *frame + 1 < frame_count(old_path))
+	{
+		strcpy(new_path, old_path);
+		(*frame)++;
+		return true;
+	}
+
+	*frame = 0;
+
 	extract_folder_file(folder, file, old_path);
 
 
@@ -164,6 +897,10 @@ static void find_next_folder(char* folder)
 		//Read next entry
 		fres = f_readdir(&dp, &fno);
 
+		//Hidden and system folders (render cache, System Volume Information) are not played
+		if(fno.fattrib & (AM_HID | AM_SYS))
+			continue;
+
 		//Find the first folder name
 		if((fno.fattrib & AM_DIR) && (*fno.fname != '\0') && (strcmp(fno.fname, first_folder) < 0 || first_entry))
 		{
@@ -229,4 +966,7 @@ static void find_first_file(const char* folder, char* file)
 			strcpy(file, fno.fname);
 		}
 	}
+
+	//Open directories hold an entry of the _FS_LOCK table
+	f_closedir(&dp);
 }
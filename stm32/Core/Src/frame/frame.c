@@ -0,0 +1,319 @@
+/**
+ ******************************************************************************
+ * @file      frame.c
+ * @author    ts-manuel
+ * @brief     Pre-rendered frames (.epd files)
+ *
+ ******************************************************************************
+ */
+
+#include "frame/frame.h"
+#include "crc32.h"
+#include "profiler.h"
+#include "arena.h"
+
+typedef struct
+{
+	FIL* fp;
+	uint8_t* buff;			//_FRM_CHUNK_SIZE bytes
+	UINT len;				//Bytes in the buffer
+	UINT pos;				//Next byte to be read from the buffer
+	uint32_t remaining;		//Bytes still in the file
+	uint32_t crc;			//CRC of the bytes read so far
+	bool error;				//Read error or end of data
+} LZInput_t;
+
+static bool read_header(FIL* fp, FSIZE_t base, FRM_Header_t* header);
+static bool check_header(const FRM_Header_t* header);
+static bool display_raw(FIL* fp, const FRM_Header_t* header);
+static bool display_lz(FIL* fp, const FRM_Header_t* header);
+static uint8_t lz_read_byte(LZInput_t* in);
+static uint32_t lz_read_length(LZInput_t* in, uint32_t len);
+
+
+/*
+ * Returns true if the file starts with a frame header,
+ * the file pointer is moved back to the beginning of the file
+ * */
+bool FRM_IsFrame(FIL* fp)
+{
+	FRM_Header_t header;
+	uint32_t start = PROF_Start();
+	bool res = read_header(fp, 0, &header);
+
+	f_lseek(fp, 0);
+	PROF_Add(e_ProfHeader, start);
+
+	return res;
+}
+
+
+/*
+ * Stream the pixel data from the file to the display,
+ * must be called between DISP_BeginUpdate() and DISP_EndUpdate().
+ * Returns false if the header is invalid or the file is corrupted
+ * */
+bool FRM_Display(FIL* fp)
+{
+	return FRM_DisplayAt(fp, 0);
+}
+
+
+/*
+ * Stream the frame stored at offset base of the file (frame of a movie)
+ * */
+bool FRM_DisplayAt(FIL* fp, FSIZE_t base)
+{
+	FRM_Header_t header;
+	uint32_t ccm_mark = ARENA_Mark(&arena_ccm);
+	uint32_t sram_mark = ARENA_Mark(&arena_sram);
+	bool res;
+
+	if(!read_header(fp, base, &header) || !check_header(&header))
+		return false;
+
+	if(f_lseek(fp, base + header.data_offset) != FR_OK)
+	{
+		printf("ERROR: Frame data missing\n");
+		return false;
+	}
+
+	if(header.format == _FRM_FORMAT_LZ)
+		res = display_lz(fp, &header);
+	else
+		res = display_raw(fp, &header);
+
+	ARENA_Release(&arena_sram, sram_mark);
+	ARENA_Release(&arena_ccm, ccm_mark);
+
+	return res;
+}
+
+
+/*
+ * Stream uncompressed pixel data, the next chunk is read
+ * while the previous one is sent to the display by DMA
+ * */
+static bool display_raw(FIL* fp, const FRM_Header_t* header)
+{
+	uint8_t (*buff)[_FRM_CHUNK_SIZE] = ARENA_Alloc(&arena_sram, 2 * _FRM_CHUNK_SIZE);
+	uint32_t crc = 0;
+	uint32_t remaining;
+	int index = 0;
+
+	if(buff == NULL)
+		return false;
+
+	remaining = header->data_size;
+	while(remaining > 0)
+	{
+		UINT len = remaining < _FRM_CHUNK_SIZE ? remaining : _FRM_CHUNK_SIZE;
+		UINT read;
+		uint32_t start = PROF_Start();
+		FRESULT fres = f_read(fp, buff[index], len, &read);
+
+		PROF_Add(e_ProfSDRead, start);
+
+		if(fres != FR_OK || read != len)
+		{
+			printf("ERROR: Frame file ended prematurely\n");
+			DBUS_WaitIdle();
+			return false;
+		}
+
+		crc = CRC32_Update(crc, buff[index], len);
+		DISP_SendRow(buff[index], len);
+
+		remaining -= len;
+		index ^= 1;
+	}
+
+	//Wait for the DMA to complete before the buffers are released
+	DBUS_WaitIdle();
+
+	if(crc != header->crc)
+	{
+		printf("ERROR: Frame CRC mismatch\n");
+		return false;
+	}
+
+	return true;
+}
+
+
+/*
+ * Decompress pixel data, only the last _FRM_LZ_WINDOW output bytes are kept
+ * for the matches, the output goes to the display row buffers byte by byte
+ * */
+static bool display_lz(FIL* fp, const FRM_Header_t* header)
+{
+	LZInput_t in;
+	uint8_t* window = ARENA_Alloc(&arena_ccm, _FRM_LZ_WINDOW);
+	const uint32_t total = _DISPLAY_ROW_BYTES * _DISPLAY_HEIGHT;
+	uint32_t out = 0;
+
+	if(window == NULL || (in.buff = ARENA_Alloc(&arena_sram, _FRM_CHUNK_SIZE)) == NULL)
+		return false;
+
+	in.fp = fp;
+	in.len = 0;
+	in.pos = 0;
+	in.remaining = header->data_size;
+	in.crc = 0;
+	in.error = false;
+
+	while(out < total && !in.error)
+	{
+		uint8_t token = lz_read_byte(&in);
+		uint32_t literals = lz_read_length(&in, token >> 4);
+
+		//Copy literals
+		if(literals > total - out)
+			break;
+
+		for(uint32_t i = 0; i < literals; i++)
+		{
+			uint8_t data = lz_read_byte(&in);
+			window[out & (_FRM_LZ_WINDOW-1)] = data;
+			DISP_SendData(data);
+			out++;
+		}
+
+		if(out >= total)
+			break;
+
+		//Copy match
+		uint32_t offset = lz_read_byte(&in);
+		offset |= (uint32_t)lz_read_byte(&in) << 8;
+		uint32_t match = lz_read_length(&in, token & 0x0f) + _FRM_LZ_MIN_MATCH;
+
+		if(offset == 0 || offset > _FRM_LZ_WINDOW || offset > out || match > total - out)
+			break;
+
+		for(uint32_t i = 0; i < match; i++)
+		{
+			uint8_t data = window[(out - offset) & (_FRM_LZ_WINDOW-1)];
+			window[out & (_FRM_LZ_WINDOW-1)] = data;
+			DISP_SendData(data);
+			out++;
+		}
+	}
+
+	//All the compressed data must be used to produce exactly one frame
+	if(in.error || out != total || in.pos != in.len || in.remaining != 0)
+	{
+		printf("ERROR: Frame data corrupted\n");
+		return false;
+	}
+
+	if(in.crc != header->crc)
+	{
+		printf("ERROR: Frame CRC mismatch\n");
+		return false;
+	}
+
+	return true;
+}
+
+
+/*
+ * Returns the next byte of compressed data, reads the next chunk from the file when needed
+ * */
+static uint8_t lz_read_byte(LZInput_t* in)
+{
+	if(in->pos >= in->len)
+	{
+		UINT len = in->remaining < _FRM_CHUNK_SIZE ? in->remaining : _FRM_CHUNK_SIZE;
+		uint32_t start = PROF_Start();
+		FRESULT fres = FR_OK;
+
+		if(len > 0)
+			fres = f_read(in->fp, in->buff, len, &in->len);
+		PROF_Add(e_ProfSDRead, start);
+
+		if(len == 0 || fres != FR_OK || in->len != len)
+		{
+			in->error = true;
+			in->len = 0;
+			in->pos = 0;
+			return 0;
+		}
+
+		in->crc = CRC32_Update(in->crc, in->buff, len);
+		in->remaining -= len;
+		in->pos = 0;
+	}
+
+	return in->buff[in->pos++];
+}
+
+
+/*
+ * Read the continuation bytes of a literal or match length
+ * */
+static uint32_t lz_read_length(LZInput_t* in, uint32_t len)
+{
+	if(len == 15)
+	{
+		uint8_t data;
+
+		do
+		{
+			data = lz_read_byte(in);
+			len += data;
+		} while(data == 255 && !in->error);
+	}
+
+	return len;
+}
+
+
+/*
+ * Read header at offset base of the file and check the magic number
+ * */
+static bool read_header(FIL* fp, FSIZE_t base, FRM_Header_t* header)
+{
+	UINT read;
+
+	if(f_lseek(fp, base) != FR_OK)
+		return false;
+
+	if(f_read(fp, header, sizeof(FRM_Header_t), &read) != FR_OK || read != sizeof(FRM_Header_t))
+		return false;
+
+	return memcmp(header->magic, _FRM_MAGIC, 4) == 0;
+}
+
+
+/*
+ * Check that the frame can be displayed
+ * */
+static bool check_header(const FRM_Header_t* header)
+{
+	if(header->version != _FRM_VERSION)
+	{
+		printf("ERROR: Frame version not supported: %d\n", (int)header->version);
+		return false;
+	}
+
+	if(header->width != _DISPLAY_WIDTH || header->height != _DISPLAY_HEIGHT)
+	{
+		printf("ERROR: Frame size %dx%d does not match the display\n", (int)header->width, (int)header->height);
+		return false;
+	}
+
+	if(header->palette != _PANEL_PALETTE)
+	{
+		printf("ERROR: Frame palette not supported: %d\n", (int)header->palette);
+		return false;
+	}
+
+	if(!(header->format == _FRM_FORMAT_RAW && header->data_size == _DISPLAY_ROW_BYTES * _DISPLAY_HEIGHT) &&
+	   !(header->format == _FRM_FORMAT_LZ && header->data_size > 0))
+	{
+		printf("ERROR: Frame format not supported: %d\n", (int)header->format);
+		return false;
+	}
+
+	return true;
+}
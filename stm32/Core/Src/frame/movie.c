@@ -0,0 +1,113 @@
+/**
+ ******************************************************************************
+ * @file      movie.c
+ * @author    ts-manuel
+ * @brief     Movie containers (.epm files)
+ *
+ ******************************************************************************
+ */
+
+#include "frame/movie.h"
+#include "crc32.h"
+#include "profiler.h"
+#include <ctype.h>
+#include <stddef.h>
+
+static bool read_header(FIL* fp, MOV_Header_t* header);
+
+
+/*
+ * Returns true if the file name has the movie extension
+ * */
+bool MOV_IsMovieName(const char* path)
+{
+	const char* ext = strrchr(path, '.');
+
+	if(ext == NULL || strlen(ext) != strlen(_MOV_EXTENSION))
+		return false;
+
+	for(int i = 0; ext[i] != '\0'; i++)
+	{
+		if(toupper((unsigned char)ext[i]) != _MOV_EXTENSION[i])
+			return false;
+	}
+
+	return true;
+}
+
+
+/*
+ * Returns the number of frames or 0 if the file is not a movie,
+ * the file pointer is moved back to the beginning of the file
+ * */
+uint32_t MOV_GetFrameCount(FIL* fp)
+{
+	MOV_Header_t header;
+	uint32_t start = PROF_Start();
+	bool res = read_header(fp, &header);
+
+	f_lseek(fp, 0);
+	PROF_Add(e_ProfHeader, start);
+
+	return res ? header.frame_count : 0;
+}
+
+
+/*
+ * Move the file pointer to the beginning of the frame,
+ * returns false if the frame doesn't exist or its entry is invalid
+ * */
+bool MOV_Seek(FIL* fp, uint32_t frame, MOV_Entry_t* entry)
+{
+	uint32_t start = PROF_Start();
+	MOV_Header_t header;
+	UINT read;
+	bool res = false;
+
+	if(!read_header(fp, &header))
+		return false;
+
+	if(frame >= header.frame_count)
+	{
+		printf("ERROR: Movie frame %lu out of range (%lu frames)\n", frame, header.frame_count);
+		return false;
+	}
+
+	if(f_lseek(fp, header.table_offset + frame * sizeof(MOV_Entry_t)) == FR_OK &&
+	   f_read(fp, entry, sizeof(MOV_Entry_t), &read) == FR_OK && read == sizeof(MOV_Entry_t))
+	{
+		res = entry->offset >= header.table_offset + header.frame_count * sizeof(MOV_Entry_t) &&
+			  entry->length <= f_size(fp) && entry->offset <= f_size(fp) - entry->length &&
+			  (entry->type == _MOV_TYPE_JPEG || entry->type == _MOV_TYPE_FRAME) &&
+			  f_lseek(fp, entry->offset) == FR_OK;
+	}
+
+	PROF_Add(e_ProfHeader, start);
+
+	if(!res)
+		printf("ERROR: Movie frame %lu corrupted\n", frame);
+
+	return res;
+}
+
+
+/*
+ * Read the header from the beginning of the file and check it
+ * */
+static bool read_header(FIL* fp, MOV_Header_t* header)
+{
+	UINT read;
+
+	if(f_lseek(fp, 0) != FR_OK)
+		return false;
+
+	if(f_read(fp, header, sizeof(MOV_Header_t), &read) != FR_OK || read != sizeof(MOV_Header_t))
+		return false;
+
+	return memcmp(header->magic, _MOV_MAGIC, 4) == 0 && header->version == _MOV_VERSION &&
+		   header->crc == CRC32_Update(0, header, offsetof(MOV_Header_t, crc)) &&
+		   header->frame_count > 0 && header->frame_count <= _MOV_MAX_FRAMES &&
+		   header->table_offset >= sizeof(MOV_Header_t) &&
+		   header->table_offset + header->frame_count * sizeof(MOV_Entry_t) <= f_size(fp);
+}
+
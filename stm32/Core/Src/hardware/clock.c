@@ -0,0 +1,367 @@
+/**
+ ******************************************************************************
+ * @file      clock.c
+ * @author    ts-manuel
+ * @brief     Clock governor
+ *
+ ******************************************************************************
+ */
+
+#include "hardware/clock.h"
+#include <string.h>
+#include "main.h"
+#include "cmsis_os.h"
+#include "FreeRTOS.h"
+
+typedef struct
+{
+	const char* name;
+	uint32_t ahb_div;	//RCC_SYSCLK_DIVx
+	uint32_t apb1_div;	//RCC_HCLK_DIVx, PCLK1 = 4.5MHz
+	uint32_t apb2_div;	//RCC_HCLK_DIVx, PCLK2 = 9MHz
+	uint32_t latency;	//Flash wait states at 3.3V
+	uint32_t hclk;		//Resulting core clock
+} ClockLevelConfig_t;
+
+typedef struct
+{
+	osThreadId_t thread;
+	bool used;
+	uint16_t requests[e_ClockLevels];
+	uint16_t waits;		//The requests of the task are ignored while it waits
+} ClockHolder_t;
+
+static const ClockLevelConfig_t levels[e_ClockLevels] = {
+	{"low",    RCC_SYSCLK_DIV4, RCC_HCLK_DIV4,  RCC_HCLK_DIV2, FLASH_LATENCY_0, _CLK_SYSCLK_HZ / 4},
+	{"medium", RCC_SYSCLK_DIV2, RCC_HCLK_DIV8,  RCC_HCLK_DIV4, FLASH_LATENCY_1, _CLK_SYSCLK_HZ / 2},
+	{"high",   RCC_SYSCLK_DIV1, RCC_HCLK_DIV16, RCC_HCLK_DIV8, FLASH_LATENCY_2, _CLK_SYSCLK_HZ}
+};
+
+//USB is always enabled, every level must keep the core fast enough for it
+_Static_assert(_CLK_SYSCLK_HZ / 4 >= _CLK_USB_MIN_HCLK_HZ, "The lowest level is too slow for USB");
+_Static_assert(_CLK_SYSCLK_HZ * 2 / 3 == _CLK_PLL48_HZ, "PLLQ must give 48MHz for USB");
+
+extern SPI_HandleTypeDef hspi1;
+extern SD_HandleTypeDef hsd;
+extern UART_HandleTypeDef huart3;
+
+static ClockHolder_t holders[_CLK_MAX_HOLDERS];
+static ClockLevel_e current = e_ClockHigh;
+static ClockResidency_t residency;
+static uint32_t lastTick;
+static uint32_t sdioMax = _CLK_SDIO_MAX_HZ;
+static bool initialized = false;
+
+static ClockHolder_t* GetHolder(void);
+static void Update(void);
+static void ApplyLevel(ClockLevel_e level);
+static void UpdatePeripherals(void);
+
+
+/*
+ * Called once after the peripherals are initialized,
+ * SystemClock_Config() leaves the core at the high level
+ * */
+void CLK_Init(void)
+{
+	memset(holders, 0, sizeof(holders));
+	memset(&residency, 0, sizeof(residency));
+	current = e_ClockHigh;
+	lastTick = HAL_GetTick();
+	initialized = true;
+
+	Update();
+}
+
+
+/*
+ * Request at least the given level until CLK_Release() is called
+ * with the same level, requests can be nested
+ * */
+void CLK_Request(ClockLevel_e level)
+{
+	int32_t lock = osKernelLock();
+	GetHolder()->requests[level]++;
+	Update();
+	osKernelRestoreLock(lock);
+}
+
+
+/*
+ * Release a level requested with CLK_Request()
+ * */
+void CLK_Release(ClockLevel_e level)
+{
+	int32_t lock = osKernelLock();
+	ClockHolder_t* holder = GetHolder();
+	if(holder->requests[level] > 0)
+		holder->requests[level]--;
+	Update();
+	osKernelRestoreLock(lock);
+}
+
+
+/*
+ * Ignore the requests of the calling task while it waits for I/O,
+ * the other tasks keep their level. Waits can be nested
+ * */
+void CLK_BeginWait(void)
+{
+	int32_t lock = osKernelLock();
+	GetHolder()->waits++;
+	Update();
+	osKernelRestoreLock(lock);
+}
+
+
+/*
+ * Restore the requested level at the end of the wait
+ * */
+void CLK_EndWait(void)
+{
+	int32_t lock = osKernelLock();
+	ClockHolder_t* holder = GetHolder();
+	if(holder->waits > 0)
+		holder->waits--;
+	Update();
+	osKernelRestoreLock(lock);
+}
+
+
+/*
+ * The core wakes up from stop mode running from HSI, start HSE and PLL again.
+ * The prescalers and the flash latency are retained so the level is unchanged
+ * */
+void CLK_ResumeFromStop(void)
+{
+	__HAL_RCC_HSE_CONFIG(RCC_HSE_ON);
+	while(__HAL_RCC_GET_FLAG(RCC_FLAG_HSERDY) == RESET);
+
+	__HAL_RCC_PLL_ENABLE();
+	while(__HAL_RCC_GET_FLAG(RCC_FLAG_PLLRDY) == RESET);
+
+	__HAL_RCC_SYSCLK_CONFIG(RCC_SYSCLKSOURCE_PLLCLK);
+	while(__HAL_RCC_GET_SYSCLK_SOURCE() != RCC_SYSCLKSOURCE_STATUS_PLLCLK);
+
+	SystemCoreClockUpdate();
+}
+
+
+/*
+ * Returns the level the core is running at
+ * */
+ClockLevel_e CLK_GetLevel(void)
+{
+	return current;
+}
+
+
+/*
+ * Returns the time spent at each level, including the current one
+ * */
+const ClockResidency_t* CLK_GetResidency(void)
+{
+	uint32_t now = HAL_GetTick();
+	residency.ms[current] += now - lastTick;
+	lastTick = now;
+
+	return &residency;
+}
+
+
+/*
+ * Reset the residency counters
+ * */
+void CLK_ClearResidency(void)
+{
+	memset(&residency, 0, sizeof(residency));
+	lastTick = HAL_GetTick();
+}
+
+
+/*
+ * Returns the name of the level
+ * */
+const char* CLK_GetLevelName(ClockLevel_e level)
+{
+	return level < e_ClockLevels ? levels[level].name : "?";
+}
+
+
+/*
+ * Returns the core clock of the level in Hz
+ * */
+uint32_t CLK_GetLevelFrequency(ClockLevel_e level)
+{
+	return level < e_ClockLevels ? levels[level].hclk : 0;
+}
+
+
+/*
+ * Lower the SD card clock by one divider step after a data error,
+ * returns false if it's already at _CLK_SDIO_MIN_HZ
+ * */
+bool CLK_LowerSDIOClock(void)
+{
+	int32_t lock = osKernelLock();
+	bool res = CLK_GetSDIOFrequency() > _CLK_SDIO_MIN_HZ;
+
+	if(res)
+	{
+		sdioMax = _CLK_PLL48_HZ / (hsd.Init.ClockDiv + 3);
+		UpdatePeripherals();
+	}
+
+	osKernelRestoreLock(lock);
+
+	return res;
+}
+
+
+/*
+ * Returns the SD card clock in Hz
+ * */
+uint32_t CLK_GetSDIOFrequency(void)
+{
+	return _CLK_PLL48_HZ / (hsd.Init.ClockDiv + 2);
+}
+
+
+/*
+ * Returns the requests of the calling task,
+ * the last entry is shared when there are more tasks than entries
+ * */
+static ClockHolder_t* GetHolder(void)
+{
+	osThreadId_t thread = osThreadGetId();
+	ClockHolder_t* free = NULL;
+
+	for(int i = 0; i < _CLK_MAX_HOLDERS; i++)
+	{
+		if(holders[i].used && holders[i].thread == thread)
+			return &holders[i];
+		if(!holders[i].used && free == NULL)
+			free = &holders[i];
+	}
+
+	if(free == NULL)
+		return &holders[_CLK_MAX_HOLDERS - 1];
+
+	free->thread = thread;
+	free->used = true;
+
+	return free;
+}
+
+
+/*
+ * Switch to the highest level requested by a task that isn't waiting,
+ * or to the default one if there is none
+ * */
+static void Update(void)
+{
+	ClockLevel_e level = _CLK_DEFAULT_LEVEL;
+
+	if(!initialized)
+		return;
+
+	for(int h = 0; h < _CLK_MAX_HOLDERS; h++)
+	{
+		for(int i = e_ClockLevels - 1; i > level && holders[h].waits == 0; i--)
+		{
+			if(holders[h].requests[i] > 0)
+			{
+				level = i;
+				break;
+			}
+		}
+	}
+
+	if(level != current)
+	{
+		uint32_t now = HAL_GetTick();
+		residency.ms[current] += now - lastTick;
+		residency.switches++;
+		lastTick = now;
+
+		ApplyLevel(level);
+		current = level;
+	}
+}
+
+
+/*
+ * Change the AHB and APB prescalers and update everything that
+ * depends on the core clock
+ * */
+static void ApplyLevel(ClockLevel_e level)
+{
+	const ClockLevelConfig_t* cfg = &levels[level];
+	uint32_t pclk2 = HAL_RCC_GetPCLK2Freq();
+
+	//More wait states before raising the clock, fewer after lowering it
+	if(cfg->latency > __HAL_FLASH_GET_LATENCY())
+		__HAL_FLASH_SET_LATENCY(cfg->latency);
+
+	//All the prescalers are written at once so that the APB clocks don't glitch
+	MODIFY_REG(RCC->CFGR, RCC_CFGR_HPRE | RCC_CFGR_PPRE1 | RCC_CFGR_PPRE2,
+			cfg->ahb_div | cfg->apb1_div | (cfg->apb2_div << 3));
+
+	if(cfg->latency < __HAL_FLASH_GET_LATENCY())
+		__HAL_FLASH_SET_LATENCY(cfg->latency);
+
+	SystemCoreClockUpdate();
+
+	//The RTOS tick is generated by SysTick from the core clock
+	SysTick->LOAD = SystemCoreClock / configTICK_RATE_HZ - 1;
+	SysTick->VAL = 0;
+
+	//The HAL tick is generated by TIM1 from PCLK2
+	if(HAL_RCC_GetPCLK2Freq() != pclk2)
+		HAL_InitTick(uwTickPrio);
+
+	UpdatePeripherals();
+}
+
+
+/*
+ * Derive the SPI, SDIO and UART dividers from the current APB clocks,
+ * the registers are written only if the value changes
+ * */
+static void UpdatePeripherals(void)
+{
+	uint32_t pclk1 = HAL_RCC_GetPCLK1Freq();
+	uint32_t pclk2 = HAL_RCC_GetPCLK2Freq();
+
+	//SPI1 (PCLK2 / 2^(BR+1)), fastest clock the display accepts
+	uint32_t br = 0;
+	while(br < 7 && (pclk2 >> (br + 1)) > _CLK_SPI_MAX_HZ)
+		br++;
+	br <<= SPI_CR1_BR_Pos;
+	if(hspi1.Init.BaudRatePrescaler != br)
+	{
+		while(hspi1.State != HAL_SPI_STATE_READY);
+		hspi1.Init.BaudRatePrescaler = br;
+		MODIFY_REG(hspi1.Instance->CR1, SPI_CR1_BR, br);
+	}
+
+	//SDIO (48MHz / (CLKDIV + 2)), PCLK2 must be at least 3/8 of the SD clock
+	uint32_t sdio_max = sdioMax;
+	if(pclk2 / 3 * 8 < sdio_max)
+		sdio_max = pclk2 / 3 * 8;
+	uint32_t div = (_CLK_PLL48_HZ + sdio_max - 1) / sdio_max;
+	div = div > 2 ? div - 2 : 0;
+	if(hsd.Init.ClockDiv != div)
+	{
+		hsd.Init.ClockDiv = div;
+
+		//During the card identification the HAL uses its own divider
+		if(hsd.State == HAL_SD_STATE_READY)
+			MODIFY_REG(hsd.Instance->CLKCR, SDIO_CLKCR_CLKDIV, div);
+	}
+
+	//USART3 (PCLK1), 16x oversampling
+	uint32_t brr = UART_BRR_SAMPLING16(pclk1, huart3.Init.BaudRate);
+	if(huart3.Instance->BRR != brr)
+		huart3.Instance->BRR = brr;
+}
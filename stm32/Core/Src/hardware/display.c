@@ -8,41 +8,142 @@
  */
 
 #include "hardware/display.h"
+#include "hardware/power.h"
+#include "profiler.h"
+#include "arena.h"
+#include "crc32.h"
+#include "main.h"
+#include "cmsis_os.h"
+
+#define ROW_PIXEL_R(row, x) (row)[(x)*3    ]
+#define ROW_PIXEL_G(row, x) (row)[(x)*3 + 1]
+#define ROW_PIXEL_B(row, x) (row)[(x)*3 + 2]
+
+typedef struct
+{
+	uint8_t slot;		//Index of the stripe slot
+	uint8_t height;		//Rows in the stripe
+	bool first;			//First stripe of the image
+} StripeMessage_t;
+
+//Stripes of decoded pixels, filled by the decoder and dithered by the output task
+static uint8_t (*slots)[_DISPLAY_SLOT_BYTES];
+static osMessageQueueId_t freeSlots;	//Indices of the slots that can be filled
+static osMessageQueueId_t fullSlots;	//Stripes waiting for the output task
+static volatile bool outputRunning;
+static bool pipelined;
+static int currentSlot = -1;
+static int stripeIndex;
+static DisplayPipelineStats_t pipelineStats;
+static DisplayPipelineStats_t updateStats;	//Stats of the last update, the render changes pipelineStats
+
+//Owned by the update or by the render from the beginning to the end of the data
+static osMutexId_t pipelineLock;
+
+//Set once the refresh command is sent or the update ends, the CPU is free until BUSY
+#define _DISPLAY_EVENT_REFRESH	0x0001
+static osEventFlagsId_t displayEvents;
+
+//File receiving the packed pixels between DISP_BeginRender() and DISP_EndRender()
+static FIL* renderFile;
+static uint32_t renderCrc;
+static bool renderError;
+
+//Rows of the dither, the last one carries the error into the next stripe (CCM RAM)
+static int16_t (*ditherRows)[_DISPLAY_WIDTH * 3];
 
-#define _STRIPE_HEIGHT 16
-#define STRIPE_PIXEL_R(x, y) stripe[((y)*EPD_5IN65F_WIDTH + (x))*3    ]
-#define STRIPE_PIXEL_G(x, y) stripe[((y)*EPD_5IN65F_WIDTH + (x))*3 + 1]
-#define STRIPE_PIXEL_B(x, y) stripe[((y)*EPD_5IN65F_WIDTH + (x))*3 + 2]
-static int16_t stripe[EPD_5IN65F_WIDTH * (_STRIPE_HEIGHT+1) * 3];
 static int pixelCount;
 static int stripeCounter;
-static int stripeHeight = _STRIPE_HEIGHT;
-static int stripeSize = EPD_5IN65F_WIDTH * _STRIPE_HEIGHT;
+static int stripeHeight = _DISPLAY_STRIPE_HEIGHT;
+static int stripeSize = _DISPLAY_WIDTH * _DISPLAY_STRIPE_HEIGHT;
+
+//Pixels packed into the current byte
+static uint8_t pixelByte;
+static int pixelBits;
 
+#if _PANEL_PLANES == 2
+//The second plane is sent after the first one, it is kept in RAM
+static uint8_t* planeBuffer;
+static uint8_t planeByte;
+#endif
+
+#if _PANEL_PARTIAL
+//The first plane is kept in RAM until the changed window is known
+static uint8_t* frameBuffer;
+#endif
 
-const RGB16_t display_colors[_NUM_COLORS+1] = {
-		{0x00, 0x00, 0x00},	//EPD_5IN65F_BLACK
-		{0xff, 0xff, 0xff},	//EPD_5IN65F_WHITE
-		{0x00, 0xff, 0x00},	//EPD_5IN65F_GREEN
-		{0x00, 0x00, 0xff},	//EPD_5IN65F_BLUE
-		{0xff, 0x00, 0x00},	//EPD_5IN65F_RED
-		{0xff, 0xff, 0x00},	//EPD_5IN65F_YELLOW
-		{0xff, 0x80, 0x00},	//EPD_5IN65F_ORANGE
-		{0xaa, 0x6e, 0x96}	//EPD_5IN65F_CLEAN
-};
+//Double buffered rows, one is filled while the other one is sent by DMA
+static uint8_t (*rowBuffer)[_DISPLAY_ROW_BYTES];
+static int rowIndex;
+static int rowPtr;
 
+//Hash of each tile of the image, compared with the previous image stored in backup SRAM
+#define _TILE_BYTES	(_DISPLAY_TILE_SIZE / _DISPLAY_PIXELS_PER_BYTE)
+#define _TILE_COLS	((_DISPLAY_WIDTH + _DISPLAY_TILE_SIZE - 1) / _DISPLAY_TILE_SIZE)
+#define _TILE_ROWS	((_DISPLAY_HEIGHT + _DISPLAY_TILE_SIZE - 1) / _DISPLAY_TILE_SIZE)
+#define _TILE_COUNT	(_TILE_COLS * _TILE_ROWS)
+#define _BACKUP_MAGIC	(0xD15A0000 | _PANEL)
 
-static void SendStripe(void);
+typedef struct
+{
+	uint32_t magic;				//_BACKUP_MAGIC if the content is valid
+	uint16_t partial_count;		//Partial refreshes since the last full refresh
+	uint16_t tiles[_TILE_COUNT];	//Hash of the tiles shown by the panel
+} DisplayBackup_t;
+
+_Static_assert(sizeof(DisplayBackup_t) <= _BKP_DISPLAY_SIZE, "Tile hashes don't fit the backup SRAM region");
+
+static uint32_t tileHash[_TILE_COUNT];
+static uint32_t dataOffset;
+static bool forceFull;
+
+static DisplayBusyTimes_t busyTimes;
+static DisplayWindow_t window;
+
+
+static void ResetPipeline(void);
+static void FinishImage(void);
+static void AcquireSlot(void);
+static void CommitSlot(void);
+static void DrainPipeline(void);
+static void SendStripe(const StripeMessage_t* msg);
+static void FlushRow(void);
+static void OutputData(const uint8_t* data, int len);
+static void HashData(const uint8_t* data, int len);
+static DisplayRefresh_e CompareTiles(void);
+static void SaveTiles(DisplayRefresh_e refresh);
+static inline void PackPixel(uint8_t code);
 static uint8_t FindClosestColor(RGB16_t color);
 
 
+/*
+ * Allocate the buffers from the arenas,
+ * must be called once before the scheduler is started
+ * */
+void DISP_Setup(void)
+{
+	slots = ARENA_Alloc(&arena_sram, _DISPLAY_PIPELINE_DEPTH * _DISPLAY_SLOT_BYTES);
+	ditherRows = ARENA_Alloc(&arena_ccm, _DISPLAY_DITHER_BYTES);
+	rowBuffer = ARENA_Alloc(&arena_sram, 2 * _DISPLAY_ROW_BYTES);
+#if _PANEL_PLANES == 2
+	planeBuffer = ARENA_Alloc(&arena_sram, _DISPLAY_PLANE_BYTES);
+#endif
+#if _PANEL_PARTIAL
+	frameBuffer = ARENA_Alloc(&arena_sram, _DISPLAY_PLANE_BYTES);
+#endif
+
+	pipelineLock = osMutexNew(NULL);
+	displayEvents = osEventFlagsNew(NULL);
+}
+
+
 /*
  * Initialize display
  * This function must be called first
  * */
 void DISP_Init(void)
 {
-	EPD_5IN65F_Init();
+	panel.init(&busyTimes);
 }
 
 
@@ -51,56 +152,287 @@ void DISP_Init(void)
  * */
 void DISP_Sleep(void)
 {
-	EPD_5IN65F_Sleep();
+	panel.sleep();
 }
 
 
 /*
- * Begin the update cycle
+ * Begin the update cycle, the new image is compared with the previous one
+ * unless force_full is true
  * */
-void DISP_BeginUpdate(void)
+void DISP_BeginUpdate(bool force_full)
 {
+#if !_PANEL_PARTIAL
 	//Send commands (set resolution, data start)
-	EPD_5IN65F_SendCommand(0x61);
-	EPD_5IN65F_SendData(0x02);
-	EPD_5IN65F_SendData(0x58);
-	EPD_5IN65F_SendData(0x01);
-	EPD_5IN65F_SendData(0xC0);
-	EPD_5IN65F_SendCommand(0x10);
+	panel.begin();
+	DBUS_SendCommand(panel.plane_command[0]);
+#endif
 
-	pixelCount = 0;
+	//Wait for the render of the next image to finish
+	osMutexAcquire(pipelineLock, osWaitForever);
+	osEventFlagsClear(displayEvents, _DISPLAY_EVENT_REFRESH);
+
+	ResetPipeline();
+	forceFull = force_full;
+	memset(tileHash, 0, sizeof(tileHash));
+
+#if _PANEL_PLANES == 2
+	memset(planeBuffer, 0xff, _DISPLAY_PLANE_BYTES);
+#endif
 }
 
 
 /*
- * Terminate the update cycle
+ * Terminate the update cycle,
+ * the panel is refreshed only if the image has changed
  * */
-void DISP_EndUpdate(void)
+DisplayRefresh_e DISP_EndUpdate(void)
 {
-	//Send remaining pixels
-	while(pixelCount < EPD_5IN65F_HEIGHT * EPD_5IN65F_WIDTH)
+	DisplayRefresh_e refresh;
+
+	FinishImage();
+
+#if _PANEL_PLANES == 2
+	//The second plane goes into the same tile hashes
+	dataOffset = 0;
+	HashData(planeBuffer, _DISPLAY_PLANE_BYTES);
+#endif
+
+	refresh = CompareTiles();
+
+	//The rows are sent, the pipeline can render the next image during the refresh
+	DBUS_WaitIdle();
+	updateStats = pipelineStats;
+	osMutexRelease(pipelineLock);
+
+	busyTimes.power_on = 0;
+	busyTimes.refresh = 0;
+	busyTimes.power_off = 0;
+
+#if _PANEL_PARTIAL
+	if(refresh == e_RefreshPartial)
+	{
+		panel.refresh_window(frameBuffer, &window, &busyTimes);
+	}
+	else if(refresh == e_RefreshFull)
 	{
-		EPD_5IN65F_SendData(EPD_5IN65F_BLACK << 4 | EPD_5IN65F_BLACK);
-		pixelCount += 2;
+		//Send the first plane from RAM
+		panel.begin();
+		DBUS_SendCommand(panel.plane_command[0]);
+		for(int y = 0; y < _DISPLAY_HEIGHT; y++)
+			DBUS_SendBurst(&frameBuffer[y * _DISPLAY_ROW_BYTES], _DISPLAY_ROW_BYTES);
 	}
+#endif
+
+	if(refresh == e_RefreshFull)
+	{
+#if _PANEL_PLANES == 2
+		//Send the second plane
+		DBUS_SendCommand(panel.plane_command[1]);
+		for(int y = 0; y < _DISPLAY_HEIGHT; y++)
+			DBUS_SendBurst(&planeBuffer[y * _DISPLAY_ROW_BYTES], _DISPLAY_ROW_BYTES);
+#endif
+
+		//Show the image, the task sleeps while the display is busy
+		panel.refresh(&busyTimes);
+	}
+
+	DBUS_WaitIdle();
+	SaveTiles(refresh);
+	osEventFlagsSet(displayEvents, _DISPLAY_EVENT_REFRESH);
+
+	return refresh;
+}
+
+
+/*
+ * Called by the refresh hooks of the panel once the refresh command is sent
+ * */
+void DISP_RefreshStarted(void)
+{
+	osEventFlagsSet(displayEvents, _DISPLAY_EVENT_REFRESH);
+}
+
+
+/*
+ * Wait until the panel is refreshing or the update has ended without
+ * a refresh, the display doesn't need the CPU until the BUSY edge then.
+ * Returns false on timeout
+ * */
+bool DISP_WaitRefresh(uint32_t timeout)
+{
+	return (osEventFlagsWait(displayEvents, _DISPLAY_EVENT_REFRESH, osFlagsNoClear, timeout) & osFlagsError) == 0;
+}
+
+
+/*
+ * Terminate the update cycle without refreshing the panel
+ * */
+void DISP_AbortUpdate(void)
+{
+	DrainPipeline();
+	DBUS_WaitIdle();
+	updateStats = pipelineStats;
+	osMutexRelease(pipelineLock);
+	osEventFlagsSet(displayEvents, _DISPLAY_EVENT_REFRESH);
+}
+
+
+/*
+ * Begin rendering an image into a file instead of the display, the packed
+ * pixels of the first plane are appended to fp. The panel, the tile hashes
+ * and the frame buffer are not touched so the render can run while the panel
+ * is refreshed. Waits for the update in progress to send its data.
+ * Returns false on panels with two planes
+ * */
+bool DISP_BeginRender(FIL* fp)
+{
+#if _PANEL_PLANES == 2
+	return false;
+#else
+	osMutexAcquire(pipelineLock, osWaitForever);
+
+	ResetPipeline();
+	renderFile = fp;
+	renderCrc = 0;
+	renderError = false;
+
+	return true;
+#endif
+}
+
+
+/*
+ * Terminate the render, crc is set to the CRC-32 of the bytes written.
+ * Returns false if the file could not be written
+ * */
+bool DISP_EndRender(uint32_t* crc)
+{
+	FinishImage();
 
-	//Send commands (power on, refresh, power of)
-	EPD_5IN65F_SendCommand(0x04);
-	EPD_5IN65F_BusyHigh();
-	EPD_5IN65F_SendCommand(0x12);
-	EPD_5IN65F_BusyHigh();
-	EPD_5IN65F_SendCommand(0x02);
-	EPD_5IN65F_BusyLow();
+	renderFile = NULL;
+	*crc = renderCrc;
+	osMutexRelease(pipelineLock);
+
+	return !renderError;
 }
 
 
 /*
  * Send two pixels to the display buffer
+ * (bytes are collected into a row and sent in a single burst)
  * */
 void DISP_SendData(uint8_t data)
 {
-	EPD_5IN65F_SendData(data);
-	pixelCount += 2;
+	rowBuffer[rowIndex][rowPtr++] = data;
+	pixelCount += _DISPLAY_PIXELS_PER_BYTE;
+
+	if(rowPtr >= _DISPLAY_ROW_BYTES)
+		FlushRow();
+}
+
+
+/*
+ * Send one pixel (palette index)
+ * */
+void DISP_SendPixel(uint8_t color)
+{
+	PackPixel(color);
+}
+
+
+/*
+ * Send a packed row of the first plane in a single DMA burst.
+ * The function returns while the row is still being sent, the data
+ * must not be modified until the next call to a DISP_ function.
+ * Rows filled in place in the buffer returned by DISP_GetRowBuffer() are not copied.
+ * */
+void DISP_SendRow(const uint8_t* data, int len)
+{
+	if(data == rowBuffer[rowIndex])
+	{
+		rowPtr = len;
+		pixelCount += len * _DISPLAY_PIXELS_PER_BYTE;
+		FlushRow();
+	}
+	else
+	{
+		FlushRow();
+		OutputData(data, len);
+		pixelCount += len * _DISPLAY_PIXELS_PER_BYTE;
+	}
+}
+
+
+/*
+ * Returns the row buffer that is not being sent,
+ * it can be filled and passed to DISP_SendRow()
+ * */
+uint8_t* DISP_GetRowBuffer(void)
+{
+	FlushRow();
+
+	return rowBuffer[rowIndex];
+}
+
+
+/*
+ * Returns the area of the display that was refreshed by the last partial refresh
+ * */
+const DisplayWindow_t* DISP_GetWindow(void)
+{
+	return &window;
+}
+
+
+/*
+ * Returns the stall times of the decoder and of the output task during the last update
+ * */
+const DisplayPipelineStats_t* DISP_GetPipelineStats(void)
+{
+	return &updateStats;
+}
+
+
+/*
+ * Body of the output task, dithers the stripes written by DISP_WritePixel()
+ * and sends them to the display. Until this function is running the stripes
+ * are dithered by the task that writes the pixels.
+ * */
+void DISP_RunOutput(void)
+{
+	freeSlots = osMessageQueueNew(_DISPLAY_PIPELINE_DEPTH, sizeof(uint8_t), NULL);
+	fullSlots = osMessageQueueNew(_DISPLAY_PIPELINE_DEPTH, sizeof(StripeMessage_t), NULL);
+
+	for(uint8_t i = 0; i < _DISPLAY_PIPELINE_DEPTH; i++)
+		osMessageQueuePut(freeSlots, &i, 0, 0);
+
+	outputRunning = true;
+
+	while(1)
+	{
+		StripeMessage_t msg;
+		uint32_t start = HAL_GetTick();
+
+		if(osMessageQueueGet(fullSlots, &msg, NULL, osWaitForever) == osOK)
+		{
+			//Time spent waiting for the decoder between the stripes of an image
+			if(!msg.first)
+				pipelineStats.output_stall += HAL_GetTick() - start;
+
+			SendStripe(&msg);
+			osMessageQueuePut(freeSlots, &msg.slot, 0, 0);
+		}
+	}
+}
+
+
+/*
+ * Returns the time spent waiting for the BUSY pin during the last update
+ * */
+const DisplayBusyTimes_t* DISP_GetBusyTimes(void)
+{
+	return &busyTimes;
 }
 
 
@@ -114,53 +446,179 @@ void DISP_SetStripeHeight(int h)
 	if(h == 8 || h == 16)
 	{
 		stripeHeight = h;
-		stripeSize = EPD_5IN65F_WIDTH * h;
+		stripeSize = _DISPLAY_WIDTH * h;
 	}
 }
 
 
 /*
- * Write pixel to the display
+ * Write pixel to the display, the pixels must be written one stripe at a time
  * */
 void DISP_WritePixel(int x, int y, uint8_t r, uint8_t g, uint8_t b)
 {
-	//Clear last row of pixel at the beginning of the scan
-	if(x == 0 && y == 0)
-	{
-		for(int i = 0; i < EPD_5IN65F_WIDTH; i++)
-		{
-			STRIPE_PIXEL_R(i, stripeHeight) = 0;
-			STRIPE_PIXEL_G(i, stripeHeight) = 0;
-			STRIPE_PIXEL_B(i, stripeHeight) = 0;
-		}
-	}
+	//Crop images larger than the display
+	if(x >= _DISPLAY_WIDTH || y >= _DISPLAY_HEIGHT)
+		return;
 
-	//Write pixel into buffer
-	STRIPE_PIXEL_R(x, y % stripeHeight) = (int16_t)r;
-	STRIPE_PIXEL_G(x, y % stripeHeight) = (int16_t)g;
-	STRIPE_PIXEL_B(x, y % stripeHeight) = (int16_t)b;
+	if(currentSlot < 0)
+		AcquireSlot();
+
+	//Write pixel into the stripe
+	uint8_t* pixel = &slots[currentSlot][((y % stripeHeight) * _DISPLAY_WIDTH + x) * 3];
+	pixel[0] = r;
+	pixel[1] = g;
+	pixel[2] = b;
 
 	stripeCounter++;
 
 	//Send pixels to the display when the stripe is completed
 	if(stripeCounter >= stripeSize)
 	{
-		SendStripe();
+		CommitSlot();
 		stripeCounter = 0;
 	}
 }
 
 
 /*
- * Send pixels to the display
+ * Prepare the pipeline for a new image
+ * */
+static void ResetPipeline(void)
+{
+	pixelCount = 0;
+	pixelBits = 0;
+	rowPtr = 0;
+	dataOffset = 0;
+	stripeCounter = 0;
+	stripeIndex = 0;
+	currentSlot = -1;
+	pipelined = outputRunning;
+	memset(&pipelineStats, 0, sizeof(pipelineStats));
+}
+
+
+/*
+ * Wait for the output task to process the last stripe
+ * and fill the rest of the image with the blank color
+ * */
+static void FinishImage(void)
+{
+	DrainPipeline();
+
+	while(pixelBits != 0)
+	{
+		PackPixel(0);
+	}
+	while(pixelCount < _DISPLAY_HEIGHT * _DISPLAY_WIDTH)
+	{
+		DISP_SendData(_PANEL_BLANK_BYTE);
+	}
+	FlushRow();
+}
+
+
+/*
+ * Get an empty stripe slot, waits for the output task if all the slots are full
  * */
-static void SendStripe(void)
+static void AcquireSlot(void)
 {
-	uint8_t last_code = 0;
+	if(pipelined)
+	{
+		uint32_t start = HAL_GetTick();
+		uint8_t slot;
 
-	for(int y = 0; y < stripeHeight; y++)
+		osMessageQueueGet(freeSlots, &slot, NULL, osWaitForever);
+		pipelineStats.decode_stall += HAL_GetTick() - start;
+		currentSlot = slot;
+	}
+	else
 	{
-		for(int x = 0; x < EPD_5IN65F_WIDTH; x++)
+		currentSlot = 0;
+	}
+}
+
+
+/*
+ * Pass the completed stripe to the output task
+ * (or dither it now if the output task is not running)
+ * */
+static void CommitSlot(void)
+{
+	StripeMessage_t msg = {
+		.slot = currentSlot,
+		.height = stripeHeight,
+		.first = stripeIndex == 0
+	};
+
+	stripeIndex++;
+	pipelineStats.stripes++;
+	currentSlot = -1;
+
+	if(pipelined)
+		osMessageQueuePut(fullSlots, &msg, 0, osWaitForever);
+	else
+		SendStripe(&msg);
+}
+
+
+/*
+ * Wait for the output task to finish, the task is idle when all the slots are free.
+ * An incomplete stripe is discarded.
+ * */
+static void DrainPipeline(void)
+{
+	if(pipelined)
+	{
+		uint32_t start = HAL_GetTick();
+		uint8_t slot;
+
+		for(int i = currentSlot >= 0 ? 1 : 0; i < _DISPLAY_PIPELINE_DEPTH; i++)
+			osMessageQueueGet(freeSlots, &slot, NULL, osWaitForever);
+		pipelineStats.decode_stall += HAL_GetTick() - start;
+
+		for(slot = 0; slot < _DISPLAY_PIPELINE_DEPTH; slot++)
+			osMessageQueuePut(freeSlots, &slot, 0, 0);
+	}
+
+	currentSlot = -1;
+	stripeCounter = 0;
+}
+
+
+/*
+ * Dither the pixels of the stripe and send them to the display
+ * */
+static void SendStripe(const StripeMessage_t* msg)
+{
+	const uint8_t* src = slots[msg->slot];
+	const int h = msg->height;
+	uint32_t start = PROF_Start();
+	int16_t* carry = ditherRows[2];
+	int16_t* cur = ditherRows[0];
+	int16_t* next = ditherRows[1];
+
+	//Clear the error carried into the first stripe
+	if(msg->first)
+		memset(carry, 0, sizeof(*ditherRows));
+
+	for(int i = 0; i < _DISPLAY_WIDTH * 3; i++)
+		cur[i] = src[i];
+
+	for(int y = 0; y < h; y++)
+	{
+		//The error of the last row goes into the carry row (cleared while reading the first row)
+		if(y < h - 1)
+		{
+			const uint8_t* row = &src[(y + 1) * _DISPLAY_WIDTH * 3];
+			for(int i = 0; i < _DISPLAY_WIDTH * 3; i++)
+				next[i] = row[i];
+		}
+		else
+		{
+			next = carry;
+		}
+
+		for(int x = 0; x < _DISPLAY_WIDTH; x++)
 		{
 #if _DITHER == 1	//Floyd–Steinberg dithering
 			uint8_t new_code;
@@ -168,18 +626,18 @@ static void SendStripe(void)
 
 			if(y == 0)
 			{
-				old_color.r = STRIPE_PIXEL_R(x, y) + STRIPE_PIXEL_R(x, stripeHeight);
-				old_color.g = STRIPE_PIXEL_G(x, y) + STRIPE_PIXEL_G(x, stripeHeight);
-				old_color.b = STRIPE_PIXEL_B(x, y) + STRIPE_PIXEL_B(x, stripeHeight);
-				STRIPE_PIXEL_R(x, stripeHeight) = 0;
-				STRIPE_PIXEL_G(x, stripeHeight) = 0;
-				STRIPE_PIXEL_B(x, stripeHeight) = 0;
+				old_color.r = ROW_PIXEL_R(cur, x) + ROW_PIXEL_R(carry, x);
+				old_color.g = ROW_PIXEL_G(cur, x) + ROW_PIXEL_G(carry, x);
+				old_color.b = ROW_PIXEL_B(cur, x) + ROW_PIXEL_B(carry, x);
+				ROW_PIXEL_R(carry, x) = 0;
+				ROW_PIXEL_G(carry, x) = 0;
+				ROW_PIXEL_B(carry, x) = 0;
 			}
 			else
 			{
-				old_color.r = STRIPE_PIXEL_R(x, y);
-				old_color.g = STRIPE_PIXEL_G(x, y);
-				old_color.b = STRIPE_PIXEL_B(x, y);
+				old_color.r = ROW_PIXEL_R(cur, x);
+				old_color.g = ROW_PIXEL_G(cur, x);
+				old_color.b = ROW_PIXEL_B(cur, x);
 			}
 
 			//Find closest color and quantization error
@@ -199,65 +657,226 @@ static void SendStripe(void)
 			}
 
 			//Write color to the display
-			if(x % 2 == 0)
-			{
-				last_code = new_code;
-			}
-			else
-			{
-				EPD_5IN65F_SendData((last_code << 4) | new_code);
-				pixelCount += 2;
-			}
+			PackPixel(new_code);
 
 			//Propagate quantization error
-			if(x < EPD_5IN65F_WIDTH-1)
+			if(x < _DISPLAY_WIDTH-1)
 			{
-				STRIPE_PIXEL_R(x+1, y) = (STRIPE_PIXEL_R(x+1, y)*16 + 7*quant_err.r) / 16;
-				STRIPE_PIXEL_G(x+1, y) = (STRIPE_PIXEL_G(x+1, y)*16 + 7*quant_err.g) / 16;
-				STRIPE_PIXEL_B(x+1, y) = (STRIPE_PIXEL_B(x+1, y)*16 + 7*quant_err.b) / 16;
+				ROW_PIXEL_R(cur, x+1) = (ROW_PIXEL_R(cur, x+1)*16 + 7*quant_err.r) / 16;
+				ROW_PIXEL_G(cur, x+1) = (ROW_PIXEL_G(cur, x+1)*16 + 7*quant_err.g) / 16;
+				ROW_PIXEL_B(cur, x+1) = (ROW_PIXEL_B(cur, x+1)*16 + 7*quant_err.b) / 16;
 
-				STRIPE_PIXEL_R(x+1, y+1) = (STRIPE_PIXEL_R(x+1, y+1)*16 + 1*quant_err.r) / 16;
-				STRIPE_PIXEL_G(x+1, y+1) = (STRIPE_PIXEL_G(x+1, y+1)*16 + 1*quant_err.g) / 16;
-				STRIPE_PIXEL_B(x+1, y+1) = (STRIPE_PIXEL_B(x+1, y+1)*16 + 1*quant_err.b) / 16;
+				ROW_PIXEL_R(next, x+1) = (ROW_PIXEL_R(next, x+1)*16 + 1*quant_err.r) / 16;
+				ROW_PIXEL_G(next, x+1) = (ROW_PIXEL_G(next, x+1)*16 + 1*quant_err.g) / 16;
+				ROW_PIXEL_B(next, x+1) = (ROW_PIXEL_B(next, x+1)*16 + 1*quant_err.b) / 16;
 			}
 
 			if(x > 0)
 			{
-				STRIPE_PIXEL_R(x-1, y+1) = (STRIPE_PIXEL_R(x-1, y+1)*16 + 3*quant_err.r) / 16;
-				STRIPE_PIXEL_G(x-1, y+1) = (STRIPE_PIXEL_G(x-1, y+1)*16 + 3*quant_err.g) / 16;
-				STRIPE_PIXEL_B(x-1, y+1) = (STRIPE_PIXEL_B(x-1, y+1)*16 + 3*quant_err.b) / 16;
+				ROW_PIXEL_R(next, x-1) = (ROW_PIXEL_R(next, x-1)*16 + 3*quant_err.r) / 16;
+				ROW_PIXEL_G(next, x-1) = (ROW_PIXEL_G(next, x-1)*16 + 3*quant_err.g) / 16;
+				ROW_PIXEL_B(next, x-1) = (ROW_PIXEL_B(next, x-1)*16 + 3*quant_err.b) / 16;
 			}
 
-			STRIPE_PIXEL_R(x, y+1) = (STRIPE_PIXEL_R(x, y+1)*16 + 5*quant_err.r) / 16;
-			STRIPE_PIXEL_G(x, y+1) = (STRIPE_PIXEL_G(x, y+1)*16 + 5*quant_err.g) / 16;
-			STRIPE_PIXEL_B(x, y+1) = (STRIPE_PIXEL_B(x, y+1)*16 + 5*quant_err.b) / 16;
+			ROW_PIXEL_R(next, x) = (ROW_PIXEL_R(next, x)*16 + 5*quant_err.r) / 16;
+			ROW_PIXEL_G(next, x) = (ROW_PIXEL_G(next, x)*16 + 5*quant_err.g) / 16;
+			ROW_PIXEL_B(next, x) = (ROW_PIXEL_B(next, x)*16 + 5*quant_err.b) / 16;
 #else	//No dithering
 			RGB16_t color;
 			uint8_t new_code;
 
-			color.r = STRIPE_PIXEL_R(x, y);
-			color.g = STRIPE_PIXEL_G(x, y);
-			color.b = STRIPE_PIXEL_B(x, y);
+			color.r = ROW_PIXEL_R(cur, x);
+			color.g = ROW_PIXEL_G(cur, x);
+			color.b = ROW_PIXEL_B(cur, x);
 			new_code = FindClosestColor(color);
 
 			//Write color to the display
-			if(x % 2 == 0)
-			{
-				last_code = new_code;
-			}
-			else
-			{
-				EPD_5IN65F_SendData((last_code << 4) | new_code);
-				pixelCount += 2;
-			}
+			PackPixel(new_code);
+#endif
+		}
+
+		//Swap the rows
+		int16_t* tmp = cur;
+		cur = next;
+		next = tmp;
+	}
+
+	PROF_Add(e_ProfDither, start);
+}
+
+
+/*
+ * Start sending the current row and switch to the other buffer
+ * */
+static void FlushRow(void)
+{
+	if(rowPtr > 0)
+	{
+		OutputData(rowBuffer[rowIndex], rowPtr);
+		rowIndex ^= 1;
+		rowPtr = 0;
+	}
+}
+
+
+/*
+ * Send bytes of the first plane to the display (or to the frame buffer
+ * on panels with partial refresh) and update the tile hashes,
+ * during a render the bytes go to the file
+ * */
+static void OutputData(const uint8_t* data, int len)
+{
+	if(renderFile != NULL)
+	{
+		UINT written;
+
+		if(f_write(renderFile, data, len, &written) != FR_OK || written != len)
+			renderError = true;
+		renderCrc = CRC32_Update(renderCrc, data, len);
+		return;
+	}
+
+#if _PANEL_PARTIAL
+	if(dataOffset + len <= _DISPLAY_PLANE_BYTES)
+		memcpy(&frameBuffer[dataOffset], data, len);
+#else
+	DBUS_SendBurst(data, len);
 #endif
+
+	HashData(data, len);
+}
+
+
+/*
+ * Add bytes at dataOffset in the plane to the hashes of the tiles they belong to
+ * (FNV-1a)
+ * */
+static void HashData(const uint8_t* data, int len)
+{
+	while(len > 0 && dataOffset < _DISPLAY_ROW_BYTES * _DISPLAY_HEIGHT)
+	{
+		int y = dataOffset / _DISPLAY_ROW_BYTES;
+		int x = dataOffset % _DISPLAY_ROW_BYTES;
+		int n = _TILE_BYTES - x % _TILE_BYTES;
+
+		//Bytes in the same tile
+		if(n > _DISPLAY_ROW_BYTES - x)
+			n = _DISPLAY_ROW_BYTES - x;
+		if(n > len)
+			n = len;
+
+		uint32_t* hash = &tileHash[(y / _DISPLAY_TILE_SIZE) * _TILE_COLS + x / _TILE_BYTES];
+		uint32_t h = *hash ^ 0x811c9dc5;
+		for(int i = 0; i < n; i++)
+			h = (h ^ data[i]) * 16777619;
+		*hash = h ^ 0x811c9dc5;
+
+		data += n;
+		len -= n;
+		dataOffset += n;
+	}
+}
+
+
+/*
+ * Compare the tile hashes with the image shown by the panel
+ * and compute the bounding box of the changed tiles
+ * */
+static DisplayRefresh_e CompareTiles(void)
+{
+	const DisplayBackup_t* backup = PWR_BackupRegion(_BKP_DISPLAY_OFFSET);
+	bool valid = backup->magic == _BACKUP_MAGIC && !forceFull;
+	int x0 = _TILE_COLS, y0 = _TILE_ROWS, x1 = -1, y1 = -1;
+
+	for(int i = 0; i < _TILE_COUNT; i++)
+	{
+		if(!valid || backup->tiles[i] != (uint16_t)(tileHash[i] ^ (tileHash[i] >> 16)))
+		{
+			int x = i % _TILE_COLS;
+			int y = i / _TILE_COLS;
+
+			if(x < x0) x0 = x;
+			if(x > x1) x1 = x;
+			if(y < y0) y0 = y;
+			if(y > y1) y1 = y;
 		}
 	}
+
+	if(x1 < 0)
+		return e_RefreshNone;
+
+	window.x0 = x0 * _DISPLAY_TILE_SIZE;
+	window.y0 = y0 * _DISPLAY_TILE_SIZE;
+	window.x1 = (x1 + 1) * _DISPLAY_TILE_SIZE < _DISPLAY_WIDTH ? (x1 + 1) * _DISPLAY_TILE_SIZE : _DISPLAY_WIDTH;
+	window.y1 = (y1 + 1) * _DISPLAY_TILE_SIZE < _DISPLAY_HEIGHT ? (y1 + 1) * _DISPLAY_TILE_SIZE : _DISPLAY_HEIGHT;
+
+#if _PANEL_PARTIAL
+	//Full refresh every _DISPLAY_FULL_REFRESH_EVERY updates to clear ghosting
+	if(valid && backup->partial_count + 1 < _DISPLAY_FULL_REFRESH_EVERY)
+		return e_RefreshPartial;
+#endif
+
+	return e_RefreshFull;
+}
+
+
+/*
+ * Store the tile hashes of the image shown by the panel
+ * */
+static void SaveTiles(DisplayRefresh_e refresh)
+{
+	DisplayBackup_t* backup = PWR_BackupRegion(_BKP_DISPLAY_OFFSET);
+
+	if(refresh == e_RefreshNone)
+		return;
+
+	//The content of the panel is unknown if the refresh didn't complete
+	if(busyTimes.timeout)
+	{
+		backup->magic = 0;
+		return;
+	}
+
+	for(int i = 0; i < _TILE_COUNT; i++)
+		backup->tiles[i] = (uint16_t)(tileHash[i] ^ (tileHash[i] >> 16));
+
+	backup->partial_count = refresh == e_RefreshPartial ? backup->partial_count + 1 : 0;
+	backup->magic = _BACKUP_MAGIC;
+}
+
+
+/*
+ * Pack one pixel into the plane bytes, the packing is selected at compile time
+ * */
+static inline void PackPixel(uint8_t code)
+{
+#if _PANEL_BPP == 4
+	pixelByte = (pixelByte << 4) | code;
+	if(++pixelBits == 2)
+	{
+		DISP_SendData(pixelByte);
+		pixelBits = 0;
+	}
+#else
+	pixelByte = (pixelByte << 1) | _PANEL_PLANE0_BIT(code);
+#if _PANEL_PLANES == 2
+	planeByte = (planeByte << 1) | _PANEL_PLANE1_BIT(code);
+#endif
+	if(++pixelBits == 8)
+	{
+#if _PANEL_PLANES == 2
+		if(pixelCount < _DISPLAY_WIDTH * _DISPLAY_HEIGHT)
+			planeBuffer[pixelCount / 8] = planeByte;
+#endif
+		DISP_SendData(pixelByte);
+		pixelBits = 0;
+	}
+#endif
 }
 
 
 /*
- * Returns the closest color from the 7 color-palatte
+ * Returns the closest color from the palette
  * */
 static uint8_t FindClosestColor(RGB16_t color)
 {
@@ -0,0 +1,364 @@
+/**
+ ******************************************************************************
+ * @file      display_bus.c
+ * @author    ts-manuel
+ * @brief     SPI transport for the E-Paper display
+ *
+ ******************************************************************************
+ */
+
+#include "hardware/display_bus.h"
+#include "profiler.h"
+
+#if _DBUS_CAPTURE == 0	//SPI1 + DMA
+
+#include "main.h"
+#include "cmsis_os.h"
+#include "Config/DEV_Config.h"
+#include "hardware/clock.h"
+
+extern SPI_HandleTypeDef hspi1;
+static volatile bool burst_active = false;
+static volatile osThreadId_t busy_thread = NULL;
+static volatile osThreadId_t idle_thread = NULL;
+static uint32_t last_busy_time;
+
+static bool WaitBusy(uint8_t level, int status, uint32_t* elapsed);
+
+
+/*
+ * Send one command byte (DC low)
+ * */
+void DBUS_SendCommand(uint8_t cmd)
+{
+	DBUS_WaitIdle();
+	DEV_Digital_Write(EPD_DC_PIN, 0);
+	DEV_Digital_Write(EPD_CS_PIN, 0);
+	DEV_SPI_WriteByte(cmd);
+	DEV_Digital_Write(EPD_CS_PIN, 1);
+}
+
+
+/*
+ * Send one data byte (DC high)
+ * */
+void DBUS_SendData(uint8_t data)
+{
+	DBUS_WaitIdle();
+	DEV_Digital_Write(EPD_DC_PIN, 1);
+	DEV_Digital_Write(EPD_CS_PIN, 0);
+	DEV_SPI_WriteByte(data);
+	DEV_Digital_Write(EPD_CS_PIN, 1);
+}
+
+
+/*
+ * Start sending a block of data bytes by DMA, returns before the transfer
+ * is completed. The buffer must not be modified until DBUS_WaitIdle() returns
+ * or the next call to any DBUS_Send function.
+ * */
+void DBUS_SendBurst(const uint8_t* data, int len)
+{
+	DBUS_WaitIdle();
+
+	if(len <= 0)
+		return;
+
+	//Assert DC and CS for the whole burst, CS is released by the DMA complete callback
+	DEV_Digital_Write(EPD_DC_PIN, 1);
+	DEV_Digital_Write(EPD_CS_PIN, 0);
+	burst_active = true;
+
+	if(HAL_SPI_Transmit_DMA(&hspi1, (uint8_t*)data, len) != HAL_OK)
+	{
+		//Fall back to a blocking transfer
+		HAL_SPI_Transmit(&hspi1, (uint8_t*)data, len, 1000);
+		DEV_Digital_Write(EPD_CS_PIN, 1);
+		burst_active = false;
+	}
+}
+
+
+/*
+ * Wait for the current burst to complete, the task sleeps on a thread flag
+ * set by the DMA complete callback so that other tasks can run during the transfer
+ * */
+void DBUS_WaitIdle(void)
+{
+	uint32_t start = PROF_Start();
+
+	if(!burst_active)
+		return;
+
+	if(osKernelGetState() == osKernelRunning)
+	{
+		osThreadFlagsClear(_DBUS_FLAG_IDLE);
+		idle_thread = osThreadGetId();
+
+		//A transfer completed before idle_thread was set doesn't set the flag,
+		//burst_active is checked again after setting it
+		if(burst_active)
+			osThreadFlagsWait(_DBUS_FLAG_IDLE, osFlagsWaitAny, osWaitForever);
+
+		idle_thread = NULL;
+	}
+
+	while(burst_active);
+
+	PROF_Add(e_ProfSPI, start);
+}
+
+
+/*
+ * Block until the BUSY pin reads level or _DBUS_BUSY_TIMEOUT expires,
+ * the task sleeps on a thread flag set by the EXTI interrupt.
+ * Returns false on timeout, elapsed is set to the waiting time in ms
+ * */
+bool DBUS_WaitBusy(uint8_t level, uint32_t* elapsed)
+{
+	return WaitBusy(level, -1, elapsed);
+}
+
+
+/*
+ * Same as DBUS_WaitBusy() for the controllers that update BUSY only after
+ * a status command, status is sent every _DBUS_STATUS_PERIOD ms while busy
+ * */
+bool DBUS_WaitBusyStatus(uint8_t level, uint8_t status, uint32_t* elapsed)
+{
+	return WaitBusy(level, status, elapsed);
+}
+
+
+/*
+ * Returns the duration of the last BUSY wait in ms
+ * */
+uint32_t DBUS_GetLastBusyTime(void)
+{
+	return last_busy_time;
+}
+
+
+/*
+ * Called from HAL_GPIO_EXTI_Callback() on every edge of the BUSY pin
+ * */
+void DBUS_BusyIRQHandler(void)
+{
+	osThreadId_t thread = busy_thread;
+
+	if(thread != NULL)
+		osThreadFlagsSet(thread, _DBUS_FLAG_BUSY);
+}
+
+
+/*
+ * Replaces the polling loop used by the Waveshare driver
+ * */
+void DEV_Wait_Busy(UBYTE level)
+{
+	if(!DBUS_WaitBusy(level, NULL))
+		printf("ERROR: Display BUSY timeout\n");
+}
+
+
+/*
+ * Replaces the polling loop that sends the status command
+ * */
+void DEV_Wait_Busy_Status(UBYTE level, UBYTE cmd)
+{
+	if(!DBUS_WaitBusyStatus(level, cmd, NULL))
+		printf("ERROR: Display BUSY timeout\n");
+}
+
+
+/*
+ * This callback is called by the HAL when the DMA transfer is completed
+ * and the last byte has left the shift register
+ * */
+void HAL_SPI_TxCpltCallback(SPI_HandleTypeDef *hspi)
+{
+	if(hspi->Instance == hspi1.Instance)
+	{
+		osThreadId_t thread = idle_thread;
+
+		DEV_Digital_Write(EPD_CS_PIN, 1);
+		burst_active = false;
+
+		if(thread != NULL)
+			osThreadFlagsSet(thread, _DBUS_FLAG_IDLE);
+	}
+}
+
+/*
+ * Wait for the BUSY pin to read level, if status >= 0 the command is sent
+ * every _DBUS_STATUS_PERIOD ms until the pin changes
+ * */
+static bool WaitBusy(uint8_t level, int status, uint32_t* elapsed)
+{
+	uint32_t start = HAL_GetTick();
+	uint32_t time = 0;
+	bool scheduler_running = osKernelGetState() == osKernelRunning;
+
+	DBUS_WaitIdle();
+
+	if(scheduler_running)
+	{
+		osThreadFlagsClear(_DBUS_FLAG_BUSY);
+		busy_thread = osThreadGetId();
+	}
+
+	CLK_BeginWait();
+
+	while(DEV_Digital_Read(EPD_BUSY_PIN) != level && time < _DBUS_BUSY_TIMEOUT)
+	{
+		uint32_t timeout = _DBUS_BUSY_TIMEOUT - time;
+
+		if(status >= 0 && timeout > _DBUS_STATUS_PERIOD)
+			timeout = _DBUS_STATUS_PERIOD;
+
+		//Wait for the next edge on the BUSY pin (spin if called before the scheduler is started)
+		if(scheduler_running)
+			osThreadFlagsWait(_DBUS_FLAG_BUSY, osFlagsWaitAny, timeout);
+		else if(status >= 0)
+			HAL_Delay(timeout);
+
+		time = HAL_GetTick() - start;
+
+		if(status >= 0 && DEV_Digital_Read(EPD_BUSY_PIN) != level)
+			DBUS_SendCommand(status);
+	}
+
+	CLK_EndWait();
+	busy_thread = NULL;
+	last_busy_time = time;
+	PROF_AddUs(e_ProfBusy, time * 1000);
+
+	if(elapsed != NULL)
+		*elapsed = time;
+
+	return time < _DBUS_BUSY_TIMEOUT;
+}
+
+#else	//Capture backend
+
+static DBusCapture_t capture;
+
+static void CaptureTransaction(DBusTransactionType_e type, const uint8_t* data, int len);
+
+
+/*
+ * Record one command byte
+ * */
+void DBUS_SendCommand(uint8_t cmd)
+{
+	CaptureTransaction(e_DBusCommand, &cmd, 1);
+}
+
+
+/*
+ * Record one data byte
+ * */
+void DBUS_SendData(uint8_t data)
+{
+	CaptureTransaction(e_DBusData, &data, 1);
+}
+
+
+/*
+ * Record a block of data bytes as a single transaction
+ * */
+void DBUS_SendBurst(const uint8_t* data, int len)
+{
+	if(len > 0)
+		CaptureTransaction(e_DBusData, data, len);
+}
+
+
+/*
+ * Transfers are synchronous, there is nothing to wait for
+ * */
+void DBUS_WaitIdle(void)
+{
+}
+
+
+/*
+ * The captured display is never busy
+ * */
+bool DBUS_WaitBusy(uint8_t level, uint32_t* elapsed)
+{
+	if(elapsed != NULL)
+		*elapsed = 0;
+
+	return true;
+}
+
+
+/*
+ * The captured display is never busy
+ * */
+bool DBUS_WaitBusyStatus(uint8_t level, uint8_t status, uint32_t* elapsed)
+{
+	return DBUS_WaitBusy(level, elapsed);
+}
+
+
+/*
+ * Returns the duration of the last BUSY wait in ms
+ * */
+uint32_t DBUS_GetLastBusyTime(void)
+{
+	return 0;
+}
+
+
+/*
+ * Nothing to wake up
+ * */
+void DBUS_BusyIRQHandler(void)
+{
+}
+
+
+/*
+ * Clear the captured data
+ * */
+void DBUS_CaptureReset(void)
+{
+	capture.byte_count = 0;
+	capture.transaction_count = 0;
+}
+
+
+/*
+ * Returns the captured data
+ * */
+const DBusCapture_t* DBUS_GetCapture(void)
+{
+	return &capture;
+}
+
+
+/*
+ * Append bytes to the stream and record the transaction boundary
+ * */
+static void CaptureTransaction(DBusTransactionType_e type, const uint8_t* data, int len)
+{
+	if(capture.transaction_count < _DBUS_CAPTURE_TRANSACTIONS)
+	{
+		DBusTransaction_t* t = &capture.transactions[capture.transaction_count];
+		t->type = type;
+		t->offset = capture.byte_count;
+		t->length = len;
+	}
+	capture.transaction_count++;
+
+	for(int i = 0; i < len; i++)
+	{
+		if(capture.byte_count < _DBUS_CAPTURE_SIZE)
+			capture.data[capture.byte_count] = data[i];
+		capture.byte_count++;
+	}
+}
+
+#endif
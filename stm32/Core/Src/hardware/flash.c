@@ -8,42 +8,219 @@
  */
 
 #include "hardware/flash.h"
+#include "profiler.h"
+#include "crc32.h"
+#include "cmsis_os.h"
+#include "frame/movie.h"
+#include <stddef.h>
+
+#define _FLASH_ERASED		0xffffffff
+#define _FLASH_SKIPPED		0x00000000	//Tag of a slot that failed to program
+#define _FLASH_SLOT_WORDS	4			//Tag word and 12 bytes of the record
+#define _FLASH_SLOT_DATA	((_FLASH_SLOT_WORDS - 1) * sizeof(uint32_t))
+#define _FLASH_SLOTS		(_FLASH_SECTOR_SIZE / (_FLASH_SLOT_WORDS * sizeof(uint32_t)))
+#define _FLASH_TAG_MARK		0xa5		//Top byte of the tags, a tag is never erased or skipped
+#define _FLASH_KEY_HEADER	0xfe		//Record in the first slot of a sector
+#define _FLASH_MAX_VALUE	sizeof(FlashSource_t)
+#define _FLASH_HOT_MAGIC	0x31544F48	//"HOT1", changed when FlashHotState_t changes
+
+//Slots of a record, the value followed by its CRC
+#define FLASH_SLOTS(size)				(((size) + sizeof(uint32_t) + _FLASH_SLOT_DATA - 1) / _FLASH_SLOT_DATA)
+#define FLASH_TAG(key, index, slots)	((uint32_t)_FLASH_TAG_MARK << 24 | (uint32_t)(slots) << 16 | (uint32_t)(index) << 8 | (key))
+#define TAG_VALID(tag)					((tag) >> 24 == _FLASH_TAG_MARK)
+#define TAG_SLOTS(tag)					(((tag) >> 16) & 0xff)
+#define TAG_INDEX(tag)					(((tag) >> 8) & 0xff)
+#define TAG_KEY(tag)					((tag) & 0xff)
+#define FLASH_SLOT(sector, n)			((uint32_t*)(_FLASH_STORE_ADDR + (sector) * _FLASH_SECTOR_SIZE) + (n) * _FLASH_SLOT_WORDS)
+
+#define _FLASH_MAX_SLOTS	FLASH_SLOTS(_FLASH_MAX_VALUE)
 
-#define _FLASH_STRT_ADDR	0x080e0000
-#define _FLASH_STOP_ADDR	0x08100000
+typedef struct
+{
+	uint32_t magic;			//_FLASH_STORE_MAGIC
+	uint32_t sequence;		//Incremented at each switch, the sector with the newest header is the active one
+} FlashHeader_t;
 
-#define FLASH_READ(x) (*(uint8_t*)((x) + _FLASH_STRT_ADDR))
+static const uint16_t valueSize[e_FlashKeyCount] = {
+	[e_FlashKeySource] = sizeof(FlashSource_t),
+	[e_FlashKeyDecode] = sizeof(FlashDecode_t),
+	[e_FlashKeyCounters] = sizeof(FlashCounters_t),
+	[e_FlashKeyTimings] = sizeof(ProfWake_t),
+};
 
 typedef struct
 {
-	char file_path[_FILE_PATH_MAX_LEN];	//File path string
-	uint8_t padding[8];					//Padding to make the struct 32 bytes
-	uint8_t magic;						//Magic number (0x5A = entry contains data)
-	uint8_t checksum;					//Checksum for the entry
-} FlashEntry_t;
+	uint32_t magic;				//_FLASH_HOT_MAGIC
+	FlashSource_t source;		//File on the display, updated every wake
+	FlashCounters_t counters;	//Updated every wake
+	uint32_t crc;				//CRC-32 of the fields above
+} FlashHotState_t;
+
+_Static_assert(sizeof(FlashHotState_t) <= _BKP_STATE_SIZE, "Wake state doesn't fit the backup SRAM region");
+_Static_assert(sizeof(ProfWake_t) <= _FLASH_MAX_VALUE, "Flash values must fit the record buffer");
+_Static_assert(FLASH_SLOTS(sizeof(FlashHeader_t)) == 1, "The sector header must fit the first slot");
+
+static osMutexId_t flashLock;				//Written by the console task, erased by the render task
+static uint32_t keySlot[e_FlashKeyCount];	//First slot of the latest record of each key, 0 if none
+static bool inactiveBlank;					//The inactive sector was found blank since reset
+static uint32_t record[_FLASH_MAX_SLOTS * _FLASH_SLOT_WORDS];
+static FlashInfo_t info;
+static FlashHotState_t* hot;				//In the backup SRAM
+static bool commitPending;					//The next file is committed even in the same folder
+
+static void FLASH_Load(void);
+static uint32_t FLASH_FindHead(int sector);
+static void FLASH_IndexKeys(void);
+static bool FLASH_ReadRecord(int sector, uint32_t first, uint8_t key, void* value, uint32_t size);
+static uint32_t FLASH_BuildRecord(uint32_t* rec, uint8_t key, const void* value, uint32_t size);
+static bool FLASH_Append(uint8_t key, const void* value, uint32_t size);
+static bool FLASH_Switch(void);
+static bool FLASH_CleanInactive(void);
+static bool FLASH_Program(int sector, uint32_t first, const uint32_t* src, uint32_t slots);
+static void FLASH_EraseSector(int sector);
+static bool FLASH_IsBlank(int sector, uint32_t words);
+static uint32_t FLASH_ComputeCRC(uint32_t tag, const void* value, uint32_t size);
+static bool FLASH_Commit(void);
+static bool FLASH_SameSource(const char* a, const char* b);
+static uint32_t FLASH_HotCRC(void);
+
+
+/*
+ * Find the active sector and the latest record of each key, must be called
+ * before the other functions. The wake state is loaded from flash if the
+ * backup SRAM content was lost
+ * */
+void FLASH_Init(void)
+{
+	if(flashLock == NULL)
+		flashLock = osMutexNew(NULL);
+
+	memset(&info, 0, sizeof(info));
+	FLASH_Load();
+
+	hot = PWR_BackupRegion(_BKP_STATE_OFFSET);
+	info.backup_reset = hot->magic != _FLASH_HOT_MAGIC || hot->crc != FLASH_HotCRC();
+	if(info.backup_reset)
+	{
+		memset(hot, 0, sizeof(FlashHotState_t));
+		if(!FLASH_Read(e_FlashKeySource, &hot->source, sizeof(hot->source)))
+		{
+			hot->source.position.record = 0xffffffff;
+			hot->source.position.generation = _FMAN_NO_POSITION;
+		}
+		hot->source.path[sizeof(hot->source.path) - 1] = '\0';
+		FLASH_Read(e_FlashKeyCounters, &hot->counters, sizeof(hot->counters));
+		hot->magic = _FLASH_HOT_MAGIC;
+		hot->crc = FLASH_HotCRC();
+	}
+
+	//The counters in flash are behind the lost ones
+	commitPending = info.backup_reset;
+}
+
+
+/*
+ * Read the value of the key, size must be the size of its type
+ * return false if no valid record is found
+ * */
+bool FLASH_Read(FlashKey_e key, void* value, uint32_t size)
+{
+	bool ok;
+
+	if(key <= 0 || key >= e_FlashKeyCount || size != valueSize[key])
+		return false;
+
+	osMutexAcquire(flashLock, osWaitForever);
+	ok = info.active >= 0 && keySlot[key] != 0 && FLASH_ReadRecord(info.active, keySlot[key], key, value, size);
+	osMutexRelease(flashLock);
+
+	return ok;
+}
+
+
+/*
+ * Write the value of the key, nothing is programmed if it's the stored one.
+ * Returns false if the record can't be programmed
+ * */
+bool FLASH_Write(FlashKey_e key, const void* value, uint32_t size)
+{
+	uint8_t stored[_FLASH_MAX_VALUE];
+	uint32_t start = PROF_Start();
+	bool ok = true;
+
+	if(key <= 0 || key >= e_FlashKeyCount || size != valueSize[key])
+		return false;
+
+	osMutexAcquire(flashLock, osWaitForever);
+
+	if(info.active >= 0 && keySlot[key] != 0 && FLASH_ReadRecord(info.active, keySlot[key], key, stored, size) &&
+	   memcmp(stored, value, size) == 0)
+	{
+		info.skipped++;
+	}
+	else if(!FLASH_Append(key, value, size))
+	{
+		printf("ERROR: Unable to write key %d to the flash\n", key);
+		ok = false;
+	}
+
+	osMutexRelease(flashLock);
+
+	PROF_Add(e_ProfFlash, start);
+
+	return ok;
+}
+
+
+/*
+ * Erase the inactive sector if it's not blank. The CPU stalls for about
+ * a second, call it when it would wait anyway (panel refresh, standby).
+ * Returns true if the sector was erased
+ * */
+bool FLASH_EraseInactive(void)
+{
+	uint32_t start = PROF_Start();
+
+	osMutexAcquire(flashLock, osWaitForever);
+	bool erased = FLASH_CleanInactive();
+	osMutexRelease(flashLock);
+
+	if(erased)
+		PROF_Add(e_ProfFlash, start);
 
+	return erased;
+}
 
-static FlashEntry_t* FLASH_FindLastValidEntry(void);
-static FlashEntry_t* FLASH_FindFirstEmptyEntry(void);
-static uint8_t FLASH_ComputeChecksum(FlashEntry_t* entry);
+
+/*
+ * Returns the state of the store and the counters since reset
+ * */
+const FlashInfo_t* FLASH_GetInfo(void)
+{
+	return &info;
+}
 
 
 /*
- * Read file path from flash
+ * Read file path and playlist position of the file on the display, pos can be NULL
  * return false if no valid data is found
  * */
-bool FLASH_LoadFilePath(char* file_path)
+bool FLASH_LoadFilePath(char* file_path, FmanPosition_t* pos)
 {
-	FlashEntry_t* pt;
 	file_path[0] = '\0';
+	if(pos != NULL)
+	{
+		pos->generation = _FMAN_NO_POSITION;
+		pos->frame = 0;
+	}
 
-	//Search for most recent valid entry
-	pt = FLASH_FindLastValidEntry();
-	if(pt == NULL)
+	if(hot->source.path[0] == '\0')
 		return false;
 
 	//Copy file path
-	strcpy(file_path, pt->file_path);
+	strcpy(file_path, hot->source.path);
+	if(pos != NULL)
+		*pos = hot->source.position;
 
 	//Return
 	return true;
@@ -51,125 +228,447 @@ bool FLASH_LoadFilePath(char* file_path)
 
 
 /*
- * Write file path to flash
+ * Store file path and playlist position of the file on the display in the backup SRAM,
+ * pos can be NULL. The file is committed to flash when its folder (movie) changes
+ * */
+void FLASH_StoreFilePath(const char* file_path, const FmanPosition_t* pos)
+{
+	FlashSource_t* source = &hot->source;
+	FlashSource_t committed;
+
+	//Padding is zero, the record of the same file compares equal
+	memset(source, 0, sizeof(FlashSource_t));
+	source->position.record = pos != NULL ? pos->record : 0xffffffff;
+	source->position.generation = pos != NULL ? pos->generation : _FMAN_NO_POSITION;
+	source->position.frame = pos != NULL ? pos->frame : 0;
+	strncpy(source->path, file_path, sizeof(source->path) - 1);
+	hot->crc = FLASH_HotCRC();
+
+	if(commitPending || !FLASH_Read(e_FlashKeySource, &committed, sizeof(committed)) ||
+	   !FLASH_SameSource(committed.path, source->path))
+	{
+		commitPending = !FLASH_Commit();
+	}
+}
+
+
+/*
+ * Count the wake in the backup SRAM, called before standby
+ * */
+void FLASH_EndWake(uint32_t updates, uint32_t failures)
+{
+	hot->counters.wakes++;
+	hot->counters.updates += updates;
+	hot->counters.failures += failures;
+	if(failures > 0)
+		hot->counters.last_failure = hot->counters.wakes;
+	hot->crc = FLASH_HotCRC();
+}
+
+
+/*
+ * Returns the wake counters in the backup SRAM
+ * */
+const FlashCounters_t* FLASH_GetCounters(void)
+{
+	return &hot->counters;
+}
+
+
+/*
+ * Erase both sectors, all keys are lost
+ * */
+void FLASH_Erase(void)
+{
+	osMutexAcquire(flashLock, osWaitForever);
+	FLASH_EraseSector(0);
+	FLASH_EraseSector(1);
+	FLASH_Load();
+	osMutexRelease(flashLock);
+}
+
+
+/*
+ * The active sector is the one with the newest valid header,
+ * the store is empty if no sector has one
  * */
-void FLASH_StoreFilePath(const char* file_path)
+static void FLASH_Load(void)
 {
-	FlashEntry_t new_entity;
-	FlashEntry_t* pt;
+	FlashHeader_t header;
 
-	//Check if there is space
-	pt = FLASH_FindFirstEmptyEntry();
+	memset(keySlot, 0, sizeof(keySlot));
+	info.active = -1;
+	info.sequence = 0;
+	info.used = 0;
+	info.slots = _FLASH_SLOTS;
 
-	if(pt == NULL)
+	for(int sector = 0; sector < 2; sector++)
 	{
-		//Erase sector
-		FLASH_Erase();
-		pt = (FlashEntry_t*)_FLASH_STRT_ADDR;
+		if(FLASH_ReadRecord(sector, 0, _FLASH_KEY_HEADER, &header, sizeof(header)) && header.magic == _FLASH_STORE_MAGIC &&
+		   (info.active < 0 || (int32_t)(header.sequence - info.sequence) > 0))
+		{
+			info.active = sector;
+			info.sequence = header.sequence;
+		}
 	}
 
-	//Prepare entry
-	strcpy(new_entity.file_path, file_path);
-	new_entity.padding[0] = 0xff;
-	new_entity.padding[1] = 0xff;
-	new_entity.padding[2] = 0xff;
-	new_entity.padding[3] = 0xff;
-	new_entity.padding[4] = 0xff;
-	new_entity.padding[5] = 0xff;
-	new_entity.padding[6] = 0xff;
-	new_entity.padding[7] = 0xff;
-	new_entity.magic = 0x5a;
-	new_entity.checksum = 0;
-	new_entity.checksum = FLASH_ComputeChecksum(&new_entity);
+	if(info.active >= 0)
+	{
+		info.used = FLASH_FindHead(info.active);
+		FLASH_IndexKeys();
+	}
+
+	//Checked in full by FLASH_CleanInactive(), only the first slots here
+	inactiveBlank = false;
+	info.erase_pending = !FLASH_IsBlank(info.active < 0 ? 0 : info.active ^ 1, 2 * _FLASH_SLOT_WORDS);
+}
 
-	//Unlock flash memory
-	HAL_FLASH_Unlock();
 
-	//Write data to flash
-	for(int i = 0; i < sizeof(FlashEntry_t); i++)
-		HAL_FLASH_Program(FLASH_TYPEPROGRAM_BYTE, (uint32_t)pt + i, ((uint8_t*)(&new_entity))[i]);
+/*
+ * Returns the number of used slots, the first erased one is the head of the sector.
+ * Slots are used in order, a binary search on the tags finds the boundary
+ * */
+static uint32_t FLASH_FindHead(int sector)
+{
+	uint32_t lo = 1;
+	uint32_t hi = _FLASH_SLOTS;
 
-	for(int i = 0; i < sizeof(FlashEntry_t); i++)
-		HAL_FLASH_Program(FLASH_TYPEPROGRAM_BYTE, (uint32_t)pt + i, ((uint8_t*)(&new_entity))[i]);
+	while(lo < hi)
+	{
+		uint32_t mid = lo + (hi - lo) / 2;
 
-	//Lock flash memory
-	HAL_FLASH_Lock();
+		if(FLASH_SLOT(sector, mid)[0] != _FLASH_ERASED)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	return lo;
 }
 
 
 /*
- * Erase all entries from flash
+ * Walk the records back from the head to find the latest valid one of each key.
+ * A tag is trusted only if the first slot of its record covers it: a tag cut by
+ * a power loss has bits still set and may point before the start of its record
  * */
-void FLASH_Erase(void)
+static void FLASH_IndexKeys(void)
 {
-	HAL_FLASH_Unlock();
-	FLASH_Erase_Sector(FLASH_SECTOR_11, FLASH_VOLTAGE_RANGE_1);
-	HAL_FLASH_Lock();
+	uint32_t missing = e_FlashKeyCount - 1;
+	uint32_t slot = info.used;
+
+	while(slot > 1 && missing > 0)
+	{
+		uint32_t tag = FLASH_SLOT(info.active, --slot)[0];
+
+		if(!TAG_VALID(tag) || TAG_INDEX(tag) >= slot)
+			continue;
+
+		uint32_t first = slot - TAG_INDEX(tag);
+		uint32_t head = FLASH_SLOT(info.active, first)[0];
+
+		if(!TAG_VALID(head) || TAG_INDEX(head) != 0 || first + TAG_SLOTS(head) <= slot)
+			continue;
+
+		//Records cut by a power loss have no valid CRC
+		uint32_t key = TAG_KEY(head);
+		if(key > 0 && key < e_FlashKeyCount && keySlot[key] == 0 &&
+		   FLASH_ReadRecord(info.active, first, key, NULL, valueSize[key]))
+		{
+			keySlot[key] = first;
+			missing--;
+		}
+
+		slot = first;
+	}
 }
 
 
 /*
- * Finds the last entry in the flash
- * returns null if no valid entry is found
+ * Read the record of the key starting at slot first, value can be NULL to only check it.
+ * Returns false if the tags or the CRC don't match
  * */
-static FlashEntry_t* FLASH_FindLastValidEntry(void)
+static bool FLASH_ReadRecord(int sector, uint32_t first, uint8_t key, void* value, uint32_t size)
 {
-	FlashEntry_t* pt = (FlashEntry_t*)(_FLASH_STOP_ADDR - sizeof(FlashEntry_t));
+	uint8_t data[_FLASH_MAX_SLOTS * _FLASH_SLOT_DATA];
+	uint32_t slots = FLASH_SLOTS(size);
+	uint32_t crc;
 
-	while(pt >= (FlashEntry_t*)_FLASH_STRT_ADDR)
+	if(first + slots > _FLASH_SLOTS)
+		return false;
+
+	for(uint32_t i = 0; i < slots; i++)
 	{
-		//Check if the entry is valid (checksum is not computed if magic is invalid)
-		if(pt->magic == 0x5A && FLASH_ComputeChecksum(pt) == 0)
-			return pt;
+		const uint32_t* pt = FLASH_SLOT(sector, first + i);
+
+		if(pt[0] != FLASH_TAG(key, i, slots))
+			return false;
+
+		memcpy(&data[i * _FLASH_SLOT_DATA], &pt[1], _FLASH_SLOT_DATA);
+	}
+
+	memcpy(&crc, &data[slots * _FLASH_SLOT_DATA - sizeof(crc)], sizeof(crc));
+	if(crc != FLASH_ComputeCRC(FLASH_TAG(key, 0, slots), data, size))
+		return false;
+
+	if(value != NULL)
+		memcpy(value, data, size);
+
+	return true;
+}
+
+
+/*
+ * Lay out the record in slots: tag word and 12 bytes of the value,
+ * the CRC is in the last word. Returns the number of slots
+ * */
+static uint32_t FLASH_BuildRecord(uint32_t* rec, uint8_t key, const void* value, uint32_t size)
+{
+	uint8_t data[_FLASH_MAX_SLOTS * _FLASH_SLOT_DATA];
+	uint32_t slots = FLASH_SLOTS(size);
+	uint32_t crc = FLASH_ComputeCRC(FLASH_TAG(key, 0, slots), value, size);
+
+	memset(data, 0, sizeof(data));
+	memcpy(data, value, size);
+	memcpy(&data[slots * _FLASH_SLOT_DATA - sizeof(crc)], &crc, sizeof(crc));
 
-		//Point to the previous entry
-		pt --;
+	for(uint32_t i = 0; i < slots; i++)
+	{
+		rec[i * _FLASH_SLOT_WORDS] = FLASH_TAG(key, i, slots);
+		memcpy(&rec[i * _FLASH_SLOT_WORDS + 1], &data[i * _FLASH_SLOT_DATA], _FLASH_SLOT_DATA);
 	}
 
-	return NULL;
+	return slots;
 }
 
 
 /*
- * Finds the address of the first empty entry
- * returns null if no valid entry is found
+ * Append the record at the head of the active sector, switching sector when it's full.
+ * A record that fails to program is skipped and written again after it
  * */
-static FlashEntry_t* FLASH_FindFirstEmptyEntry(void)
+static bool FLASH_Append(uint8_t key, const void* value, uint32_t size)
 {
-	FlashEntry_t* pt = (FlashEntry_t*)_FLASH_STRT_ADDR;
+	uint32_t slots = FLASH_BuildRecord(record, key, value, size);
 
-	while(pt <= (FlashEntry_t*)(_FLASH_STOP_ADDR - sizeof(FlashEntry_t)))
+	for(int attempt = 0; attempt < 3; attempt++)
 	{
-		//Check if the entry is empty (check magic first)
-		if(pt->magic == 0xff)
+		if(info.active < 0 || info.used + slots > _FLASH_SLOTS)
 		{
-			uint8_t t = 0xff;
+			if(!FLASH_Switch())
+				return false;
+		}
 
-			for(int i = 0; i < sizeof(FlashEntry_t); i++)
-				t &= ((uint8_t*)pt)[i];
+		uint32_t first = info.used;
+		bool ok = FLASH_Program(info.active, first, record, slots);
 
-			if(t == 0xff)
-				return pt;
+		info.used = first + slots;
+		if(ok)
+		{
+			keySlot[key] = first;
+			info.records++;
+			return true;
 		}
+	}
+
+	return false;
+}
+
+
+/*
+ * Copy the latest record of each key to the inactive sector and make it the active one.
+ * Its header is programmed last, until then the old sector is still the active one
+ * */
+static bool FLASH_Switch(void)
+{
+	int target = info.active < 0 ? 0 : info.active ^ 1;
+	FlashHeader_t header = {_FLASH_STORE_MAGIC, info.sequence + 1};
+	uint32_t moved[e_FlashKeyCount] = {0};
+	uint32_t hdr[_FLASH_SLOT_WORDS];
+	uint32_t slot = 1;
+
+	//The background erase was missed, the CPU stalls here
+	if(FLASH_CleanInactive())
+		info.blocking_erases++;
 
-		//Point to the next entry
-		pt ++;
+	if(!inactiveBlank)
+		return false;
+
+	inactiveBlank = false;
+	info.erase_pending = true;
+
+	for(int key = 1; key < e_FlashKeyCount; key++)
+	{
+		uint32_t slots = FLASH_SLOTS(valueSize[key]);
+
+		if(keySlot[key] == 0)
+			continue;
+
+		if(!FLASH_Program(target, slot, FLASH_SLOT(info.active, keySlot[key]), slots))
+			return false;
+
+		moved[key] = slot;
+		slot += slots;
 	}
 
-	return NULL;
+	FLASH_BuildRecord(hdr, _FLASH_KEY_HEADER, &header, sizeof(header));
+	if(!FLASH_Program(target, 0, hdr, 1))
+		return false;
+
+	//The old sector is erased in the background
+	info.active = target;
+	info.sequence = header.sequence;
+	info.used = slot;
+	memcpy(keySlot, moved, sizeof(keySlot));
+
+	return true;
 }
 
 
+/*
+ * Erase the inactive sector if it's not blank, returns true if it was erased
+ * */
+static bool FLASH_CleanInactive(void)
+{
+	int sector = info.active < 0 ? 0 : info.active ^ 1;
+	bool erased = false;
+
+	if(inactiveBlank)
+		return false;
+
+	if(!FLASH_IsBlank(sector, _FLASH_SECTOR_SIZE / sizeof(uint32_t)))
+	{
+		FLASH_EraseSector(sector);
+		erased = true;
+	}
+
+	inactiveBlank = !erased || FLASH_IsBlank(sector, _FLASH_SECTOR_SIZE / sizeof(uint32_t));
+	info.erase_pending = !inactiveBlank;
+
+	if(!inactiveBlank)
+		printf("ERROR: Unable to erase flash sector %d\n", 10 + sector);
+
+	return erased;
+}
+
 
 /*
- * Compute checksum for the entry
+ * Program the slots a word at a time in address order, the CRC is the last word.
+ * Returns false if the slots weren't erased or don't read back, their tags are
+ * then cleared so that the slots before the head stay used
  * */
-static uint8_t FLASH_ComputeChecksum(FlashEntry_t* entry)
+static bool FLASH_Program(int sector, uint32_t first, const uint32_t* src, uint32_t slots)
 {
-	uint8_t sum = 0;
+	uint32_t* dst = FLASH_SLOT(sector, first);
+	uint32_t words = slots * _FLASH_SLOT_WORDS;
+	bool ok = true;
+
+	for(uint32_t i = 0; i < words && ok; i++)
+		ok = dst[i] == _FLASH_ERASED;
+
+	HAL_FLASH_Unlock();
+
+	for(uint32_t i = 0; i < words && ok; i++)
+		ok = HAL_FLASH_Program(FLASH_TYPEPROGRAM_WORD, (uintptr_t)&dst[i], src[i]) == HAL_OK;
 
-	for(int i = 0; i < sizeof(FlashEntry_t); i++)
-		sum += ((uint8_t*)entry)[i];
+	ok = ok && memcmp(dst, src, words * sizeof(uint32_t)) == 0;
 
-	return ~sum+1;
+	//Bits can always be cleared
+	if(!ok)
+	{
+		for(uint32_t i = 0; i < slots; i++)
+			HAL_FLASH_Program(FLASH_TYPEPROGRAM_WORD, (uintptr_t)&dst[i * _FLASH_SLOT_WORDS], _FLASH_SKIPPED);
+	}
+
+	HAL_FLASH_Lock();
+
+	return ok;
+}
+
+
+/*
+ * Erase sector 10 (0) or 11 (1), the CPU stalls until it's done
+ * */
+static void FLASH_EraseSector(int sector)
+{
+	FLASH_EraseInitTypeDef erase = {0};
+	uint32_t error;
+
+	erase.TypeErase = FLASH_TYPEERASE_SECTORS;
+	erase.Sector = sector == 0 ? FLASH_SECTOR_10 : FLASH_SECTOR_11;
+	erase.NbSectors = 1;
+	erase.VoltageRange = FLASH_VOLTAGE_RANGE_3;
+
+	HAL_FLASH_Unlock();
+	HAL_FLASHEx_Erase(&erase, &error);
+	HAL_FLASH_Lock();
+
+	info.erases++;
+}
+
+
+/*
+ * The first words of the sector are erased
+ * */
+static bool FLASH_IsBlank(int sector, uint32_t words)
+{
+	const uint32_t* pt = FLASH_SLOT(sector, 0);
+
+	for(uint32_t i = 0; i < words; i++)
+	{
+		if(pt[i] != _FLASH_ERASED)
+			return false;
+	}
+
+	return true;
+}
+
+
+/*
+ * CRC of the tag of the first slot and of the value
+ * */
+static uint32_t FLASH_ComputeCRC(uint32_t tag, const void* value, uint32_t size)
+{
+	return CRC32_Update(CRC32_Update(0, &tag, sizeof(tag)), value, size);
+}
+
+
+/*
+ * Write the file on the display, the counters and the timings of the last wake to flash,
+ * returns false if the file can't be written
+ * */
+static bool FLASH_Commit(void)
+{
+	bool ok = FLASH_Write(e_FlashKeySource, &hot->source, sizeof(hot->source));
+
+	FLASH_Write(e_FlashKeyCounters, &hot->counters, sizeof(hot->counters));
+	if(PROF_GetWakeCount() > 1)
+		FLASH_Write(e_FlashKeyTimings, PROF_GetWake(1), sizeof(ProfWake_t));
+
+	return ok;
+}
+
+
+/*
+ * Files in the same folder, or frames of the same movie
+ * */
+static bool FLASH_SameSource(const char* a, const char* b)
+{
+	if(MOV_IsMovieName(a) || MOV_IsMovieName(b))
+		return strcmp(a, b) == 0;
+
+	const char* end_a = strrchr(a, '/');
+	const char* end_b = strrchr(b, '/');
+	size_t len_a = end_a != NULL ? end_a - a : 0;
+	size_t len_b = end_b != NULL ? end_b - b : 0;
+
+	return len_a == len_b && strncmp(a, b, len_a) == 0;
+}
+
+
+/*
+ * CRC of the wake state fields before the crc
+ * */
+static uint32_t FLASH_HotCRC(void)
+{
+	return CRC32_Update(0, hot, offsetof(FlashHotState_t, crc));
 }
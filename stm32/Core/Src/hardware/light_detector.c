@@ -29,13 +29,41 @@
 
 #include "hardware/light_detector.h"
 #include "main.h"
+#include "cmsis_os.h"
 
+static volatile osThreadId_t ldr_thread = NULL;
 
+
+/*
+ * Measure the charge time of the capacitor, the calling task sleeps
+ * until the EXTI interrupt on LDR_SIG reports the rising edge
+ * */
 bool LDR_IsDark(void)
 {
+	bool scheduler_running = osKernelGetState() == osKernelRunning;
+
 	//Discharge the capacitor
 	HAL_GPIO_WritePin(LDR_SIG_GPIO_Port, LDR_SIG_Pin, GPIO_PIN_RESET);
-	HAL_Delay(1);
+	if(scheduler_running)
+		osDelay(1);
+	else
+		HAL_Delay(1);
+
+	//Route LDR_SIG to EXTI8 on the rising edge, the pin stays an open drain output
+	__HAL_RCC_SYSCFG_CLK_ENABLE();
+	MODIFY_REG(SYSCFG->EXTICR[2], SYSCFG_EXTICR3_EXTI8, SYSCFG_EXTICR3_EXTI8_PB);
+	EXTI->RTSR |= LDR_SIG_Pin;
+	EXTI->FTSR &= ~LDR_SIG_Pin;
+	__HAL_GPIO_EXTI_CLEAR_IT(LDR_SIG_Pin);
+	EXTI->IMR |= LDR_SIG_Pin;
+	HAL_NVIC_SetPriority(EXTI9_5_IRQn, 5, 0);
+	HAL_NVIC_EnableIRQ(EXTI9_5_IRQn);
+
+	if(scheduler_running)
+	{
+		osThreadFlagsClear(_LDR_FLAG_RISE);
+		ldr_thread = osThreadGetId();
+	}
 
 	//Release the LDR_SIG pin
 	HAL_GPIO_WritePin(LDR_SIG_GPIO_Port, LDR_SIG_Pin, GPIO_PIN_SET);
@@ -43,10 +71,28 @@ bool LDR_IsDark(void)
 	uint32_t time = 0;
 
 	//Wait until the LDR_SIG rises above the threshold level
-	while(HAL_GPIO_ReadPin(LDR_SIG_GPIO_Port, LDR_SIG_Pin) == GPIO_PIN_RESET && time < 255)
+	while(HAL_GPIO_ReadPin(LDR_SIG_GPIO_Port, LDR_SIG_Pin) == GPIO_PIN_RESET && time < _LDR_MAX_TIME)
 	{
+		if(scheduler_running)
+			osThreadFlagsWait(_LDR_FLAG_RISE, osFlagsWaitAny, _LDR_MAX_TIME - time);
+
 		time = HAL_GetTick() - start;
 	}
 
+	ldr_thread = NULL;
+	EXTI->IMR &= ~LDR_SIG_Pin;
+
 	return time >= _DARK_THRESHOLD;
 }
+
+
+/*
+ * Called from HAL_GPIO_EXTI_Callback() on the rising edge of LDR_SIG
+ * */
+void LDR_IRQHandler(void)
+{
+	osThreadId_t thread = ldr_thread;
+
+	if(thread != NULL)
+		osThreadFlagsSet(thread, _LDR_FLAG_RISE);
+}
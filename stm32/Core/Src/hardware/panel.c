@@ -0,0 +1,248 @@
+/**
+ ******************************************************************************
+ * @file      panel.c
+ * @author    ts-manuel
+ * @brief     E-Paper panel descriptors
+ *
+ ******************************************************************************
+ */
+
+#include "hardware/panel.h"
+#include "hardware/display_bus.h"
+
+
+#if _PANEL == _PANEL_5IN65F
+
+const RGB16_t display_colors[_PANEL_COLORS+1] = {
+		{0x00, 0x00, 0x00},	//EPD_5IN65F_BLACK
+		{0xff, 0xff, 0xff},	//EPD_5IN65F_WHITE
+		{0x00, 0xff, 0x00},	//EPD_5IN65F_GREEN
+		{0x00, 0x00, 0xff},	//EPD_5IN65F_BLUE
+		{0xff, 0x00, 0x00},	//EPD_5IN65F_RED
+		{0xff, 0xff, 0x00},	//EPD_5IN65F_YELLOW
+		{0xff, 0x80, 0x00},	//EPD_5IN65F_ORANGE
+		{0xaa, 0x6e, 0x96}	//EPD_5IN65F_CLEAN
+};
+
+
+/*
+ * Reset and configure the panel
+ * */
+static void Init(DisplayBusyTimes_t* times)
+{
+	EPD_5IN65F_Init();
+	times->init = DBUS_GetLastBusyTime();
+	times->timeout = times->init >= _DBUS_BUSY_TIMEOUT;
+}
+
+
+/*
+ * Set resolution
+ * */
+static void Begin(void)
+{
+	DBUS_SendCommand(0x61);
+	DBUS_SendData(0x02);
+	DBUS_SendData(0x58);
+	DBUS_SendData(0x01);
+	DBUS_SendData(0xC0);
+}
+
+
+/*
+ * Power on, refresh, power off, the task sleeps while the display is busy
+ * */
+static void Refresh(DisplayBusyTimes_t* times)
+{
+	DBUS_SendCommand(0x04);
+	if(!DBUS_WaitBusy(1, &times->power_on))
+		times->timeout = true;
+	DBUS_SendCommand(0x12);
+	DISP_RefreshStarted();
+	if(!DBUS_WaitBusy(1, &times->refresh))
+		times->timeout = true;
+	DBUS_SendCommand(0x02);
+	if(!DBUS_WaitBusy(0, &times->power_off))
+		times->timeout = true;
+}
+
+
+const PanelDescriptor_t panel = {
+	.name = "5.65\" 7 color",
+	.width = _PANEL_WIDTH,
+	.height = _PANEL_HEIGHT,
+	.bpp = _PANEL_BPP,
+	.planes = _PANEL_PLANES,
+	.num_colors = _PANEL_COLORS,
+	.palette = display_colors,
+	.plane_command = {0x10, 0x00},
+	.init = Init,
+	.begin = Begin,
+	.refresh = Refresh,
+	.sleep = EPD_5IN65F_Sleep
+};
+
+#elif _PANEL == _PANEL_4IN2
+
+const RGB16_t display_colors[_PANEL_COLORS+1] = {
+		{0x00, 0x00, 0x00},	//Black
+		{0xff, 0xff, 0xff},	//White
+		{0xff, 0xff, 0xff}	//Clean
+};
+
+
+/*
+ * Reset, configure and power on the panel
+ * */
+static void Init(DisplayBusyTimes_t* times)
+{
+	EPD_4IN2_Init();
+	times->init = DBUS_GetLastBusyTime();
+	times->timeout = times->init >= _DBUS_BUSY_TIMEOUT;
+}
+
+
+static void Begin(void)
+{
+}
+
+
+/*
+ * Refresh, BUSY is low while the panel is busy,
+ * the UC8176 updates it after the get status command (0x71)
+ * */
+static void Refresh(DisplayBusyTimes_t* times)
+{
+	times->power_on = 0;
+	DBUS_SendCommand(0x12);
+	DISP_RefreshStarted();
+	DEV_Delay_ms(100);
+	if(!DBUS_WaitBusyStatus(1, 0x71, &times->refresh))
+		times->timeout = true;
+	times->power_off = 0;
+}
+
+
+/*
+ * Send the window of the plane and refresh only that part of the panel,
+ * the full refresh mode is restored afterwards
+ * */
+static void RefreshWindow(const uint8_t* plane, const DisplayWindow_t* win, DisplayBusyTimes_t* times)
+{
+	static uint8_t inverted[2][_PANEL_WIDTH / 8];	//One row is sent while the other is filled
+	const int row_bytes = _PANEL_WIDTH / 8;
+	const int win_bytes = (win->x1 - win->x0) / 8;
+	const uint8_t* src = &plane[win->y0 * row_bytes + win->x0 / 8];
+
+	DBUS_WaitIdle();
+	EPD_4IN2_PartialMode();
+
+	DBUS_SendCommand(0x90);
+	DBUS_SendData(win->x0 >> 8);
+	DBUS_SendData(win->x0 & 0xff);
+	DBUS_SendData((win->x1 - 1) >> 8);
+	DBUS_SendData((win->x1 - 1) & 0xff);
+	DBUS_SendData(win->y0 >> 8);
+	DBUS_SendData(win->y0 & 0xff);
+	DBUS_SendData((win->y1 - 1) >> 8);
+	DBUS_SendData((win->y1 - 1) & 0xff);
+	DBUS_SendData(0x28);
+
+	//Old data, then the new data inverted as the partial LUT expects
+	DBUS_SendCommand(0x10);
+	for(int y = win->y0; y < win->y1; y++)
+		DBUS_SendBurst(&src[(y - win->y0) * row_bytes], win_bytes);
+
+	DBUS_SendCommand(0x13);
+	for(int y = win->y0; y < win->y1; y++)
+	{
+		uint8_t* row = inverted[y & 1];
+
+		for(int i = 0; i < win_bytes; i++)
+			row[i] = ~src[(y - win->y0) * row_bytes + i];
+		DBUS_SendBurst(row, win_bytes);
+	}
+
+	DBUS_SendCommand(0x12);
+	DISP_RefreshStarted();
+	DEV_Delay_ms(10);
+	if(!DBUS_WaitBusyStatus(1, 0x71, &times->refresh))
+		times->timeout = true;
+
+	EPD_4IN2_FullMode();
+}
+
+
+const PanelDescriptor_t panel = {
+	.name = "4.2\" black/white",
+	.width = _PANEL_WIDTH,
+	.height = _PANEL_HEIGHT,
+	.bpp = _PANEL_BPP,
+	.planes = _PANEL_PLANES,
+	.num_colors = _PANEL_COLORS,
+	.palette = display_colors,
+	.plane_command = {0x13, 0x00},
+	.init = Init,
+	.begin = Begin,
+	.refresh = Refresh,
+	.refresh_window = RefreshWindow,
+	.sleep = EPD_4IN2_Sleep
+};
+
+#elif _PANEL == _PANEL_4IN2BC
+
+const RGB16_t display_colors[_PANEL_COLORS+1] = {
+		{0x00, 0x00, 0x00},	//Black
+		{0xff, 0xff, 0xff},	//White
+		{0xff, 0x00, 0x00},	//Red
+		{0xff, 0xff, 0xff}	//Clean
+};
+
+
+/*
+ * Reset, configure and power on the panel
+ * */
+static void Init(DisplayBusyTimes_t* times)
+{
+	EPD_4IN2BC_Init();
+	times->init = DBUS_GetLastBusyTime();
+	times->timeout = times->init >= _DBUS_BUSY_TIMEOUT;
+}
+
+
+static void Begin(void)
+{
+}
+
+
+/*
+ * Refresh, BUSY is low while the panel is busy
+ * */
+static void Refresh(DisplayBusyTimes_t* times)
+{
+	times->power_on = 0;
+	DBUS_SendCommand(0x12);
+	DISP_RefreshStarted();
+	DEV_Delay_ms(100);
+	if(!DBUS_WaitBusy(1, &times->refresh))
+		times->timeout = true;
+	times->power_off = 0;
+}
+
+
+const PanelDescriptor_t panel = {
+	.name = "4.2\" black/white/red",
+	.width = _PANEL_WIDTH,
+	.height = _PANEL_HEIGHT,
+	.bpp = _PANEL_BPP,
+	.planes = _PANEL_PLANES,
+	.num_colors = _PANEL_COLORS,
+	.palette = display_colors,
+	.plane_command = {0x10, 0x13},
+	.init = Init,
+	.begin = Begin,
+	.refresh = Refresh,
+	.sleep = EPD_4IN2BC_Sleep
+};
+
+#endif
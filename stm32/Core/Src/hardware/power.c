@@ -8,9 +8,28 @@
  */
 
 #include "hardware/power.h"
+#include "hardware/clock.h"
+#include "profiler.h"
+#include "usb_device.h"
+#include "FreeRTOS.h"
+#include "task.h"
 
 
 extern RTC_HandleTypeDef hrtc;
+extern SPI_HandleTypeDef hspi1;
+extern SD_HandleTypeDef hsd;
+extern UART_HandleTypeDef huart3;
+extern USBD_HandleTypeDef hUsbDeviceFS;
+
+static volatile uint32_t stopLocks = 0;
+static PowerIdleStats_t idleStats;
+
+static bool StopAllowed(void);
+static void StartWakeUpTimer(uint32_t counts);
+static void StopWakeUpTimer(void);
+static void StartConsoleWake(void);
+static void StopConsoleWake(void);
+static uint32_t ReadRTCMillis(void);
 
 
 /*
@@ -54,9 +73,260 @@ void PWR_Disable(Device_e dev)
  * */
 void PWR_EnterStandBy(void)
 {
+	PROF_EndWake();
+
+	//The wakeup timer is also used by the tickless idle, set the standby period again
+	HAL_RTCEx_SetWakeUpTimer_IT(&hrtc, _PWR_WAKEUP_PERIOD, RTC_WAKEUPCLOCK_CK_SPRE_16BITS);
+
 	__HAL_PWR_CLEAR_FLAG(PWR_FLAG_SB);
 	__HAL_PWR_CLEAR_FLAG(PWR_FLAG_WU);
 	__HAL_RTC_WAKEUPTIMER_CLEAR_FLAG(&hrtc, RTC_FLAG_WUTF);
 	HAL_PWR_EnterSTANDBYMode();
 }
 
+
+
+/*
+ * Enable access to the backup SRAM and its regulator,
+ * so that the content is retained in standby
+ * */
+void PWR_BackupInit(void)
+{
+	__HAL_RCC_PWR_CLK_ENABLE();
+	HAL_PWR_EnableBkUpAccess();
+	__HAL_RCC_BKPSRAM_CLK_ENABLE();
+	HAL_PWREx_EnableBkUpReg();
+}
+
+
+/*
+ * Returns a pointer to the region of the backup SRAM at offset
+ * */
+void* PWR_BackupRegion(uint32_t offset)
+{
+	return (void*)(BKPSRAM_BASE + offset);
+}
+
+
+/*
+ * Called by the idle task when no task has to run for expected_idle_time ticks,
+ * the core sleeps until the RTC wakeup timer expires or an interrupt occurs
+ * */
+void PWR_SuppressTicksAndSleep(uint32_t expected_idle_time)
+{
+	if(expected_idle_time > _PWR_IDLE_MAX_TICKS)
+		expected_idle_time = _PWR_IDLE_MAX_TICKS;
+
+	//Interrupts still wake the core from WFI, but are not served until the ticks are fixed
+	__disable_irq();
+	__DSB();
+	__ISB();
+
+	if(eTaskConfirmSleepModeStatus() == eAbortSleep)
+	{
+		__enable_irq();
+		return;
+	}
+
+	//Stop the RTOS and HAL ticks, the RTC keeps time
+	SysTick->CTRL &= ~SysTick_CTRL_ENABLE_Msk;
+	HAL_SuspendTick();
+
+	uint32_t start = ReadRTCMillis();
+	StartWakeUpTimer(expected_idle_time * _PWR_WUT_HZ / configTICK_RATE_HZ);
+
+	bool stop = StopAllowed();
+	if(stop)
+	{
+		//Everything clocked by the PLL stops, the core wakes up on HSI
+		StartConsoleWake();
+		HAL_PWREx_EnableFlashPowerDown();
+		HAL_PWR_EnterSTOPMode(PWR_LOWPOWERREGULATOR_ON, PWR_STOPENTRY_WFI);
+		CLK_ResumeFromStop();
+		StopConsoleWake();
+
+		//The calendar shadow registers are not updated in stop mode
+		__HAL_RTC_WRITEPROTECTION_DISABLE(&hrtc);
+		HAL_RTC_WaitForSynchro(&hrtc);
+		__HAL_RTC_WRITEPROTECTION_ENABLE(&hrtc);
+	}
+	else
+	{
+		__DSB();
+		__WFI();
+		__ISB();
+	}
+
+	StopWakeUpTimer();
+
+	//Elapsed time (the calendar wraps at midnight)
+	uint32_t elapsed = (ReadRTCMillis() + 86400000 - start) % 86400000;
+	uint32_t ticks = elapsed * configTICK_RATE_HZ / 1000;
+
+	if(stop)
+	{
+		idleStats.stop_ms += elapsed;
+		idleStats.stop_count++;
+	}
+	else
+	{
+		idleStats.sleep_ms += elapsed;
+		idleStats.sleep_count++;
+	}
+
+	//Step the ticks, the last one is counted by the SysTick interrupt
+	uwTick += elapsed;
+	HAL_ResumeTick();
+
+	if(ticks >= expected_idle_time)
+	{
+		vTaskStepTick(expected_idle_time - 1);
+		SCB->ICSR = SCB_ICSR_PENDSTSET_Msk;
+	}
+	else
+	{
+		vTaskStepTick(ticks);
+	}
+
+	SysTick->LOAD = SystemCoreClock / configTICK_RATE_HZ - 1;
+	SysTick->VAL = 0;
+	SysTick->CTRL |= SysTick_CTRL_ENABLE_Msk;
+
+	__enable_irq();
+}
+
+
+/*
+ * Prevent stop mode (it stops the UART and USB clocks)
+ * until PWR_StopUnlock() is called
+ * */
+void PWR_StopLock(void)
+{
+	stopLocks++;
+}
+
+
+/*
+ * Release a lock taken with PWR_StopLock()
+ * */
+void PWR_StopUnlock(void)
+{
+	if(stopLocks > 0)
+		stopLocks--;
+}
+
+
+/*
+ * Returns the time spent in sleep and stop mode
+ * */
+const PowerIdleStats_t* PWR_GetIdleStats(void)
+{
+	return &idleStats;
+}
+
+
+/*
+ * Stop mode is allowed only if no peripheral is transferring data
+ * */
+static bool StopAllowed(void)
+{
+	return stopLocks == 0 &&
+			hspi1.State == HAL_SPI_STATE_READY &&
+			(hsd.State == HAL_SD_STATE_READY || hsd.State == HAL_SD_STATE_RESET) &&
+			huart3.gState == HAL_UART_STATE_READY &&
+			hUsbDeviceFS.dev_state != USBD_STATE_CONFIGURED;
+}
+
+
+/*
+ * Start the RTC wakeup timer clocked by LSE / 16
+ * */
+static void StartWakeUpTimer(uint32_t counts)
+{
+	if(counts == 0)
+		counts = 1;
+
+	__HAL_RTC_WRITEPROTECTION_DISABLE(&hrtc);
+	__HAL_RTC_WAKEUPTIMER_DISABLE(&hrtc);
+	while(__HAL_RTC_WAKEUPTIMER_GET_FLAG(&hrtc, RTC_FLAG_WUTWF) == RESET);
+
+	hrtc.Instance->WUTR = counts - 1;
+	MODIFY_REG(hrtc.Instance->CR, RTC_CR_WUCKSEL, RTC_WAKEUPCLOCK_RTCCLK_DIV16);
+	__HAL_RTC_WAKEUPTIMER_CLEAR_FLAG(&hrtc, RTC_FLAG_WUTF);
+	__HAL_RTC_WAKEUPTIMER_EXTI_CLEAR_FLAG();
+	__HAL_RTC_WAKEUPTIMER_EXTI_ENABLE_IT();
+	__HAL_RTC_WAKEUPTIMER_EXTI_ENABLE_RISING_EDGE();
+	__HAL_RTC_WAKEUPTIMER_ENABLE_IT(&hrtc, RTC_IT_WUT);
+	__HAL_RTC_WAKEUPTIMER_ENABLE(&hrtc);
+	__HAL_RTC_WRITEPROTECTION_ENABLE(&hrtc);
+}
+
+
+/*
+ * Stop the wakeup timer and clear a pending wake up
+ * */
+static void StopWakeUpTimer(void)
+{
+	__HAL_RTC_WRITEPROTECTION_DISABLE(&hrtc);
+	__HAL_RTC_WAKEUPTIMER_DISABLE(&hrtc);
+	__HAL_RTC_WAKEUPTIMER_CLEAR_FLAG(&hrtc, RTC_FLAG_WUTF);
+	__HAL_RTC_WRITEPROTECTION_ENABLE(&hrtc);
+	__HAL_RTC_WAKEUPTIMER_EXTI_CLEAR_FLAG();
+	NVIC_ClearPendingIRQ(RTC_WKUP_IRQn);
+}
+
+
+/*
+ * The UART is not clocked in stop mode, the start bit of a character
+ * wakes the core through the EXTI line of the RX pin instead
+ * */
+static void StartConsoleWake(void)
+{
+	//EXTI line 11 from PB11 (USART3 RX)
+	MODIFY_REG(SYSCFG->EXTICR[2], SYSCFG_EXTICR3_EXTI11, SYSCFG_EXTICR3_EXTI11_PB);
+	__HAL_GPIO_EXTI_CLEAR_IT(_PWR_CONSOLE_RX_PIN);
+	SET_BIT(EXTI->FTSR, _PWR_CONSOLE_RX_PIN);
+	SET_BIT(EXTI->IMR, _PWR_CONSOLE_RX_PIN);
+	NVIC_EnableIRQ(EXTI15_10_IRQn);
+}
+
+
+/*
+ * Disable the console wake up. If a character woke the core it was received
+ * without clock and is dropped, stop mode stays locked for the rest
+ * of the wake so the next ones are not lost
+ * */
+static void StopConsoleWake(void)
+{
+	CLEAR_BIT(EXTI->IMR, _PWR_CONSOLE_RX_PIN);
+	CLEAR_BIT(EXTI->FTSR, _PWR_CONSOLE_RX_PIN);
+	NVIC_DisableIRQ(EXTI15_10_IRQn);
+	NVIC_ClearPendingIRQ(EXTI15_10_IRQn);
+
+	if(__HAL_GPIO_EXTI_GET_IT(_PWR_CONSOLE_RX_PIN) != RESET)
+	{
+		__HAL_GPIO_EXTI_CLEAR_IT(_PWR_CONSOLE_RX_PIN);
+		__HAL_UART_CLEAR_PEFLAG(&huart3);
+		NVIC_ClearPendingIRQ(USART3_IRQn);
+		stopLocks++;
+	}
+}
+
+
+/*
+ * Returns the time of the day in ms read from the RTC calendar
+ * */
+static uint32_t ReadRTCMillis(void)
+{
+	//Reading SSR locks TR and DR until DR is read
+	uint32_t ssr = hrtc.Instance->SSR;
+	uint32_t tr = hrtc.Instance->TR;
+	(void)hrtc.Instance->DR;
+
+	uint32_t hours = RTC_Bcd2ToByte((tr & (RTC_TR_HT | RTC_TR_HU)) >> RTC_TR_HU_Pos);
+	uint32_t minutes = RTC_Bcd2ToByte((tr & (RTC_TR_MNT | RTC_TR_MNU)) >> RTC_TR_MNU_Pos);
+	uint32_t seconds = RTC_Bcd2ToByte((tr & (RTC_TR_ST | RTC_TR_SU)) >> RTC_TR_SU_Pos);
+	uint32_t ms = (_PWR_RTC_SYNC_PREDIV - ssr) * 1000 / (_PWR_RTC_SYNC_PREDIV + 1);
+
+	return ((hours * 60 + minutes) * 60 + seconds) * 1000 + ms;
+}
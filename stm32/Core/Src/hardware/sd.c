@@ -8,26 +8,113 @@
  */
 
 #include <hardware/sd.h>
+#include <stdio.h>
+#include <stddef.h>
+#include "profiler.h"
+#include "crc32.h"
+#include "hardware/clock.h"
+#include "bsp_driver_sd.h"
+
+#define _SD_CACHE_MAGIC		0x53440001	//Changed when SDVolumeCache_t changes
+#define _SD_MOUNT_ID		0x8000		//Mount ID of the fast mount, FatFs numbers its mounts from 1
+#define _SD_BPB_FSINFO32	48			//Offsets in the boot record and in the FSInfo sector (ff.c)
+#define _SD_FSI_LEAD_SIG	0
+#define _SD_FSI_STRUC_SIG	484
+#define _SD_FSI_FREE_COUNT	488
+#define _SD_FSI_NXT_FREE	492
+#define _SD_BS_55AA			510
+
+typedef struct
+{
+	uint32_t magic;
+	uint32_t cid[4];		//Card identification register
+	uint32_t vbr_crc;		//CRC-32 of the volume boot record
+	uint32_t volbase;		//Fields of the FATFS object filled by f_mount()
+	uint32_t fatbase;
+	uint32_t dirbase;
+	uint32_t database;
+	uint32_t fsize;
+	uint32_t n_fatent;
+	uint16_t n_rootdir;
+	uint16_t csize;
+	uint8_t fs_type;
+	uint8_t n_fats;
+	uint8_t fsinfo;			//FAT32 volume with the FSInfo sector after the boot record
+	uint8_t reserved;
+	uint32_t crc;			//CRC-32 of the fields above
+} SDVolumeCache_t;
+
+_Static_assert(sizeof(SDVolumeCache_t) <= _BKP_SD_SIZE, "Volume geometry doesn't fit the backup SRAM region");
+
+//restore_volume() fills the private fields of the FATFS object, check them after an upgrade of FatFs
+_Static_assert(_FATFS == 68300, "FatFs revision changed, check restore_volume() and SD_BeginWrite() against f_mount()");
 
 
 extern SD_HandleTypeDef hsd;
 extern FATFS fs;
 
+static SDVolumeCache_t* cache;
+static SDWakeInfo_t info;
+
+static bool wait_card(void);
+static bool sync_window(void);
+static void restore_volume(void);
+static void store_volume(void);
+static uint32_t cache_crc(const SDVolumeCache_t* c);
+static uint32_t load_word(const BYTE* p);
+static uint32_t load_dword(const BYTE* p);
+
 
 /*
  * Initialize SD-Card
  * */
 HAL_StatusTypeDef SD_Init(void)
 {
-	FRESULT fs_res;
+	FRESULT fs_res = FR_OK;
+	uint32_t power = PROF_Start();
+	uint32_t start = power;
 
-	//Enable power
+	cache = PWR_BackupRegion(_BKP_SD_OFFSET);
+	memset(&info, 0, sizeof(info));
+
+	//Enable power and identify the card as soon as it answers
 	PWR_Enable(PWR_SD);
-	HAL_Delay(100);
+	bool ready = wait_card();
+	PROF_Add(e_ProfSDPower, start);
+	if(!ready)
+	{
+		return HAL_ERROR;
+	}
+
+	info.same_card = cache->magic == _SD_CACHE_MAGIC && cache->crc == cache_crc(cache) &&
+	                 memcmp(cache->cid, hsd.CID, sizeof(cache->cid)) == 0;
 
-	//Initialize SD and Mount drive
-	fs_res = f_mount(&fs, "", 1);
-	if(fs_res != FR_OK)
+	//Register the volume without mounting it and read the boot record
+	//of the volume mounted at the last wake, or the MBR of a new card
+	start = PROF_Start();
+	DWORD sector = info.same_card ? cache->volbase : 0;
+	if(f_mount(&fs, "", 0) != FR_OK || (disk_initialize(0) & STA_NOINIT) || disk_read(0, fs.win, sector, 1) != RES_OK)
+	{
+		PROF_Add(e_ProfMount, start);
+		return HAL_ERROR;
+	}
+	PROF_Add(e_ProfFirstSector, power);
+
+	//Same card and same volume, the geometry doesn't have to be parsed again
+	info.cached = info.same_card && CRC32_Update(0, fs.win, _MAX_SS) == cache->vbr_crc;
+	if(info.cached)
+	{
+		restore_volume();
+	}
+	else
+	{
+		fs_res = f_mount(&fs, "", 1);
+		if(fs_res == FR_OK)
+			store_volume();
+	}
+	PROF_Add(e_ProfMount, start);
+
+	if(!info.cached && fs_res != FR_OK)
 	{
 		return HAL_ERROR;
 	}
@@ -54,3 +141,197 @@ HAL_StatusTypeDef SD_Sleep(void)
 
 	return HAL_OK;
 }
+
+
+/*
+ * Load the FSInfo sector skipped by the fast mount,
+ * must be called before creating, extending or deleting files
+ * */
+void SD_BeginWrite(void)
+{
+	if(!info.cached || info.writable)
+		return;
+
+	ff_req_grant(fs.sobj);
+
+	if(cache->fsinfo)
+	{
+		//Clusters allocated before the call are not in the free count of the sector
+		bool allocated = (fs.fsi_flag & 1) != 0;
+
+		if(!sync_window())
+		{
+			printf("ERROR: Unable to write back the FAT window\n");
+		}
+		else if(disk_read(fs.drv, fs.win, fs.volbase + 1, 1) == RES_OK)
+		{
+			fs.winsect = fs.volbase + 1;
+
+			//As f_mount(), the sector is updated by f_sync() only if it's valid
+			if(load_word(fs.win + _SD_BS_55AA) == 0xAA55 &&
+			   load_dword(fs.win + _SD_FSI_LEAD_SIG) == 0x41615252 &&
+			   load_dword(fs.win + _SD_FSI_STRUC_SIG) == 0x61417272)
+			{
+				fs.fsi_flag = allocated ? 1 : 0;
+				if(!allocated)
+				{
+					fs.free_clst = load_dword(fs.win + _SD_FSI_FREE_COUNT);
+					fs.last_clst = load_dword(fs.win + _SD_FSI_NXT_FREE);
+				}
+			}
+		}
+		else
+		{
+			fs.winsect = 0xFFFFFFFF;
+			printf("ERROR: Unable to read the FSInfo sector\n");
+		}
+	}
+
+	info.writable = true;
+
+	ff_rel_grant(fs.sobj);
+}
+
+
+/*
+ * Returns how the card was brought up at this wake
+ * */
+const SDWakeInfo_t* SD_GetWakeInfo(void)
+{
+	return &info;
+}
+
+
+/*
+ * Attempt the identification until the card answers,
+ * returns false if it doesn't within _SD_READY_TIMEOUT ms
+ * */
+static bool wait_card(void)
+{
+	uint32_t start = osKernelGetTickCount();
+
+	CLK_BeginWait();
+	osDelay(_SD_RAMP_MS);
+	CLK_EndWait();
+
+	for(;;)
+	{
+		info.polls++;
+
+		if(BSP_SD_Init() == MSD_OK)
+			return true;
+
+		if(osKernelGetTickCount() - start >= _SD_READY_TIMEOUT)
+			return false;
+
+		CLK_BeginWait();
+		osDelay(_SD_POLL_MS);
+		CLK_EndWait();
+	}
+}
+
+
+/*
+ * Write back the sector in the window if it's dirty, as sync_window() in ff.c
+ * */
+static bool sync_window(void)
+{
+	if(fs.wflag == 0)
+		return true;
+
+	if(disk_write(fs.drv, fs.win, fs.winsect, 1) != RES_OK)
+		return false;
+
+	fs.wflag = 0;
+
+	//Reflect the change to all the FAT copies
+	if(fs.winsect - fs.fatbase < fs.fsize)
+	{
+		for(DWORD n = 1; n < fs.n_fats; n++)
+			disk_write(fs.drv, fs.win, fs.winsect + n * fs.fsize, 1);
+	}
+
+	return true;
+}
+
+
+/*
+ * Fill the FATFS object as f_mount() would have with the geometry in the backup SRAM,
+ * fs.win holds the boot record. The FSInfo sector is loaded by SD_BeginWrite()
+ * */
+static void restore_volume(void)
+{
+	fs.drv = 0;
+	fs.n_fats = cache->n_fats;
+	fs.csize = cache->csize;
+	fs.n_rootdir = cache->n_rootdir;
+	fs.n_fatent = cache->n_fatent;
+	fs.fsize = cache->fsize;
+	fs.volbase = cache->volbase;
+	fs.fatbase = cache->fatbase;
+	fs.dirbase = cache->dirbase;
+	fs.database = cache->database;
+	fs.last_clst = fs.free_clst = 0xFFFFFFFF;
+	fs.fsi_flag = 0x80;
+	fs.wflag = 0;
+	fs.winsect = cache->volbase;
+	fs.id = _SD_MOUNT_ID;
+	fs.fs_type = cache->fs_type;
+}
+
+
+/*
+ * Store the CID of the card and the geometry of the volume just mounted
+ * */
+static void store_volume(void)
+{
+	cache->magic = 0;
+
+	//The window holds the FSInfo sector or the boot record, nothing was written yet
+	if(disk_read(fs.drv, fs.win, fs.volbase, 1) != RES_OK)
+	{
+		fs.winsect = 0xFFFFFFFF;
+		return;
+	}
+	fs.winsect = fs.volbase;
+
+	memcpy(cache->cid, hsd.CID, sizeof(cache->cid));
+	cache->vbr_crc = CRC32_Update(0, fs.win, _MAX_SS);
+	cache->volbase = fs.volbase;
+	cache->fatbase = fs.fatbase;
+	cache->dirbase = fs.dirbase;
+	cache->database = fs.database;
+	cache->fsize = fs.fsize;
+	cache->n_fatent = fs.n_fatent;
+	cache->n_rootdir = fs.n_rootdir;
+	cache->csize = fs.csize;
+	cache->fs_type = fs.fs_type;
+	cache->n_fats = fs.n_fats;
+	cache->fsinfo = fs.fs_type == FS_FAT32 && load_word(fs.win + _SD_BPB_FSINFO32) == 1;
+	cache->reserved = 0;
+	cache->magic = _SD_CACHE_MAGIC;
+	cache->crc = cache_crc(cache);
+}
+
+
+/*
+ * CRC of the cached geometry
+ * */
+static uint32_t cache_crc(const SDVolumeCache_t* c)
+{
+	return CRC32_Update(0, c, offsetof(SDVolumeCache_t, crc));
+}
+
+
+/*
+ * Little endian fields of the boot record and of the FSInfo sector
+ * */
+static uint32_t load_word(const BYTE* p)
+{
+	return p[0] | p[1] << 8;
+}
+
+static uint32_t load_dword(const BYTE* p)
+{
+	return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24;
+}
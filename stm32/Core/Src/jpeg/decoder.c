@@ -8,6 +8,7 @@
  */
 
 #include "jpeg/decoder.h"
+#include "arena.h"
 
 
 static const uint8_t zigZagMap[] = {
@@ -58,8 +59,14 @@ const float s5 = cosf(5.f / 16.f * M_PI) / 2.f;
 const float s6 = cosf(6.f / 16.f * M_PI) / 2.f;
 const float s7 = cosf(7.f / 16.f * M_PI) / 2.f;
 
+//Time spent in each phase of the current decode (profiler ticks)
+static uint32_t readTicks;
+static uint32_t idctTicks;
+static uint32_t colorTicks;
+
 static uint8_t read_byte(JPG_t* jpg, FIL* fp);
 static uint16_t read_uint(JPG_t* jpg, FIL* fp);
+static void skip_bytes(JPG_t* jpg, FIL* fp, uint32_t n);
 static bool eof(JPG_t* jpg);
 static void init_jpg(JPG_t* jpg);
 static void ReadAPPn(FIL* fp, JPG_t* jpg);
@@ -78,6 +85,32 @@ static void YCbCr_to_RGB(JPG_t* jpg);
 static void PrintHeader(JPG_t* jpg);
 #endif
 
+/*
+ * Decode JPG file and send pixels to display, the decoder state is taken
+ * from the arenas. Returns false if the file can't be decoded
+ * */
+bool JPG_Display(FIL* fp)
+{
+	uint32_t ccm_mark = ARENA_Mark(&arena_ccm);
+	uint32_t sram_mark = ARENA_Mark(&arena_sram);
+	JPG_t* jpg = ARENA_Alloc(&arena_ccm, sizeof(JPG_t));
+	bool res = false;
+
+	if(jpg != NULL && (jpg->buff = ARENA_Alloc(&arena_sram, _JPG_BUFF_SIZE)) != NULL)
+	{
+		//The file is read ahead by the read-ahead task while it's decoded
+		RAHEAD_Open(fp, jpg->buff);
+		res = !JPG_decode(fp, jpg);
+		RAHEAD_Close();
+	}
+
+	ARENA_Release(&arena_sram, sram_mark);
+	ARENA_Release(&arena_ccm, ccm_mark);
+
+	return res;
+}
+
+
 /*
  * Decode JPG file and send pixels to display
  * */
@@ -85,6 +118,11 @@ bool JPG_decode(FIL* fp, JPG_t* jpg)
 {
 	uint8_t byte0;
 	uint8_t byte1;
+	uint32_t start = PROF_Start();
+
+	readTicks = 0;
+	idctTicks = 0;
+	colorTicks = 0;
 
 	init_jpg(jpg);
 
@@ -106,7 +144,7 @@ bool JPG_decode(FIL* fp, JPG_t* jpg)
 		byte1 = read_byte(jpg, fp);
 
 		//Exit with error if the end of file is reached before the End Of Image Marker
-		if (f_eof(fp)) {
+		if (eof(jpg)) {
 			printf("ERROR: File ended prematurely\n");
 			jpg->valid = false;
 			break;
@@ -199,10 +237,17 @@ bool JPG_decode(FIL* fp, JPG_t* jpg)
 
 	} while(jpg->valid);
 
+	PROF_AddTicks(e_ProfHeader, PROF_Start() - start - readTicks);
+	PROF_AddTicks(e_ProfSDRead, readTicks);
+
 	//Read Huffman data if jpg is still valid
 	if(jpg->valid)
 	{
 		BitBuffer_t buffer;
+
+		//The scan time minus the time spent in the other phases is the entropy decode
+		start = PROF_Start();
+		readTicks = 0;
 		byte1 = read_byte(jpg, fp);
 
 		//Initialize huffman data buffer
@@ -266,6 +311,11 @@ bool JPG_decode(FIL* fp, JPG_t* jpg)
 		}
 		if(!decode_huffman(jpg, &buffer, true))
 			jpg->valid = false;
+
+		PROF_AddTicks(e_ProfEntropy, PROF_Start() - start - readTicks - idctTicks - colorTicks);
+		PROF_AddTicks(e_ProfSDRead, readTicks);
+		PROF_AddTicks(e_ProfIDCT, idctTicks);
+		PROF_AddTicks(e_ProfColor, colorTicks);
 	}
 
 #if (_DEBUG_PRINT > 0)
@@ -281,13 +331,18 @@ bool JPG_decode(FIL* fp, JPG_t* jpg)
  * */
 static uint8_t read_byte(JPG_t* jpg, FIL* fp)
 {
-	if(jpg->ptr >= 512)
+	if(jpg->ptr >= jpg->size)
 	{
-		f_read(fp, (void*)jpg->buff, 512, &jpg->size);
+		//Only the time waiting for the SD card is spent here
+		uint32_t start = PROF_Start();
+		RAHEAD_ReleaseChunk();
+		jpg->chunk = RAHEAD_NextChunk();
 		jpg->ptr = 0;
+		jpg->size = jpg->chunk->size;
+		readTicks += PROF_Start() - start;
 	}
 
-	return jpg->buff[jpg->ptr++];
+	return jpg->chunk->data[jpg->ptr++];
 }
 
 /*
@@ -298,6 +353,33 @@ static uint16_t read_uint(JPG_t* jpg, FIL* fp)
 	return ((uint16_t)read_byte(jpg, fp) << 8) + (uint16_t)read_byte(jpg, fp);
 }
 
+/*
+ * Skip n bytes, what is not in the buffer is skipped with a seek
+ * (a lookup in the link map table for the large files) instead of being read
+ * */
+static void skip_bytes(JPG_t* jpg, FIL* fp, uint32_t n)
+{
+	uint32_t buffered = jpg->ptr < jpg->size ? jpg->size - jpg->ptr : 0;
+
+	if(n <= buffered)
+	{
+		jpg->ptr += n;
+		return;
+	}
+
+	//The file ends before
+	if(jpg->chunk->end)
+	{
+		jpg->ptr = jpg->size + 1;
+		return;
+	}
+
+	//The chunks read ahead are dropped, the next read waits for the new position
+	RAHEAD_Seek(jpg->chunk->offset + jpg->ptr + n);
+	jpg->ptr = 0;
+	jpg->size = 0;
+}
+
 /*
  * Return true if the end of the file is reached
  * */
@@ -335,7 +417,9 @@ static void init_jpg(JPG_t* jpg)
 	jpg->decode.mcu.y = 0;
 	jpg->decode.blockCounter = 0;
 
-	jpg->ptr = 512;
+	jpg->chunk = NULL;
+	jpg->ptr = 0;
+	jpg->size = 0;
 }
 
 /*
@@ -345,11 +429,9 @@ static void ReadAPPn(FIL* fp, JPG_t* jpg)
 {
 	uint16_t length = read_uint(jpg, fp);
 
-	//Discard data
-	for (int i = 0; i < length - 2; i++)
-	{
-		read_byte(jpg, fp);
-	}
+	//Discard data (Exif thumbnails can be tens of KB)
+	if(length > 2)
+		skip_bytes(jpg, fp, length - 2);
 
 #if (_DEBUG_PRINT > 1)
 	printf("Reading APPn Marker\n");
@@ -364,10 +446,8 @@ static void ReadComment(FIL* fp, JPG_t* jpg)
 	uint16_t length = read_uint(jpg, fp);
 
 	//Discard data
-	for (int i = 0; i < length - 2; i++)
-	{
-		read_byte(jpg, fp);
-	}
+	if(length > 2)
+		skip_bytes(jpg, fp, length - 2);
 
 #if (_DEBUG_PRINT > 1)
 	printf("Reading COM Marker\n");
@@ -905,9 +985,13 @@ static bool decode_huffman(JPG_t* jpg, BitBuffer_t* buffer, bool terminate)
 				//If MCU is completed
 				if(jpg->decode.compNum >= jpg->numComp)
 				{
+					uint32_t t0 = PROF_Start();
 					dequantize(jpg);
 					inverseDCT(jpg);
+					uint32_t t1 = PROF_Start();
 					YCbCr_to_RGB(jpg);
+					idctTicks += t1 - t0;
+					colorTicks += PROF_Start() - t1;
 
 					//Handle restart intervals
 					jpg->decode.blockCounter ++;
@@ -35,8 +35,12 @@
 
 #include "hardware/power.h"
 #include "hardware/sd.h"
+#include "hardware/clock.h"
+#include "hardware/light_detector.h"
+#include "hardware/flash.h"
 #include "tasks/console_task.h"
 #include "tasks/display_task.h"
+#include "profiler.h"
 /* USER CODE END Includes */
 
 /* Private typedef -----------------------------------------------------------*/
@@ -61,6 +65,7 @@ DMA_HandleTypeDef hdma_sdio_rx;
 DMA_HandleTypeDef hdma_sdio_tx;
 
 SPI_HandleTypeDef hspi1;
+DMA_HandleTypeDef hdma_spi1_tx;
 
 UART_HandleTypeDef huart3;
 
@@ -76,7 +81,28 @@ osThreadId_t displayTaskHandle;
 const osThreadAttr_t displayTask_attributes = {
   .name = "displayTask",
   .priority = (osPriority_t) osPriorityAboveNormal,
-  .stack_size = 10000 * 4
+  .stack_size = 1024 * 4
+};
+/* Definitions for outputTask */
+osThreadId_t outputTaskHandle;
+const osThreadAttr_t outputTask_attributes = {
+  .name = "outputTask",
+  .priority = (osPriority_t) osPriorityHigh,
+  .stack_size = 512 * 4
+};
+/* Definitions for renderTask */
+osThreadId_t renderTaskHandle;
+const osThreadAttr_t renderTask_attributes = {
+  .name = "renderTask",
+  .priority = (osPriority_t) osPriorityBelowNormal,
+  .stack_size = 1024 * 4
+};
+/* Definitions for readAheadTask */
+osThreadId_t readAheadTaskHandle;
+const osThreadAttr_t readAheadTask_attributes = {
+  .name = "readAheadTask",
+  .priority = (osPriority_t) osPriorityAboveNormal1,
+  .stack_size = 512 * 4
 };
 /* USER CODE BEGIN PV */
 
@@ -97,6 +123,9 @@ static void MX_SDIO_SD_Init(void);
 static void MX_USART3_UART_Init(void);
 void StartConsoleTask(void *argument);
 extern void StartDisplayTask(void *argument);
+extern void StartDisplayOutputTask(void *argument);
+extern void StartRenderTask(void *argument);
+extern void StartReadAheadTask(void *argument);
 
 /* USER CODE BEGIN PFP */
 
@@ -112,7 +141,19 @@ void HAL_GPIO_EXTI_Callback(uint16_t GPIO_Pin)
 {
 	if(GPIO_Pin & BTN_SLEEP_Pin)
 	{
+		//Stay awake for the console, stop mode would stop the UART and USB
 		sleep_cmd_disabled = true;
+		PWR_StopLock();
+	}
+
+	if(GPIO_Pin & EP_BUSY_Pin)
+	{
+		DBUS_BusyIRQHandler();
+	}
+
+	if(GPIO_Pin & LDR_SIG_Pin)
+	{
+		LDR_IRQHandler();
 	}
 }
 
@@ -163,6 +204,9 @@ int main(void)
   printf("Enabling power\n");
   PWR_Enable(PWR_3V3);
   HAL_Delay(100);
+  PWR_BackupInit();
+  PROF_Init();
+  CLK_Init();
 
   //Flash LED0 on startup
   for(int i = 0; i < 4; i++)
@@ -195,7 +239,12 @@ int main(void)
 
   /* USER CODE BEGIN RTOS_QUEUES */
   /* add queues, ... */
-  displayTask_args.message_queue =  osMessageQueueNew(1, sizeof(DisplayMessage_t), NULL);
+  displayTask_args.message_queue =  osMessageQueueNew(_DJOB_QUEUE_DEPTH, sizeof(DisplayJob_t), NULL);
+  FSEEK_Init();
+  RAHEAD_Init();
+  DJOB_Init(&displayTask_args);
+  FMAN_Init();
+  FLASH_Init();
   /* USER CODE END RTOS_QUEUES */
 
   /* Create the thread(s) */
@@ -205,11 +254,18 @@ int main(void)
   /* creation of displayTask */
   displayTaskHandle = osThreadNew(StartDisplayTask, (void*)&displayTask_args, &displayTask_attributes);
 
+  /* creation of outputTask */
+  outputTaskHandle = osThreadNew(StartDisplayOutputTask, NULL, &outputTask_attributes);
+
+  /* creation of renderTask */
+  renderTaskHandle = osThreadNew(StartRenderTask, NULL, &renderTask_attributes);
+
+  /* creation of readAheadTask */
+  readAheadTaskHandle = osThreadNew(StartReadAheadTask, NULL, &readAheadTask_attributes);
+
   /* USER CODE BEGIN RTOS_THREADS */
 
   consoleTask_args.huart = &huart3;
-  consoleTask_args.displayTaskId = displayTaskHandle;
-  consoleTask_args.display_message_queue = displayTask_args.message_queue;
   consoleTask_args.sleep_cmd_disabled = &sleep_cmd_disabled;
 
   /* USER CODE END RTOS_THREADS */
@@ -301,8 +357,8 @@ static void MX_RTC_Init(void)
   */
   hrtc.Instance = RTC;
   hrtc.Init.HourFormat = RTC_HOURFORMAT_24;
-  hrtc.Init.AsynchPrediv = 127;
-  hrtc.Init.SynchPrediv = 255;
+  hrtc.Init.AsynchPrediv = 31;
+  hrtc.Init.SynchPrediv = 1023;
   hrtc.Init.OutPut = RTC_OUTPUT_DISABLE;
   hrtc.Init.OutPutPolarity = RTC_OUTPUT_POLARITY_HIGH;
   hrtc.Init.OutPutType = RTC_OUTPUT_TYPE_OPENDRAIN;
@@ -459,6 +515,9 @@ static void MX_DMA_Init(void)
   /* DMA2_Stream3_IRQn interrupt configuration */
   HAL_NVIC_SetPriority(DMA2_Stream3_IRQn, 5, 0);
   HAL_NVIC_EnableIRQ(DMA2_Stream3_IRQn);
+  /* DMA2_Stream5_IRQn interrupt configuration */
+  HAL_NVIC_SetPriority(DMA2_Stream5_IRQn, 5, 0);
+  HAL_NVIC_EnableIRQ(DMA2_Stream5_IRQn);
   /* DMA2_Stream6_IRQn interrupt configuration */
   HAL_NVIC_SetPriority(DMA2_Stream6_IRQn, 5, 0);
   HAL_NVIC_EnableIRQ(DMA2_Stream6_IRQn);
@@ -528,7 +587,7 @@ static void MX_GPIO_Init(void)
 
   /*Configure GPIO pin : EP_BUSY_Pin */
   GPIO_InitStruct.Pin = EP_BUSY_Pin;
-  GPIO_InitStruct.Mode = GPIO_MODE_INPUT;
+  GPIO_InitStruct.Mode = GPIO_MODE_IT_RISING_FALLING;
   GPIO_InitStruct.Pull = GPIO_NOPULL;
   HAL_GPIO_Init(EP_BUSY_GPIO_Port, &GPIO_InitStruct);
 
@@ -564,6 +623,9 @@ static void MX_GPIO_Init(void)
   HAL_NVIC_SetPriority(EXTI0_IRQn, 5, 0);
   HAL_NVIC_EnableIRQ(EXTI0_IRQn);
 
+  HAL_NVIC_SetPriority(EXTI1_IRQn, 5, 0);
+  HAL_NVIC_EnableIRQ(EXTI1_IRQn);
+
 }
 
 /* USER CODE BEGIN 4 */
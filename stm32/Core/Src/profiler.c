@@ -0,0 +1,171 @@
+/**
+ ******************************************************************************
+ * @file      profiler.c
+ * @author    ts-manuel
+ * @brief     Time spent in each phase of the wake cycle
+ *
+ ******************************************************************************
+ */
+
+#include "profiler.h"
+#include "hardware/power.h"
+
+#define _PROF_MAGIC (0x50520000 | e_ProfCount)	//Records are reset when phases are added
+
+typedef struct
+{
+	uint32_t magic;
+	uint32_t head;					//Record of the current wake
+	uint32_t count;					//Valid records, including the current one
+	ProfWake_t wakes[_PROF_WAKES];
+} ProfBackup_t;
+
+_Static_assert(sizeof(ProfBackup_t) <= _BKP_PROFILER_SIZE, "Profiler records don't fit the backup SRAM region");
+
+static const char* phase_names[e_ProfCount] = {
+	"sd-power", "mount", "1st-sector", "find-next", "sd-read", "header",
+	"entropy", "idct", "color", "dither", "spi", "busy", "flash", "render", "saved", "wake"
+};
+
+//Fractions of us not yet added to the records
+static uint32_t remainder[e_ProfCount];
+
+static ProfBackup_t* backup;
+
+static uint32_t TicksPerUs(void);
+
+
+/*
+ * Start the cycle counter and open the record of this wake
+ * */
+void PROF_Init(void)
+{
+#if !_PROF_HOST
+	CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+	DWT->CYCCNT = 0;
+	DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+#endif
+
+	backup = PWR_BackupRegion(_BKP_PROFILER_OFFSET);
+
+	if(backup->magic != _PROF_MAGIC || backup->head >= _PROF_WAKES || backup->count > _PROF_WAKES)
+	{
+		memset(backup, 0, sizeof(ProfBackup_t));
+		backup->magic = _PROF_MAGIC;
+		backup->head = _PROF_WAKES - 1;
+	}
+
+	backup->head = (backup->head + 1) % _PROF_WAKES;
+	if(backup->count < _PROF_WAKES)
+		backup->count++;
+
+	memset(&backup->wakes[backup->head], 0, sizeof(ProfWake_t));
+	memset(remainder, 0, sizeof(remainder));
+}
+
+
+/*
+ * Add the time from start (returned by PROF_Start()) to the phase
+ * */
+void PROF_Add(ProfPhase_e phase, uint32_t start)
+{
+	PROF_AddTicks(phase, PROF_Start() - start);
+}
+
+
+/*
+ * Add counter ticks to the phase
+ * */
+void PROF_AddTicks(ProfPhase_e phase, uint32_t ticks)
+{
+	const uint32_t ticks_per_us = TicksPerUs();
+
+	if(backup == NULL)
+		return;
+
+	uint32_t total = remainder[phase] + ticks;
+	backup->wakes[backup->head].us[phase] += total / ticks_per_us;
+	remainder[phase] = total % ticks_per_us;
+}
+
+
+/*
+ * Convert counter ticks to us at the current core clock
+ * */
+uint32_t PROF_TicksToUs(uint32_t ticks)
+{
+	return ticks / TicksPerUs();
+}
+
+
+/*
+ * Add time measured in us to the phase (long phases measured with HAL_GetTick())
+ * */
+void PROF_AddUs(ProfPhase_e phase, uint32_t us)
+{
+	if(backup != NULL)
+		backup->wakes[backup->head].us[phase] += us;
+}
+
+
+/*
+ * Store the duration of the wake, called before entering standby
+ * */
+void PROF_EndWake(void)
+{
+	if(backup != NULL)
+		backup->wakes[backup->head].us[e_ProfWake] = HAL_GetTick() * 1000;
+}
+
+
+/*
+ * Remove all the records except the current one
+ * */
+void PROF_Clear(void)
+{
+	if(backup != NULL)
+		backup->count = 1;
+}
+
+
+/*
+ * Returns the number of records, including the current wake
+ * */
+int PROF_GetWakeCount(void)
+{
+	return backup != NULL ? backup->count : 0;
+}
+
+
+/*
+ * Returns the record of the wake, age 0 is the current one, 1 the previous one...
+ * */
+const ProfWake_t* PROF_GetWake(int age)
+{
+	if(backup == NULL || age < 0 || age >= backup->count)
+		return NULL;
+
+	return &backup->wakes[(backup->head + _PROF_WAKES - age) % _PROF_WAKES];
+}
+
+
+/*
+ * Returns the name of the phase printed by the console
+ * */
+const char* PROF_GetPhaseName(ProfPhase_e phase)
+{
+	return phase < e_ProfCount ? phase_names[phase] : "";
+}
+
+
+/*
+ * Counter ticks per us
+ * */
+static uint32_t TicksPerUs(void)
+{
+#if _PROF_HOST
+	return 1000;
+#else
+	return SystemCoreClock / 1000000;
+#endif
+}
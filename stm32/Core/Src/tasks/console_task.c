@@ -18,12 +18,23 @@ static void CMD_ParseHelp(const char* str);
 static void CMD_ParseDisplay(const char* str, ConsoleTaskArgs_t* args);
 static void CMD_ParseLoad(const char* str_args, ConsoleTaskArgs_t* args);
 static void CMD_ParseUpdate(const char* str, ConsoleTaskArgs_t* args);
+static void CMD_ParseJob(const char* str);
+static void CMD_ParseStats(const char* str);
+static void CMD_ParseClock(const char* str);
+static void CMD_ParseMem(const char* str);
+static void CMD_ParseSdBench(const char* str);
+static void CMD_ParseCache(const char* str);
+static void CMD_ParsePlaylist(const char* str);
 static void CMD_ParseTaskInfo(const char* str);
 static void CMD_ParseSleep(const char* str, ConsoleTaskArgs_t* args);
 static void CMD_ParseFlash(const char* str, ConsoleTaskArgs_t* args);
 static const char* CMD_Trim(const char* str, const char* msg);
 static const char* CMD_TrimSpaces(const char* str);
 static const char* CMD_ReadColor(const char* str, uint8_t* color);
+static void CMD_SubmitJob(const DisplayJob_t* job);
+static void CMD_LoadFile(const char* path, uint16_t frame);
+static void StoreJobPath(const DisplayJob_t* job);
+static void EnterStandBy(void);
 
 
 // Serial RX buffer
@@ -34,10 +45,16 @@ static volatile char buffer[_MAX_CMD_LENGTH];
 static volatile int rx_read_ptr = 0;
 static volatile int rx_write_ptr = 0;
 static volatile bool new_char_available = false;
+static volatile osThreadId_t console_thread = NULL;
+static volatile bool console_in_use = false;
 #define RX_AVAILABLE_DATA() (((unsigned int)(rx_write_ptr - rx_read_ptr)) % _MAX_CMD_LENGTH)
 #define RX_DATA(x) buffer[(rx_read_ptr + (x)) % _MAX_CMD_LENGTH]
 #define RX_REMOVE_CHARS(x) {rx_read_ptr = (rx_read_ptr + (x)) % _MAX_CMD_LENGTH;}
 
+// Display jobs of this wake, counted by StoreJobPath()
+static uint32_t wakeUpdates;
+static uint32_t wakeFailures;
+
 
 /*
  * This callback is called by the HAL_UART_IRQHandler
@@ -101,6 +118,18 @@ void ConsoleReceive(char* buff, int len, bool from_usb)
 				HAL_UART_Transmit(huart_handle, (uint8_t*)&bel, 1, 100);
 		}
 	}
+
+	//Somebody is typing, stop mode would lose the next characters
+	if(!console_in_use)
+	{
+		console_in_use = true;
+		PWR_StopLock();
+	}
+
+	//Wake up the console task
+	osThreadId_t thread = console_thread;
+	if(thread != NULL)
+		osThreadFlagsSet(thread, _FLAG_CONSOLE_RX);
 }
 
 
@@ -147,6 +176,7 @@ void StartConsoleTask(void *_args)
 	bool low_power_timeout_enabled = true;
 
 	//Initialize RX buffer and start UART ISR
+	console_thread = osThreadGetId();
 	huart_handle = args->huart;
 	HAL_UART_Receive_IT(args->huart, (uint8_t*)&new_char, 1);
 
@@ -204,11 +234,26 @@ void StartConsoleTask(void *_args)
 
 		//Enter low power mode if there are no commands for more than _SLEEP_TIMEOUT seconds
 		uint32_t tick = osKernelGetTickCount();
-		if((tick - last_cmd_tick) / osKernelGetTickFreq() > _SLEEP_TIMEOUT && low_power_timeout_enabled)
+		uint32_t timeout = (_SLEEP_TIMEOUT + 1) * osKernelGetTickFreq();
+		if(tick - last_cmd_tick >= timeout && low_power_timeout_enabled && DJOB_IsIdle())
+		{
+			EnterStandBy();
+		}
+
+		//Sleep until a character is received or the timeout expires,
+		//while the display jobs are running the timeout is checked every _CONSOLE_POLL_TIME ms
+		if(!found)
 		{
-			printf("Entering low power mode\n");
-			osDelay(1);
-			PWR_EnterStandBy();
+			uint32_t wait = osWaitForever;
+
+			if(low_power_timeout_enabled)
+			{
+				wait = tick - last_cmd_tick < timeout ? timeout - (tick - last_cmd_tick) : 0;
+				if(wait == 0)
+					wait = _CONSOLE_POLL_TIME;
+			}
+
+			osThreadFlagsWait(_FLAG_CONSOLE_RX, osFlagsWaitAny, wait);
 		}
 	}
 }
@@ -241,6 +286,34 @@ static void CMD_ParseString(const char* str, ConsoleTaskArgs_t* args, bool* en_l
 	{
 		CMD_ParseUpdate(str_args, args);
 	}
+	else if((str_args = CMD_Trim(str, "job")))
+	{
+		CMD_ParseJob(str_args);
+	}
+	else if((str_args = CMD_Trim(str, "stats")))
+	{
+		CMD_ParseStats(str_args);
+	}
+	else if((str_args = CMD_Trim(str, "clock")))
+	{
+		CMD_ParseClock(str_args);
+	}
+	else if((str_args = CMD_Trim(str, "mem")))
+	{
+		CMD_ParseMem(str_args);
+	}
+	else if((str_args = CMD_Trim(str, "sdbench")))
+	{
+		CMD_ParseSdBench(str_args);
+	}
+	else if((str_args = CMD_Trim(str, "cache")))
+	{
+		CMD_ParseCache(str_args);
+	}
+	else if((str_args = CMD_Trim(str, "playlist")))
+	{
+		CMD_ParsePlaylist(str_args);
+	}
 	else if((str_args = CMD_Trim(str, "start")))
 	{
 		*en_lpw = true;
@@ -345,8 +418,8 @@ static void CMD_ParseHelp(const char* str)
 	{
 		printf(
 			"\n"
-			"usage: load [path] \n"
-			"Load image from SD card. \n"
+			"usage: load [path] [frame] \n"
+			"Load image from SD card, frame selects the frame of a movie (.epm). \n"
 		);
 	}
 	else if(CMD_Trim(str, "update"))
@@ -357,6 +430,86 @@ static void CMD_ParseHelp(const char* str)
 			"Load next image from SD card. \n"
 		);
 	}
+	else if(CMD_Trim(str, "job"))
+	{
+		printf(
+			"\n"
+			"usage: job \n"
+			"usage: job wait \n"
+			"usage: job cancel [id] \n"
+			"Without arguments prints the state and the timing of the last display job, \n"
+			"for a decoded jpeg also how long the decoder and the read-ahead task waited for each other. \n"
+			"Commands: \n"
+			"  wait:   Waits for all the queued jobs to be finished. \n"
+			"  cancel: Cancels the job with the given id, all the jobs if no id is given. \n"
+		);
+	}
+	else if(CMD_Trim(str, "stats"))
+	{
+		printf(
+			"\n"
+			"usage: stats \n"
+			"usage: stats clear \n"
+			"Prints the time spent in each phase of the current wake and min/avg/max of the previous %d wakes. \n"
+			"The records are kept in the backup SRAM, clear removes the previous wakes. \n"
+			"1st-sector is the time from SD power on to the first sector read, followed by how the card was mounted. \n",
+			_PROF_WAKES - 1
+		);
+	}
+	else if(CMD_Trim(str, "clock"))
+	{
+		printf(
+			"\n"
+			"usage: clock \n"
+			"usage: clock clear \n"
+			"Prints the current performance level and the time spent at each level since boot, \n"
+			"and the time the core was idle in sleep and stop mode. \n"
+			"clear resets the counters. \n"
+		);
+	}
+	else if(CMD_Trim(str, "mem"))
+	{
+		printf(
+			"\n"
+			"usage: mem \n"
+			"Prints the use of the static memory arenas (now and peak since boot), \n"
+			"the minimum free stack of each task and the free RTOS heap (now and minimum ever). \n"
+		);
+	}
+	else if(CMD_Trim(str, "sdbench"))
+	{
+		printf(
+			"\n"
+			"usage: sdbench PATH \n"
+			"Reads the file with 512 byte reads, with %d byte reads into an aligned buffer and into an unaligned one, \n"
+			"and prints the throughput, the read commands sent to the SD card and the sectors copied through the scratch buffer. \n",
+			_SD_BENCH_BYTES
+		);
+	}
+	else if(CMD_Trim(str, "cache"))
+	{
+		printf(
+			"\n"
+			"usage: cache \n"
+			"usage: cache clear \n"
+			"Prints the entries and the size of the render cache folder (%s, at most %d KB), \n"
+			"the hits, misses and evictions since boot and the decode time and source bytes saved by the hits. \n"
+			"clear deletes every entry. \n",
+			_RCACHE_DIR, _RCACHE_MAX_KB
+		);
+	}
+	else if(CMD_Trim(str, "playlist"))
+	{
+		printf(
+			"\n"
+			"usage: playlist \n"
+			"usage: playlist rebuild \n"
+			"Prints the number of files in the playlist index (%s) and the current position. \n"
+			"The index is built again when the root directory changes or a file doesn't match its record, \n"
+			"rebuild forces it after files have been replaced in a folder. \n",
+			_FMAN_INDEX_PATH
+		);
+	}
 	else if(CMD_Trim(str, "task-info"))
 	{
 		printf(
@@ -369,11 +522,13 @@ static void CMD_ParseHelp(const char* str)
 	{
 		printf(
 				"\n"
-			"usage: falsh erase \n"
-			"usage: falsh dump [start] [stop] \n"
+			"usage: flash \n"
+			"usage: flash erase \n"
+			"usage: flash dump [start] [stop] \n"
+			"Prints the state of the flash store (sectors 10 and 11), the wake state in the backup SRAM and the stored keys. \n"
 			"Commands: \n"
-			"  erase: Erases the entire flash memory. \n"
-			"  dump:  Prints the flash content. start and stop are decimal addresses. \n"
+			"  erase: Erases both sectors, all keys are lost. \n"
+			"  dump:  Prints the flash content. start and stop are decimal addresses from the start of sector 10. \n"
 		);
 	}
 	else
@@ -387,8 +542,15 @@ static void CMD_ParseHelp(const char* str)
 			"  stop:                Stop low power timer, no timeout. \n"
 			"  sleep:               Enter low power mode immediately if not disabled. \n"
 			"  display: [pattern]   Display test pattern. \n"
-			"  load:    [path]      Load image from SD card. \n"
+			"  load:    [path] [n]  Load image (frame n of a movie) from SD card. \n"
 			"  update:              Load next image from SD card. \n"
+			"  job:     [action]    Display job state, wait or cancel. \n"
+			"  stats:               Time spent in each phase of the last wakes. \n"
+			"  clock:               Time spent at each performance level. \n"
+			"  mem:                 Memory budget: arenas, stacks and heap. \n"
+			"  sdbench: [path]      SD card read throughput. \n"
+			"  cache:   [clear]     Render cache entries, hits and savings. \n"
+			"  playlist: [rebuild]  Playlist index and position. \n"
 			"  task-info:           Print running tasks. \n"
 			"  flash:   [action]    Read / Write internal flash. \n",
 			_SLEEP_TIMEOUT
@@ -403,9 +565,7 @@ static void CMD_ParseHelp(const char* str)
 static void CMD_ParseDisplay(const char* str, ConsoleTaskArgs_t* args)
 {
 	const char* color_name;
-	DisplayMessage_t msg;
-
-	printf("Wait...\n");
+	DisplayJob_t msg = {0};
 
 	if((color_name = CMD_Trim(str, "grad")))
 	{
@@ -444,63 +604,41 @@ static void CMD_ParseDisplay(const char* str, ConsoleTaskArgs_t* args)
 		}
 	}
 
-	//Trigger display task
-	osMessageQueuePut(args->display_message_queue, &msg, 1, 0);
-	osThreadFlagsSet(args->displayTaskId, _FLAG_DISPLAY_UPDATE);
-	osThreadYield();
-
-	printf("Done\n");
+	CMD_SubmitJob(&msg);
 }
 
 
 /*
- * Parse Load command
+ * Parse Load command: path and frame of a movie
  * */
 static void CMD_ParseLoad(const char* str_args, ConsoleTaskArgs_t* args)
 {
-	DisplayMessage_t msg;
-	FRESULT fres;
-	FIL file;
+	char path[_FILE_PATH_MAX_LEN];
+	const char* space = strrchr(str_args, ' ');
+	unsigned long frame = 0;
 
-	printf("Loading <%s>\n", str_args);
+	//Long file names can contain spaces, the frame is a number after the last one
+	if(space != NULL && strspn(space + 1, "0123456789") != strlen(space + 1))
+		space = NULL;
 
-	if(strlen(str_args) < _MAX_LFN*2+2)
-	{
-		//Open file
-		if((fres = f_open(&file, str_args, FA_READ | FA_OPEN_EXISTING)) == FR_OK)
-		{
-			msg.action = e_DisplayJPEG;
-			msg.fp = &file;
-
-			//Trigger display task
-			osMessageQueuePut(args->display_message_queue, &msg, 1, 0);
-			osThreadFlagsSet(args->displayTaskId, _FLAG_DISPLAY_UPDATE);
-			osThreadYield();
-
-			//Close file
-			int cnt = 0;
-			do{
-				osDelay(1000);
-				fres = f_close(&file);
-			} while(fres != FR_OK && cnt < 10);
-
-			if(cnt >= 10)
-				printf("ERROR: f_close returned %d\n", (int)fres);
-
-			//Store file path to flash
-			FLASH_StoreFilePath(str_args);
-		}
-		else
-		{
-			printf("ERROR: Unable to open file, f_open returned %d\n", (int)fres);
-		}
+	size_t len = space != NULL ? (size_t)(space - str_args) : strlen(str_args);
 
-		printf("Done\n");
+	if(len >= _FILE_PATH_MAX_LEN)
+	{
+		printf("ERROR: Invalid file name (folder and file names up to %d characters)\n", _MAX_LFN);
+		return;
 	}
-	else
+
+	if(space != NULL && (sscanf(CMD_TrimSpaces(space), "%lu", &frame) != 1 || frame >= _MOV_MAX_FRAMES))
 	{
-		printf("ERROR: Invalid file name (only 8.3 filename supported)\n");
+		printf("ERROR: Invalid frame number\n");
+		return;
 	}
+
+	memcpy(path, str_args, len);
+	path[len] = '\0';
+
+	CMD_LoadFile(path, frame);
 }
 
 
@@ -511,20 +649,27 @@ static void CMD_ParseUpdate(const char* str, ConsoleTaskArgs_t* args)
 {
 	char curr_file_path[_FILE_PATH_MAX_LEN];
 	char next_file_path[_FILE_PATH_MAX_LEN];
+	FmanPosition_t position;
 	bool display_splash_screen = false;
 
 	if(!disk_status(0))
 	{
 		printf("Updating...\n");
 
-		//Load current file path from flash
-		FLASH_LoadFilePath(curr_file_path);
+		//Load current file path and playlist position from flash
+		FLASH_LoadFilePath(curr_file_path, &position);
 
 		//Find next file
-		if(FMAN_FindNext(next_file_path, curr_file_path))
+		uint32_t start = PROF_Start();
+		CLK_Request(e_ClockMedium);
+		bool found = FMAN_FindNext(next_file_path, curr_file_path, &position);
+		CLK_Release(e_ClockMedium);
+		PROF_Add(e_ProfFindNext, start);
+
+		if(found)
 		{
 			//Display new file
-			CMD_ParseLoad(next_file_path, args);
+			CMD_LoadFile(next_file_path, position.frame);
 		}
 		else
 		{
@@ -539,21 +684,381 @@ static void CMD_ParseUpdate(const char* str, ConsoleTaskArgs_t* args)
 	}
 
 
-	//Display bitmap
+	//Display bitmap, the panels without a splash screen show the color blocks
 	if(display_splash_screen)
 	{
-		DisplayMessage_t msg;
-		msg.action = e_DisplayBMP;
-		msg.bmp = (uint8_t*)splash_screen;
+		DisplayJob_t job = {0};
+#if _PANEL_SPLASH
+		job.action = e_DisplayBMP;
+		job.bmp = (const uint8_t*)splash_screen;
+#else
+		job.action = e_DisplayBlocks;
+#endif
+
+		CMD_SubmitJob(&job);
+	}
+}
 
-		//Trigger display task
-		osMessageQueuePut(args->display_message_queue, &msg, 1, 0);
-		osThreadFlagsSet(args->displayTaskId, _FLAG_DISPLAY_UPDATE);
-		osThreadYield();
+
+/*
+ * Print the last display job, wait for the jobs or cancel them
+ * */
+static void CMD_ParseJob(const char* str)
+{
+	const char* state_to_str[] = {"queued", "running", "done", "failed", "cancelled", "skipped"};
+	const char* refresh_to_str[] = {"none", "partial", "full"};
+	const char* id_str;
+
+	if(strcmp(str, "wait") == 0)
+	{
+		if(!DJOB_WaitIdle(_DJOB_WAIT_TIMEOUT))
+			printf("ERROR: Display jobs not finished after %d ms\n", _DJOB_WAIT_TIMEOUT);
+	}
+	else if((id_str = CMD_Trim(str, "cancel")))
+	{
+		uint32_t id = 0;
+		sscanf(id_str, "%lu", &id);
+		DJOB_Cancel(id);
+	}
+	else
+	{
+		const DisplayJob_t* job = DJOB_GetLast();
+
+		if(job->id == 0)
+		{
+			printf("No display job finished\n");
+			return;
+		}
+
+		printf("Job %lu: %s, refresh %s\n", job->id, state_to_str[job->state], refresh_to_str[job->refresh]);
+		printf("  queued %lu ms, data %lu ms, refresh %lu ms, total %lu ms\n",
+				job->start_tick - job->submit_tick,
+				job->data_tick - job->start_tick,
+				job->done_tick - job->data_tick,
+				job->done_tick - job->submit_tick);
+		if(job->saved_ms > 0)
+			printf("  streamed from the render cache, %lu ms saved\n", job->saved_ms);
+
+		//The side that waited less is the bottleneck
+		const RAheadStats_t* ra = &job->read_ahead;
+		if(ra->chunks > 0)
+			printf("  read-ahead %lu chunks, %lu seeks, decoder waited %lu times %lu ms, SD task waited %lu times %lu ms: %s bound\n",
+					ra->chunks, ra->seeks, ra->reader_waits, ra->reader_us / 1000, ra->worker_waits, ra->worker_us / 1000,
+					ra->reader_us > ra->worker_us ? "I/O" : "CPU");
 	}
 }
 
 
+/*
+ * Print the time spent in each phase of the current wake and
+ * min/avg/max of the previous wakes
+ * */
+static void CMD_ParseStats(const char* str)
+{
+	if(strcmp(str, "clear") == 0)
+	{
+		PROF_Clear();
+		return;
+	}
+
+	int count = PROF_GetWakeCount();
+	const ProfWake_t* now = PROF_GetWake(0);
+
+	if(now == NULL)
+	{
+		printf("ERROR: Profiler not initialized\n");
+		return;
+	}
+
+	printf("%d previous wakes\n", count - 1);
+	printf("%-10s %10s %10s %10s %10s\n", "phase", "now ms", "min ms", "avg ms", "max ms");
+
+	for(int p = 0; p < e_ProfCount; p++)
+	{
+		uint32_t min = 0xffffffff, max = 0;
+		uint64_t sum = 0;
+
+		for(int age = 1; age < count; age++)
+		{
+			uint32_t us = PROF_GetWake(age)->us[p];
+
+			if(us < min) min = us;
+			if(us > max) max = us;
+			sum += us;
+		}
+
+		printf("%-10s %6lu.%03lu", PROF_GetPhaseName(p), now->us[p] / 1000, now->us[p] % 1000);
+
+		if(count > 1)
+		{
+			uint32_t avg = sum / (count - 1);
+			printf(" %6lu.%03lu %6lu.%03lu %6lu.%03lu",
+					min / 1000, min % 1000, avg / 1000, avg % 1000, max / 1000, max % 1000);
+		}
+
+		printf("\n");
+	}
+
+	const SDWakeInfo_t* sd = SD_GetWakeInfo();
+	printf("SD card: identified after %lu attempts, %s, %s mount%s\n", sd->polls,
+			sd->same_card ? "same card" : "new card", sd->cached ? "cached" : "full",
+			sd->cached ? (sd->writable ? ", FSInfo loaded" : ", read only") : "");
+}
+
+
+/*
+ * Print the time spent at each performance level
+ * */
+static void CMD_ParseClock(const char* str)
+{
+	if(strcmp(str, "clear") == 0)
+	{
+		CLK_ClearResidency();
+		return;
+	}
+
+	const ClockResidency_t* res = CLK_GetResidency();
+	uint32_t total = 0;
+
+	for(int l = 0; l < e_ClockLevels; l++)
+		total += res->ms[l];
+
+	printf("Level: %s, HCLK %lu Hz, %lu switches\n", CLK_GetLevelName(CLK_GetLevel()), SystemCoreClock, res->switches);
+	printf("%-10s %10s %10s %6s\n", "level", "MHz", "ms", "%");
+
+	for(int l = 0; l < e_ClockLevels; l++)
+	{
+		printf("%-10s %10lu %10lu %6lu\n", CLK_GetLevelName(l), CLK_GetLevelFrequency(l) / 1000000,
+				res->ms[l], total > 0 ? (uint32_t)((uint64_t)res->ms[l] * 100 / total) : 0);
+	}
+
+	const PowerIdleStats_t* idle = PWR_GetIdleStats();
+	printf("Idle: sleep %lu ms (%lu times), stop %lu ms (%lu times)\n",
+			idle->sleep_ms, idle->sleep_count, idle->stop_ms, idle->stop_count);
+}
+
+
+/*
+ * Print the memory budget
+ * */
+static void CMD_ParseMem(const char* str)
+{
+	const Arena_t* arenas[] = {&arena_ccm, &arena_sram};
+	osThreadId_t thread_IDs[16];
+	uint32_t thread_count;
+
+	printf("%-12s %8s %8s %8s\n", "arena", "used", "peak", "size");
+	for(int i = 0; i < sizeof(arenas) / sizeof(arenas[0]); i++)
+		printf("%-12s %8lu %8lu %8lu\n", arenas[i]->name, arenas[i]->used, arenas[i]->peak, arenas[i]->size);
+
+	//Minimum free stack since the task was started
+	thread_count = osThreadEnumerate(thread_IDs, 16);
+	printf("%-12s %8s\n", "task", "free");
+	for(int i = 0; i < thread_count; i++)
+		printf("%-12s %8lu\n", osThreadGetName(thread_IDs[i]), osThreadGetStackSpace(thread_IDs[i]) * sizeof(StackType_t));
+
+	printf("Heap: %u free, %u minimum ever free, %u size\n",
+			(unsigned)xPortGetFreeHeapSize(), (unsigned)xPortGetMinimumEverFreeHeapSize(), (unsigned)configTOTAL_HEAP_SIZE);
+
+	const FastSeekStats_t* seek = FSEEK_GetStats();
+	printf("Link maps: %lu built, %lu reused, %lu too fragmented, %lu without a free slot\n",
+			seek->built, seek->reused, seek->fragmented, seek->full);
+}
+
+
+/*
+ * Read a file with small, large aligned and large unaligned reads and print the throughput
+ * */
+static void CMD_ParseSdBench(const char* str)
+{
+	const struct { UINT size; UINT offset; const char* name; } passes[] = {
+		{512, 0, "512"},
+		{_SD_BENCH_BYTES, 0, "aligned"},
+		{_SD_BENCH_BYTES, 1, "unaligned"}
+	};
+	uint8_t* buff;
+	FIL file;
+
+	if(disk_status(0))
+	{
+		printf("ERROR: Drive not mounted\n");
+		return;
+	}
+
+	//Too large for the stack of the console task
+	if((buff = pvPortMalloc(_SD_BENCH_BYTES + 4)) == NULL)
+	{
+		printf("ERROR: Not enough heap for the %d byte buffer\n", _SD_BENCH_BYTES);
+		return;
+	}
+
+	printf("SD clock %lu Hz, HCLK %lu Hz\n", CLK_GetSDIOFrequency(), SystemCoreClock);
+	printf("%-10s %8s %8s %8s %10s %8s\n", "read", "KB", "ms", "KB/s", "commands", "bounced");
+
+	for(int i = 0; i < sizeof(passes) / sizeof(passes[0]); i++)
+	{
+		if(FSEEK_Open(&file, str) != FR_OK)
+		{
+			printf("ERROR: Unable to open file: %s\n", str);
+			break;
+		}
+
+		SD_ReadStats_t before = *SD_GetReadStats();
+		uint32_t bytes = 0;
+		uint32_t start = HAL_GetTick();
+		UINT read;
+
+		while(f_read(&file, buff + passes[i].offset, passes[i].size, &read) == FR_OK && read > 0)
+			bytes += read;
+
+		uint32_t ms = HAL_GetTick() - start;
+		const SD_ReadStats_t* after = SD_GetReadStats();
+
+		FSEEK_Close(&file);
+
+		printf("%-10s %8lu %8lu %8lu %10lu %8lu\n", passes[i].name, bytes / 1024, ms,
+				ms > 0 ? (uint32_t)((uint64_t)bytes * 1000 / 1024 / ms) : 0,
+				after->commands - before.commands, after->bounced - before.bounced);
+	}
+
+	vPortFree(buff);
+}
+
+
+/*
+ * Print the render cache statistics
+ * */
+static void CMD_ParseCache(const char* str)
+{
+#if _RCACHE_ENABLE
+	//The render task may be writing an entry
+	RCACHE_Wait(osWaitForever);
+
+	if(strcmp(str, "clear") == 0)
+	{
+		printf("%lu files deleted\n", RCACHE_Clear());
+		return;
+	}
+
+	if(!RCACHE_Scan())
+		return;
+
+	const RCacheStats_t* stats = RCACHE_GetStats();
+
+	printf("Folder <%s>: %lu entries, %lu KB of %d KB\n", _RCACHE_DIR, stats->entries, stats->bytes / 1024, _RCACHE_MAX_KB);
+	printf("Hits %lu, misses %lu, rendered %lu, failed %lu, evicted %lu\n",
+			stats->hits, stats->misses, stats->renders, stats->failures, stats->evictions);
+	printf("Saved %lu ms of decode, %lu source bytes\n", stats->saved_ms, stats->saved_bytes);
+#else
+	printf("Render cache disabled on this panel\n");
+#endif
+}
+
+
+/*
+ * Print the playlist index and the current position
+ * */
+static void CMD_ParsePlaylist(const char* str)
+{
+	char path[_FILE_PATH_MAX_LEN];
+	FmanPosition_t position;
+
+	if(disk_status(0))
+	{
+		printf("ERROR: Drive not mounted\n");
+		return;
+	}
+
+	if(strcmp(str, "rebuild") == 0 && !FMAN_Rebuild())
+		printf("ERROR: Unable to build the playlist index\n");
+
+	const FmanIndexHeader_t* index = FMAN_GetIndex();
+	printf("Index <%s>: %lu records, generation %04lX\n", _FMAN_INDEX_PATH, index->count, index->generation);
+
+	if(FLASH_LoadFilePath(path, &position))
+	{
+		if(position.generation == index->generation)
+			printf("Current: <%s> frame %u, record %lu\n", path, position.frame, position.record);
+		else
+			printf("Current: <%s>, not indexed\n", path);
+	}
+}
+
+
+/*
+ * Display the file (frame of a movie),
+ * the path is stored to flash when the job is finished
+ * */
+static void CMD_LoadFile(const char* path, uint16_t frame)
+{
+	DisplayJob_t job = {0};
+
+	if(MOV_IsMovieName(path))
+		printf("Loading <%s> frame %u\n", path, frame);
+	else
+		printf("Loading <%s>\n", path);
+
+	job.action = e_DisplayFile;
+	strcpy(job.path, path);
+	job.frame = frame;
+	job.done = StoreJobPath;
+
+	CMD_SubmitJob(&job);
+}
+
+
+/*
+ * Submit a display job and print its id
+ * */
+static void CMD_SubmitJob(const DisplayJob_t* job)
+{
+	uint32_t id = DJOB_Submit(job);
+
+	if(id != 0)
+		printf("Display job %lu queued\n", id);
+	else
+		printf("ERROR: Display job queue full\n");
+}
+
+
+/*
+ * Called by the display task when a load job is finished
+ * */
+static void StoreJobPath(const DisplayJob_t* job)
+{
+	FmanPosition_t position;
+	FlashDecode_t decode = {_PANEL, _PANEL_PALETTE, _DITHER, 1};
+
+	if(job->state == e_JobDone)
+	{
+		FMAN_GetPosition(job->path, job->frame, &position);
+		FLASH_StoreFilePath(job->path, &position);
+		FLASH_Write(e_FlashKeyDecode, &decode, sizeof(decode));
+		wakeUpdates++;
+	}
+	else if(job->state == e_JobFailed)
+	{
+		wakeFailures++;
+	}
+}
+
+
+/*
+ * Save the state of the wake and enter standby, does not return
+ * */
+static void EnterStandBy(void)
+{
+	//Erased by the render task during the refresh, unless it didn't run
+	if(FLASH_EraseInactive())
+		printf("Flash sector erased before standby\n");
+	FLASH_EndWake(wakeUpdates, wakeFailures);
+
+	printf("Entering low power mode\n");
+	osDelay(1);
+	PWR_EnterStandBy();
+}
+
+
 /*
  * Print info on all running tasks
  * */
@@ -588,9 +1093,11 @@ static void CMD_ParseSleep(const char* str, ConsoleTaskArgs_t* args)
 {
 	if(*args->sleep_cmd_disabled == false)
 	{
-		printf("Entering low power mode\n");
-		osDelay(1);
-		PWR_EnterStandBy();
+		//Let the display finish the queued updates
+		if(!DJOB_WaitIdle(_DJOB_WAIT_TIMEOUT))
+			printf("ERROR: Display jobs not finished after %d ms\n", _DJOB_WAIT_TIMEOUT);
+
+		EnterStandBy();
 	}
 	else
 	{
@@ -606,7 +1113,7 @@ static void CMD_ParseFlash(const char* str, ConsoleTaskArgs_t* args)
 {
 	const char* ss_str;
 	const int flash_add_min = 0;
-	const int flash_add_max = 131072;
+	const int flash_add_max = 2 * _FLASH_SECTOR_SIZE;
 	char path[_FILE_PATH_MAX_LEN];
 
 	if(strcmp(str, "erase") == 0)
@@ -624,7 +1131,7 @@ static void CMD_ParseFlash(const char* str, ConsoleTaskArgs_t* args)
 		sscanf(ss_str, "%d %d", &strt_add, &stop_add);
 
 		//Print flash content
-		char* pt = (char*)0x080e0000;
+		char* pt = (char*)_FLASH_STORE_ADDR + strt_add;
 		for(int i = strt_add; i < stop_add; i += 16)
 		{
 			printf("%05X: ", i);
@@ -649,9 +1156,34 @@ static void CMD_ParseFlash(const char* str, ConsoleTaskArgs_t* args)
 	}
 	else
 	{
-		//Print last valid entry
-		bool valid = FLASH_LoadFilePath(path);
-		printf("FLASH_Load() returned: %d, path: <%s>\n", valid, path);
+		//Print the state of the store and the keys
+		const FlashInfo_t* info = FLASH_GetInfo();
+		const FlashCounters_t* counters = FLASH_GetCounters();
+		FmanPosition_t position;
+		FlashSource_t committed;
+		FlashDecode_t decode;
+		ProfWake_t timings;
+
+		if(info->active >= 0)
+			printf("Active sector %d, sequence %lu, %lu of %lu slots used%s\n", 10 + info->active,
+					info->sequence, info->used, info->slots, info->erase_pending ? ", erase pending" : "");
+		else
+			printf("Flash store empty\n");
+		printf("Since reset: %lu records written, %lu unchanged, %lu sectors erased (%lu while writing)\n",
+				info->records, info->skipped, info->erases, info->blocking_erases);
+
+		bool valid = FLASH_LoadFilePath(path, &position);
+		printf("FLASH_Load() returned: %d, path: <%s>, frame: %u, record: %lu, generation: %04X\n",
+				valid, path, position.frame, position.record, position.generation);
+		printf("Wakes %lu, updates %lu, failures %lu, last failure at wake %lu%s\n", counters->wakes, counters->updates,
+				counters->failures, counters->last_failure, info->backup_reset ? " (backup SRAM lost, loaded from flash)" : "");
+
+		if(FLASH_Read(e_FlashKeySource, &committed, sizeof(committed)))
+			printf("Committed: <%.*s> frame %u\n", (int)sizeof(committed.path), committed.path, committed.position.frame);
+		if(FLASH_Read(e_FlashKeyDecode, &decode, sizeof(decode)))
+			printf("Decode: panel %u, palette %u, dither %u, scale %u\n", decode.panel, decode.palette, decode.dither, decode.scale);
+		if(FLASH_Read(e_FlashKeyTimings, &timings, sizeof(timings)))
+			printf("Committed wake %lu ms, flash %lu us\n", timings.us[e_ProfWake] / 1000, timings.us[e_ProfFlash]);
 	}
 }
 
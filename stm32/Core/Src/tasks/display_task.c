@@ -8,79 +8,336 @@
  */
 
 #include "tasks/display_task.h"
-
-
+#include "arena.h"
+
+
+static osMessageQueueId_t jobQueue;
+static osEventFlagsId_t jobEvents;
+static volatile osThreadId_t displayThread;
+static volatile uint32_t submittedId;	//Id of the last job submitted
+static volatile uint32_t finishedId;	//Id of the last job finished
+static volatile uint32_t cancelId;		//Job to be cancelled
+static volatile uint32_t cancelUpTo;	//All the jobs up to this one are cancelled
+static DisplayJob_t lastJob;
+static FIL* file;			//Filled by SDIO DMA, must not be in CCM RAM
+static bool cached;			//The file is the render cache
+static RAheadStats_t readAhead;	//Counters of the jpeg decoded by the job
+
+static void run_job(DisplayJob_t* job);
+static bool job_cancelled(const DisplayJob_t* job);
 static void display_solid(uint8_t color);
 static void display_bloks(void);
 static void display_stripes(void);
 static void display_lines(void);
 static void display_gradient(uint8_t color);
-static void display_jpeg(FIL* fp);
-static void display_bmp(uint8_t* bmp);
+static bool display_path(DisplayJob_t* job);
+static bool display_file(FIL* fp, uint16_t frame);
+static bool display_movie(FIL* fp, uint16_t frame);
+static bool display_jpeg(FIL* fp);
+#if _PANEL_SPLASH
+static void display_bmp(const uint8_t* bmp);
+#endif
 
 
 /*
- *
+ * Initialize the job queue, must be called before the scheduler is started
+ * */
+void DJOB_Init(const DisplayTaskArgs_t* args)
+{
+	jobQueue = args->message_queue;
+	jobEvents = osEventFlagsNew(NULL);
+
+	DISP_Setup();
+	file = ARENA_Alloc(&arena_sram, sizeof(FIL));
+#if _RCACHE_ENABLE
+	RCACHE_Init();
+#endif
+}
+
+
+/*
+ * Queue a job for the display task, returns the id of the job
+ * or 0 if the queue is full
+ * */
+uint32_t DJOB_Submit(const DisplayJob_t* job)
+{
+	DisplayJob_t queued = *job;
+	osThreadId_t thread = displayThread;
+
+	queued.id = submittedId + 1;
+	queued.state = e_JobQueued;
+	queued.refresh = e_RefreshNone;
+	queued.saved_ms = 0;
+	memset(&queued.read_ahead, 0, sizeof(queued.read_ahead));
+	queued.submit_tick = osKernelGetTickCount();
+
+	if(osMessageQueuePut(jobQueue, &queued, 0, 0) != osOK)
+		return 0;
+
+	submittedId = queued.id;
+
+	if(thread != NULL)
+		osThreadFlagsSet(thread, _FLAG_DISPLAY_UPDATE);
+
+	return queued.id;
+}
+
+
+/*
+ * Cancel a job, queued jobs are dropped and the running job
+ * is stopped before the refresh. id = 0 cancels all the jobs submitted so far
+ * */
+void DJOB_Cancel(uint32_t id)
+{
+	if(id == 0)
+		cancelUpTo = submittedId;
+	else
+		cancelId = id;
+}
+
+
+/*
+ * Wait for the job to be finished, returns false on timeout
+ * */
+bool DJOB_Wait(uint32_t id, uint32_t timeout)
+{
+	uint32_t start = osKernelGetTickCount();
+
+	while((int32_t)(finishedId - id) < 0)
+	{
+		uint32_t elapsed = osKernelGetTickCount() - start;
+
+		if(timeout != osWaitForever && elapsed >= timeout)
+			return false;
+
+		osEventFlagsWait(jobEvents, _DJOB_EVENT_DONE, osFlagsWaitAny,
+				timeout == osWaitForever ? osWaitForever : timeout - elapsed);
+	}
+
+	return true;
+}
+
+
+/*
+ * Wait for all the submitted jobs to be finished, returns false on timeout
+ * */
+bool DJOB_WaitIdle(uint32_t timeout)
+{
+	uint32_t start = osKernelGetTickCount();
+
+	if(!DJOB_Wait(submittedId, timeout))
+		return false;
+
+#if _RCACHE_ENABLE
+	//The render of the next file is part of the last job
+	uint32_t elapsed = osKernelGetTickCount() - start;
+	return RCACHE_Wait(timeout == osWaitForever ? osWaitForever : (elapsed < timeout ? timeout - elapsed : 0));
+#else
+	(void)start;
+	return true;
+#endif
+}
+
+
+/*
+ * Returns true if there are no jobs queued or running
+ * and the next file is not being rendered
+ * */
+bool DJOB_IsIdle(void)
+{
+#if _RCACHE_ENABLE
+	if(!RCACHE_IsIdle())
+		return false;
+#endif
+
+	return finishedId == submittedId;
+}
+
+
+/*
+ * Returns the last finished job
+ * */
+const DisplayJob_t* DJOB_GetLast(void)
+{
+	return &lastJob;
+}
+
+
+/*
+ * Runs the jobs submitted with DJOB_Submit()
  * */
 void StartDisplayTask(void *_args)
 {
-	const DisplayTaskArgs_t* args = (DisplayTaskArgs_t*)_args;
+	displayThread = osThreadGetId();
 
 	while(1)
 	{
-		//Wait for flag
-		osThreadFlagsWait(_FLAG_DISPLAY_UPDATE, osFlagsWaitAny, osWaitForever);
+		DisplayJob_t job;
 
-		//Read message
-		DisplayMessage_t msg;
-		if(osMessageQueueGet (args->message_queue, &msg, NULL, 100) == osOK)
+		//Run all the queued jobs
+		while(osMessageQueueGet(jobQueue, &job, NULL, 0) == osOK)
 		{
+			run_job(&job);
 
-			if(LDR_IsDark() == false)
-			{
-				//Initialize display
-				DISP_Init();
-				DISP_BeginUpdate();
-
-				switch(msg.action)
-				{
-					case e_DisplaySolid:
-						display_solid(msg.color);
-						break;
-					case e_DisplayBlocks:
-						display_bloks();
-						break;
-					case e_DisplayStripes:
-						display_stripes();
-						break;
-					case e_DisplayLines:
-						display_lines();
-						break;
-					case e_DisplayGradient:
-						display_gradient(msg.color);
-						break;
-					case e_DisplayJPEG:
-						display_jpeg(msg.fp);
-						break;
-					case e_DisplayBMP:
-						display_bmp(msg.bmp);
-						break;
-				}
-
-				//Update display and enter low power mode
-				DISP_EndUpdate();
-				DISP_Sleep();
-			}
-			else
-			{
-				printf("DisplayTask: Too dark to see the display, update aborted\n");
-			}
+			lastJob = job;
+			finishedId = job.id;
+			if(job.done != NULL)
+				job.done(&job);
+			osEventFlagsSet(jobEvents, _DJOB_EVENT_DONE);
 		}
-		else
+
+		//Wait for flag
+		osThreadFlagsWait(_FLAG_DISPLAY_UPDATE, osFlagsWaitAny, osWaitForever);
+	}
+}
+
+
+/*
+ * Update the display
+ * */
+static void run_job(DisplayJob_t* job)
+{
+	FRESULT fres;
+	bool ok = true;
+
+	job->start_tick = osKernelGetTickCount();
+	job->data_tick = job->start_tick;
+	job->done_tick = job->start_tick;
+
+	if(job_cancelled(job))
+	{
+		job->state = e_JobCancelled;
+		return;
+	}
+
+	if(LDR_IsDark())
+	{
+		printf("DisplayTask: Too dark to see the display, update aborted\n");
+		job->state = e_JobSkipped;
+		return;
+	}
+
+	if(job->action == e_DisplayFile)
+	{
+		//Stream the render cache if it holds the file
+		cached = false;
+#if _RCACHE_ENABLE
+		cached = RCACHE_Open(file, job->path, job->frame);
+#endif
+
+		if(!cached && (fres = FSEEK_Open(file, job->path)) != FR_OK)
 		{
-			printf("DisplayTask: Unable to read message\n");
+			printf("ERROR: Unable to open file <%s>, f_open returned %d\n", job->path, (int)fres);
+			job->state = e_JobFailed;
+			return;
 		}
 	}
+
+	job->state = e_JobRunning;
+
+	//Colors are indices in the palette of the panel
+	job->color %= _NUM_COLORS+1;
+
+	//Initialize display, test patterns always refresh the whole panel
+	//Decode and dither at full speed, the clock drops during the BUSY waits
+	CLK_Request(e_ClockHigh);
+	DISP_Init();
+	DISP_BeginUpdate(job->action != e_DisplayFile);
+
+	switch(job->action)
+	{
+		case e_DisplaySolid:
+			display_solid(job->color);
+			break;
+		case e_DisplayBlocks:
+			display_bloks();
+			break;
+		case e_DisplayStripes:
+			display_stripes();
+			break;
+		case e_DisplayLines:
+			display_lines();
+			break;
+		case e_DisplayGradient:
+			display_gradient(job->color);
+			break;
+		case e_DisplayFile:
+			memset(&readAhead, 0, sizeof(readAhead));
+			ok = display_path(job);
+			job->read_ahead = readAhead;
+			break;
+#if _PANEL_SPLASH
+		case e_DisplayBMP:
+			display_bmp(job->bmp);
+			break;
+#endif
+	}
+
+	job->data_tick = osKernelGetTickCount();
+
+	if(!ok || job_cancelled(job))
+	{
+		//Leave the old image on the panel, a file that failed to stream is not shown
+		DISP_AbortUpdate();
+		DISP_Sleep();
+		CLK_Release(e_ClockHigh);
+		job->state = ok ? e_JobCancelled : e_JobFailed;
+		job->done_tick = osKernelGetTickCount();
+		return;
+	}
+
+#if _RCACHE_ENABLE
+	//Render the next file while the panel is refreshed
+	if(job->action == e_DisplayFile)
+		RCACHE_Start(job->path, job->frame);
+#endif
+
+	//Update display and enter low power mode
+	job->refresh = DISP_EndUpdate();
+	DISP_Sleep();
+	CLK_Release(e_ClockHigh);
+	job->done_tick = osKernelGetTickCount();
+	job->state = e_JobDone;
+
+	if(job->refresh == e_RefreshNone)
+	{
+		printf("DisplayTask: Image unchanged, refresh skipped\n");
+	}
+	else if(job->refresh == e_RefreshPartial)
+	{
+		const DisplayWindow_t* win = DISP_GetWindow();
+		printf("DisplayTask: Partial refresh (%d,%d)-(%d,%d)\n", win->x0, win->y0, win->x1, win->y1);
+	}
+
+	const DisplayPipelineStats_t* pipeline = DISP_GetPipelineStats();
+	if(pipeline->stripes > 0)
+		printf("DisplayTask: %lu stripes, decoder stalled %lu ms, output stalled %lu ms\n",
+				pipeline->stripes, pipeline->decode_stall, pipeline->output_stall);
+
+	const DisplayBusyTimes_t* busy = DISP_GetBusyTimes();
+	printf("DisplayTask: BUSY init %lu ms, power-on %lu ms, refresh %lu ms, power-off %lu ms\n",
+			busy->init, busy->power_on, busy->refresh, busy->power_off);
+	if(busy->timeout)
+		printf("ERROR: Display BUSY timeout\n");
+}
+
+
+/*
+ * Returns true if DJOB_Cancel() was called for the job
+ * */
+static bool job_cancelled(const DisplayJob_t* job)
+{
+	return job->id == cancelId || (int32_t)(cancelUpTo - job->id) >= 0;
+}
+
+
+/*
+ * Dithers the stripes decoded by the display task and sends them to the display,
+ * runs while the display task decodes the next stripe
+ * */
+void StartDisplayOutputTask(void *_args)
+{
+	DISP_RunOutput();
 }
 
 
@@ -89,11 +346,11 @@ void StartDisplayTask(void *_args)
  * */
 static void display_solid(uint8_t color)
 {
-    for(int i = 0; i < _DISPLAY_WIDTH/2; i++)
+    for(int i = 0; i < _DISPLAY_WIDTH; i++)
     {
         for(int j = 0; j < _DISPLAY_HEIGHT; j++)
         {
-        	DISP_SendData((color<<4)|color);
+        	DISP_SendPixel(color);
         }
     }
 }
@@ -108,9 +365,9 @@ static void display_bloks(void)
 	{
 		for(uint8_t k = 0; k < 4; k++)
 		{
-			for(int j = 0; j < _DISPLAY_WIDTH/8; j++)
+			for(int j = 0; j < _DISPLAY_WIDTH/4; j++)
 			{
-				DISP_SendData((k<<4)|k);
+				DISP_SendPixel(k % (_NUM_COLORS+1));
 			}
 		}
 	}
@@ -118,9 +375,9 @@ static void display_bloks(void)
 	{
 		for(uint8_t k = 4; k < 8; k++)
 		{
-			for(int j = 0; j < _DISPLAY_WIDTH/8; j++)
+			for(int j = 0; j < _DISPLAY_WIDTH/4; j++)
 			{
-				DISP_SendData((k<<4)|k);
+				DISP_SendPixel(k % (_NUM_COLORS+1));
 			}
 		}
 	}
@@ -136,10 +393,10 @@ static void display_stripes(void)
 {
 	for(int y = 0; y < _DISPLAY_HEIGHT; y++)
 	{
-		for(int x = 0; x < _DISPLAY_WIDTH/2; x++)
+		for(int x = 0; x < _DISPLAY_WIDTH; x++)
 		{
-			uint8_t c = y / (_DISPLAY_HEIGHT / 7);
-			DISP_SendData((c << 4) | c);
+			uint8_t c = y * _NUM_COLORS / _DISPLAY_HEIGHT;
+			DISP_SendPixel(c);
 		}
 	}
 }
@@ -154,10 +411,10 @@ void display_lines(void)
 {
 	for(int y = 0; y < _DISPLAY_HEIGHT; y++)
 	{
-		for(int x = 0; x < _DISPLAY_WIDTH/2; x++)
+		for(int x = 0; x < _DISPLAY_WIDTH; x++)
 		{
 			uint8_t c = y % 2 == 0 ? 1 : 0;
-			DISP_SendData((c << 4) | c);
+			DISP_SendPixel(c);
 		}
 	}
 }
@@ -175,17 +432,17 @@ static void display_gradient(uint8_t color)
 	const float b0 = (float)cl.b / 255.f;
 
 	//Send data
-	for(int y = 0; y < EPD_5IN65F_HEIGHT; y++)
+	for(int y = 0; y < _DISPLAY_HEIGHT; y++)
 	{
-		if(y < 448/2)
+		if(y < _DISPLAY_HEIGHT/2)
 		{
 			//Color to White
-			for(int x = 0; x < EPD_5IN65F_WIDTH; x++)
+			for(int x = 0; x < _DISPLAY_WIDTH; x++)
 			{
 				float r1 = 1.f;
 				float g1 = 1.f;
 				float b1 = 1.f;
-				float t = (float)x / (float)(EPD_5IN65F_WIDTH-1);
+				float t = (float)x / (float)(_DISPLAY_WIDTH-1);
 
 				uint8_t r = (uint8_t)((r0 * t + r1 * (1-t)) * 255.f);
 				uint8_t g = (uint8_t)((g0 * t + g1 * (1-t)) * 255.f);
@@ -197,12 +454,12 @@ static void display_gradient(uint8_t color)
 		else
 		{
 			//Black to Color
-			for(int x = 0; x < EPD_5IN65F_WIDTH; x++)
+			for(int x = 0; x < _DISPLAY_WIDTH; x++)
 			{
 				float r1 = 0.f;
 				float g1 = 0.f;
 				float b1 = 0.f;
-				float t = 1.f - (float)x / (float)(EPD_5IN65F_WIDTH-1);
+				float t = 1.f - (float)x / (float)(_DISPLAY_WIDTH-1);
 
 				uint8_t r = (uint8_t)((r0 * t + r1 * (1-t)) * 255.f);
 				uint8_t g = (uint8_t)((g0 * t + g1 * (1-t)) * 255.f);
@@ -216,26 +473,122 @@ static void display_gradient(uint8_t color)
 
 
 /*
- * Load jpeg image from SD card
+ * Display the file opened by run_job(),
+ * a corrupted render cache is replaced by the decoded file
+ * */
+static bool display_path(DisplayJob_t* job)
+{
+#if _RCACHE_ENABLE
+	uint32_t start = osKernelGetTickCount();
+#endif
+	bool ok = display_file(file, cached ? 0 : job->frame);
+
+	FSEEK_Close(file);
+
+#if _RCACHE_ENABLE
+	if(cached && ok)
+	{
+		job->saved_ms = RCACHE_Hit(osKernelGetTickCount() - start);
+		printf("DisplayTask: Streamed from the render cache, %lu ms saved\n", job->saved_ms);
+	}
+	else if(cached)
+	{
+		printf("ERROR: Render cache corrupted, decoding <%s>\n", job->path);
+		RCACHE_Invalidate();
+		DISP_AbortUpdate();
+		DISP_BeginUpdate(false);
+
+		if(FSEEK_Open(file, job->path) != FR_OK)
+			return false;
+
+		ok = display_file(file, job->frame);
+		FSEEK_Close(file);
+	}
+#endif
+
+	return ok;
+}
+
+
+/*
+ * Load image from SD card, pre-rendered frames are streamed to the display,
+ * movies show one of their frames, other files are decoded as jpeg
  * */
-static void display_jpeg(FIL* fp)
+static bool display_file(FIL* fp, uint16_t frame)
 {
-	JPG_t jpg;
+	if(MOV_GetFrameCount(fp) > 0)
+	{
+		return display_movie(fp, frame);
+	}
+	else if(FRM_IsFrame(fp))
+	{
+		if(!FRM_Display(fp))
+		{
+			printf("ERROR: Frame streaming failed\n");
+			return false;
+		}
+
+		return true;
+	}
+	else
+	{
+		return display_jpeg(fp);
+	}
+}
 
+
+/*
+ * Seek to the frame of the movie and display it
+ * */
+static bool display_movie(FIL* fp, uint16_t frame)
+{
+	MOV_Entry_t entry;
+
+	if(!MOV_Seek(fp, frame, &entry))
+		return false;
+
+	if(entry.type == _MOV_TYPE_FRAME)
+	{
+		if(!FRM_DisplayAt(fp, entry.offset))
+		{
+			printf("ERROR: Frame streaming failed\n");
+			return false;
+		}
+
+		return true;
+	}
+
+	return display_jpeg(fp);
+}
+
+
+/*
+ * Load jpeg image from SD card
+ * */
+static bool display_jpeg(FIL* fp)
+{
 	//Decode image
-	if(JPG_decode(fp, &jpg))
+	bool ok = JPG_Display(fp);
+	readAhead = *RAHEAD_GetStats();
+
+	if(!ok)
 	{
 		printf("ERROR: JPG decoding failed\n");
+		return false;
 	}
+
+	return true;
 }
 
 
+#if _PANEL_SPLASH
 /*
- * Display 600x448 bitmap
+ * Display a bitmap in the format of the panel
  * */
-static void display_bmp(uint8_t* bmp)
+static void display_bmp(const uint8_t* bmp)
 {
-	for(int i = 0; i < (EPD_5IN65F_WIDTH * EPD_5IN65F_HEIGHT) / 2; i++)
-		DISP_SendData(bmp[i]);
+	for(int y = 0; y < _DISPLAY_HEIGHT; y++)
+		DISP_SendRow(&bmp[y * _DISPLAY_ROW_BYTES], _DISPLAY_ROW_BYTES);
 }
+#endif
 
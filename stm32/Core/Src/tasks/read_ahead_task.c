@@ -0,0 +1,251 @@
+/**
+ ******************************************************************************
+ * @file      read_ahead_task.c
+ * @author    ts-manuel
+ * @brief     Read-ahead of the file being decoded
+ *
+ ******************************************************************************
+ */
+
+#include "tasks/read_ahead_task.h"
+#include "profiler.h"
+
+
+static osSemaphoreId_t freeSem;		//Buffers the task can fill
+static osSemaphoreId_t filledSem;	//Chunks the decoder can take
+static osSemaphoreId_t idleSem;		//Released by the task when it stops reading
+static volatile osThreadId_t worker;	//NULL until the task is started
+static FIL* file;
+static RAheadChunk_t chunks[_RAHEAD_DEPTH];
+static uint32_t head;				//Next chunk for the decoder
+static uint32_t tail;				//Next buffer for the task
+static const RAheadChunk_t* held;	//Chunk the decoder is working on
+static bool ended;					//The last chunk has been taken
+static bool active;					//The task is reading the stream
+static volatile bool streaming;		//Cleared to stop the task
+static RAheadStats_t stats;
+
+static const uint8_t none = 0;
+static const RAheadChunk_t empty = {(uint8_t*)&none, 0, 0, true, false};
+
+static void start(void);
+static void stop(void);
+static void fill(void);
+static bool read_chunk(RAheadChunk_t* chunk);
+
+
+/*
+ * Create the semaphores, must be called before the scheduler is started
+ * */
+void RAHEAD_Init(void)
+{
+	freeSem = osSemaphoreNew(_RAHEAD_DEPTH, _RAHEAD_DEPTH, NULL);
+	filledSem = osSemaphoreNew(_RAHEAD_DEPTH, 0, NULL);
+	idleSem = osSemaphoreNew(1, 0, NULL);
+}
+
+
+/*
+ * Start reading the file from its current position into the ring
+ * (_RAHEAD_RING_BYTES, word aligned, not in CCM RAM)
+ * */
+void RAHEAD_Open(FIL* fp, uint8_t* ring)
+{
+	file = fp;
+	memset(&stats, 0, sizeof(stats));
+
+	for(int i = 0; i < _RAHEAD_DEPTH; i++)
+		chunks[i].data = &ring[i * _RAHEAD_CHUNK_SIZE];
+
+	start();
+}
+
+
+/*
+ * Returns the next chunk of the file, waiting for the SD card if it hasn't
+ * been read yet. After the last one an empty chunk is returned
+ * */
+const RAheadChunk_t* RAHEAD_NextChunk(void)
+{
+	if(held != NULL)
+		RAHEAD_ReleaseChunk();
+
+	if(ended)
+		return &empty;
+
+	RAheadChunk_t* chunk = &chunks[head];
+
+	if(worker == NULL)
+	{
+		read_chunk(chunk);
+	}
+	else if(osSemaphoreAcquire(filledSem, 0) != osOK)
+	{
+		uint32_t start = PROF_Start();
+		stats.reader_waits++;
+		osSemaphoreAcquire(filledSem, osWaitForever);
+		stats.reader_us += PROF_TicksToUs(PROF_Start() - start);
+	}
+
+	stats.chunks++;
+	ended = chunk->end;
+	held = chunk;
+
+	return chunk;
+}
+
+
+/*
+ * Give back the chunk returned by RAHEAD_NextChunk(), its buffer is filled again
+ * */
+void RAHEAD_ReleaseChunk(void)
+{
+	if(held == NULL || held == &empty)
+		return;
+
+	held = NULL;
+	head = (head + 1) % _RAHEAD_DEPTH;
+
+	if(worker != NULL)
+		osSemaphoreRelease(freeSem);
+}
+
+
+/*
+ * Drop the chunks read ahead and continue from the new position
+ * */
+void RAHEAD_Seek(FSIZE_t ofs)
+{
+	stop();
+	stats.seeks++;
+
+	if(f_lseek(file, ofs) != FR_OK)
+		printf("ERROR: Read-ahead seek to %lu failed\n", (uint32_t)ofs);
+
+	start();
+}
+
+
+/*
+ * Stop reading, the ring can be released
+ * */
+void RAHEAD_Close(void)
+{
+	stop();
+	file = NULL;
+}
+
+
+/*
+ * Returns the counters of the last stream
+ * */
+const RAheadStats_t* RAHEAD_GetStats(void)
+{
+	return &stats;
+}
+
+
+/*
+ * Fill the ring while a stream is open
+ * */
+void StartReadAheadTask(void *_args)
+{
+	worker = osThreadGetId();
+
+	for(;;)
+	{
+		osThreadFlagsWait(_FLAG_RAHEAD_START, osFlagsWaitAny, osWaitForever);
+		fill();
+		osSemaphoreRelease(idleSem);
+	}
+}
+
+
+/*
+ * Empty the ring and let the task fill it from the current position of the file
+ * */
+static void start(void)
+{
+	head = 0;
+	tail = 0;
+	held = NULL;
+	ended = false;
+
+	if(worker == NULL)
+		return;
+
+	//The task is idle, all the buffers are free
+	while(osSemaphoreAcquire(filledSem, 0) == osOK);
+	while(osSemaphoreAcquire(freeSem, 0) == osOK);
+	for(int i = 0; i < _RAHEAD_DEPTH; i++)
+		osSemaphoreRelease(freeSem);
+
+	streaming = true;
+	active = true;
+	osThreadFlagsSet(worker, _FLAG_RAHEAD_START);
+}
+
+
+/*
+ * Wait for the task to finish the chunk it's reading
+ * */
+static void stop(void)
+{
+	if(!active)
+		return;
+
+	//Wake the task up if it's waiting for a buffer
+	streaming = false;
+	osSemaphoreRelease(freeSem);
+	osSemaphoreAcquire(idleSem, osWaitForever);
+	active = false;
+}
+
+
+/*
+ * Read chunks until the end of the file or until the stream is stopped
+ * */
+static void fill(void)
+{
+	bool end = false;
+
+	while(streaming && !end)
+	{
+		if(osSemaphoreAcquire(freeSem, 0) != osOK)
+		{
+			uint32_t start = PROF_Start();
+			stats.worker_waits++;
+			osSemaphoreAcquire(freeSem, osWaitForever);
+			stats.worker_us += PROF_TicksToUs(PROF_Start() - start);
+		}
+
+		if(!streaming)
+			break;
+
+		end = !read_chunk(&chunks[tail]);
+		tail = (tail + 1) % _RAHEAD_DEPTH;
+		osSemaphoreRelease(filledSem);
+	}
+}
+
+
+/*
+ * Read the next chunk of the file, up to a sector boundary after a seek,
+ * returns false if it's the last one
+ * */
+static bool read_chunk(RAheadChunk_t* chunk)
+{
+	UINT len = _RAHEAD_CHUNK_SIZE - f_tell(file) % _MAX_SS;
+
+	chunk->offset = f_tell(file);
+	chunk->error = f_read(file, chunk->data, len, &chunk->size) != FR_OK;
+	chunk->end = chunk->error || chunk->size < len;
+
+	if(chunk->error)
+	{
+		printf("ERROR: Read-ahead f_read failed at %lu\n", (uint32_t)chunk->offset);
+		chunk->size = 0;
+	}
+
+	return !chunk->end;
+}
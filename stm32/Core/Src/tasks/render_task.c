@@ -0,0 +1,622 @@
+/**
+ ******************************************************************************
+ * @file      render_task.c
+ * @author    ts-manuel
+ * @brief     Render-ahead cache
+ *
+ ******************************************************************************
+ */
+
+#include "tasks/render_task.h"
+#include "frame/frame.h"
+#include "frame/movie.h"
+#include "jpeg/decoder.h"
+#include "hardware/clock.h"
+#include "file_manager.h"
+#include "profiler.h"
+#include "crc32.h"
+#include "arena.h"
+#include "fast_seek.h"
+#include "hardware/sd.h"
+#include "hardware/flash.h"
+#include "cmsis_os.h"
+#include <stddef.h>
+
+typedef struct __attribute__((packed))
+{
+	FRM_Header_t frame;
+	RCacheKey_t key;
+	uint32_t render_ms;		//Decode and dither time
+	uint32_t used;			//Use sequence, the lowest is evicted first
+} RCacheHeader_t;
+
+_Static_assert(sizeof(RCacheHeader_t) <= _RCACHE_DATA_OFFSET, "Render cache header doesn't fit the first sector");
+_Static_assert(sizeof(_RCACHE_DIR "/00000000.EPD") <= _FILE_PATH_MAX_LEN, "Render cache entry path too long");
+
+typedef struct
+{
+	uint32_t entries;
+	uint32_t bytes;
+	uint32_t last_used;					//Highest use sequence
+	uint32_t oldest_count;
+	uint32_t evicted;								//Oldest entries already deleted
+	uint32_t oldest_used[_RCACHE_EVICT_SLOTS];
+	char oldest[_RCACHE_EVICT_SLOTS][_FILE_PATH_MAX_LEN];	//Least recently used entries, oldest first
+} CacheScan_t;
+
+static volatile osThreadId_t renderThread;
+static osEventFlagsId_t renderEvents;
+static osMutexId_t cacheLock;		//Folder and file objects, shared with the console
+static volatile bool busy;
+static char request[_FILE_PATH_MAX_LEN];	//File shown by the display, the next one is rendered
+static uint16_t requestFrame;			//Frame of the movie shown
+static FIL* source;		//Filled by SDIO DMA, must not be in CCM RAM
+static FIL* cache;
+static char hitName[_FILE_PATH_MAX_LEN];	//Entry opened by RCACHE_Open()
+static char touchName[_FILE_PATH_MAX_LEN];	//Entry streamed, marked as used by the next render
+static uint32_t hitRenderMs;
+static uint32_t hitSourceBytes;
+static RCacheStats_t stats;
+
+static void Render(void);
+static bool OpenEntry(FIL* fp, const char* name, const RCacheKey_t* key, uint32_t* render_ms);
+static bool ReadUse(const char* name, uint32_t* used);
+static void Touch(const char* name, uint32_t used);
+static bool ScanCache(CacheScan_t* scan);
+static void AddOldest(CacheScan_t* scan, const char* name, uint32_t used);
+static bool MakeRoom(CacheScan_t* scan, uint32_t bytes);
+static void FillKey(RCacheKey_t* key, const char* path, uint16_t frame, const FILINFO* fno);
+static void EntryName(char* name, const RCacheKey_t* key);
+
+
+/*
+ * Allocate the file objects, must be called before the scheduler is started
+ * */
+void RCACHE_Init(void)
+{
+	source = ARENA_Alloc(&arena_sram, sizeof(FIL));
+	cache = ARENA_Alloc(&arena_sram, sizeof(FIL));
+	renderEvents = osEventFlagsNew(NULL);
+	cacheLock = osMutexNew(NULL);
+	osEventFlagsSet(renderEvents, _RCACHE_EVENT_IDLE);
+}
+
+
+/*
+ * Render the file that follows path (frame of a movie) in the playlist,
+ * returns immediately, the request is dropped if a render is in progress
+ * */
+void RCACHE_Start(const char* path, uint16_t frame)
+{
+	osThreadId_t thread = renderThread;
+
+	if(busy || thread == NULL || strlen(path) >= _FILE_PATH_MAX_LEN)
+		return;
+
+	strcpy(request, path);
+	requestFrame = frame;
+	busy = true;
+	osEventFlagsClear(renderEvents, _RCACHE_EVENT_IDLE);
+	osThreadFlagsSet(thread, _RCACHE_FLAG_START);
+}
+
+
+/*
+ * Wait for the render in progress to finish, returns false on timeout
+ * */
+bool RCACHE_Wait(uint32_t timeout)
+{
+	if(!busy)
+		return true;
+
+	return (osEventFlagsWait(renderEvents, _RCACHE_EVENT_IDLE, osFlagsNoClear, timeout) & osFlagsError) == 0;
+}
+
+
+/*
+ * Returns true if no render is in progress
+ * */
+bool RCACHE_IsIdle(void)
+{
+	return !busy;
+}
+
+
+/*
+ * Open the cache entry of the file at path (frame of a movie) rendered with the
+ * current settings, otherwise returns false and the file must be decoded
+ * */
+bool RCACHE_Open(FIL* fp, const char* path, uint16_t frame)
+{
+	RCacheKey_t key;
+	FILINFO fno;
+
+	//The file may be the one being rendered
+	RCACHE_Wait(osWaitForever);
+
+	if(f_stat(path, &fno) == FR_OK)
+	{
+		FillKey(&key, path, frame, &fno);
+		EntryName(hitName, &key);
+
+		if(OpenEntry(fp, hitName, &key, &hitRenderMs))
+		{
+			hitSourceBytes = fno.fsize;
+			stats.hits++;
+			return true;
+		}
+	}
+
+	stats.misses++;
+	return false;
+}
+
+
+/*
+ * Called after the entry opened by RCACHE_Open() has been streamed in stream_ms,
+ * returns the time saved by not decoding the file
+ * */
+uint32_t RCACHE_Hit(uint32_t stream_ms)
+{
+	uint32_t saved = hitRenderMs > stream_ms ? hitRenderMs - stream_ms : 0;
+
+	stats.saved_ms += saved;
+	stats.saved_bytes += hitSourceBytes;
+	PROF_AddUs(e_ProfSaved, saved * 1000);
+
+	//The use sequence is written by the next render, in the background
+	strcpy(touchName, hitName);
+
+	return saved;
+}
+
+
+/*
+ * Delete the entry opened by RCACHE_Open(), called when the frame is corrupted
+ * */
+void RCACHE_Invalidate(void)
+{
+	osMutexAcquire(cacheLock, osWaitForever);
+	SD_BeginWrite();
+	f_unlink(hitName);
+	FSEEK_Flush();
+	osMutexRelease(cacheLock);
+}
+
+
+/*
+ * Count the entries and the size of the cache folder
+ * */
+bool RCACHE_Scan(void)
+{
+	CacheScan_t scan;
+
+	osMutexAcquire(cacheLock, osWaitForever);
+	bool ok = ScanCache(&scan);
+	FSEEK_Flush();
+	osMutexRelease(cacheLock);
+
+	return ok;
+}
+
+
+/*
+ * Delete every entry, returns the number of files deleted
+ * */
+uint32_t RCACHE_Clear(void)
+{
+	char name[_FILE_PATH_MAX_LEN];
+	uint32_t count = 0;
+	FILINFO fno;
+	DIR dir;
+
+	osMutexAcquire(cacheLock, osWaitForever);
+	SD_BeginWrite();
+
+	if(f_opendir(&dir, _RCACHE_DIR) == FR_OK)
+	{
+		while(f_readdir(&dir, &fno) == FR_OK && fno.fname[0] != '\0')
+		{
+			sprintf(name, _RCACHE_DIR "/%s", fno.fname);
+			if(!(fno.fattrib & AM_DIR) && f_unlink(name) == FR_OK)
+				count++;
+		}
+		f_closedir(&dir);
+	}
+
+	FSEEK_Flush();
+	touchName[0] = '\0';
+	stats.entries = 0;
+	stats.bytes = 0;
+
+	osMutexRelease(cacheLock);
+
+	return count;
+}
+
+
+/*
+ * Returns the hit and miss counters since boot
+ * */
+const RCacheStats_t* RCACHE_GetStats(void)
+{
+	return &stats;
+}
+
+
+/*
+ * Renders the next file into the cache while the panel is refreshed
+ * */
+void StartRenderTask(void *_args)
+{
+	renderThread = osThreadGetId();
+
+	while(1)
+	{
+		osThreadFlagsWait(_RCACHE_FLAG_START, osFlagsWaitAny, osWaitForever);
+
+		//The CPU stalls while the sector is erased, wait until the panel is refreshing
+		DISP_WaitRefresh(osWaitForever);
+		FLASH_EraseInactive();
+
+		osMutexAcquire(cacheLock, osWaitForever);
+		Render();
+		FSEEK_Flush();	//Entries deleted, their clusters can be reused
+		osMutexRelease(cacheLock);
+
+		busy = false;
+		osEventFlagsSet(renderEvents, _RCACHE_EVENT_IDLE);
+	}
+}
+
+
+/*
+ * Decode and dither the next file into the cache
+ * */
+static void Render(void)
+{
+	char next[_FILE_PATH_MAX_LEN];
+	char name[_FILE_PATH_MAX_LEN];
+	FmanPosition_t pos = {.generation = _FMAN_NO_POSITION, .frame = requestFrame};
+	MOV_Entry_t entry;
+	RCacheHeader_t header;
+	RCacheKey_t key;
+	CacheScan_t scan;
+	FILINFO fno;
+	uint32_t start;
+	uint32_t start_tick;
+	uint32_t crc = 0;
+	UINT written;
+	bool skip;
+	bool ok;
+
+	if(!ScanCache(&scan))
+		return;
+
+	//The file just shown becomes the most recently used
+	uint32_t sequence = scan.last_used + 1;
+	if(touchName[0] != '\0')
+	{
+		Touch(touchName, sequence++);
+		touchName[0] = '\0';
+	}
+
+	//The next wake finds the same file
+	if(!FMAN_FindNext(next, request, &pos) || f_stat(next, &fno) != FR_OK)
+		return;
+
+	//Already rendered, the playlist has looped
+	FillKey(&key, next, pos.frame, &fno);
+	EntryName(name, &key);
+	if(OpenEntry(cache, name, &key, NULL))
+	{
+		f_close(cache);
+		return;
+	}
+
+	if(FSEEK_Open(source, next) != FR_OK)
+		return;
+
+	//Frames are streamed anyway, a jpeg in a movie is decoded from the frame offset
+	if(MOV_GetFrameCount(source) > 0)
+		skip = !MOV_Seek(source, pos.frame, &entry) || entry.type != _MOV_TYPE_JPEG;
+	else
+		skip = FRM_IsFrame(source);
+
+	if(skip)
+	{
+		FSEEK_Close(source);
+		return;
+	}
+
+	if(!MakeRoom(&scan, _RCACHE_ENTRY_BYTES) || f_open(cache, _RCACHE_TEMP, FA_WRITE | FA_CREATE_ALWAYS) != FR_OK)
+	{
+		printf("ERROR: Unable to create <%s>\n", _RCACHE_TEMP);
+		FSEEK_Close(source);
+		stats.failures++;
+		return;
+	}
+
+	//Waits for the display task to send the data of the current image
+	ok = f_lseek(cache, _RCACHE_DATA_OFFSET) == FR_OK && DISP_BeginRender(cache);
+	start = PROF_Start();
+	start_tick = osKernelGetTickCount();
+
+	//Decode and dither at full speed, the display task only waits for BUSY meanwhile
+	CLK_Request(e_ClockHigh);
+	if(ok)
+	{
+		ok = JPG_Display(source);
+		ok = DISP_EndRender(&crc) && ok;
+	}
+	CLK_Release(e_ClockHigh);
+	FSEEK_Close(source);
+
+	uint32_t render_ms = (osKernelGetTickCount() - start_tick) * 1000 / osKernelGetTickFreq();
+	PROF_Add(e_ProfRender, start);
+
+	//The headers make the entry valid, they are written last
+	if(ok)
+	{
+		memset(&header, 0, sizeof(header));
+		memcpy(header.frame.magic, _FRM_MAGIC, 4);
+		header.frame.version = _FRM_VERSION;
+		header.frame.palette = key.palette;
+		header.frame.format = _FRM_FORMAT_RAW;
+		header.frame.width = _DISPLAY_WIDTH;
+		header.frame.height = _DISPLAY_HEIGHT;
+		header.frame.data_offset = _RCACHE_DATA_OFFSET;
+		header.frame.data_size = _DISPLAY_PLANE_BYTES;
+		header.frame.crc = crc;
+		header.key = key;
+		header.render_ms = render_ms;
+		header.used = sequence;
+
+		ok = f_lseek(cache, 0) == FR_OK &&
+			 f_write(cache, &header, sizeof(header), &written) == FR_OK && written == sizeof(header);
+	}
+
+	if(f_close(cache) != FR_OK)
+		ok = false;
+
+	//Publish the complete entry, an entry with the same name has a different key
+	if(ok)
+	{
+		f_unlink(name);
+		ok = f_rename(_RCACHE_TEMP, name) == FR_OK;
+	}
+
+	if(ok)
+	{
+		stats.renders++;
+		stats.entries++;
+		stats.bytes += _RCACHE_ENTRY_BYTES;
+		printf("RenderTask: <%s> rendered ahead to <%s>, %lu ms\n", next, name, header.render_ms);
+	}
+	else
+	{
+		f_unlink(_RCACHE_TEMP);
+		stats.failures++;
+		printf("ERROR: Unable to render <%s> ahead\n", next);
+	}
+}
+
+
+/*
+ * Open the entry and check that it was rendered with the key,
+ * the file is closed if it doesn't match. render_ms can be NULL
+ * */
+static bool OpenEntry(FIL* fp, const char* name, const RCacheKey_t* key, uint32_t* render_ms)
+{
+	RCacheHeader_t header;
+	UINT read;
+
+	if(f_open(fp, name, FA_READ | FA_OPEN_EXISTING) != FR_OK)
+		return false;
+
+	if(f_read(fp, &header, sizeof(header), &read) == FR_OK && read == sizeof(header) &&
+	   memcmp(header.frame.magic, _FRM_MAGIC, 4) == 0 &&
+	   memcmp(&header.key, key, sizeof(RCacheKey_t)) == 0 &&
+	   f_lseek(fp, 0) == FR_OK)
+	{
+		if(render_ms != NULL)
+			*render_ms = header.render_ms;
+		return true;
+	}
+
+	f_close(fp);
+	return false;
+}
+
+
+/*
+ * Read the use sequence of an entry, returns false if the file is not a complete entry
+ * */
+static bool ReadUse(const char* name, uint32_t* used)
+{
+	RCacheHeader_t header;
+	UINT read;
+	bool ok;
+
+	if(f_open(cache, name, FA_READ | FA_OPEN_EXISTING) != FR_OK)
+		return false;
+
+	ok = f_read(cache, &header, sizeof(header), &read) == FR_OK && read == sizeof(header) &&
+		 memcmp(header.frame.magic, _FRM_MAGIC, 4) == 0 &&
+		 header.key.magic == _RCACHE_MAGIC &&
+		 f_size(cache) == header.frame.data_offset + header.frame.data_size;
+	*used = header.used;
+
+	f_close(cache);
+	return ok;
+}
+
+
+/*
+ * Write the use sequence of an entry
+ * */
+static void Touch(const char* name, uint32_t used)
+{
+	UINT written;
+
+	if(f_open(cache, name, FA_WRITE | FA_OPEN_EXISTING) != FR_OK)
+		return;
+
+	if(f_lseek(cache, offsetof(RCacheHeader_t, used)) != FR_OK ||
+	   f_write(cache, &used, sizeof(used), &written) != FR_OK || written != sizeof(used))
+		printf("ERROR: Unable to update <%s>\n", name);
+
+	f_close(cache);
+}
+
+
+/*
+ * Count the entries of the cache folder and find the least recently used ones,
+ * the folder is created if missing and anything that is not a complete entry
+ * (interrupted render, other settings) is deleted
+ * */
+static bool ScanCache(CacheScan_t* scan)
+{
+	char name[_FILE_PATH_MAX_LEN];
+	uint32_t used;
+	FILINFO fno;
+	DIR dir;
+
+	memset(scan, 0, sizeof(CacheScan_t));
+	SD_BeginWrite();
+
+	if(f_opendir(&dir, _RCACHE_DIR) != FR_OK)
+	{
+		//Hidden and system, FMAN_FindNext() doesn't play it
+		if(f_mkdir(_RCACHE_DIR) != FR_OK || f_chmod(_RCACHE_DIR, AM_HID | AM_SYS, AM_HID | AM_SYS) != FR_OK)
+		{
+			printf("ERROR: Unable to create <%s>\n", _RCACHE_DIR);
+			return false;
+		}
+	}
+	else
+	{
+		while(f_readdir(&dir, &fno) == FR_OK && fno.fname[0] != '\0')
+		{
+			if(fno.fattrib & AM_DIR)
+				continue;
+
+			sprintf(name, _RCACHE_DIR "/%s", fno.fname);
+			if(!ReadUse(name, &used))
+			{
+				f_unlink(name);
+				continue;
+			}
+
+			//The entry streamed is touched after the scan, it becomes the most recently used
+			if(strcmp(name, touchName) != 0)
+				AddOldest(scan, name, used);
+			if(used > scan->last_used)
+				scan->last_used = used;
+
+			scan->entries++;
+			scan->bytes += fno.fsize;
+		}
+		f_closedir(&dir);
+	}
+
+	stats.entries = scan->entries;
+	stats.bytes = scan->bytes;
+
+	return true;
+}
+
+
+/*
+ * Insert an entry in the list of the oldest ones, sorted by use sequence
+ * */
+static void AddOldest(CacheScan_t* scan, const char* name, uint32_t used)
+{
+	int i = scan->oldest_count;
+
+	if(i == _RCACHE_EVICT_SLOTS)
+	{
+		if(used >= scan->oldest_used[i - 1])
+			return;
+		i--;
+	}
+	else
+	{
+		scan->oldest_count++;
+	}
+
+	//Move the more recently used entries up, the last one is dropped if the list is full
+	for(; i > 0 && used < scan->oldest_used[i - 1]; i--)
+	{
+		scan->oldest_used[i] = scan->oldest_used[i - 1];
+		strcpy(scan->oldest[i], scan->oldest[i - 1]);
+	}
+
+	scan->oldest_used[i] = used;
+	strcpy(scan->oldest[i], name);
+}
+
+
+/*
+ * Delete the least recently used entries until there is room for bytes more,
+ * the folder is scanned again only if more than _RCACHE_EVICT_SLOTS are deleted
+ * */
+static bool MakeRoom(CacheScan_t* scan, uint32_t bytes)
+{
+	if(bytes > _RCACHE_MAX_KB * 1024)
+		return false;
+
+	while(scan->bytes + bytes > _RCACHE_MAX_KB * 1024)
+	{
+		if(scan->evicted == scan->oldest_count)
+		{
+			if(!ScanCache(scan) || scan->oldest_count == 0)
+				return false;
+			continue;
+		}
+
+		if(f_unlink(scan->oldest[scan->evicted++]) != FR_OK)
+			return false;
+
+		stats.evictions++;
+		scan->entries--;
+		scan->bytes -= _RCACHE_ENTRY_BYTES;
+	}
+
+	stats.entries = scan->entries;
+	stats.bytes = scan->bytes;
+
+	return true;
+}
+
+
+/*
+ * Identity of the source file and render settings
+ * */
+static void FillKey(RCacheKey_t* key, const char* path, uint16_t frame, const FILINFO* fno)
+{
+	memset(key, 0, sizeof(RCacheKey_t));
+	key->magic = _RCACHE_MAGIC;
+	strncpy(key->path, path, _FILE_PATH_MAX_LEN - 1);
+	key->frame = frame;
+	key->size = fno->fsize;
+	key->date = fno->fdate;
+	key->time = fno->ftime;
+	key->panel = _PANEL;
+	key->palette = _PANEL_PALETTE;
+	key->dither = _DITHER;
+	key->scale = 1;
+	key->crop_x = 0;
+	key->crop_y = 0;
+	key->crop_width = _DISPLAY_WIDTH;
+	key->crop_height = _DISPLAY_HEIGHT;
+}
+
+
+/*
+ * Path of the entry, named after the CRC of the key
+ * */
+static void EntryName(char* name, const RCacheKey_t* key)
+{
+	sprintf(name, _RCACHE_DIR "/%08lX.EPD", (unsigned long)CRC32_Update(0, key, sizeof(RCacheKey_t)));
+}
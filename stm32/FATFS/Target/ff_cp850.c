@@ -0,0 +1,88 @@
+/**
+ ******************************************************************************
+ * @file      ff_cp850.c
+ * @author    ts-manuel
+ * @brief     Code page 850 conversions of the FatFs long file names
+ *
+ *            With _USE_LFN the long names are stored on the card in UTF-16
+ *            and FatFs converts them to and from the code page of the path
+ *            strings (_CODE_PAGE 850) with ff_convert(), ff_wtoupper() is
+ *            used to compare the names without case. Only the characters
+ *            of the code page can be in a path, the upper case conversion
+ *            covers them.
+ *
+ ******************************************************************************
+ */
+
+#include "ff.h"
+
+#if _USE_LFN != 0
+
+#if _CODE_PAGE != 850
+#error ff_cp850.c only supports _CODE_PAGE 850
+#endif
+
+//Unicode of the OEM codes 0x80 to 0xFF
+static const WCHAR table[128] = {
+	0x00C7, 0x00FC, 0x00E9, 0x00E2, 0x00E4, 0x00E0, 0x00E5, 0x00E7,
+	0x00EA, 0x00EB, 0x00E8, 0x00EF, 0x00EE, 0x00EC, 0x00C4, 0x00C5,
+	0x00C9, 0x00E6, 0x00C6, 0x00F4, 0x00F6, 0x00F2, 0x00FB, 0x00F9,
+	0x00FF, 0x00D6, 0x00DC, 0x00F8, 0x00A3, 0x00D8, 0x00D7, 0x0192,
+	0x00E1, 0x00ED, 0x00F3, 0x00FA, 0x00F1, 0x00D1, 0x00AA, 0x00BA,
+	0x00BF, 0x00AE, 0x00AC, 0x00BD, 0x00BC, 0x00A1, 0x00AB, 0x00BB,
+	0x2591, 0x2592, 0x2593, 0x2502, 0x2524, 0x00C1, 0x00C2, 0x00C0,
+	0x00A9, 0x2563, 0x2551, 0x2557, 0x255D, 0x00A2, 0x00A5, 0x2510,
+	0x2514, 0x2534, 0x252C, 0x251C, 0x2500, 0x253C, 0x00E3, 0x00C3,
+	0x255A, 0x2554, 0x2569, 0x2566, 0x2560, 0x2550, 0x256C, 0x00A4,
+	0x00F0, 0x00D0, 0x00CA, 0x00CB, 0x00C8, 0x0131, 0x00CD, 0x00CE,
+	0x00CF, 0x2518, 0x250C, 0x2588, 0x2584, 0x00A6, 0x00CC, 0x2580,
+	0x00D3, 0x00DF, 0x00D4, 0x00D2, 0x00F5, 0x00D5, 0x00B5, 0x00FE,
+	0x00DE, 0x00DA, 0x00DB, 0x00D9, 0x00FD, 0x00DD, 0x00AF, 0x00B4,
+	0x00AD, 0x00B1, 0x2017, 0x00BE, 0x00B6, 0x00A7, 0x00F7, 0x00B8,
+	0x00B0, 0x00A8, 0x00B7, 0x00B9, 0x00B3, 0x00B2, 0x25A0, 0x00A0,
+};
+
+
+/*
+ * Convert an OEM code to Unicode (dir = 1) or Unicode to an OEM code (dir = 0),
+ * returns 0 if the character can't be converted
+ * */
+WCHAR ff_convert(WCHAR chr, UINT dir)
+{
+	if(chr < 0x80)
+		return chr;
+
+	if(dir)
+		return chr < 0x100 ? table[chr - 0x80] : 0;
+
+	for(int i = 0; i < 128; i++)
+	{
+		if(table[i] == chr)
+			return 0x80 + i;
+	}
+
+	return 0;
+}
+
+
+/*
+ * Upper case of the Basic Latin and Latin-1 letters of the code page
+ * */
+WCHAR ff_wtoupper(WCHAR chr)
+{
+	if(chr >= 'a' && chr <= 'z')
+		return chr - 0x20;
+
+	if(chr >= 0xE0 && chr <= 0xFE && chr != 0xF7)
+		return chr - 0x20;
+
+	if(chr == 0xFF)
+		return 0x178;
+
+	if(chr == 0x192)
+		return 0x191;
+
+	return chr;
+}
+
+#endif /* _USE_LFN != 0 */
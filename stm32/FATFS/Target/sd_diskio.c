@@ -23,6 +23,10 @@
 
 /* USER CODE BEGIN firstSection */
 /* can be used to modify / undefine following code or add new definitions */
+#define RW_ERROR_MSG       (uint32_t) 3
+#define RW_ABORT_MSG       (uint32_t) 4
+
+#include "hardware/clock.h"
 /* USER CODE END firstSection*/
 
 /* Includes ------------------------------------------------------------------*/
@@ -66,7 +70,8 @@ See BSP_SD_ErrorCallback() and BSP_SD_AbortCallback() below
  * BSP_SD_Init() elsewhere in the application.
  */
 /* USER CODE BEGIN disableSDInit */
-/* #define DISABLE_SD_INIT */
+/* The card is identified by SD_Init() (hardware/sd.c) as soon as it answers */
+#define DISABLE_SD_INIT
 /* USER CODE END disableSDInit */
 
 /*
@@ -238,6 +243,117 @@ DSTATUS SD_status(BYTE lun)
 
 /* USER CODE BEGIN beforeReadSection */
 /* can be used to modify previous code / undefine following code / add new code */
+#define SD_READ_RETRIES    2    /* Reads retried after a data error at a lower clock */
+
+static SD_ReadStats_t readStats;
+
+/*
+ * One multi-block DMA read into a word aligned buffer. A CRC error or a FIFO
+ * overrun means the clock is too fast for the card or for the DMA, the clock
+ * is lowered one step and the read is retried
+ */
+static DRESULT SD_ReadDMA(BYTE *buff, DWORD sector, UINT count)
+{
+  extern SD_HandleTypeDef hsd;
+
+  for (int attempt = 0; attempt <= SD_READ_RETRIES; attempt++)
+  {
+    uint16_t event = 0;
+
+    readStats.commands++;
+
+    /* a failed transfer can post both an error and an abort message */
+    osMessageQueueReset(SDQueueID);
+
+    if (BSP_SD_ReadBlocks_DMA((uint32_t*)buff, (uint32_t)sector, count) == MSD_OK &&
+        osMessageQueueGet(SDQueueID, (void *)&event, NULL, SD_TIMEOUT) == osOK &&
+        event == READ_CPLT_MSG)
+    {
+      /* block until SDIO IP is ready or a timeout occur */
+      if (SD_CheckStatusWithTimeout(SD_TIMEOUT) < 0)
+      {
+        return RES_ERROR;
+      }
+
+      readStats.sectors += count;
+      return RES_OK;
+    }
+
+    readStats.errors++;
+
+    if (!(hsd.ErrorCode & (HAL_SD_ERROR_DATA_CRC_FAIL | HAL_SD_ERROR_RX_OVERRUN)) ||
+        !CLK_LowerSDIOClock() || SD_CheckStatusWithTimeout(SD_TIMEOUT) < 0)
+    {
+      return RES_ERROR;
+    }
+
+    printf("ERROR: SD read failed (0x%08lx), clock lowered to %lu Hz\n", hsd.ErrorCode, CLK_GetSDIOFrequency());
+  }
+
+  return RES_ERROR;
+}
+
+/*
+ * Returns the read counters since boot
+ */
+const SD_ReadStats_t* SD_GetReadStats(void)
+{
+  return &readStats;
+}
+
+/*
+ * Replaces the generated SD_read(), which reads an unaligned buffer one sector
+ * at a time. The DMA writes whole words: the sectors but the last one are read
+ * in one command to the next word boundary inside the buffer and moved down,
+ * the last one is read through readScratch
+ */
+DRESULT SD_read(BYTE lun, BYTE *buff, DWORD sector, UINT count)
+{
+  __ALIGN_BEGIN static uint8_t readScratch[BLOCKSIZE] __ALIGN_END;
+  DRESULT res = RES_OK;
+
+  /*
+  * ensure the SDCard is ready for a new operation
+  */
+
+  if (SD_CheckStatusWithTimeout(SD_TIMEOUT) < 0)
+  {
+    return RES_ERROR;
+  }
+
+  if (!((uint32_t)buff & 0x3))
+  {
+    /* Fast path cause destination buffer is correctly aligned, all the sectors in one command */
+    return SD_ReadDMA(buff, sector, count);
+  }
+
+  if (count > 1)
+  {
+    UINT shift = 4 - ((uint32_t)buff & 0x3);
+
+    res = SD_ReadDMA(buff + shift, sector, count - 1);
+    if (res == RES_OK)
+    {
+      memmove(buff, buff + shift, (count - 1) * BLOCKSIZE);
+    }
+  }
+
+  if (res == RES_OK)
+  {
+    readStats.bounced++;
+    res = SD_ReadDMA(readScratch, sector + count - 1, 1);
+  }
+
+  if (res == RES_OK)
+  {
+    memcpy(buff + (count - 1) * BLOCKSIZE, readScratch, BLOCKSIZE);
+  }
+
+  return res;
+}
+
+/* the generated SD_read() below is compiled under another name and not used */
+#define SD_read SD_read_generated
 /* USER CODE END beforeReadSection */
 /**
   * @brief  Reads Sector(s)
@@ -666,6 +782,14 @@ void BSP_SD_ReadCpltCallback(void)
 
 /* USER CODE BEGIN ErrorAbortCallbacks */
 /*
+ * Without these the task waiting for a transfer that failed would block for SD_TIMEOUT
+ */
+void HAL_SD_ErrorCallback(SD_HandleTypeDef *hsd)
+{
+   const uint16_t msg = RW_ERROR_MSG;
+   osMessageQueuePut(SDQueueID, (const void *)&msg, NULL, 0);
+}
+
 void BSP_SD_AbortCallback(void)
 {
 #if (osCMSIS < 0x20000U)
@@ -675,7 +799,6 @@ void BSP_SD_AbortCallback(void)
    osMessageQueuePut(SDQueueID, (const void *)&msg, NULL, 0);
 #endif
 }
-*/
 /* USER CODE END ErrorAbortCallbacks */
 
 /* USER CODE BEGIN lastSection */
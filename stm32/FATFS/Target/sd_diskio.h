@@ -37,6 +37,15 @@ extern const Diskio_drvTypeDef  SD_Driver;
 
 /* USER CODE BEGIN lastSection */
 /* can be used to modify / undefine previous code or add new definitions */
+typedef struct
+{
+  uint32_t commands;  /* Read commands issued, a command reads all the contiguous sectors */
+  uint32_t sectors;   /* Sectors read */
+  uint32_t bounced;   /* Sectors read through the scratch buffer (unaligned destination) */
+  uint32_t errors;    /* Failed transfers */
+} SD_ReadStats_t;
+
+const SD_ReadStats_t* SD_GetReadStats(void);
 /* USER CODE END lastSection */
 
 #endif /* __SD_DISKIO_H */
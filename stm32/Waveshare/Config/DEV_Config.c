@@ -30,6 +30,7 @@
 #
 ******************************************************************************/
 #include "DEV_Config.h"
+#include "cmsis_os.h"
 
 extern SPI_HandleTypeDef hspi1;
 void DEV_SPI_WriteByte(UBYTE value)
@@ -37,6 +38,41 @@ void DEV_SPI_WriteByte(UBYTE value)
     HAL_SPI_Transmit(&hspi1, &value, 1, 1000);
 }
 
+/**
+ * Sleep for ms milliseconds, the task blocks so that the core can idle
+**/
+void DEV_Delay(uint32_t ms)
+{
+    if(osKernelGetState() == osKernelRunning)
+        osDelay(ms);
+    else
+        HAL_Delay(ms);
+}
+
+/**
+ * Wait until the BUSY pin reads level,
+ * can be overridden with an interrupt driven wait
+**/
+__weak void DEV_Wait_Busy(UBYTE level)
+{
+    while(DEV_Digital_Read(EPD_BUSY_PIN) != level);
+}
+
+/**
+ * Wait until the BUSY pin reads level, sending cmd every 100ms
+ * (controllers that update BUSY only after a status command)
+**/
+__weak void DEV_Wait_Busy_Status(UBYTE level, UBYTE cmd)
+{
+    while(DEV_Digital_Read(EPD_BUSY_PIN) != level) {
+        DEV_Digital_Write(EPD_DC_PIN, 0);
+        DEV_Digital_Write(EPD_CS_PIN, 0);
+        DEV_SPI_WriteByte(cmd);
+        DEV_Digital_Write(EPD_CS_PIN, 1);
+        DEV_Delay_ms(100);
+    }
+}
+
 int DEV_Module_Init(void)
 {
     DEV_Digital_Write(EPD_DC_PIN, 0);
@@ -76,9 +76,13 @@
 /**
  * delay x ms
 **/
-#define DEV_Delay_ms(__xms) HAL_Delay(__xms);
+#define DEV_Delay_ms(__xms) DEV_Delay(__xms);
+
+void DEV_Delay(uint32_t ms);
 
 void DEV_SPI_WriteByte(UBYTE value);
+void DEV_Wait_Busy(UBYTE level);
+void DEV_Wait_Busy_Status(UBYTE level, UBYTE cmd);
 
 int DEV_Module_Init(void);
 void DEV_Module_Exit(void);
@@ -312,10 +312,7 @@ void EPD_4IN2_ReadBusy(void)
 {
     Debug("e-Paper busy\r\n");
     EPD_4IN2_SendCommand(0x71);
-    while(DEV_Digital_Read(EPD_BUSY_PIN) == 0) {      //LOW: idle, HIGH: busy
-        EPD_4IN2_SendCommand(0x71);
-        DEV_Delay_ms(100);
-    }
+    DEV_Wait_Busy_Status(1, 0x71);      //0: busy, 1: idle
     Debug("e-Paper busy release\r\n");
 }
 
@@ -606,6 +603,43 @@ void EPD_4IN2_PartialDisplay(UWORD X_start,UWORD Y_start,UWORD X_end,UWORD Y_end
     EPD_4IN2_TurnOnDisplay();
 }
 
+/******************************************************************************
+function :	Enter the partial refresh mode, the window (0x90) and the data
+            are sent by the caller
+parameter:
+******************************************************************************/
+void EPD_4IN2_PartialMode(void)
+{
+    EPD_4IN2_SendCommand(0X50);
+    EPD_4IN2_SendData(0xf7);
+    DEV_Delay_ms(100);
+
+    EPD_4IN2_SendCommand(0x82);			//vcom_DC setting
+    EPD_4IN2_SendData (0x08);
+    EPD_4IN2_SendCommand(0X50);
+    EPD_4IN2_SendData(0x47);
+    EPD_4IN2_Partial_SetLut();
+    EPD_4IN2_SendCommand(0x91);		//This command makes the display enter partial mode
+}
+
+/******************************************************************************
+function :	Leave the partial refresh mode, restore the settings and the LUT
+            of EPD_4IN2_Init
+parameter:
+******************************************************************************/
+void EPD_4IN2_FullMode(void)
+{
+    EPD_4IN2_SendCommand(0x92);		//Partial out
+
+    EPD_4IN2_SendCommand(0x82); // vcom_DC setting
+    EPD_4IN2_SendData(0x28);
+
+    EPD_4IN2_SendCommand(0X50); // VCOM AND DATA INTERVAL SETTING
+    EPD_4IN2_SendData(0x97);
+
+    EPD_4IN2_SetLut();
+}
+
 void EPD_4IN2_4GrayDisplay(const UBYTE *Image)
 {
     UDOUBLE i,j,k;
@@ -123,6 +123,8 @@ void EPD_4IN2_Clear(void);
 void EPD_4IN2_Display(UBYTE *Image);
 void EPD_4IN2_Sleep(void);
 void EPD_4IN2_PartialDisplay(UWORD X_start,UWORD Y_start,UWORD X_end,UWORD Y_end, UBYTE *Image);
+void EPD_4IN2_PartialMode(void);
+void EPD_4IN2_FullMode(void);
 
 void EPD_4IN2_Init_4Gray(void);
 void EPD_4IN2_4GrayDisplay(const UBYTE *Image);
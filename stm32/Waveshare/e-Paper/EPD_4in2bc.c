@@ -131,9 +131,7 @@ parameter:
 void EPD_4IN2BC_ReadBusy(void)
 {
     Debug("e-Paper busy\r\n");
-    while(DEV_Digital_Read(EPD_BUSY_PIN) == 0) {      //0: busy, 1: idle
-        DEV_Delay_ms(100);
-    }
+    DEV_Wait_Busy(1);      //0: busy, 1: idle
     Debug("e-Paper busy release\r\n");
 }
 
@@ -73,12 +73,12 @@ void EPD_5IN65F_SendData(UBYTE Data)
 
 void EPD_5IN65F_BusyHigh(void)// If BUSYN=0 then waiting
 {
-    while(!(DEV_Digital_Read(EPD_BUSY_PIN)));
+    DEV_Wait_Busy(1);
 }
 
 void EPD_5IN65F_BusyLow(void)// If BUSYN=1 then waiting
 {
-    while(DEV_Digital_Read(EPD_BUSY_PIN));
+    DEV_Wait_Busy(0);
 }
 
 /******************************************************************************